@@ -0,0 +1,388 @@
+/*
+  Compare leaf nodes that all send at SF10 and full power with nodes
+  moved to faster spreading factors and lower power by LinkAdr.h: how
+  many frames the main node gets and how much of the channel they use,
+  as the uplink rate goes up.
+
+  adr_sim [-n nodes] [-u uplink_s] [-r radius_m] [-e exponent]
+          [-g shadowing_db] [-d days] [-s seed]
+
+  -n  leaf nodes (default 32)
+  -u  seconds between a node's uplinks (default 300); the capacity table
+      halves this five times
+  -r  the nodes are spread evenly over a disc this big, m (default 2000)
+  -e  path loss exponent (default 3.0)
+  -g  standard deviation of each node's shadowing, dB (default 6)
+  -d  days to simulate (default 1)
+  -s  random number seed (default 1)
+
+  The link model: free-space loss to 1 m at 915 MHz (31.7 dB), then
+  10 * exponent * log10(d); a fixed shadowing term per node and 2 dB of
+  fading per frame; a -117 dBm noise floor (125 kHz, 6 dB noise figure).
+  The radio reports SNR up to +10 dB. A frame is received if the main
+  node was listening at its spreading factor when it started, its SNR
+  was at or over the floor for that spreading factor, no other frame at
+  the same spreading factor overlapped it and the main node was not
+  transmitting. Frames at different spreading factors do not interfere.
+
+  The main node ACKs each frame it gets, and sends a moved node's
+  command right after; the node ACKs that. A node that gets no ACK sends
+  the frame again after 200 to 400 ms, up to three times, as
+  RHReliableDatagram does. A node whose messages go without an ACK
+  LINK_ADR_MAX_MISSED times in a row goes back to SF10 and full power.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "LinkAdr.h"
+#include "LoRaAirtime.h"
+
+#define START_TIME 1615909112.0
+
+// The main node's radio settings; see main-node.cc
+#define SPREADING_FACTOR 10
+#define BANDWIDTH 125000
+#define CODING_RATE 5
+
+#define DATA_MESSAGE_LEN 20
+#define ACK_LEN 1                   // RHReliableDatagram's ACK payload
+#define TURNAROUND_S 0.005
+#define LEAF_RETRIES 3
+#define LEAF_TIMEOUT_S 0.2          // RHReliableDatagram waits this to twice this for an ACK
+
+#define NOISE_FLOOR_DBM -117.0
+#define SNR_MAX_DB 10               // the SX1276's SNR reading tops out about here
+#define FADING_DB 2.0
+#define LOSS_1M_DB 31.7             // free space, 915 MHz
+#define MIN_DISTANCE_M 20.0
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n nodes] [-u uplink_s] [-r radius_m] [-e exponent] [-g shadowing_db] [-d days] "
+                    "[-s seed]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double airtime_s(uint8_t sf, uint16_t len) {
+    return lora_airtime_us(lora_settings(sf, BANDWIDTH, CODING_RATE), len + LORA_RH_HEADER_LEN) / 1e6;
+}
+
+struct leaf_t {
+    uint8_t address;
+    double loss_db;         // path loss and shadowing
+    uint8_t sf;
+    int8_t power;
+    int unacked;            // messages in a row without an ACK
+    int attempt;            // sends of the message on the air, less one
+    double message_at;      // when it was first sent
+    double next;            // when the node sends next; HUGE_VAL while it waits for an ACK
+};
+
+struct frame_t {
+    int leaf;
+    uint8_t sf;
+    double start;
+    double end;
+    double snr;
+    const char *lost;       // why, or null
+};
+
+struct result_t {
+    uint64_t messages;
+    uint64_t delivered;
+    uint64_t uplinks;       // frames, counting resends
+    uint64_t weak;          // under the SNR floor
+    uint64_t wrong_sf;      // the main node was listening at another spreading factor
+    uint64_t collisions;
+    uint64_t transmitting;  // the main node was sending an ACK or a command
+    uint64_t commands;
+    uint64_t fallbacks;
+    double uplink_air_s;
+    double downlink_air_s;
+    double power_sum;       // of the nodes' power, for the mean
+    uint32_t sf_frames[13]; // uplinks at each spreading factor
+};
+
+struct options_t {
+    int nodes;
+    double uplink_s;
+    double radius_m;
+    double exponent;
+    double shadowing_db;
+    double days;
+    unsigned seed;
+};
+
+class Channel {
+    const options_t &d_opts;
+    bool d_adr;
+    std::mt19937 d_rng;
+    std::uniform_real_distribution<double> d_uniform;
+    std::normal_distribution<double> d_fading;
+
+    std::vector<leaf_t> d_leaves;
+    std::vector<frame_t> d_air;     // frames on the air
+    double d_busy_until;            // the main node is transmitting until then
+
+    NodeRegistry<254> d_nodes;
+    LinkAdr d_link_adr;
+    result_t d_r;
+
+    // The main node transmits for 'air' seconds from 'start'; frames on the air then are lost
+    void transmit(double start, double air) {
+        for (size_t i = 0; i < d_air.size(); ++i) {
+            if (!d_air[i].lost && d_air[i].end > start && d_air[i].start < start + air)
+                d_air[i].lost = "transmitting";
+        }
+        d_busy_until = start + air;
+        d_r.downlink_air_s += air;
+    }
+
+    void send(leaf_t &leaf, int i, double t) {
+        if (leaf.attempt == 0) {
+            leaf.message_at = t;
+            ++d_r.messages;
+        }
+
+        frame_t f;
+        f.leaf = i;
+        f.sf = leaf.sf;
+        f.start = t;
+        f.end = t + airtime_s(leaf.sf, DATA_MESSAGE_LEN);
+        f.snr = leaf.power - leaf.loss_db - NOISE_FLOOR_DBM + d_fading(d_rng);
+        f.lost = 0;
+
+        uint8_t listening = d_adr ? d_link_adr.listen(d_nodes, (uint32_t)t) : SPREADING_FACTOR;
+        if (t < d_busy_until)
+            f.lost = "transmitting";
+        else if (listening != f.sf)
+            f.lost = "wrong spreading factor";
+        else if (10 * f.snr < lora_snr_floor_db10(f.sf))
+            f.lost = "weak";
+        for (size_t k = 0; k < d_air.size(); ++k) {
+            if (d_air[k].sf == f.sf) {
+                if (!d_air[k].lost)
+                    d_air[k].lost = "collision";
+                if (!f.lost)
+                    f.lost = "collision";
+            }
+        }
+        d_air.push_back(f);
+        leaf.next = HUGE_VAL;
+
+        ++d_r.uplinks;
+        d_r.uplink_air_s += f.end - f.start;
+        d_r.power_sum += leaf.power;
+        ++d_r.sf_frames[leaf.sf];
+    }
+
+    void finish(const frame_t &f) {
+        leaf_t &leaf = d_leaves[f.leaf];
+        if (f.lost) {
+            if (f.lost[0] == 'w' && f.lost[1] == 'e')
+                ++d_r.weak;
+            else if (f.lost[0] == 'w')
+                ++d_r.wrong_sf;
+            else if (f.lost[0] == 'c')
+                ++d_r.collisions;
+            else
+                ++d_r.transmitting;
+
+            if (leaf.attempt < LEAF_RETRIES) {
+                ++leaf.attempt;
+                leaf.next = f.end + LEAF_TIMEOUT_S * (1 + d_uniform(d_rng));
+                return;
+            }
+            leaf.attempt = 0;
+            leaf.next = leaf.message_at + d_opts.uplink_s + d_uniform(d_rng) - 0.5;
+            if (++leaf.unacked >= LINK_ADR_MAX_MISSED
+                && (leaf.sf != SPREADING_FACTOR || leaf.power != LINK_ADR_MAX_TX_POWER)) {
+                leaf.sf = SPREADING_FACTOR;
+                leaf.power = LINK_ADR_MAX_TX_POWER;
+                leaf.unacked = 0;
+                ++d_r.fallbacks;
+            }
+            return;
+        }
+
+        ++d_r.delivered;
+        leaf.unacked = 0;
+        leaf.attempt = 0;
+        leaf.next = leaf.message_at + d_opts.uplink_s + d_uniform(d_rng) - 0.5;
+
+        uint32_t now = (uint32_t)f.end;
+        const node_state_t *before = d_nodes.node(leaf.address);
+        uint32_t last_seen = before ? before->last_seen : 0;
+        int8_t snr = (int8_t)floor(f.snr < SNR_MAX_DB ? f.snr : SNR_MAX_DB);
+        int16_t rssi = (int16_t)(leaf.power - leaf.loss_db);
+        node_state_t *node = d_nodes.saw_frame(leaf.address, now, rssi, snr);
+
+        double at = f.end + TURNAROUND_S;
+        double ack_air = airtime_s(f.sf, ACK_LEN);
+        transmit(at, ack_air);
+        if (!d_adr)
+            return;
+
+        d_link_adr.saw_uplink(*node, now, last_seen);
+        link_adr_command_t command;
+        if (d_link_adr.check(*node, &command)) {
+            // The command goes out after the ACK, and the node ACKs it
+            at += ack_air + TURNAROUND_S;
+            double air = airtime_s(f.sf, sizeof(command));
+            transmit(at, air + TURNAROUND_S + ack_air);
+            d_r.downlink_air_s -= ack_air;      // the node's ACK is uplink
+            leaf.sf = command.spreading_factor;
+            leaf.power = command.tx_power;
+            d_link_adr.confirm(*node, true);
+            ++d_r.commands;
+        }
+    }
+
+public:
+    Channel(const options_t &opts, bool adr)
+        : d_opts(opts), d_adr(adr), d_rng(opts.seed), d_uniform(0.0, 1.0), d_fading(0.0, FADING_DB),
+          d_busy_until(0), d_link_adr(SPREADING_FACTOR), d_r(result_t()) {
+        // The same nodes for both policies
+        std::normal_distribution<double> shadowing(0.0, opts.shadowing_db);
+        for (int i = 0; i < opts.nodes; ++i) {
+            leaf_t leaf;
+            leaf.address = i + 1;
+            double d = opts.radius_m * sqrt(d_uniform(d_rng));
+            if (d < MIN_DISTANCE_M)
+                d = MIN_DISTANCE_M;
+            leaf.loss_db = LOSS_1M_DB + 10 * opts.exponent * log10(d) + shadowing(d_rng);
+            leaf.sf = SPREADING_FACTOR;
+            leaf.power = LINK_ADR_MAX_TX_POWER;
+            leaf.unacked = 0;
+            leaf.attempt = 0;
+            leaf.message_at = 0;
+            leaf.next = START_TIME + d_uniform(d_rng) * opts.uplink_s;
+            d_leaves.push_back(leaf);
+        }
+    }
+
+    result_t run() {
+        double end = START_TIME + d_opts.days * 86400.0;
+        while (true) {
+            // The next event: a frame ends or a node sends
+            size_t sender = 0;
+            for (size_t i = 1; i < d_leaves.size(); ++i) {
+                if (d_leaves[i].next < d_leaves[sender].next)
+                    sender = i;
+            }
+            size_t done = d_air.size();
+            for (size_t i = 0; i < d_air.size(); ++i) {
+                if (done == d_air.size() || d_air[i].end < d_air[done].end)
+                    done = i;
+            }
+
+            if (done < d_air.size() && d_air[done].end <= d_leaves[sender].next) {
+                frame_t f = d_air[done];
+                d_air.erase(d_air.begin() + done);
+                finish(f);
+            }
+            else if (d_leaves[sender].next < end) {
+                send(d_leaves[sender], sender, d_leaves[sender].next);
+            }
+            else {
+                break;
+            }
+        }
+        return d_r;
+    }
+};
+
+static void print_result(const char *name, const options_t &opts, const result_t &r) {
+    double duration = opts.days * 86400.0;
+    printf("%-10s %8llu %7.2f %8llu %6llu %6llu %6llu %6llu %8.1f %7.2f %7.2f %6.1f %5llu %5llu\n", name,
+           (unsigned long long)r.messages, r.messages ? 100.0 * r.delivered / r.messages : 0.0,
+           (unsigned long long)r.uplinks, (unsigned long long)r.weak, (unsigned long long)r.wrong_sf,
+           (unsigned long long)r.collisions, (unsigned long long)r.transmitting,
+           r.uplinks ? 1e3 * r.uplink_air_s / r.uplinks : 0.0, 100.0 * r.uplink_air_s / duration, 100.0 * r.downlink_air_s / duration,
+           r.uplinks ? r.power_sum / r.uplinks : 0.0, (unsigned long long)r.commands,
+           (unsigned long long)r.fallbacks);
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts;
+    opts.nodes = 32;
+    opts.uplink_s = 300;
+    opts.radius_m = 2000;
+    opts.exponent = 3.0;
+    opts.shadowing_db = 6;
+    opts.days = 1;
+    opts.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:r:e:g:d:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                opts.nodes = atoi(optarg);
+                break;
+            case 'u':
+                opts.uplink_s = atof(optarg);
+                break;
+            case 'r':
+                opts.radius_m = atof(optarg);
+                break;
+            case 'e':
+                opts.exponent = atof(optarg);
+                break;
+            case 'g':
+                opts.shadowing_db = atof(optarg);
+                break;
+            case 'd':
+                opts.days = atof(optarg);
+                break;
+            case 's':
+                opts.seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || opts.nodes < 1 || opts.nodes > 254 || opts.uplink_s < 1 || opts.radius_m <= 0)
+        usage(argv[0]);
+
+    printf("%d nodes within %.0f m, path loss exponent %.1f, %.0f dB shadowing, an uplink every %.0f s for %.1f "
+           "days\n", opts.nodes, opts.radius_m, opts.exponent, opts.shadowing_db, opts.uplink_s, opts.days);
+    printf("A %d byte data message is %.1f ms of airtime at SF%d and %.1f ms at SF%d\n\n", DATA_MESSAGE_LEN,
+           1e3 * airtime_s(SPREADING_FACTOR, DATA_MESSAGE_LEN), SPREADING_FACTOR,
+           1e3 * airtime_s(LINK_ADR_MIN_SF, DATA_MESSAGE_LEN), LINK_ADR_MIN_SF);
+
+    printf("%-10s %8s %7s %8s %6s %6s %6s %6s %8s %7s %7s %6s %5s %5s\n", "Policy", "Messages", "Got %", "Frames",
+           "Weak", "Wrong", "Coll", "TX", "Air ms", "Up %", "Down %", "dBm", "Cmds", "Back");
+    Channel fixed_channel(opts, false);
+    result_t fixed = fixed_channel.run();
+    print_result("fixed SF10", opts, fixed);
+    Channel adr_channel(opts, true);
+    result_t adr = adr_channel.run();
+    print_result("link ADR", opts, adr);
+
+    printf("\nFrames by spreading factor with link ADR:");
+    for (int sf = LINK_ADR_MIN_SF; sf <= SPREADING_FACTOR; ++sf)
+        printf(" SF%d %.1f%%", sf, adr.uplinks ? 100.0 * adr.sf_frames[sf] / adr.uplinks : 0.0);
+    printf("\n");
+
+    // Capacity: the messages per hour the main node gets as the load goes up
+    printf("\n%10s %10s %12s %12s %12s %12s\n", "Uplink s", "Offered/h", "SF10 got %", "ADR got %", "SF10 got/h",
+           "ADR got/h");
+    options_t load = opts;
+    for (int i = 0; i < 6; ++i) {
+        Channel a(load, false), b(load, true);
+        result_t ra = a.run(), rb = b.run();
+        double hours = load.days * 24.0;
+        printf("%10.1f %10.0f %12.2f %12.2f %12.0f %12.0f\n", load.uplink_s, ra.messages / hours,
+               ra.messages ? 100.0 * ra.delivered / ra.messages : 0.0,
+               rb.messages ? 100.0 * rb.delivered / rb.messages : 0.0, ra.delivered / hours, rb.delivered / hours);
+        load.uplink_s /= 2;
+    }
+
+    return EXIT_SUCCESS;
+}
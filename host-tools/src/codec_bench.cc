@@ -0,0 +1,417 @@
+/*
+  Micro-benchmarks for the message layer: Soil_Sensor_Common's
+  get_message_type(), parse_data_packet() and *_to_string() functions
+  and TextLines' iso8601_date_time() and tft_get_data_line(), which are
+  the CPU work loop() does for each received packet.
+
+  codec_bench [-m ms] [-r repeats] [-j] [-w file] [-b file] [-t percent] [filter]
+
+  -m  time each benchmark for at least this long, each repeat (default 50)
+  -r  repeats; the fastest is reported (default 7)
+  -j  print JSON lines instead of a table
+  -w  write the results to this baseline file
+  -b  compare the results with this baseline file and exit with 1 if
+      any benchmark regressed
+  -t  how much slower than the baseline is a regression, in percent
+      (default 25)
+  filter  run only the benchmarks whose names contain this
+
+  For example:
+
+    codec_bench -b baselines/codec_bench.jsonl
+    codec_bench -w baselines/codec_bench.jsonl
+
+  Each benchmark calls one function with the same input over and over.
+  The results are ns per call, the bytes the call reads (its input) and
+  writes (its output, including the null), and the heap allocations per
+  call. Allocations are counted by wrapping malloc(), which works with
+  glibc only; elsewhere they are -1.
+
+  A result is a regression if it is more than -t percent and NOISE_NS
+  slower than the baseline, or allocates more. Output bytes that differ from the
+  baseline are reported but are not a regression; they mean the text
+  changed. Times are only comparable on the machine that wrote the
+  baseline, so write one with -w on the machine that runs -b.
+
+  The baseline file is JSON lines: one line that describes the machine,
+  then one line a benchmark:
+
+    {"name":"iso8601_date_time","ns":95.1,"in_bytes":4,"out_bytes":20,"allocs":0}
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "TextLines.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define NOW 1615909112UL
+
+// Calls that take a few ns vary by more than -t from run to run; a
+// regression has to be at least this much slower, too
+#define NOISE_NS 10
+
+#ifdef __GLIBC__
+// Count every heap allocation, from C and from C++ (operator new calls malloc())
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+static uint64_t allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+    ++allocations;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size) {
+    ++allocations;
+    return __libc_realloc(p, size);
+}
+
+#define COUNTS_ALLOCATIONS 1
+#else
+static uint64_t allocations = 0;
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+struct options_t {
+    uint32_t min_ms;
+    int repeats;
+    bool json;
+    const char *write;
+    const char *baseline;
+    double tolerance;
+    const char *filter;
+};
+
+struct result_t {
+    std::string name;
+    double ns;
+    uint32_t in_bytes;
+    uint32_t out_bytes;
+    double allocs;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-m ms] [-r repeats] [-j] [-w file] [-b file] [-t percent] [filter]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The inputs, built once
+static packet_t packet;
+static data_message_t message;
+static join_request_t join;
+static time_request_t time_req;
+static text_t text_msg;
+static batch_reading_t reading;
+
+// Where the results go, so that no call is optimized away
+static volatile uint32_t sink;
+
+// Each benchmark makes one call and returns the bytes it wrote
+
+static uint32_t b_get_message_type() {
+    sink = get_message_type(&message);
+    return sizeof(MessageType);
+}
+
+static uint32_t b_get_message_type_string() {
+    const char *s = get_message_type_string(data_message);
+    sink = s[0];
+    return strlen(s) + 1;
+}
+
+static uint32_t b_parse_data_packet() {
+    uint8_t node, status;
+    uint32_t msg, time;
+    uint16_t battery, last_tx_duration, humidity;
+    int16_t temp;
+    parse_data_packet(&packet, &node, &msg, &time, &battery, &last_tx_duration, &temp, &humidity, &status);
+    sink = node + msg + time + battery + last_tx_duration + temp + humidity + status;
+    return sizeof(node) + sizeof(msg) + sizeof(time) + sizeof(battery) + sizeof(last_tx_duration) + sizeof(temp) +
+           sizeof(humidity) + sizeof(status);
+}
+
+static uint32_t b_parse_data_message() {
+    uint8_t node, status;
+    uint32_t msg, time;
+    uint16_t battery, last_tx_duration, humidity;
+    int16_t temp;
+    parse_data_message(&message, &node, &msg, &time, &battery, &last_tx_duration, &temp, &humidity, &status);
+    sink = node + msg + time + battery + last_tx_duration + temp + humidity + status;
+    return sizeof(node) + sizeof(msg) + sizeof(time) + sizeof(battery) + sizeof(last_tx_duration) + sizeof(temp) +
+           sizeof(humidity) + sizeof(status);
+}
+
+static uint32_t text_bytes(const char *s) {
+    sink = s[0];
+    return strlen(s) + 1;
+}
+
+static uint32_t b_data_packet_to_string() { return text_bytes(data_packet_to_string(&packet, false)); }
+static uint32_t b_data_packet_to_string_pretty() { return text_bytes(data_packet_to_string(&packet, true)); }
+static uint32_t b_data_message_to_string() { return text_bytes(data_message_to_string(&message, false)); }
+static uint32_t b_data_message_to_string_pretty() { return text_bytes(data_message_to_string(&message, true)); }
+static uint32_t b_join_request_to_string() { return text_bytes(join_request_to_string(&join, true)); }
+static uint32_t b_time_request_to_string() { return text_bytes(time_request_to_string(&time_req, true)); }
+static uint32_t b_text_message_to_string() { return text_bytes(text_message_to_string(&text_msg, true)); }
+
+static uint32_t b_iso8601_date_time() {
+    char date_time[ISO8601_CHARS];
+    return text_bytes(iso8601_date_time(NOW, date_time));
+}
+
+static uint32_t b_tft_get_data_line() {
+    char line[DATA_LINE_CHARS];
+    tft_get_data_line(&packet, 38, 35, line);
+    return text_bytes(line);
+}
+
+static uint32_t b_tft_get_reading_line() {
+    char line[DATA_LINE_CHARS];
+    tft_get_reading_line(4, reading, 38, 35, line);
+    return text_bytes(line);
+}
+
+/**
+ * @brief Call a benchmark 'calls' times
+ * @return The time it took, in seconds
+ */
+template <uint32_t (*F)()>
+static double time_calls(uint64_t calls) {
+    double start = seconds();
+    for (uint64_t i = 0; i < calls; ++i)
+        F();
+    return seconds() - start;
+}
+
+struct bench_t {
+    const char *name;
+    uint32_t (*call)();
+    double (*time)(uint64_t calls);
+    uint32_t in_bytes;
+};
+
+#define BENCH(f, in) {#f, b_##f, time_calls<b_##f>, in}
+
+static const bench_t benches[] = {
+    BENCH(get_message_type, 1),
+    BENCH(get_message_type_string, sizeof(MessageType)),
+    BENCH(parse_data_packet, sizeof(packet_t)),
+    BENCH(parse_data_message, sizeof(data_message_t)),
+    BENCH(data_packet_to_string, sizeof(packet_t)),
+    BENCH(data_packet_to_string_pretty, sizeof(packet_t)),
+    BENCH(data_message_to_string, sizeof(data_message_t)),
+    BENCH(data_message_to_string_pretty, sizeof(data_message_t)),
+    BENCH(join_request_to_string, sizeof(join_request_t)),
+    BENCH(time_request_to_string, sizeof(time_request_t)),
+    BENCH(text_message_to_string, sizeof(text_t)),
+    BENCH(iso8601_date_time, sizeof(uint32_t)),
+    BENCH(tft_get_data_line, sizeof(packet_t)),
+    BENCH(tft_get_reading_line, sizeof(batch_reading_t)),
+};
+
+static result_t run(const bench_t &b, const options_t &opts) {
+    result_t r;
+    r.name = b.name;
+    r.in_bytes = b.in_bytes;
+    r.out_bytes = b.call();
+
+    // The allocations of a call that is not the first
+    const int counted = 1000;
+    uint64_t before = allocations;
+    for (int i = 0; i < counted; ++i)
+        b.call();
+    r.allocs = COUNTS_ALLOCATIONS ? (double)(allocations - before) / counted : -1;
+
+    // Enough calls to take min_ms, then the fastest of the repeats
+    uint64_t calls = 1000;
+    double t;
+    while ((t = b.time(calls)) < opts.min_ms / 1000.0)
+        calls *= t > 0 ? (uint64_t)(opts.min_ms / 1000.0 / t * 1.2) + 1 : 10;
+    double best = t;
+    for (int i = 1; i < opts.repeats; ++i) {
+        t = b.time(calls);
+        if (t < best)
+            best = t;
+    }
+    r.ns = 1e9 * best / calls;
+    return r;
+}
+
+static void print_json(FILE *out, const result_t &r) {
+    fprintf(out, "{\"name\":\"%s\",\"ns\":%.1f,\"in_bytes\":%u,\"out_bytes\":%u,\"allocs\":%g}\n", r.name.c_str(),
+            r.ns, r.in_bytes, r.out_bytes, r.allocs);
+}
+
+static bool write_baseline(const char *name, const std::vector<result_t> &results) {
+    FILE *out = fopen(name, "w");
+    if (!out) {
+        perror(name);
+        return false;
+    }
+
+    struct utsname u;
+    uname(&u);
+    fprintf(out, "{\"machine\":\"%s %s\",\"compiler\":\"%s\"}\n", u.sysname, u.machine, __VERSION__);
+    for (size_t i = 0; i < results.size(); ++i)
+        print_json(out, results[i]);
+    return fclose(out) == 0;
+}
+
+static bool read_baseline(const char *name, std::vector<result_t> &baseline) {
+    FILE *in = fopen(name, "r");
+    if (!in) {
+        perror(name);
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        char bench[64];
+        result_t r;
+        if (sscanf(line, "{\"name\":\"%63[^\"]\",\"ns\":%lf,\"in_bytes\":%u,\"out_bytes\":%u,\"allocs\":%lf}", bench,
+                   &r.ns, &r.in_bytes, &r.out_bytes, &r.allocs) != 5)
+            continue;       // the machine's line
+        r.name = bench;
+        baseline.push_back(r);
+    }
+    fclose(in);
+    return true;
+}
+
+/**
+ * @brief Print the results next to the baseline's
+ * @return The number of regressions
+ */
+static int compare(const std::vector<result_t> &results, const std::vector<result_t> &baseline,
+                   double tolerance) {
+    int regressions = 0;
+    printf("%-30s %10s %10s %8s %7s %7s  %s\n", "", "ns/call", "baseline", "change", "allocs", "was", "");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const result_t &r = results[i];
+        const result_t *b = 0;
+        for (size_t k = 0; k < baseline.size() && !b; ++k)
+            if (baseline[k].name == r.name)
+                b = &baseline[k];
+
+        if (!b) {
+            printf("%-30s %10.1f %10s %8s %7g %7s  new\n", r.name.c_str(), r.ns, "", "", r.allocs, "");
+            continue;
+        }
+
+        double change = 100.0 * (r.ns - b->ns) / b->ns;
+        const char *verdict = "ok";
+        if (change > tolerance && r.ns - b->ns > NOISE_NS)
+            verdict = "SLOWER";
+        else if (r.allocs > b->allocs)
+            verdict = "ALLOCATES";
+        if (verdict[0] != 'o')
+            ++regressions;
+        printf("%-30s %10.1f %10.1f %+7.0f%% %7g %7g  %s%s\n", r.name.c_str(), r.ns, b->ns, change, r.allocs,
+               b->allocs, verdict, r.out_bytes != b->out_bytes ? ", output bytes changed" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {50, 7, false, 0, 0, 25, 0};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:jw:b:t:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                opts.min_ms = atoi(optarg);
+                break;
+            case 'r':
+                opts.repeats = atoi(optarg);
+                break;
+            case 'j':
+                opts.json = true;
+                break;
+            case 'w':
+                opts.write = optarg;
+                break;
+            case 'b':
+                opts.baseline = optarg;
+                break;
+            case 't':
+                opts.tolerance = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind < argc - 1 || opts.min_ms < 1 || opts.repeats < 1 || opts.tolerance < 0)
+        usage(argv[0]);
+    if (optind == argc - 1)
+        opts.filter = argv[optind];
+
+    std::vector<result_t> baseline;
+    if (opts.baseline && !read_baseline(opts.baseline, baseline))
+        return EXIT_FAILURE;
+
+    build_data_packet(&packet, 4, 1042, NOW, 416, 370, 2041, 2950, 0);
+    build_data_message(&message, 4, 1042, NOW, 416, 370, 2041, 2950, 0);
+    build_join_request(&join, 0x0123456789abcdefULL);
+    build_time_request(&time_req, 4, NOW);
+    memset(&text_msg, 0, sizeof(text_msg));
+    text_msg.type = text;
+    strncpy(text_msg.text, "Leaf node 4 restarted", sizeof(text_msg.text) - 1);
+    text_msg.len = strlen(text_msg.text);
+    reading.message = 1042;
+    reading.time = NOW;
+    reading.battery = 416;
+    reading.last_tx_duration = 370;
+    reading.temp = 2041;
+    reading.humidity = 2950;
+    reading.status = 0;
+
+    std::vector<result_t> results;
+    if (!opts.json && !opts.baseline)
+        printf("%-30s %10s %9s %9s %7s\n", "", "ns/call", "in bytes", "out bytes", "allocs");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        if (opts.filter && !strstr(benches[i].name, opts.filter))
+            continue;
+        result_t r = run(benches[i], opts);
+        results.push_back(r);
+        if (opts.json)
+            print_json(stdout, r);
+        else if (!opts.baseline)
+            printf("%-30s %10.1f %9u %9u %7g\n", r.name.c_str(), r.ns, r.in_bytes, r.out_bytes, r.allocs);
+    }
+
+    if (opts.write && !write_baseline(opts.write, results))
+        return EXIT_FAILURE;
+
+    if (opts.baseline) {
+        int regressions = compare(results, baseline, opts.tolerance);
+        if (regressions) {
+            printf("\n%d regressed\n", regressions);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+/*
+  The CPU time loop() spends decoding and rendering a received frame,
+  the way it did before FramePipeline.h and the way it does now.
+
+  frame_bench [-n frames] [-b batch_size] [-p percent_batches] [-r rounds] [-s seed]
+
+  -n  frames in the mix (default 1000)
+  -b  readings in each batch (default 8)
+  -p  percent of the frames that are batches; the rest are half legacy
+      packets and half data messages (default 25)
+  -r  times to go through the mix with each (default 200)
+  -s  random number seed (default 1)
+
+  Both handle the same frames and produce the same text: the console's
+  pretty-printed line, the SD card's plain line and, for data packets,
+  the TFT's line. "before" is loop() as it was: it works the type out
+  from the length and first byte, renders from the radio's buffer, and
+  for the TFT parses the packet again; a batch is decoded and each
+  reading built into a packet_t and then rendered. "after" is
+  decode_frame() and a FramePipeline with three sinks that render what
+  they need from the record. The hardware (the serial port, the SD card
+  and the display) is left out, so this is the CPU cost alone; run it
+  on the M0 for the M0's.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "BatchMessage.h"
+#include "FramePipeline.h"
+#include "TextLines.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define NOW 1615909112UL
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n frames] [-b batch_size] [-p percent_batches] [-r rounds] [-s seed]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+struct frame_t {
+    uint8_t buf[BATCH_MAX_SIZE];
+    uint8_t len;
+    uint8_t from;
+};
+
+// Where the text goes; summed so that none of it is optimized away
+static uint32_t chars = 0;
+
+static void out(const char *text) {
+    chars += strlen(text);
+}
+
+// TFTDisplay.cc's line, before TextFormat.h
+static void tft_line(uint8_t node, int16_t temp, uint16_t humidity, uint16_t battery, uint8_t status,
+                     unsigned int min, unsigned int sec) {
+    char text[DATA_LINE_CHARS];
+    snprintf(text, DATA_LINE_CHARS, "%u %02u:%02u %3.1f %u %3.2f 0x%02x", node, min, sec, temp / 100.0,
+             humidity / 100, battery / 100.0, (unsigned int)status);
+    out(text);
+}
+
+static void tft_get_data_line(const packet_t *p, unsigned int min, unsigned int sec) {
+    uint8_t node, status;
+    uint32_t message, time;
+    uint16_t battery, last_tx_duration, humidity;
+    int16_t temp;
+    parse_data_packet(p, &node, &message, &time, &battery, &last_tx_duration, &temp, &humidity, &status);
+    tft_line(node, temp, humidity, battery, status, min, sec);
+}
+
+// loop() before FramePipeline
+static void before(const frame_t &f) {
+    static batch_reading_t readings[BATCH_MAX_READINGS];
+    uint8_t *buf = (uint8_t *)f.buf;
+    uint8_t len = f.len;
+
+    bool batch = len != sizeof(packet_t) && is_batch_message(buf, len);
+    MessageType type = (len == sizeof(packet_t)) ? data_packet : get_message_type((char *)buf);
+    out(batch ? "data batch" : len == sizeof(packet_t) ? "data packet" : get_message_type_string(type));
+
+    if (batch) {
+        uint8_t node, count;
+        uint32_t node_time;
+        if (!decode_batch(buf, len, &node, &node_time, readings, &count))
+            return;
+        for (uint8_t i = 0; i < count; ++i) {
+            const batch_reading_t &r = readings[i];
+            packet_t p;
+            build_data_packet(&p, node, r.message, r.time, r.battery, r.last_tx_duration, r.temp, r.humidity,
+                              r.status);
+            out(data_packet_to_string(&p, true));
+            out(data_packet_to_string(&p, false));
+            tft_get_data_line(&p, (r.time / 60) % 60, r.time % 60);
+        }
+        return;
+    }
+
+    switch (type) {
+        case data_packet:
+            out(data_packet_to_string((packet_t *)buf, true));
+            out(data_packet_to_string((packet_t *)buf, false));
+            tft_get_data_line((packet_t *)buf, (NOW / 60) % 60, NOW % 60);
+            break;
+        case data_message:
+            out(data_message_to_string((data_message_t *)buf, true));
+            out(data_message_to_string((data_message_t *)buf, false));
+            break;
+        default:
+            break;
+    }
+}
+
+class ConsoleSink : public FrameSink {
+public:
+    void message(const frame_record_t &, MessageType type, const uint8_t *msg, uint8_t, int8_t) {
+        if (type == data_packet)
+            out(data_packet_to_string((packet_t *)msg, true));
+        else if (type == data_message)
+            out(data_message_to_string((data_message_t *)msg, true));
+    }
+};
+
+class TextLogSink : public FrameSink {
+public:
+    void message(const frame_record_t &, MessageType type, const uint8_t *msg, uint8_t, int8_t) {
+        if (type == data_packet)
+            out(data_packet_to_string((packet_t *)msg, false));
+        else if (type == data_message)
+            out(data_message_to_string((data_message_t *)msg, false));
+    }
+};
+
+class TftSink : public FrameSink {
+public:
+    void message(const frame_record_t &record, MessageType type, const uint8_t *, uint8_t, int8_t reading) {
+        if (type != data_packet)
+            return;
+        const batch_reading_t &r = record.readings[reading];
+        uint32_t t = record.batch ? r.time : record.rx_time;
+        char text[DATA_LINE_CHARS];
+        tft_get_reading_line(record.node, r, (t / 60) % 60, t % 60, text);
+        out(text);
+    }
+};
+
+static FramePipeline pipeline;
+
+// loop() now
+static void after(const frame_t &f) {
+    static frame_record_t record;
+    if (!decode_frame(f.buf, f.len, f.from, NOW, &record))
+        return;
+    out(record.batch ? "data batch"
+                     : record.type == data_packet ? "data packet" : get_message_type_string(record.type));
+    pipeline.dispatch(record);
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(void (*handle)(const frame_t &), const std::vector<frame_t> &frames, int rounds) {
+    double start = seconds();
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < frames.size(); ++i)
+            handle(frames[i]);
+    return seconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+    int n = 1000;
+    int batch_size = 8;
+    double percent_batches = 25;
+    int rounds = 200;
+    unsigned seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:p:r:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 'p':
+                percent_batches = atof(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || n < 1 || batch_size < 1 || batch_size > BATCH_MAX_READINGS || rounds < 1)
+        usage(argv[0]);
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::vector<frame_t> frames(n);
+    uint32_t readings = 0;
+    for (int i = 0; i < n; ++i) {
+        frame_t &f = frames[i];
+        f.from = 1 + rng() % 16;
+        uint32_t message = 1000 + i * BATCH_MAX_READINGS;
+        int16_t temp = 2000 + rng() % 100;
+        uint16_t humidity = 2900 + rng() % 100;
+        if (percent(rng) < percent_batches) {
+            batch_reading_t r[BATCH_MAX_READINGS];
+            for (int k = 0; k < batch_size; ++k) {
+                r[k].message = message + k;
+                r[k].time = NOW - 300 * (batch_size - k);
+                r[k].battery = 416;
+                r[k].last_tx_duration = 370 + rng() % 20;
+                r[k].temp = temp + k;
+                r[k].humidity = humidity - k;
+                r[k].status = 0;
+            }
+            f.len = encode_batch(f.from, NOW, r, batch_size, f.buf, sizeof(f.buf));
+            readings += batch_size;
+        }
+        else if (i % 2) {
+            build_data_packet((packet_t *)f.buf, f.from, message, NOW, 416, 370, temp, humidity, 0);
+            f.len = sizeof(packet_t);
+            readings += 1;
+        }
+        else {
+            build_data_message((data_message_t *)f.buf, f.from, message, NOW, 416, 370, temp, humidity, 0);
+            f.len = sizeof(data_message_t);
+            readings += 1;
+        }
+    }
+
+    ConsoleSink console_sink;
+    TextLogSink text_log_sink;
+    TftSink tft_sink;
+    pipeline.add(&console_sink);
+    pipeline.add(&text_log_sink);
+    pipeline.add(&tft_sink);
+
+    // The same text both ways, or the comparison means nothing
+    chars = 0;
+    run(before, frames, 1);
+    uint32_t before_chars = chars;
+    chars = 0;
+    run(after, frames, 1);
+    if (chars != before_chars) {
+        fprintf(stderr, "The two render different text: %u and %u characters\n", before_chars, chars);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d frames, %.0f%% batches of %d, %u readings, %d rounds\n\n", n, percent_batches, batch_size,
+           readings, rounds);
+    printf("%-8s %12s %12s\n", "", "ns/frame", "ns/reading");
+    double t_before = run(before, frames, rounds);
+    double t_after = run(after, frames, rounds);
+    double frames_run = (double)n * rounds;
+    double readings_run = (double)readings * rounds;
+    printf("%-8s %12.0f %12.0f\n", "before", 1e9 * t_before / frames_run, 1e9 * t_before / readings_run);
+    printf("%-8s %12.0f %12.0f\n", "after", 1e9 * t_after / frames_run, 1e9 * t_after / readings_run);
+    printf("\n%.2fx\n", t_before / t_after);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/*
+  Per-node link and loss statistics from a capture of the main node's
+  serial output (what PyNodeLog.py writes, like test_data_no_ant.csv).
+
+  log_analyzer [-j threads] [-H] capture.csv
+
+  -j  parse with this many threads (default: the number of CPUs)
+  -H  print each node's histograms too
+
+  The capture is memory-mapped and split into one piece per thread at
+  line boundaries; each thread parses its piece into a CaptureStats and
+  the pieces are merged in order. The parse time and rate go to stderr.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "CaptureStats.h"
+
+#define MAX_THREADS 64
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-j threads] [-H] capture.csv\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// The upper limit, in seconds, of an inter-arrival histogram bin
+static double gap_bin_limit(int bin) {
+    return (double)(1UL << bin);
+}
+
+static void print_percentiles(const uint32_t *bins, int n, int offset, int scale) {
+    int p5 = histogram_percentile(bins, n, 0.05);
+    if (p5 < 0) {
+        printf(" %15s", "-");
+        return;
+    }
+    int p50 = histogram_percentile(bins, n, 0.50);
+    int p95 = histogram_percentile(bins, n, 0.95);
+    char text[32];
+    snprintf(text, sizeof(text), "%d/%d/%d", p5 * scale + offset, p50 * scale + offset, p95 * scale + offset);
+    printf(" %15s", text);
+}
+
+static void print_histogram(const char *name, const uint32_t *bins, int n, int offset, int scale) {
+    if (histogram_total(bins, n) == 0)
+        return;
+    printf("    %s:", name);
+    for (int i = 0; i < n; ++i) {
+        if (bins[i])
+            printf(" %d:%u", i * scale + offset, bins[i]);
+    }
+    printf("\n");
+}
+
+static void print_report(const CaptureStats &stats, bool histograms) {
+    printf("%llu lines, %u boots, %u crash dumps", (unsigned long long)stats.lines(), stats.boots(), stats.crashes());
+    for (int i = 0; i < RESET_CAUSES; ++i) {
+        if (stats.reset_cause(i))
+            printf(", rst cause %d: %u", i, stats.reset_cause(i));
+    }
+    printf("\n\n");
+
+    printf("%4s %7s %7s %6s %6s %5s %5s %15s %15s %9s %9s %7s %6s %15s %s\n", "Node", "Frames", "Msgs", "Lost",
+           "Loss%", "Dup", "Rst", "RSSI p5/50/95", "SNR p5/50/95", "Gap mean", "Gap p95<", "Replies", "Failed",
+           "Reply ms p5/50/95", "Retrans 0/1/2/3+");
+
+    for (int node = 0; node < CAPTURE_NODES; ++node) {
+        const node_link_stats_t &n = stats.node(node);
+        if (!n.frames && !n.messages && !n.replies && !n.reply_failures)
+            continue;
+
+        uint64_t gaps = histogram_total(n.gaps, GAP_BINS);
+        double loss = n.messages + n.lost ? 100.0 * n.lost / (n.messages + n.lost) : 0.0;
+        printf("%4d %7u %7u %6u %6.2f %5u %5u", node, n.frames, n.messages, n.lost, loss, n.duplicates, n.restarts);
+        print_percentiles(n.rssi, RSSI_BINS, RSSI_MIN_DBM, 1);
+        print_percentiles(n.snr, SNR_BINS, SNR_MIN_DB, 1);
+        if (gaps) {
+            int p95 = histogram_percentile(n.gaps, GAP_BINS, 0.95);
+            printf(" %8.1fs %8.0fs", n.gap_sum / gaps, gap_bin_limit(p95));
+        } else {
+            printf(" %9s %9s", "-", "-");
+        }
+        printf(" %7u %6u", n.replies, n.reply_failures);
+        print_percentiles(n.latency, LATENCY_BINS, 0, LATENCY_BIN_MS);
+        uint32_t more = 0;
+        for (int i = 3; i < RETRANS_BINS; ++i)
+            more += n.retrans[i];
+        printf(" %u/%u/%u/%u\n", n.retrans[0], n.retrans[1], n.retrans[2], more);
+
+        if (histograms) {
+            print_histogram("RSSI dBm", n.rssi, RSSI_BINS, RSSI_MIN_DBM, 1);
+            print_histogram("SNR dB", n.snr, SNR_BINS, SNR_MIN_DB, 1);
+            print_histogram("Reply ms", n.latency, LATENCY_BINS, 0, LATENCY_BIN_MS);
+            print_histogram("Retransmissions", n.retrans, RETRANS_BINS, 0, 1);
+            if (gaps) {
+                printf("    Gap s:");
+                for (int i = 0; i < GAP_BINS; ++i) {
+                    if (n.gaps[i])
+                        printf(" <%.0f:%u", gap_bin_limit(i), n.gaps[i]);
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    const node_link_stats_t &u = stats.unattributed();
+    if (u.messages || u.replies || u.reply_failures)
+        printf("\nBefore the first Received line: %u data lines, %u replies, %u failed replies\n", u.messages,
+               u.replies, u.reply_failures);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned threads = std::thread::hardware_concurrency();
+    bool histograms = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:Hh")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'H':
+                histograms = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    size_t size = st.st_size;
+
+    const char *data = 0;
+    if (size > 0) {
+        data = (const char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            return EXIT_FAILURE;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Split at line boundaries: each piece ends just after a newline
+    std::vector<size_t> bounds(1, 0);
+    for (unsigned i = 1; i < threads; ++i) {
+        size_t at = size / threads * i;
+        if (at <= bounds.back())
+            continue;
+        const char *nl = (const char *)memchr(data + at, '\n', size - at);
+        if (!nl)
+            break;
+        bounds.push_back(nl - data + 1);
+    }
+    bounds.push_back(size);
+
+    size_t pieces = bounds.size() - 1;
+    std::vector<CaptureStats *> stats(pieces);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < pieces; ++i) {
+        stats[i] = new CaptureStats;
+        workers.push_back(std::thread([&stats, &bounds, data, i]() {
+            stats[i]->add_lines(data + bounds[i], bounds[i + 1] - bounds[i]);
+        }));
+    }
+    for (size_t i = 0; i < pieces; ++i)
+        workers[i].join();
+    for (size_t i = 1; i < pieces; ++i)
+        stats[0]->merge(*stats[i]);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (size > 0)
+        munmap((void *)data, size);
+    close(fd);
+
+    print_report(*stats[0], histograms);
+
+    fprintf(stderr, "Parsed %.1f MB in %.3f s (%.0f MB/s) with %zu threads\n", size / 1e6, seconds,
+            seconds > 0 ? size / 1e6 / seconds : 0.0, pieces);
+
+    for (size_t i = 0; i < pieces; ++i)
+        delete stats[i];
+
+    return EXIT_SUCCESS;
+}
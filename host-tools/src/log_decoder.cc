@@ -0,0 +1,84 @@
+/*
+  Decode the main node's binary log (Sensor_data.bin) to the same text
+  the main node writes to Sensor_data.csv.
+
+  log_decoder [-x] [-s] file.bin
+
+  -x  prefix each line with the receive time (unixtime), RSSI and SNR
+  -s  print block/record counts to stderr when done
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "BinaryLogDecoder.h"
+
+#define READ_BLOCKS 256
+
+struct options_t {
+    bool extra;
+    FILE *out;
+};
+
+static void print_record(const log_record_t *rec, void *context) {
+    const options_t *opts = (const options_t *)context;
+    fputs(log_record_to_string(rec, opts->extra), opts->out);
+    fputs("\n", opts->out);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-x] [-s] file.bin\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {false, stdout};
+    bool summary = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "xsh")) != -1) {
+        switch (opt) {
+            case 'x':
+                opts.extra = true;
+                break;
+            case 's':
+                summary = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (!in) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.extra)
+        fputs("# RX Time, RSSI dBm, SNR dB, Node, Message, Time, Battery V, Last TX Dur ms, Temp C, Hum %, Status\n",
+              opts.out);
+    else
+        fputs("# Node, Message, Time, Battery V, Last TX Dur ms, Temp C, Hum %, Status\n", opts.out);
+
+    static uint8_t buf[READ_BLOCKS * LOG_BLOCK_SIZE];
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        decode_log_blocks(buf, n, print_record, &opts, &stats);
+
+    fclose(in);
+
+    if (summary)
+        fprintf(stderr, "%u blocks, %u bad blocks, %u records, %u sequence gaps\n", stats.blocks, stats.bad_blocks,
+                stats.records, stats.sequence_gaps);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+/*
+  List the files on the main node's SD card, or download one, over its
+  serial port while it keeps running (see LogTransfer.h).
+
+  log_download [-l] [-o file] [-c] [-w window] [-f] [-s] port [name]
+
+  -l  list the files on the card
+  -o  write the download to this file (default: name)
+  -c  continue a download that stopped: read from the end of the
+      output file and append to it
+  -w  chunks in flight, 1 to 16 (default: the main node's, 8)
+  -f  leave the main node in framed mode (default: switch it back to text)
+  -s  print the transfer's figures to stderr when done
+
+  For example:
+
+    log_download -l /dev/ttyACM0
+    log_download -s /dev/ttyACM0 20210316.CSV
+
+  If the main node goes quiet for RETRY_MS in the middle of a download,
+  the read is sent again from the last byte received, up to RETRIES
+  times. A download that fails leaves what it got in the output file,
+  and -c picks up from there.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "LogTransfer.h"
+#include "SerialRecord.h"
+
+#define RETRY_MS 3000
+#define RETRIES 5
+
+struct options_t {
+    bool list;
+    const char *output;
+    bool resume;
+    int window;
+    bool framed;
+    bool summary;
+};
+
+struct session_t {
+    LogTransferClient *client;
+    int fd;
+    FILE *out;
+    bool progress;          // a record of the transfer came since the last check
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-l] [-o file] [-c] [-w window] [-f] [-s] port [name]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool send(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void print_info(const log_file_info_t *info, void *) {
+    printf("%-12s %10u\n", info->name, info->size);
+}
+
+static bool write_data(uint32_t, const uint8_t *data, uint16_t len, void *context) {
+    session_t *s = (session_t *)context;
+    return fwrite(data, 1, len, s->out) == len;
+}
+
+static void handle_record(const serial_record_t *rec, void *context) {
+    session_t *s = (session_t *)context;
+    if (rec->type == LOG_TRANSFER_INFO || rec->type == LOG_TRANSFER_DATA || rec->type == LOG_TRANSFER_END)
+        s->progress = true;
+
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    size_t len = s->client->record(*rec, wire);
+    if (len)
+        send(s->fd, wire, len);
+}
+
+// The serial port, raw; the baud rate does not matter over USB
+static int open_port(const char *name) {
+    int fd = open(name, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+    struct termios t;
+    if (tcgetattr(fd, &t) == 0) {
+        cfmakeraw(&t);
+        cfsetspeed(&t, B115200);
+        tcsetattr(fd, TCSANOW, &t);
+    }
+    tcflush(fd, TCIFLUSH);
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {false, 0, false, 0, false, false};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "lo:cw:fsh")) != -1) {
+        switch (opt) {
+            case 'l':
+                opts.list = true;
+                break;
+            case 'o':
+                opts.output = optarg;
+                break;
+            case 'c':
+                opts.resume = true;
+                break;
+            case 'w':
+                opts.window = atoi(optarg);
+                if (opts.window < 1 || opts.window > LOG_TRANSFER_MAX_WINDOW)
+                    usage(argv[0]);
+                break;
+            case 'f':
+                opts.framed = true;
+                break;
+            case 's':
+                opts.summary = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (opts.list ? optind != argc - 1 : optind != argc - 2)
+        usage(argv[0]);
+    const char *port = argv[optind];
+    const char *name = opts.list ? 0 : argv[optind + 1];
+    if (name && strlen(name) >= LOG_TRANSFER_NAME_LEN) {
+        fprintf(stderr, "%s: the main node's file names are 8.3\n", name);
+        return EXIT_FAILURE;
+    }
+
+    session_t s = {0, -1, 0, false};
+    uint32_t offset = 0;
+    const char *output = opts.output ? opts.output : name;
+    if (name) {
+        if (!(s.out = fopen(output, opts.resume ? "ab" : "wb"))) {
+            perror(output);
+            return EXIT_FAILURE;
+        }
+        fseek(s.out, 0, SEEK_END);
+        offset = ftell(s.out);
+    }
+
+    if ((s.fd = open_port(port)) < 0)
+        return EXIT_FAILURE;
+
+    LogTransferClient client(print_info, write_data, &s);
+    s.client = &client;
+    SerialRecordReader reader(handle_record, &s);
+
+    // Framed mode, then the request
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    size_t len = name ? client.read(name, offset, 0, opts.window, wire) : client.list(wire);
+    if (!send(s.fd, "B", 1) || !send(s.fd, wire, len))
+        return EXIT_FAILURE;
+
+    double start = seconds();
+    double heard = start;
+    int retries = 0;
+    while (!client.done()) {
+        struct pollfd p = {s.fd, POLLIN, 0};
+        int ready = poll(&p, 1, 100);
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (ready > 0) {
+            uint8_t buf[4096];
+            ssize_t n = read(s.fd, buf, sizeof(buf));
+            if (n <= 0) {
+                fprintf(stderr, "%s closed\n", port);
+                break;
+            }
+            reader.add(buf, n);
+        }
+
+        if (s.progress) {
+            s.progress = false;
+            heard = seconds();
+            continue;
+        }
+        if (seconds() - heard < RETRY_MS / 1000.0)
+            continue;
+
+        // A listing can't be picked up where it stopped, only a read
+        if (!name || retries == RETRIES) {
+            fprintf(stderr, "The main node stopped answering\n");
+            break;
+        }
+        ++retries;
+        fprintf(stderr, "No answer; asking again from byte %u\n", client.offset());
+        len = client.read(name, client.offset(), 0, opts.window, wire);
+        send(s.fd, wire, len);
+        heard = seconds();
+    }
+    double elapsed = seconds() - start;
+
+    if (!opts.framed)
+        send(s.fd, "T", 1);
+    close(s.fd);
+    if (s.out)
+        fclose(s.out);
+
+    if (client.done() && client.end().status != log_transfer_ok)
+        fprintf(stderr, "%s\n", log_transfer_status_string(client.end().status));
+    else if (client.done() && !client.ok()) {
+        // Keep what came before this read, so that -c reads it again
+        fprintf(stderr, "The CRC does not match; cutting %s back to %u bytes\n", output, client.end().offset);
+        if (truncate(output, client.end().offset) != 0)
+            perror(output);
+    }
+
+    if (opts.summary && name)
+        fprintf(stderr, "%u bytes in %.1f s (%.0f bytes/s), %u retries, %u rewinds, %u records, %u bad, %u lost\n",
+                client.offset() - offset, elapsed, (client.offset() - offset) / elapsed, retries, client.rewinds(),
+                reader.stats().records, reader.stats().bad, reader.stats().lost);
+
+    return client.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,255 @@
+/*
+  Read one node's records, or a time range's, from a day's log using
+  its index (see LogIndex.h), without reading the whole file.
+
+  log_query [-n node] [-f from] [-t to] [-x] [-s] YYYYMMDD.CSV
+
+  -n  only this node's records (default: every node)
+  -f  from this time, as unixtime or YYYY-MM-DDTHH:MM:SS (default: the start)
+  -t  to this time, inclusive (default: the end)
+  -x  also drop records whose Time is outside -f/-t
+  -s  print what was read to stderr when done
+
+  The index is the log file's name with .IDX (or .idx) in place of its
+  extension. The index's times are when the main node received the
+  records, so -f and -t pick whole blocks by that time; the Time in a
+  record is the leaf node's clock, which -x filters on. Parts of the
+  log the index does not cover (the day's last block, or one cut short
+  by a reset) are always read, and a log with no index is read whole.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "LogIndex.h"
+
+#define LINE_CHARS 256
+
+struct options_t {
+    int node;           // -1 for any
+    uint32_t from;
+    uint32_t to;
+    bool record_time;   // -x
+};
+
+// A part of the log file to read
+struct range_t {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct result_t {
+    uint32_t file_bytes;
+    uint32_t entries;
+    uint32_t blocks;        // entries that matched
+    uint32_t gaps;          // unindexed parts read
+    uint32_t bytes_read;
+    uint32_t records;       // lines printed
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n node] [-f from] [-t to] [-x] [-s] YYYYMMDD.CSV\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// unixtime, or YYYY-MM-DDTHH:MM:SS read as UTC, the way the main node's DateTime does
+static bool parse_time(const char *text, uint32_t *t) {
+    char *end;
+    unsigned long u = strtoul(text, &end, 10);
+    if (*text && !*end) {
+        *t = u;
+        return true;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(text, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || *end)
+        return false;
+    *t = timegm(&tm);
+    return true;
+}
+
+// Read the index; false if there is none or it is not an index
+static bool read_index(const char *log_name, std::vector<log_index_entry_t> *entries) {
+    char name[1024];
+    snprintf(name, sizeof(name), "%s", log_name);
+    char *dot = strrchr(name, '.');
+    if (!dot || dot < strrchr(name, '/'))
+        dot = name + strlen(name);
+
+    const char *exts[] = {".IDX", ".idx"};
+    FILE *in = 0;
+    for (int i = 0; i < 2 && !in; ++i) {
+        snprintf(dot, sizeof(name) - (dot - name), "%s", exts[i]);
+        in = fopen(name, "rb");
+    }
+    if (!in)
+        return false;
+
+    log_index_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != LOG_INDEX_MAGIC
+        || header.version != LOG_INDEX_VERSION || header.entry_size != LOG_INDEX_ENTRY_SIZE) {
+        fprintf(stderr, "%s is not a log index\n", name);
+        fclose(in);
+        return false;
+    }
+
+    log_index_entry_t e;
+    while (fread(&e, sizeof(e), 1, in) == 1)
+        if (e.length)
+            entries->push_back(e);
+    fclose(in);
+    return true;
+}
+
+static bool by_offset(const log_index_entry_t &a, const log_index_entry_t &b) { return a.offset < b.offset; }
+
+/**
+ * @brief The parts of the log to read: the blocks that match and the
+ * parts no entry covers, merged where they touch
+ */
+static std::vector<range_t> plan(std::vector<log_index_entry_t> &entries, uint32_t file_bytes,
+                                 const options_t &opts, result_t *result) {
+    std::sort(entries.begin(), entries.end(), by_offset);
+
+    std::vector<range_t> ranges;
+    uint32_t pos = 0;       // the end of what has been planned
+    for (size_t i = 0; i <= entries.size(); ++i) {
+        uint32_t start = i < entries.size() ? std::min(entries[i].offset, file_bytes) : file_bytes;
+        range_t r;
+        if (start > pos) {
+            r.offset = pos;
+            r.length = start - pos;
+            ranges.push_back(r);
+            ++result->gaps;
+        }
+        if (i == entries.size())
+            break;
+
+        const log_index_entry_t &e = entries[i];
+        uint32_t end = std::min(e.offset + e.length, file_bytes);
+        if (log_index_match(e, opts.from, opts.to, opts.node) && end > start) {
+            r.offset = start;
+            r.length = end - start;
+            ranges.push_back(r);
+            ++result->blocks;
+        }
+        pos = std::max(pos, end);
+    }
+
+    std::vector<range_t> merged;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (!merged.empty() && merged.back().offset + merged.back().length == ranges[i].offset)
+            merged.back().length += ranges[i].length;
+        else
+            merged.push_back(ranges[i]);
+    }
+    return merged;
+}
+
+// Print a line if it is a record that the options select
+static void filter_line(const char *line, const options_t &opts, result_t *result) {
+    if (line[0] == '#' || line[0] == '\0' || line[0] == '\r' || line[0] == '\n')
+        return;
+
+    // Node, Message, Time, ...
+    char *end;
+    long node = strtol(line, &end, 10);
+    if (end == line || (opts.node >= 0 && node != opts.node))
+        return;
+
+    if (opts.record_time) {
+        const char *p = strchr(line, ',');
+        p = p ? strchr(p + 1, ',') : 0;
+        if (!p)
+            return;
+        unsigned long t = strtoul(p + 1, 0, 10);
+        if (t < opts.from || t > opts.to)
+            return;
+    }
+
+    fputs(line, stdout);
+    ++result->records;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {-1, 0, UINT32_MAX, false};
+    bool summary = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:t:xsh")) != -1) {
+        switch (opt) {
+            case 'n':
+                opts.node = atoi(optarg);
+                if (opts.node < 0 || opts.node > 255)
+                    usage(argv[0]);
+                break;
+            case 'f':
+                if (!parse_time(optarg, &opts.from))
+                    usage(argv[0]);
+                break;
+            case 't':
+                if (!parse_time(optarg, &opts.to))
+                    usage(argv[0]);
+                break;
+            case 'x':
+                opts.record_time = true;
+                break;
+            case 's':
+                summary = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (!in) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    result_t result;
+    memset(&result, 0, sizeof(result));
+    fseek(in, 0, SEEK_END);
+    result.file_bytes = ftell(in);
+
+    std::vector<log_index_entry_t> entries;
+    if (!read_index(argv[optind], &entries))
+        fprintf(stderr, "No index for %s; reading all of it\n", argv[optind]);
+    result.entries = entries.size();
+
+    std::vector<range_t> ranges = plan(entries, result.file_bytes, opts, &result);
+
+    // Each range starts and ends on a line boundary
+    char line[LINE_CHARS];
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        fseek(in, ranges[i].offset, SEEK_SET);
+        uint32_t left = ranges[i].length;
+        while (left > 0 && fgets(line, sizeof(line), in)) {
+            uint32_t n = strlen(line);
+            left = n < left ? left - n : 0;
+            result.bytes_read += n;
+            filter_line(line, opts, &result);
+        }
+    }
+    fclose(in);
+
+    if (summary)
+        fprintf(stderr, "%u records; read %u of %u bytes (%.1f%%): %u of %u blocks and %u unindexed parts\n",
+                result.records, result.bytes_read, result.file_bytes,
+                result.file_bytes ? 100.0 * result.bytes_read / result.file_bytes : 0.0, result.blocks,
+                result.entries, result.gaps);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/*
+  Write a synthetic capture of the main node's serial output, in the
+  format PyNodeLog.py writes, for benchmarking and checking log_analyzer.
+
+  log_synth [-n nodes] [-l loss_percent] [-p panic_every] [-s seed] size_mb > capture.csv
+
+  -n  leaf nodes, addresses 1 to n (default 8)
+  -l  drop this percent of each node's messages (default 1)
+  -p  add an ESP8266 panic dump and reboot every this many frames
+      (default 500; 0 for none)
+  -s  random number seed (default 1)
+
+  The nodes send in turn. Each frame is a Received line, a Data line and
+  a reply line, as in test_data_no_ant.csv. What was generated (frames,
+  messages dropped, dumps) is printed to stderr so it can be compared
+  with log_analyzer's report.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#define START_TIME 1615909112.0
+#define UPLINK_INTERVAL_S 20.0
+#define DUMP_STACK_LINES 40
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n nodes] [-l loss_percent] [-p panic_every] [-s seed] size_mb\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// Print a capture line: the host time, a comma and the text, quoted if it has a comma
+static size_t capture_line(double t, const char *text) {
+    int n = strchr(text, ',') ? printf("%.6f,\"%s\"\n", t, text) : printf("%.6f,%s\n", t, text);
+    return n > 0 ? n : 0;
+}
+
+static size_t panic_dump(double t, std::mt19937 &rng) {
+    static const char *head[] = {"",
+                                 "User exception (panic/abort/assert",
+                                 "--------------- CUT HERE FOR EXCEPTION DECODER --------------",
+                                 "",
+                                 "Panic core_esp8266_main.cpp:133 __yiel",
+                                 "",
+                                 ">>>stack>>>",
+                                 "",
+                                 "ctx: cont",
+                                 "sp: 3ffffca0 end: 3fffffc0 offset: 0000"};
+    static const char *tail[] = {"<<<stack<<<",
+                                 "",
+                                 "--------------- CUT HERE FOR EXCEPTION DECODER --------------",
+                                 "",
+                                 " ets Jan  8 2013,rst cause:2, boot mode:(3,0)",
+                                 "",
+                                 "load 0x4010f000, len 3584, room 16 ",
+                                 "tail 0",
+                                 "chksum 0xb0",
+                                 "csum 0xb0",
+                                 "boot",
+                                 "Initializing SD card... OK",
+                                 "Starting receiver... OK",
+                                 "Listening on frequency: 902.30"};
+    size_t bytes = 0;
+    for (size_t i = 0; i < sizeof(head) / sizeof(head[0]); ++i)
+        bytes += capture_line(t, head[i]);
+    char line[128];
+    for (int i = 0; i < DUMP_STACK_LINES; ++i) {
+        snprintf(line, sizeof(line), "%08x:  %08x %08x %08x %08x  ", 0x3ffffca0 + 16 * i, (unsigned)rng(),
+                 (unsigned)rng(), (unsigned)rng(), (unsigned)rng());
+        bytes += capture_line(t, line);
+    }
+    for (size_t i = 0; i < sizeof(tail) / sizeof(tail[0]); ++i)
+        bytes += capture_line(t, tail[i]);
+    return bytes;
+}
+
+int main(int argc, char *argv[]) {
+    int nodes = 8;
+    double loss_percent = 1.0;
+    unsigned panic_every = 500;
+    unsigned seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:p:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                nodes = atoi(optarg);
+                break;
+            case 'l':
+                loss_percent = atof(optarg);
+                break;
+            case 'p':
+                panic_every = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || nodes < 1 || nodes > 254)
+        usage(argv[0]);
+    uint64_t size = (uint64_t)(atof(argv[optind]) * 1e6);
+
+    static char out_buf[1 << 20];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 100.0);
+    std::normal_distribution<double> rssi(-75.0, 8.0);
+    std::normal_distribution<double> snr(8.0, 3.0);
+
+    std::vector<uint32_t> message(nodes + 1, 0);
+    std::vector<uint32_t> dropped(nodes + 1, 0);
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+    uint32_t dumps = 0;
+    uint8_t id = 0;
+    double t = START_TIME;
+    char line[256];
+
+    while (bytes < size) {
+        int node = 1 + frames % nodes;
+        ++message[node];
+        t += UPLINK_INTERVAL_S / nodes;
+        if (uniform(rng) < loss_percent) {
+            ++dropped[node];
+            ++frames;
+            continue;
+        }
+
+        bytes += capture_line(t, "");
+        snprintf(line, sizeof(line), "Received length: 20, from: 0x%02x, to: 0x00, id: 0x%02x, header: 0x00", node,
+                 id++);
+        bytes += capture_line(t, line);
+        snprintf(line, sizeof(line),
+                 "Data: node: %d, message: %u, time: %.0f, Vbat 416 v, Tx dur 0 ms, T: 2043 C, RH: 2962 %%, "
+                 "status: 0x00, RSSI %d dBm, SNR %d dB, good/bad packets: %llu/0",
+                 node, message[node], t, (int)rssi(rng), (int)snr(rng), (unsigned long long)frames + 1);
+        bytes += capture_line(t, line);
+        snprintf(line, sizeof(line), "...sent a reply, %d retransmissions, %d ms, to: 0x%02x", (int)(rng() % 8 == 0),
+                 530 + (int)(rng() % 40), node);
+        bytes += capture_line(t + 0.54, line);
+
+        ++frames;
+        if (panic_every && frames % panic_every == 0) {
+            bytes += panic_dump(t + 1.0, rng);
+            ++dumps;
+        }
+    }
+
+    fflush(stdout);
+
+    uint32_t total_dropped = 0;
+    for (int node = 1; node <= nodes; ++node)
+        total_dropped += dropped[node];
+    fprintf(stderr, "%llu bytes, %llu frames from %d nodes, %u messages dropped (%.2f%%), %u panic dumps\n",
+            (unsigned long long)bytes, (unsigned long long)frames, nodes, total_dropped,
+            frames ? 100.0 * total_dropped / frames : 0.0, dumps);
+
+    return EXIT_SUCCESS;
+}
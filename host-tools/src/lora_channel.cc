@@ -0,0 +1,574 @@
+/*
+  LoRa time on air for the main node's radio settings, and a Monte Carlo
+  simulation of the leaf nodes sharing the channel with it, so the radio
+  settings and timeouts can be chosen from numbers.
+
+  lora_channel [-f sf] [-b bandwidth] [-c coding_rate] [-p preamble]
+               [-l data_len] [-L reply_len] [-n nodes] [-u uplink_s]
+               [-t ack_timeout_ms] [-r retries] [-T reply_timeout_ms]
+               [-R reply_retries] [-y reply_percent] [-g turnaround_ms]
+               [-B] [-d hours] [-s seed]
+
+  -f  spreading factor (default 10)
+  -b  bandwidth, Hz (default 125000)
+  -c  coding rate, the denominator of 4/5 to 4/8 (default 5)
+  -p  preamble, symbols (default 8)
+  -l  a leaf node's data message, bytes (default 20)
+  -L  the main node's reply, bytes (default 4, the bare time)
+  -n  leaf nodes (default 16)
+  -u  seconds between a node's messages (default 300)
+  -t  a leaf node waits this to twice this for an ACK, ms, as
+      RHReliableDatagram::sendtoWait() does (default 200, its default)
+  -r  and sends again this many times (default 3)
+  -T  the main node waits this for a reply's ACK, ms (default
+      REPLY_TIMEOUT, 400)
+  -R  and sends the reply again this many times (default 3)
+  -y  percent of new messages the main node replies to (default 100;
+      with TimeSync it is closer to 1)
+  -g  the main node's turnaround, from a frame's end to its ACK, ms
+      (default 10; loop() has to come round to the frame)
+  -B  the main node sends replies with sendtoWait(), deaf to new
+      messages until the reply is ACK'd or given up on, as it did
+      before OutboundEngine
+  -d  hours to simulate (default 24)
+  -s  random number seed (default 1)
+
+  Everything is in one collision domain: two transmissions that overlap
+  are both lost, and a radio that is transmitting hears nothing. A leaf
+  node ACKs a reply 5 ms after it ends. The main node ACKs every data
+  frame it hears, including a copy of a message it already has (a
+  retry sent because the ACK was lost or late).
+
+  The output is the airtime of each frame at every spreading factor,
+  the shortest timeouts that can work at these settings, the simulation
+  at these settings and two sweeps: the leaf nodes' ACK timeout and the
+  number of nodes.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "LoRaAirtime.h"
+
+#define ACK_LEN 1                   // RHReliableDatagram's ACK payload
+#define LEAF_TURNAROUND_S 0.005
+#define LEAF_NODE_MAX 254
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-f sf] [-b bandwidth] [-c coding_rate] [-p preamble] [-l data_len] [-L reply_len] "
+                    "[-n nodes] [-u uplink_s] [-t ack_timeout_ms] [-r retries] [-T reply_timeout_ms] "
+                    "[-R reply_retries] [-y reply_percent] [-g turnaround_ms] [-B] [-d hours] [-s seed]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+struct options_t {
+    lora_settings_t radio;
+    int data_len;
+    int reply_len;
+    int nodes;
+    double uplink_s;
+    double ack_timeout_ms;
+    int retries;
+    double reply_timeout_ms;
+    int reply_retries;
+    double reply_percent;
+    double turnaround_ms;
+    bool blocking;
+    double hours;
+    unsigned seed;
+};
+
+struct result_t {
+    uint64_t messages;
+    uint64_t delivered;         // the main node got at least one copy
+    uint64_t acked;             // the leaf node got an ACK
+    uint64_t frames;            // data frames, counting retries
+    uint64_t retries;
+    uint64_t needless_retries;  // the main node already had the message
+    uint64_t duplicates;        // copies the main node got of a message it had
+    uint64_t dropped_busy;      // new messages dropped by a blocked main node
+    uint64_t transmissions;     // every frame on the air
+    uint64_t collided;
+    uint64_t replies;
+    uint64_t replies_acked;
+    uint64_t reply_sends;
+    double air_s;               // total airtime
+    double gateway_tx_s;
+    double gateway_deaf_s;      // transmitting, or blocked in a reply
+};
+
+enum Kind { kind_data, kind_ack, kind_reply, kind_reply_ack };
+
+enum EventType { ev_message, ev_tx_end, ev_leaf_timeout, ev_gateway_ack, ev_reply_service, ev_reply_timeout,
+                 ev_leaf_reply_ack };
+
+class Channel {
+    struct tx_t {
+        double start;
+        double end;
+        int from;               // 0 is the main node
+        int to;
+        Kind kind;
+        uint32_t id;
+        bool collided;
+    };
+
+    struct leaf_t {
+        uint32_t message;       // the message being sent, or the last one
+        int attempt;
+        bool waiting;           // for an ACK
+        uint32_t wait_gen;
+        double tx_start;        // of its last transmission
+        double tx_end;
+    };
+
+    struct reply_t {
+        int to;
+        uint32_t id;
+    };
+
+    struct event_t {
+        double t;
+        uint64_t seq;
+        EventType type;
+        int node;
+        uint32_t arg;
+        bool operator<(const event_t &e) const { return t > e.t || (t == e.t && seq > e.seq); }
+    };
+
+    const options_t &d_opts;
+    std::mt19937 d_rng;
+    std::uniform_real_distribution<double> d_uniform;
+
+    std::priority_queue<event_t> d_events;
+    uint64_t d_seq;
+    std::vector<tx_t> d_tx;             // every transmission
+    std::vector<size_t> d_on_air;
+
+    std::vector<leaf_t> d_leaves;       // index 0 unused
+    std::vector<uint32_t> d_seen;       // the last message the main node got from each node
+
+    double d_gw_tx_start;
+    double d_gw_tx_end;
+    std::vector<reply_t> d_replies;     // queued
+    bool d_reply_active;
+    reply_t d_reply;
+    int d_reply_attempt;
+    uint32_t d_reply_gen;
+    uint32_t d_reply_id;
+    double d_blocked_since;
+
+    result_t d_r;
+
+    double air_s(int len) const {
+        return lora_airtime_us(d_opts.radio, len + LORA_RH_HEADER_LEN) / 1e6;
+    }
+
+    void schedule(double t, EventType type, int node = 0, uint32_t arg = 0) {
+        event_t e = {t, d_seq++, type, node, arg};
+        d_events.push(e);
+    }
+
+    // Put a frame on the air; it collides with everything on the air now
+    double transmit(double t, int from, int to, Kind kind, uint32_t id, int len) {
+        tx_t tx = {t, t + air_s(len), from, to, kind, id, false};
+        for (size_t i = 0; i < d_on_air.size(); ++i) {
+            tx_t &other = d_tx[d_on_air[i]];
+            if (other.end <= t)
+                continue;       // ending just as this one starts
+            if (!other.collided) {
+                other.collided = true;
+                ++d_r.collided;
+            }
+            if (!tx.collided) {
+                tx.collided = true;
+                ++d_r.collided;
+            }
+        }
+        d_tx.push_back(tx);
+        d_on_air.push_back(d_tx.size() - 1);
+        schedule(tx.end, ev_tx_end, 0, d_tx.size() - 1);
+
+        ++d_r.transmissions;
+        d_r.air_s += tx.end - tx.start;
+        if (from == 0) {
+            d_gw_tx_start = t;
+            d_gw_tx_end = tx.end;
+            d_r.gateway_tx_s += tx.end - tx.start;
+        }
+        else {
+            d_leaves[from].tx_start = t;
+            d_leaves[from].tx_end = tx.end;
+        }
+        return tx.end;
+    }
+
+    // The main node's radio sends one frame at a time; the next waits
+    double gateway_transmit(double t, int to, Kind kind, uint32_t id, int len) {
+        return transmit(t > d_gw_tx_end ? t : d_gw_tx_end, 0, to, kind, id, len);
+    }
+
+    bool heard(const tx_t &tx) const {
+        if (tx.collided)
+            return false;
+        double start = tx.to == 0 ? d_gw_tx_start : d_leaves[tx.to].tx_start;
+        double end = tx.to == 0 ? d_gw_tx_end : d_leaves[tx.to].tx_end;
+        return !(end > tx.start && start < tx.end);
+    }
+
+    void leaf_send(int node, double t) {
+        leaf_t &leaf = d_leaves[node];
+        ++d_r.frames;
+        if (leaf.attempt > 0) {
+            ++d_r.retries;
+            if (d_seen[node] == leaf.message)
+                ++d_r.needless_retries;
+        }
+        double end = transmit(t, node, 0, kind_data, leaf.message, d_opts.data_len);
+        leaf.waiting = true;
+        double timeout = d_opts.ack_timeout_ms * (1 + d_uniform(d_rng)) / 1e3;
+        schedule(end + timeout, ev_leaf_timeout, node, ++leaf.wait_gen);
+    }
+
+    void start_reply(double t) {
+        if (d_reply_active || d_replies.empty())
+            return;
+        d_reply = d_replies.front();
+        d_replies.erase(d_replies.begin());
+        d_reply_active = true;
+        d_reply_attempt = 0;
+        d_blocked_since = t;
+        send_reply(t);
+    }
+
+    void send_reply(double t) {
+        ++d_r.reply_sends;
+        double end = gateway_transmit(t, d_reply.to, kind_reply, d_reply.id, d_opts.reply_len);
+        // sendtoWait() randomizes its timeout; OutboundEngine does not
+        double timeout = d_opts.reply_timeout_ms * (d_opts.blocking ? 1 + d_uniform(d_rng) : 1.0) / 1e3;
+        schedule(end + timeout, ev_reply_timeout, 0, ++d_reply_gen);
+    }
+
+    void finish_reply(double t, bool acked) {
+        if (acked)
+            ++d_r.replies_acked;
+        d_reply_active = false;
+        ++d_reply_gen;
+        if (d_opts.blocking)
+            d_r.gateway_deaf_s += t - d_blocked_since;
+        schedule(t, ev_reply_service);
+    }
+
+    bool blocked() const { return d_opts.blocking && d_reply_active; }
+
+    void deliver(size_t i, double t) {
+        const tx_t &tx = d_tx[i];
+        for (size_t k = 0; k < d_on_air.size(); ++k) {
+            if (d_on_air[k] == i) {
+                d_on_air.erase(d_on_air.begin() + k);
+                break;
+            }
+        }
+        if (!heard(tx))
+            return;
+
+        double turnaround = d_opts.turnaround_ms * (0.5 + d_uniform(d_rng)) / 1e3;
+        switch (tx.kind) {
+            case kind_data: {
+                bool copy = d_seen[tx.from] == tx.id;
+                if (blocked() && !copy) {
+                    // sendtoWait() reads the frame and throws it away
+                    ++d_r.dropped_busy;
+                    break;
+                }
+                schedule(t + turnaround, ev_gateway_ack, tx.from, tx.id);
+                if (copy) {
+                    ++d_r.duplicates;
+                    break;
+                }
+                d_seen[tx.from] = tx.id;
+                ++d_r.delivered;
+                if (d_uniform(d_rng) * 100 < d_opts.reply_percent) {
+                    reply_t reply = {tx.from, ++d_reply_id};
+                    d_replies.push_back(reply);
+                    ++d_r.replies;
+                    // A blocking reply goes right after the ACK
+                    schedule(t + turnaround + air_s(ACK_LEN), ev_reply_service);
+                }
+                break;
+            }
+
+            case kind_ack: {
+                leaf_t &leaf = d_leaves[tx.to];
+                if (leaf.waiting && tx.id == leaf.message) {
+                    leaf.waiting = false;
+                    ++leaf.wait_gen;
+                    ++d_r.acked;
+                }
+                break;
+            }
+
+            case kind_reply:
+                schedule(t + LEAF_TURNAROUND_S, ev_leaf_reply_ack, tx.to, tx.id);
+                break;
+
+            case kind_reply_ack:
+                if (d_reply_active && tx.from == d_reply.to && tx.id == d_reply.id)
+                    finish_reply(t, true);
+                break;
+        }
+    }
+
+public:
+    Channel(const options_t &opts)
+        : d_opts(opts), d_rng(opts.seed), d_uniform(0.0, 1.0), d_seq(0), d_leaves(opts.nodes + 1),
+          d_seen(opts.nodes + 1, 0), d_gw_tx_start(-1), d_gw_tx_end(-1), d_reply_active(false), d_reply_attempt(0),
+          d_reply_gen(0), d_reply_id(0), d_blocked_since(0), d_r(result_t()) {
+        for (int node = 1; node <= opts.nodes; ++node) {
+            leaf_t &leaf = d_leaves[node];
+            leaf.message = 0;
+            leaf.attempt = 0;
+            leaf.waiting = false;
+            leaf.wait_gen = 0;
+            leaf.tx_start = leaf.tx_end = -1;
+            schedule(d_uniform(d_rng) * opts.uplink_s, ev_message, node);
+        }
+    }
+
+    result_t run() {
+        double end = d_opts.hours * 3600.0;
+        while (!d_events.empty()) {
+            event_t e = d_events.top();
+            d_events.pop();
+            double t = e.t;
+
+            switch (e.type) {
+                case ev_message: {
+                    if (t >= end)
+                        break;
+                    leaf_t &leaf = d_leaves[e.node];
+                    // The next message is due whether or not this one gets through
+                    schedule(t + d_opts.uplink_s * (0.99 + 0.02 * d_uniform(d_rng)), ev_message, e.node);
+                    if (leaf.waiting)
+                        break;      // still sending the last one; this one is skipped
+                    ++leaf.message;
+                    ++d_r.messages;
+                    leaf.attempt = 0;
+                    leaf_send(e.node, t);
+                    break;
+                }
+
+                case ev_tx_end:
+                    deliver(e.arg, t);
+                    break;
+
+                case ev_leaf_timeout: {
+                    leaf_t &leaf = d_leaves[e.node];
+                    if (!leaf.waiting || e.arg != leaf.wait_gen)
+                        break;
+                    if (leaf.attempt < d_opts.retries) {
+                        ++leaf.attempt;
+                        leaf_send(e.node, t);
+                    }
+                    else {
+                        leaf.waiting = false;
+                    }
+                    break;
+                }
+
+                case ev_gateway_ack:
+                    gateway_transmit(t, e.node, kind_ack, e.arg, ACK_LEN);
+                    break;
+
+                case ev_reply_service:
+                    start_reply(t);
+                    break;
+
+                case ev_reply_timeout:
+                    if (!d_reply_active || e.arg != d_reply_gen)
+                        break;
+                    if (d_reply_attempt < d_opts.reply_retries) {
+                        ++d_reply_attempt;
+                        send_reply(t);
+                    }
+                    else {
+                        finish_reply(t, false);
+                    }
+                    break;
+
+                case ev_leaf_reply_ack:
+                    transmit(t, e.node, 0, kind_reply_ack, e.arg, ACK_LEN);
+                    break;
+            }
+        }
+
+        d_r.gateway_deaf_s += d_r.gateway_tx_s;
+        return d_r;
+    }
+};
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void print_heading(const char *first) {
+    printf("%-10s %8s %7s %7s %7s %7s %7s %7s %7s %7s %8s %7s %7s\n", first, "Messages", "Got %", "ACK'd %",
+           "Retry %", "Needless", "Dups", "Busy", "Coll %", "Air %", "GW TX %", "Deaf %", "Reply %");
+}
+
+static void print_row(const char *label, const options_t &opts, const result_t &r) {
+    double duration = opts.hours * 3600.0;
+    printf("%-10s %8llu %7.2f %7.2f %7.2f %8llu %7llu %7llu %7.2f %7.2f %8.2f %7.2f %7.2f\n", label,
+           (unsigned long long)r.messages, percent(r.delivered, r.messages), percent(r.acked, r.messages),
+           percent(r.retries, r.frames), (unsigned long long)r.needless_retries, (unsigned long long)r.duplicates,
+           (unsigned long long)r.dropped_busy, percent(r.collided, r.transmissions), 100.0 * r.air_s / duration,
+           100.0 * r.gateway_tx_s / duration, 100.0 * r.gateway_deaf_s / duration,
+           percent(r.replies_acked, r.replies));
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts;
+    opts.radio = lora_settings(10, 125000, 5);
+    opts.data_len = 20;
+    opts.reply_len = 4;
+    opts.nodes = 16;
+    opts.uplink_s = 300;
+    opts.ack_timeout_ms = 200;
+    opts.retries = 3;
+    opts.reply_timeout_ms = 400;
+    opts.reply_retries = 3;
+    opts.reply_percent = 100;
+    opts.turnaround_ms = 10;
+    opts.blocking = false;
+    opts.hours = 24;
+    opts.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:c:p:l:L:n:u:t:r:T:R:y:g:Bd:s:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                opts.radio.spreading_factor = atoi(optarg);
+                break;
+            case 'b':
+                opts.radio.bandwidth = atol(optarg);
+                break;
+            case 'c':
+                opts.radio.coding_rate = atoi(optarg);
+                break;
+            case 'p':
+                opts.radio.preamble = atoi(optarg);
+                break;
+            case 'l':
+                opts.data_len = atoi(optarg);
+                break;
+            case 'L':
+                opts.reply_len = atoi(optarg);
+                break;
+            case 'n':
+                opts.nodes = atoi(optarg);
+                break;
+            case 'u':
+                opts.uplink_s = atof(optarg);
+                break;
+            case 't':
+                opts.ack_timeout_ms = atof(optarg);
+                break;
+            case 'r':
+                opts.retries = atoi(optarg);
+                break;
+            case 'T':
+                opts.reply_timeout_ms = atof(optarg);
+                break;
+            case 'R':
+                opts.reply_retries = atoi(optarg);
+                break;
+            case 'y':
+                opts.reply_percent = atof(optarg);
+                break;
+            case 'g':
+                opts.turnaround_ms = atof(optarg);
+                break;
+            case 'B':
+                opts.blocking = true;
+                break;
+            case 'd':
+                opts.hours = atof(optarg);
+                break;
+            case 's':
+                opts.seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    const lora_settings_t &radio = opts.radio;
+    if (optind != argc || radio.spreading_factor < 6 || radio.spreading_factor > 12 || radio.bandwidth == 0
+        || radio.coding_rate < 5 || radio.coding_rate > 8 || opts.data_len < 1 || opts.data_len > 251
+        || opts.reply_len < 1 || opts.reply_len > 251 || opts.nodes < 1 || opts.nodes > LEAF_NODE_MAX
+        || opts.uplink_s <= 0 || opts.hours <= 0)
+        usage(argv[0]);
+
+    printf("Time on air at %lu Hz, 4/%d, %d symbol preamble, explicit header, CRC on; RadioHead adds %d bytes\n\n",
+           (unsigned long)radio.bandwidth, radio.coding_rate, radio.preamble, LORA_RH_HEADER_LEN);
+    printf("%4s %9s %9s %11s %11s %11s\n", "SF", "Symbol ms", "LDRO", "ACK ms", "Reply ms", "Data ms");
+    for (uint8_t sf = 6; sf <= 12; ++sf) {
+        lora_settings_t s = radio;
+        s.spreading_factor = sf;
+        printf("%4d %9.3f %9s %11.1f %11.1f %11.1f%s\n", sf, lora_symbol_us(s) / 1e3,
+               lora_low_data_rate(s) ? "yes" : "no", lora_airtime_us(s, ACK_LEN + LORA_RH_HEADER_LEN) / 1e3,
+               lora_airtime_us(s, opts.reply_len + LORA_RH_HEADER_LEN) / 1e3,
+               lora_airtime_us(s, opts.data_len + LORA_RH_HEADER_LEN) / 1e3,
+               sf == radio.spreading_factor ? "   <-" : "");
+    }
+
+    // From the end of a frame to the end of its ACK
+    double ack_ms = lora_airtime_us(radio, ACK_LEN + LORA_RH_HEADER_LEN) / 1e3;
+    double leaf_wait_ms = 1.5 * opts.turnaround_ms + ack_ms;
+    double gateway_wait_ms = 1e3 * LEAF_TURNAROUND_S + ack_ms;
+    printf("\nAt SF%d a leaf node's ACK arrives up to %.1f ms after its data frame ends; wait at least that "
+           "(now %.0f to %.0f ms)\n", radio.spreading_factor, leaf_wait_ms, opts.ack_timeout_ms,
+           2 * opts.ack_timeout_ms);
+    printf("A reply's ACK arrives %.1f ms after the reply ends; REPLY_TIMEOUT must be more than that (now %.0f ms)\n",
+           gateway_wait_ms, opts.reply_timeout_ms);
+
+    printf("\n%d nodes, a message every %.0f s for %.0f hours, %.0f%% answered with a %s reply\n\n", opts.nodes,
+           opts.uplink_s, opts.hours, opts.reply_percent, opts.blocking ? "blocking" : "queued");
+    print_heading("Settings");
+    Channel channel(opts);
+    print_row("these", opts, channel.run());
+
+    printf("\nThe leaf nodes' ACK timeout (they wait this to twice this)\n\n");
+    print_heading("Timeout ms");
+    static const double timeouts[] = {100, 200, 300, 400, 600, 800};
+    for (size_t i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); ++i) {
+        options_t o = opts;
+        o.ack_timeout_ms = timeouts[i];
+        char label[16];
+        snprintf(label, sizeof(label), "%.0f", timeouts[i]);
+        Channel c(o);
+        print_row(label, o, c.run());
+    }
+
+    printf("\nThe number of nodes, with queued and with blocking replies\n\n");
+    print_heading("Nodes");
+    for (int nodes = opts.nodes; nodes <= LEAF_NODE_MAX; nodes *= 2) {
+        for (int blocking = 0; blocking < 2; ++blocking) {
+            options_t o = opts;
+            o.nodes = nodes;
+            o.blocking = blocking;
+            char label[16];
+            snprintf(label, sizeof(label), "%d%s", nodes, blocking ? " B" : "");
+            Channel c(o);
+            print_row(label, o, c.run());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+/*
+  Collect the frames of several main nodes into one log. PyNodeLog.py
+  reads one port and opens its CSV file again for each line; this reads
+  all of them (see PortSet.h and IngestMerge.h).
+
+  node_collector [-o store] [-t file] [-f seconds] [-H ms] [-m seconds] [-x] [-q] port...
+
+  -o  append the merged frames to this binary log (default: Collected.bin)
+  -t  append the main nodes' text lines to this CSV file: host time,
+      port, line
+  -f  write a block that is not full, and the text lines, after this
+      many seconds (default 10)
+  -H  hold a frame this long for the other ports (default 2000 ms)
+  -m  print each port's figures to stderr this often (default 60 s, 0
+      for never); also on SIGUSR1 and at exit
+  -x  print frames with the receive time, RSSI and SNR
+  -q  don't print the frames
+
+  For example:
+
+    node_collector -t Collected.csv /dev/serial/by-id/usb-Adafruit*
+
+  Each main node is switched to framed mode when its port opens and
+  back to text mode at exit (SIGINT or SIGTERM). The frames are printed
+  and added to the store in receive time order, once; a frame two main
+  nodes heard is counted as a duplicate against the port that was
+  second. The store is written in whole 512-byte blocks, in the main
+  node's binary log format, so log_decoder and log_query read it. A
+  block cut short (by a crash) at the end of the store is removed
+  before anything is added.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "BinaryLog.h"
+#include "BinaryLogDecoder.h"
+#include "IngestMerge.h"
+#include "PortSet.h"
+#include "SerialRecord.h"
+
+struct options_t {
+    const char *store;
+    const char *text;
+    uint32_t flush_ms;
+    uint32_t hold_ms;
+    uint32_t metrics_ms;
+    bool extra;
+    bool quiet;
+};
+
+typedef IngestMerge<PORT_SET_MAX, 1024> Merge;
+
+struct collector_t;
+
+struct port_context_t {
+    collector_t *c;
+    uint8_t port;
+};
+
+struct collector_t {
+    const options_t *opts;
+    PortSet *ports;
+    Merge *merge;
+    BinaryLogEncoder *encoder;
+    int store;
+    FILE *text;
+
+    port_context_t contexts[PORT_SET_MAX];
+    SerialRecordReader *readers[PORT_SET_MAX];
+    serial_reader_stats_t reader_stats[PORT_SET_MAX];   // from connections before this one
+
+    uint32_t blocks;
+    uint32_t frames;
+};
+
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t metrics = 0;
+
+static void on_stop(int) {
+    stop = 1;
+}
+
+static void on_metrics(int) {
+    metrics = 1;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-o store] [-t file] [-f seconds] [-H ms] [-m seconds] [-x] [-q] port...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double host_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_block(collector_t *c) {
+    if (c->encoder->empty())
+        return;
+    const log_block_t *block = c->encoder->finish();
+    if (write(c->store, block, LOG_BLOCK_SIZE) != LOG_BLOCK_SIZE)
+        perror(c->opts->store);
+    c->encoder->reset();
+    ++c->blocks;
+}
+
+// Frames that are ready go to stdout and the store
+static void drain_merge(collector_t *c, bool all) {
+    log_record_t rec;
+    uint8_t port;
+    uint32_t now = PortSet::now_ms();
+    while (c->merge->next(now, &rec, &port, all)) {
+        ++c->frames;
+        if (!c->opts->quiet)
+            printf("Frame: %s\n", log_record_to_string(&rec, c->opts->extra));
+        if (!c->encoder->add(&rec, now)) {
+            write_block(c);
+            c->encoder->add(&rec, now);
+        }
+        if (c->encoder->full())
+            write_block(c);
+    }
+    fflush(stdout);
+}
+
+// A line as a CSV field: quoted, with its quotes doubled
+static void write_text(collector_t *c, uint8_t port, const uint8_t *line, size_t len) {
+    fprintf(c->text, "%.6f,%u,\"", host_time(), port);
+    for (size_t i = 0; i < len; ++i) {
+        if (line[i] == '"')
+            fputc('"', c->text);
+        fputc(line[i], c->text);
+    }
+    fputs("\"\n", c->text);
+}
+
+static void handle_record(const serial_record_t *rec, void *context) {
+    port_context_t *pc = (port_context_t *)context;
+    collector_t *c = pc->c;
+    switch (rec->type) {
+        case SERIAL_RECORD_FRAME: {
+            log_record_t frame;
+            if (log_record_decode(rec->payload, rec->len, &frame) != rec->len)
+                break;
+            c->merge->add(pc->port, frame, PortSet::now_ms(), (uint32_t)time(0));
+            drain_merge(c, false);
+            break;
+        }
+        case SERIAL_RECORD_TEXT:
+            if (c->text)
+                write_text(c, pc->port, rec->payload, rec->len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void port_data(uint8_t port, const uint8_t *data, size_t len, void *context) {
+    collector_t *c = (collector_t *)context;
+    c->readers[port]->add(data, len);
+}
+
+// A main node that was plugged in again may have been reset: start a
+// new reader, so its record sequence starts over, and switch it to framed mode
+static void port_state(uint8_t port, bool open, void *context) {
+    collector_t *c = (collector_t *)context;
+    fprintf(stderr, "%s %s\n", c->ports->path(port), open ? "opened" : "closed");
+    c->merge->set_open(port, open);
+    if (!open)
+        return;
+
+    serial_reader_stats_t &total = c->reader_stats[port];
+    total.records += c->readers[port]->stats().records;
+    total.bad += c->readers[port]->stats().bad;
+    total.lost += c->readers[port]->stats().lost;
+    *c->readers[port] = SerialRecordReader(handle_record, &c->contexts[port]);
+    c->ports->write(port, "B", 1);
+}
+
+static void print_metrics(const collector_t *c) {
+    fprintf(stderr, "%-32s %-6s %6s %8s %8s %6s %6s %6s %6s %16s %8s\n", "port", "state", "opens", "records", "frames",
+            "dups", "late", "bad", "lost", "lag s min/avg/max", "hold ms");
+    for (uint8_t i = 0; i < c->ports->count(); ++i) {
+        const ingest_port_stats_t &m = c->merge->stats(i);
+        const serial_reader_stats_t &now = c->readers[i]->stats();
+        const serial_reader_stats_t &before = c->reader_stats[i];
+        char lag[32] = "-";
+        if (m.frames)
+            snprintf(lag, sizeof(lag), "%d/%.1f/%d", m.lag_min_s, (double)m.lag_sum_s / m.frames, m.lag_max_s);
+        fprintf(stderr, "%-32s %-6s %6u %8u %8u %6u %6u %6u %6u %16s %8u\n", c->ports->path(i),
+                c->ports->is_open(i) ? "open" : "closed", c->ports->stats(i).opens, before.records + now.records,
+                m.frames, m.duplicates, m.late, before.bad + now.bad, before.lost + now.lost, lag, m.hold_max_ms);
+    }
+    fprintf(stderr, "%u frames, %u blocks written, %u waiting\n", c->frames, c->blocks, c->merge->pending());
+}
+
+// Open the store for appending, after any partial block at its end;
+// 'sequence' is the next block's sequence number
+static int open_store(const char *name, uint32_t *sequence) {
+    int fd = open(name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+    off_t whole = st.st_size - st.st_size % LOG_BLOCK_SIZE;
+    if (whole != st.st_size) {
+        fprintf(stderr, "%s: removing %u bytes of a partial block\n", name, (unsigned)(st.st_size - whole));
+        if (ftruncate(fd, whole) != 0)
+            perror(name);
+    }
+
+    *sequence = 0;
+    log_block_t last;
+    if (whole > 0 && pread(fd, &last, LOG_BLOCK_SIZE, whole - LOG_BLOCK_SIZE) == LOG_BLOCK_SIZE &&
+        verify_log_block(&last))
+        *sequence = last.sequence + 1;
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {"Collected.bin", 0, 10000, INGEST_HOLD_MS, 60000, false, false};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:t:f:H:m:xqh")) != -1) {
+        switch (opt) {
+            case 'o':
+                opts.store = optarg;
+                break;
+            case 't':
+                opts.text = optarg;
+                break;
+            case 'f':
+                opts.flush_ms = atoi(optarg) * 1000;
+                break;
+            case 'H':
+                opts.hold_ms = atoi(optarg);
+                break;
+            case 'm':
+                opts.metrics_ms = atoi(optarg) * 1000;
+                break;
+            case 'x':
+                opts.extra = true;
+                break;
+            case 'q':
+                opts.quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind == argc || argc - optind > PORT_SET_MAX)
+        usage(argv[0]);
+
+    collector_t c;
+    memset(&c, 0, sizeof(c));
+    c.opts = &opts;
+
+    uint32_t sequence;
+    if ((c.store = open_store(opts.store, &sequence)) < 0)
+        return EXIT_FAILURE;
+    if (opts.text && !(c.text = fopen(opts.text, "a"))) {
+        perror(opts.text);
+        return EXIT_FAILURE;
+    }
+
+    BinaryLogEncoder encoder(sequence);
+    Merge merge(opts.hold_ms);
+    PortSet ports(port_data, port_state, &c);
+    c.encoder = &encoder;
+    c.merge = &merge;
+    c.ports = &ports;
+
+    for (int i = optind; i < argc; ++i) {
+        int8_t port = ports.add(argv[i]);
+        if (port < 0) {
+            perror("epoll");
+            return EXIT_FAILURE;
+        }
+        c.contexts[port] = port_context_t{&c, (uint8_t)port};
+        c.readers[port] = new SerialRecordReader(handle_record, &c.contexts[port]);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    sa.sa_handler = on_metrics;
+    sigaction(SIGUSR1, &sa, 0);
+
+    uint32_t metrics_ms = PortSet::now_ms();
+    uint32_t text_ms = metrics_ms;
+    while (!stop) {
+        ports.poll(100);
+
+        // A frame held for a quiet port, or a block that waited long enough
+        drain_merge(&c, false);
+        uint32_t now = PortSet::now_ms();
+        if (encoder.due(now, opts.flush_ms))
+            write_block(&c);
+        if (c.text && now - text_ms >= opts.flush_ms) {
+            fflush(c.text);
+            text_ms = now;
+        }
+
+        if (metrics || (opts.metrics_ms && now - metrics_ms >= opts.metrics_ms)) {
+            metrics = 0;
+            metrics_ms = now;
+            print_metrics(&c);
+        }
+    }
+
+    drain_merge(&c, true);
+    write_block(&c);
+    for (uint8_t i = 0; i < ports.count(); ++i)
+        ports.write(i, "T", 1);
+    print_metrics(&c);
+
+    close(c.store);
+    if (c.text)
+        fclose(c.text);
+    for (uint8_t i = 0; i < ports.count(); ++i)
+        delete c.readers[i];
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/*
+  Read the main node's framed serial output (see SerialRecord.h) and
+  print it: text records as the lines they hold and received frames as
+  the text log's lines.
+
+  serial_decoder [-x] [-s] [file]
+
+  -x  prefix each frame with the receive time (unixtime), RSSI and SNR
+  -s  print record counts to stderr when done
+
+  With no file, read stdin. To read the main node directly, put the port
+  in raw mode and switch the node to framed mode:
+
+    stty -F /dev/ttyACM0 raw 115200
+    printf B > /dev/ttyACM0
+    serial_decoder /dev/ttyACM0
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "BinaryLogDecoder.h"
+#include "SerialRecord.h"
+
+struct options_t {
+    bool extra;
+    FILE *out;
+};
+
+static void print_record(const serial_record_t *rec, void *context) {
+    const options_t *opts = (const options_t *)context;
+    switch (rec->type) {
+        case SERIAL_RECORD_TEXT:
+            fwrite(rec->payload, 1, rec->len, opts->out);
+            fputs("\n", opts->out);
+            break;
+        case SERIAL_RECORD_FRAME: {
+            log_record_t frame;
+            if (log_record_decode(rec->payload, rec->len, &frame) != rec->len)
+                break;
+            fputs("Frame: ", opts->out);
+            fputs(log_record_to_string(&frame, opts->extra), opts->out);
+            fputs("\n", opts->out);
+            break;
+        }
+        default:
+            break;
+    }
+    fflush(opts->out);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-x] [-s] [file]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {false, stdout};
+    bool summary = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "xsh")) != -1) {
+        switch (opt) {
+            case 'x':
+                opts.extra = true;
+                break;
+            case 's':
+                summary = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind < argc - 1)
+        usage(argv[0]);
+
+    FILE *in = stdin;
+    if (optind == argc - 1 && !(in = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    SerialRecordReader reader(print_record, &opts);
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = read(fileno(in), buf, sizeof(buf))) > 0)
+        reader.add(buf, n);
+
+    if (in != stdin)
+        fclose(in);
+
+    if (summary)
+        fprintf(stderr, "%u records, %u bad frames, %u records lost\n", reader.stats().records, reader.stats().bad,
+                reader.stats().lost);
+
+    return EXIT_SUCCESS;
+}
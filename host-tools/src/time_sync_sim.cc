@@ -0,0 +1,246 @@
+/*
+  Compare sending the leaf nodes the time after every uplink with
+  sending it only when a node's clock is off (TimeSync.h): how many
+  downlinks each takes, their airtime and how far off the nodes' clocks
+  get.
+
+  time_sync_sim [-n nodes] [-u uplink_s] [-d days] [-p drift_ppm]
+                [-t daily_ppm] [-l loss_percent] [-b bound_s] [-s seed]
+
+  -n  leaf nodes (default 16)
+  -u  seconds between a node's uplinks (default 300)
+  -d  days to simulate (default 7)
+  -p  each node's crystal is off by up to this, in ppm (default 40)
+  -t  and swings by up to this over the day with the temperature
+      (default 10)
+  -l  percent of downlinks lost; a lost reply is sent again up to
+      REPLY_RETRIES times, as OutboundEngine does (default 5)
+  -b  TimeSync's bound, seconds (default TIME_SYNC_MAX_ERROR_S)
+  -s  random number seed (default 1)
+
+  The main node's clock is taken as the truth. A node puts its clock,
+  in whole seconds, in each data packet; the main node reads its own
+  clock, in whole seconds, when the packet arrives; a node that gets the
+  time sets its clock to it when the reply arrives. Both policies see
+  the same nodes, drift and losses.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "LoRaAirtime.h"
+#include "TimeSync.h"
+
+#define START_TIME 1615909112.0
+
+// The main node's radio settings; see main-node.cc
+#define SPREADING_FACTOR 10
+#define BANDWIDTH 125000
+#define CODING_RATE 5
+
+#define DATA_PACKET_LEN 20
+#define TIME_REPLY_LEN 4            // the bare unixtime send_time_as_reply() sends
+#define REPLY_RETRIES 3
+#define REPLY_TIMEOUT_S 0.4
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n nodes] [-u uplink_s] [-d days] [-p drift_ppm] [-t daily_ppm] [-l loss_percent] "
+                    "[-b bound_s] [-s seed]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double airtime_s(int len) {
+    return lora_airtime_us(lora_settings(SPREADING_FACTOR, BANDWIDTH, CODING_RATE), len + LORA_RH_HEADER_LEN) / 1e6;
+}
+
+struct leaf_t {
+    double ppm;             // the crystal's constant error
+    double phase;           // of the daily swing
+    double start;           // when the node first sends
+    double clock_error;     // the node's clock minus the truth, s, at 'at'
+    double at;
+};
+
+struct result_t {
+    uint64_t uplinks;
+    uint64_t replies;       // times a node was sent the time
+    uint64_t transmissions; // including resends of lost replies
+    uint64_t lost;          // replies that never arrived
+    std::vector<double> errors;     // |clock error| at each uplink
+};
+
+struct options_t {
+    int nodes;
+    double uplink_s;
+    double days;
+    double drift_ppm;
+    double daily_ppm;
+    double loss_percent;
+    int bound_s;
+    unsigned seed;
+};
+
+// The node's clock error at time t: its drift integrated since 'at'
+static double advance(leaf_t &leaf, double t, double daily_ppm) {
+    // Integral of ppm + daily_ppm * sin(2 pi t / day + phase)
+    const double day = 86400.0;
+    double w = 2 * M_PI / day;
+    double swing = daily_ppm * (cos(w * leaf.at + leaf.phase) - cos(w * t + leaf.phase)) / w;
+    leaf.clock_error += (leaf.ppm * (t - leaf.at) + swing) * 1e-6;
+    leaf.at = t;
+    return leaf.clock_error;
+}
+
+static result_t run(const options_t &opts, bool every_uplink) {
+    std::mt19937 rng(opts.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<leaf_t> leaves(opts.nodes);
+    for (int i = 0; i < opts.nodes; ++i) {
+        leaf_t &leaf = leaves[i];
+        leaf.ppm = (2 * uniform(rng) - 1) * opts.drift_ppm;
+        leaf.phase = 2 * M_PI * uniform(rng);
+        leaf.start = START_TIME + uniform(rng) * opts.uplink_s;
+        leaf.clock_error = 0.0;
+        leaf.at = leaf.start;
+    }
+
+    NodeRegistry<254> nodes;
+    TimeSync sync(opts.bound_s);
+    result_t r = result_t();
+
+    double end = START_TIME + opts.days * 86400.0;
+    double uplink_air = airtime_s(DATA_PACKET_LEN);
+    double reply_air = airtime_s(TIME_REPLY_LEN);
+
+    // The nodes all send every uplink_s, each from its own start
+    for (double round = 0; START_TIME + round * opts.uplink_s < end; ++round) {
+        for (int i = 0; i < opts.nodes; ++i) {
+            leaf_t &leaf = leaves[i];
+            double sent = leaf.start + round * opts.uplink_s;
+            double error = advance(leaf, sent, opts.daily_ppm);
+            ++r.uplinks;
+            r.errors.push_back(fabs(error));
+
+            double rx = sent + uplink_air;
+            uint32_t node_time = (uint32_t)floor(sent + error);
+            uint32_t now = (uint32_t)floor(rx);
+            uint8_t address = i + 1;
+            node_state_t *node = nodes.saw_frame(address, now, -80, 5);
+
+            bool send = every_uplink || sync.check(*node, node_time, now, (uint32_t)opts.uplink_s);
+            if (!send)
+                continue;
+
+            ++r.replies;
+            double at = rx + 0.005;         // the main node's turnaround
+            bool delivered = false;
+            for (int attempt = 0; attempt <= REPLY_RETRIES && !delivered; ++attempt) {
+                ++r.transmissions;
+                delivered = uniform(rng) * 100.0 >= opts.loss_percent;
+                if (!delivered)
+                    at += reply_air + REPLY_TIMEOUT_S;
+            }
+            if (!delivered) {
+                ++r.lost;
+                continue;
+            }
+
+            // The node sets its clock to the whole seconds in the reply
+            double arrived = at + reply_air;
+            advance(leaf, arrived, opts.daily_ppm);
+            leaf.clock_error = now - arrived;
+            if (!every_uplink)
+                sync.set(*node, now);
+        }
+    }
+
+    return r;
+}
+
+static void print_result(const char *name, const options_t &opts, result_t &r) {
+    std::sort(r.errors.begin(), r.errors.end());
+    double sum = 0;
+    for (size_t i = 0; i < r.errors.size(); ++i)
+        sum += r.errors[i];
+    double p95 = r.errors.empty() ? 0 : r.errors[(size_t)(0.95 * (r.errors.size() - 1))];
+    double max = r.errors.empty() ? 0 : r.errors.back();
+    double node_days = opts.nodes * opts.days;
+
+    printf("%-14s %9llu %9llu %8llu %6llu %12.1f %10.3f %8.3f %8.3f\n", name, (unsigned long long)r.uplinks,
+           (unsigned long long)r.replies, (unsigned long long)r.transmissions, (unsigned long long)r.lost,
+           r.transmissions * airtime_s(TIME_REPLY_LEN) / node_days, r.errors.empty() ? 0 : sum / r.errors.size(),
+           p95, max);
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts;
+    opts.nodes = 16;
+    opts.uplink_s = 300;
+    opts.days = 7;
+    opts.drift_ppm = 40;
+    opts.daily_ppm = 10;
+    opts.loss_percent = 5;
+    opts.bound_s = TIME_SYNC_MAX_ERROR_S;
+    opts.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:d:p:t:l:b:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                opts.nodes = atoi(optarg);
+                break;
+            case 'u':
+                opts.uplink_s = atof(optarg);
+                break;
+            case 'd':
+                opts.days = atof(optarg);
+                break;
+            case 'p':
+                opts.drift_ppm = atof(optarg);
+                break;
+            case 't':
+                opts.daily_ppm = atof(optarg);
+                break;
+            case 'l':
+                opts.loss_percent = atof(optarg);
+                break;
+            case 'b':
+                opts.bound_s = atoi(optarg);
+                break;
+            case 's':
+                opts.seed = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || opts.nodes < 1 || opts.nodes > 254 || opts.uplink_s < 1 || opts.bound_s < 1)
+        usage(argv[0]);
+
+    printf("%d nodes, an uplink every %.0f s for %.1f days, drift up to %.0f +/- %.0f ppm, %.1f%% of downlinks "
+           "lost\n", opts.nodes, opts.uplink_s, opts.days, opts.drift_ppm, opts.daily_ppm, opts.loss_percent);
+    printf("A time reply is %.1f ms of airtime at SF%d\n\n", 1e3 * airtime_s(TIME_REPLY_LEN), SPREADING_FACTOR);
+    printf("%-14s %9s %9s %8s %6s %12s %10s %8s %8s\n", "Policy", "Uplinks", "Replies", "Sent", "Lost",
+           "Air s/node/d", "Err mean s", "p95 s", "max s");
+
+    result_t every = run(opts, true);
+    print_result("every uplink", opts, every);
+
+    char name[32];
+    snprintf(name, sizeof(name), "bound %d s", opts.bound_s);
+    result_t bounded = run(opts, false);
+    print_result(name, opts, bounded);
+
+    if (bounded.transmissions)
+        printf("\n%.0fx less downlink airtime\n", (double)every.transmissions / bounded.transmissions);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#ifndef ArduinoSpiBus_h
+#define ArduinoSpiBus_h
+
+#include <SPI.h>
+
+#include "SpiArbiter.h"
+
+/**
+ * @brief The main node's SPI bus: the RF95, the SD card and the ST7735.
+ *
+ * begin() deselects the other devices, masks the radio's interrupt when
+ * the bus goes to the SD card or the TFT and starts a transaction with
+ * that device's SPISettings. SdFat and Adafruit_SPITFT start their own
+ * (nested) transactions inside it, so the settings here should match the
+ * ones those libraries use.
+ *
+ * On the SAMD21 the radio's interrupt is held off by disabling the EIC
+ * in the NVIC, not with noInterrupts(): SysTick (millis()) and USB keep
+ * running, and an edge on DIO0 stays pending in the EIC until end(). The
+ * SPI library's usingInterrupt() masking can't be used for this because
+ * the libraries' nested endTransaction() would unmask the radio early.
+ * Elsewhere (the ESP8266, the sim) all interrupts are turned off.
+ */
+class ArduinoSpiBus : public SpiBus {
+    uint8_t d_cs[spi_device_count];
+    SPISettings d_settings[spi_device_count];
+
+    void mask_radio();
+    void unmask_radio();
+
+public:
+    ArduinoSpiBus(uint8_t radio_cs, uint8_t sd_cs, uint8_t tft_cs);
+
+    void set_settings(SpiDevice device, const SPISettings &settings) { d_settings[device] = settings; }
+
+    void begin(SpiDevice device) override;
+    void end(SpiDevice device) override;
+    uint32_t now_us() override;
+};
+
+// The arbiter for the bus; defined in main-node.cc
+extern SpiArbiter spi_arbiter;
+
+/**
+ * @brief Critical section type (static lock()/unlock()) that holds the bus
+ * for one device. Used by SDLogger and TFTLogView.
+ */
+template <SpiDevice DEVICE>
+struct SpiHold {
+    static void lock() { spi_arbiter.acquire(DEVICE); }
+    static void unlock() { spi_arbiter.release(DEVICE); }
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef AsyncReliableDatagram_h
+#define AsyncReliableDatagram_h
+
+#include <RHReliableDatagram.h>
+
+#include "OutboundEngine.h"
+
+/**
+ * @brief RHReliableDatagram that does not block when sending.
+ *
+ * Frames are sent by an OutboundEngine using start_send()/send_done().
+ * recvfromAckAsync() replaces recvfromAck(): it ACKs and de-duplicates
+ * incoming messages the same way, but it passes the ACKs it receives to
+ * the engine instead of discarding them.
+ */
+class AsyncReliableDatagram : public RHReliableDatagram, public OutboundTransport {
+    OutboundEngine *d_engine;
+    uint8_t d_seen_ids[256];
+
+public:
+    AsyncReliableDatagram(RHGenericDriver &driver, uint8_t this_address = 0);
+
+    void set_engine(OutboundEngine *engine) { d_engine = engine; }
+
+    bool start_send(uint8_t to, uint8_t id, const uint8_t *buf, uint8_t len, bool retry) override;
+    bool send_done() override;
+
+    bool recvfromAckAsync(uint8_t *buf, uint8_t *len, uint8_t *from = NULL, uint8_t *to = NULL,
+                          uint8_t *id = NULL, uint8_t *flags = NULL);
+};
+
+#endif
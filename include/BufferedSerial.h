@@ -0,0 +1,36 @@
+#ifndef BufferedSerial_h
+#define BufferedSerial_h
+
+#include <Arduino.h>
+
+#include "SerialOut.h"
+
+/**
+ * @brief A Print that stages its output in a SerialOut.
+ *
+ * print() and println() format as usual but return as soon as the text
+ * is in RAM; loop() calls service() to send it. On the M0 the port is
+ * the USB serial port. Its availableForWrite() is always one packet, so
+ * each service() call sends at most one packet; if the host is not
+ * reading, the first packet waits out the core's 70 ms timeout and the
+ * ones after it fail at once, and the lines that do not fit are dropped
+ * and counted.
+ *
+ * @tparam Port The serial port type
+ */
+template <class Port>
+class BufferedSerial : public Print {
+    SerialOut<Port> d_out;
+
+public:
+    BufferedSerial(Port &port, SerialMode mode = serial_text) : d_out(port, mode) {}
+
+    size_t write(uint8_t c) override { return d_out.write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override { return d_out.write(buf, len); }
+
+    SerialOut<Port> &out() { return d_out; }
+
+    uint16_t service() { return d_out.service(); }
+};
+
+#endif
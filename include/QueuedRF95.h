@@ -0,0 +1,57 @@
+#ifndef QueuedRF95_h
+#define QueuedRF95_h
+
+#include <RH_RF95.h>
+
+#include "RxQueue.h"
+#include "SpiArbiter.h"
+
+/**
+ * @brief RH_RF95 that queues received frames from its interrupt handler.
+ *
+ * The DIO0 interrupt runs RH_RF95's own handler and then, if that left a
+ * good frame in the driver's buffer, moves the frame to an RxQueue and
+ * puts the radio back in receive mode. After a transmission ends, the
+ * radio also goes straight back to receive mode.
+ *
+ * available() and recv() work from the queue, so RHDatagram and the
+ * layers above it are unchanged. lastRssi(), lastSNR() and last_rx_ms()
+ * describe the frame recv() most recently returned, not the last one the
+ * radio heard.
+ *
+ * If an SpiArbiter is set, the interrupt handler's time on the bus is
+ * recorded with it.
+ */
+class QueuedRF95 : public RH_RF95 {
+    uint8_t d_interrupt_pin;
+    RxQueue<> d_queue;
+    SpiArbiter *d_arbiter;
+
+    int16_t d_rssi;
+    int8_t d_snr;
+    uint32_t d_rx_ms;
+
+    static QueuedRF95 *s_instance;
+    static void isr();
+
+    void on_interrupt();
+
+public:
+    QueuedRF95(uint8_t slave_select_pin, uint8_t interrupt_pin);
+
+    void set_arbiter(SpiArbiter *arbiter) { d_arbiter = arbiter; }
+
+    bool init() override;
+    bool available() override;
+    bool recv(uint8_t *buf, uint8_t *len) override;
+
+    int16_t lastRssi() const { return d_rssi; }
+    int lastSNR() const { return d_snr; }
+
+    /// @return millis() when the frame recv() last returned was received
+    uint32_t last_rx_ms() const { return d_rx_ms; }
+
+    const RxQueue<> &queue() const { return d_queue; }
+};
+
+#endif
@@ -2,12 +2,24 @@
 #ifndef TFTDisplay_h
 #define TFTDisplay_h
 
-#include "data_packet.h"
+#include "TextLines.h"
 
-#define DATA_LINE_CHARS 161
+// The display's chip select; main-node.cc needs it for the SPI bus
+#define TFT_CS 6
 
-void tft_setup();
+class Print;
+
+// 'out' is where the setup messages go
+void tft_setup(Print &out);
 void tft_display_data_packet(const char text[DATA_LINE_CHARS]);
-void tft_get_data_line(const packet_t *data, unsigned int, unsigned int, char text[DATA_LINE_CHARS]);
+bool tft_refresh();
+
+// The node grid (TFTNodeGrid.h)
+void tft_node_heard(uint8_t node, uint32_t when, int16_t rssi);
+void tft_node_reading(uint8_t node, int16_t temp, uint16_t humidity, uint16_t battery);
+void tft_tick(uint32_t now);
+
+void tft_show_grid(bool grid);
+bool tft_showing_grid();
 
 #endif
@@ -0,0 +1,169 @@
+/*
+  Batches of readings; see BatchMessage.h.
+*/
+
+#include <string.h>
+
+#include "BatchMessage.h"
+#include "data_packet.h"
+
+namespace {
+
+// Writes bytes into a buffer; any write past the end sets 'full'
+struct Writer {
+    uint8_t *p;
+    uint8_t *end;
+    bool full;
+
+    void byte(uint8_t b) {
+        if (p < end)
+            *p++ = b;
+        else
+            full = true;
+    }
+
+    void u16(uint16_t v) {
+        byte(v);
+        byte(v >> 8);
+    }
+
+    void u32(uint32_t v) {
+        u16(v);
+        u16(v >> 16);
+    }
+
+    void varint(uint32_t v) {
+        while (v >= 0x80) {
+            byte(v | 0x80);
+            v >>= 7;
+        }
+        byte(v);
+    }
+
+    // Zigzag: 0, -1, 1, -2 ... become 0, 1, 2, 3 ...
+    void zigzag(int32_t v) { varint(((uint32_t)v << 1) ^ (uint32_t)(v >> 31)); }
+};
+
+// Reads bytes from a buffer; any read past the end sets 'short_read'
+struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool short_read;
+
+    uint8_t byte() {
+        if (p < end)
+            return *p++;
+        short_read = true;
+        return 0;
+    }
+
+    uint16_t u16() {
+        uint16_t v = byte();
+        return v | (uint16_t)byte() << 8;
+    }
+
+    uint32_t u32() {
+        uint32_t v = u16();
+        return v | (uint32_t)u16() << 16;
+    }
+
+    uint32_t varint() {
+        uint32_t v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            uint8_t b = byte();
+            v |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        short_read = true;     // more than five bytes
+        return 0;
+    }
+
+    int32_t zigzag() {
+        uint32_t v = varint();
+        return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+};
+
+} // namespace
+
+static_assert(BATCH_HEADER_SIZE + 10 > sizeof(packet_t), "A batch must not be mistaken for a packet_t");
+
+uint8_t encode_batch(uint8_t node, uint32_t now, const batch_reading_t *readings, uint8_t count, uint8_t *buf,
+                     uint8_t max_len) {
+    if (count == 0 || count > BATCH_MAX_READINGS || max_len > BATCH_MAX_SIZE || now < readings[count - 1].time)
+        return 0;
+    for (uint8_t i = 1; i < count; ++i) {
+        if (readings[i].message != readings[0].message + i || readings[i].time < readings[i - 1].time)
+            return 0;
+    }
+
+    Writer w = {buf, buf + max_len, false};
+    w.byte(BATCH_MESSAGE_TYPE);
+    w.byte(node);
+    w.byte(count);
+    w.u32(readings[0].message);
+    w.u32(now);
+
+    const batch_reading_t &first = readings[0];
+    w.varint(now - first.time);
+    w.u16(first.battery);
+    w.u16(first.last_tx_duration);
+    w.u16(first.temp);
+    w.u16(first.humidity);
+    w.byte(first.status);
+
+    for (uint8_t i = 1; i < count; ++i) {
+        const batch_reading_t &r = readings[i];
+        const batch_reading_t &prev = readings[i - 1];
+        w.varint(r.time - prev.time);
+        w.zigzag((int32_t)r.battery - prev.battery);
+        w.zigzag((int32_t)r.last_tx_duration - prev.last_tx_duration);
+        w.zigzag((int32_t)r.temp - prev.temp);
+        w.zigzag((int32_t)r.humidity - prev.humidity);
+        w.byte(r.status);
+    }
+
+    return w.full ? 0 : w.p - buf;
+}
+
+bool is_batch_message(const uint8_t *buf, uint8_t len) {
+    return len >= BATCH_HEADER_SIZE && buf[0] == BATCH_MESSAGE_TYPE;
+}
+
+bool decode_batch(const uint8_t *buf, uint8_t len, uint8_t *node, uint32_t *now, batch_reading_t *readings,
+                  uint8_t *count) {
+    if (!is_batch_message(buf, len))
+        return false;
+
+    Reader r = {buf + 1, buf + len, false};
+    *node = r.byte();
+    *count = r.byte();
+    uint32_t message = r.u32();
+    *now = r.u32();
+    if (*count == 0 || *count > BATCH_MAX_READINGS)
+        return false;
+
+    batch_reading_t &first = readings[0];
+    first.message = message;
+    first.time = *now - r.varint();
+    first.battery = r.u16();
+    first.last_tx_duration = r.u16();
+    first.temp = (int16_t)r.u16();
+    first.humidity = r.u16();
+    first.status = r.byte();
+
+    for (uint8_t i = 1; i < *count; ++i) {
+        batch_reading_t &b = readings[i];
+        const batch_reading_t &prev = readings[i - 1];
+        b.message = message + i;
+        b.time = prev.time + r.varint();
+        b.battery = prev.battery + r.zigzag();
+        b.last_tx_duration = prev.last_tx_duration + r.zigzag();
+        b.temp = prev.temp + r.zigzag();
+        b.humidity = prev.humidity + r.zigzag();
+        b.status = r.byte();
+    }
+
+    return !r.short_read && r.p == r.end;
+}
@@ -0,0 +1,90 @@
+/*
+  Several readings from one leaf node in one frame.
+
+  At SF10/125kHz a 20-byte packet_t is about 330 ms on air and most of
+  that is the preamble, header and coding of what is a few bytes of
+  news: successive readings differ by a few counts. A batch carries up
+  to BATCH_MAX_READINGS readings with consecutive message numbers, the
+  first in full and the rest as differences from the one before:
+
+    header:     type (1) node (1) count (1) first message (4) time (4)
+    reading 0:  age (v) battery (2) tx duration (2) temp (2)
+                humidity (2) status (1)
+    reading i:  time step (v) battery (z) tx duration (z) temp (z)
+                humidity (z) status (1)
+
+  'time' is the node's clock when it sent the batch and 'age' is how
+  long before that reading 0 was taken; the readings are oldest first.
+  (v) is an unsigned LEB128 varint, (z) a zigzag-encoded signed varint
+  of the difference from the reading before, and the rest is
+  little-endian. The shortest batch, 21 bytes, is longer than a
+  packet_t, which matters because the main node takes any frame of
+  sizeof(packet_t) bytes for a legacy packet_t.
+
+  This message type belongs in soil_sensor_common's messages.h, next to
+  data_message_t, and should move there; it lives here until the leaf
+  node code that sends it does.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef BatchMessage_h
+#define BatchMessage_h
+
+#include <stdint.h>
+
+// The first byte of a batch. It is well clear of the MessageType values
+// soil_sensor_common uses for its first byte.
+#define BATCH_MESSAGE_TYPE 0x80
+
+#define BATCH_HEADER_SIZE 11
+#define BATCH_MAX_READINGS 32
+#define BATCH_MAX_SIZE 251          // RH_RF95_MAX_MESSAGE_LEN; see RX_FRAME_MAX_LEN
+
+/**
+ * @brief One reading: the fields of a packet_t other than the node.
+ */
+struct batch_reading_t {
+    uint32_t message;
+    uint32_t time;
+    uint16_t battery;
+    uint16_t last_tx_duration;
+    int16_t temp;
+    uint16_t humidity;
+    uint8_t status;
+};
+
+/**
+ * @brief Encode readings as a batch.
+ * @param node The leaf node's address
+ * @param now The node's time as it sends the batch; not before the last reading
+ * @param readings The readings, oldest first, with consecutive message
+ * numbers and times that do not go back
+ * @param count 1 to BATCH_MAX_READINGS
+ * @param buf Where to put the batch
+ * @param max_len The size of 'buf', at most BATCH_MAX_SIZE
+ * @return The batch's length, or 0 if the readings are not as above or
+ * the batch would not fit
+ */
+uint8_t encode_batch(uint8_t node, uint32_t now, const batch_reading_t *readings, uint8_t count, uint8_t *buf,
+                     uint8_t max_len);
+
+/**
+ * @brief Is this frame a batch? Only the first byte is looked at.
+ */
+bool is_batch_message(const uint8_t *buf, uint8_t len);
+
+/**
+ * @brief Decode a batch.
+ * @param buf The frame
+ * @param len Its length
+ * @param node Value-result: the leaf node's address
+ * @param now Value-result: the node's time when it sent the batch
+ * @param readings At least BATCH_MAX_READINGS entries
+ * @param count Value-result: the number of readings
+ * @return False if the frame is not a well-formed batch
+ */
+bool decode_batch(const uint8_t *buf, uint8_t len, uint8_t *node, uint32_t *now, batch_reading_t *readings,
+                  uint8_t *count);
+
+#endif
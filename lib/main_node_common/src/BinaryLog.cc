@@ -0,0 +1,148 @@
+/*
+  Binary on-card log format. See BinaryLog.h
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "BinaryLog.h"
+#include "CRC32.h"
+
+/**
+ * @brief Build a log record for a received frame.
+ * @param rec Value-result parameter for the record
+ * @param rx_time When the frame was received (unixtime)
+ * @param rssi RSSI of the frame
+ * @param snr SNR of the frame
+ * @param type The frame's MessageType
+ * @param from The RadioHead 'from' header
+ * @param frame The frame as received
+ * @param len Length of the frame; only LOG_RECORD_MAX_PAYLOAD bytes are kept
+ */
+void build_log_record(log_record_t *rec, uint32_t rx_time, int16_t rssi, int8_t snr, uint8_t type, uint8_t from,
+                      const void *frame, uint8_t len) {
+    memset(rec, 0, LOG_RECORD_HEADER_SIZE);
+    rec->rx_time = rx_time;
+    rec->rssi = rssi;
+    rec->snr = snr;
+    rec->type = type;
+    rec->from = from;
+    if (len > LOG_RECORD_MAX_PAYLOAD) {
+        len = LOG_RECORD_MAX_PAYLOAD;
+        rec->flags |= LOG_RECORD_TRUNCATED;
+    }
+    rec->len = len;
+    memcpy(rec->payload, frame, len);
+}
+
+/**
+ * @brief Write a record in its file (and serial) form.
+ * @param out At least log_record_size(rec) bytes
+ * @return The number of bytes written
+ */
+size_t log_record_encode(const log_record_t *rec, uint8_t *out) {
+    size_t n = log_record_size(rec);
+    memcpy(out, rec, n);
+    return n;
+}
+
+/**
+ * @brief Read a record in its file (and serial) form.
+ * @param in The record
+ * @param len The bytes available at 'in'
+ * @param rec Value-result parameter for the record
+ * @return The number of bytes the record took, or 0 if 'len' is too
+ * short to hold it or its length is more than LOG_RECORD_MAX_PAYLOAD
+ */
+size_t log_record_decode(const uint8_t *in, size_t len, log_record_t *rec) {
+    if (len < LOG_RECORD_HEADER_SIZE)
+        return 0;
+    uint8_t payload = in[offsetof(log_record_t, len)];
+    if (payload > LOG_RECORD_MAX_PAYLOAD || len < (size_t)LOG_RECORD_HEADER_SIZE + payload)
+        return 0;
+    memcpy(rec, in, LOG_RECORD_HEADER_SIZE + payload);
+    return LOG_RECORD_HEADER_SIZE + payload;
+}
+
+/**
+ * @brief The CRC-32 of a block, computed with its crc field as zero.
+ */
+uint32_t log_block_crc(const log_block_t *block) {
+    const uint8_t *bytes = (const uint8_t *)block;
+    const size_t crc_offset = offsetof(log_block_t, crc);
+    const uint32_t zero = 0;
+
+    uint32_t crc = crc32_update(0, bytes, crc_offset);
+    crc = crc32_update(crc, &zero, sizeof(zero));
+    return crc32_update(crc, bytes + crc_offset + sizeof(zero), LOG_BLOCK_SIZE - crc_offset - sizeof(zero));
+}
+
+// Check that 'count' records fit in the block
+static bool records_fit(const log_block_t *block) {
+    if (block->version == 1)
+        return block->record_size == LOG_V1_RECORD_SIZE && block->count <= LOG_V1_RECORDS_PER_BLOCK;
+
+    if (block->record_size != LOG_RECORD_HEADER_SIZE)
+        return false;
+    size_t used = 0;
+    for (uint8_t i = 0; i < block->count; ++i) {
+        if (LOG_BLOCK_DATA - used < LOG_RECORD_HEADER_SIZE)
+            return false;
+        used += LOG_RECORD_HEADER_SIZE + block->records[used + offsetof(log_record_t, len)];
+        if (used > LOG_BLOCK_DATA)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Is this a good block?
+ * @return True if the magic number, version, record size and CRC are
+ * all OK and the records fit in the block.
+ */
+bool verify_log_block(const log_block_t *block) {
+    return block->magic == LOG_BLOCK_MAGIC && (block->version == 1 || block->version == LOG_FORMAT_VERSION) &&
+           block->crc == log_block_crc(block) && records_fit(block);
+}
+
+BinaryLogEncoder::BinaryLogEncoder(uint32_t sequence) : d_sequence(sequence), d_first_ms(0) {
+    reset();
+}
+
+/**
+ * @brief Add a record to the current block
+ * @return False if there is not room for it
+ */
+bool BinaryLogEncoder::add(const log_record_t *rec, uint32_t now_ms) {
+    if (log_record_size(rec) > (size_t)(LOG_BLOCK_DATA - d_used))
+        return false;
+
+    if (empty())
+        d_first_ms = now_ms;
+
+    d_used += log_record_encode(rec, d_block.records + d_used);
+    ++d_block.count;
+    return true;
+}
+
+/**
+ * @brief Fill in the block's header and CRC.
+ * @note Each call uses the next sequence number.
+ * @return The block, ready to write. It stays valid until reset().
+ */
+const log_block_t *BinaryLogEncoder::finish() {
+    d_block.sequence = d_sequence++;
+    d_block.crc = log_block_crc(&d_block);
+    return &d_block;
+}
+
+/**
+ * @brief Start the next block.
+ */
+void BinaryLogEncoder::reset() {
+    memset(&d_block, 0, sizeof(d_block));
+    d_block.magic = LOG_BLOCK_MAGIC;
+    d_block.version = LOG_FORMAT_VERSION;
+    d_block.record_size = LOG_RECORD_HEADER_SIZE;
+    d_used = 0;
+}
@@ -0,0 +1,125 @@
+/*
+  Binary on-card log format.
+
+  The file is a sequence of 512-byte blocks, one per SD card sector.
+  Each block has a 16-byte header and then as many records as fit,
+  packed one after the other. A record holds what the radio delivered
+  (the message, whole) plus the receive time, RSSI and SNR, so the
+  decoder can reproduce the text log and more. A record is as long as
+  its message: a data packet's is 31 bytes and a block holds 16 of them.
+
+  All values are little-endian, which is what both the M0 and the hosts
+  we decode on use.
+
+  block:  magic (4) version (1) record header size (1) count (1)
+          reserved (1) sequence (4) crc32 (4) records zero fill
+  record: rx time (4) rssi (2) snr (1) type (1) from (1) length (1)
+          flags (1) payload (length)
+
+  The CRC covers the whole block with the crc32 field taken as zero.
+
+  A record on its own, in the same form, is the payload of the serial
+  port's 'F' record (SerialRecord.h). Messages longer than
+  LOG_RECORD_MAX_PAYLOAD, which only a raw text frame can be, are cut
+  short and flagged.
+
+  Version 1 blocks held fixed, 32-byte records with the same header
+  and the payload cut to 21 bytes; the decoder still reads them.
+*/
+
+#ifndef BinaryLog_h
+#define BinaryLog_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_BLOCK_SIZE 512
+#define LOG_BLOCK_MAGIC 0x4c545348  // "HSTL"
+#define LOG_FORMAT_VERSION 2
+
+#define LOG_BLOCK_HEADER_SIZE 16
+#define LOG_BLOCK_DATA (LOG_BLOCK_SIZE - LOG_BLOCK_HEADER_SIZE)
+
+#define LOG_RECORD_HEADER_SIZE 11
+#define LOG_RECORD_MAX_PAYLOAD 239  // with the header, SERIAL_RECORD_MAX_PAYLOAD
+#define LOG_RECORD_MAX_SIZE (LOG_RECORD_HEADER_SIZE + LOG_RECORD_MAX_PAYLOAD)
+
+// A block is full() once less room than this is left; about the size of
+// a data packet's or data message's record
+#define LOG_BLOCK_MIN_ROOM 32
+
+#define LOG_V1_RECORD_SIZE 32       // version 1 records
+#define LOG_V1_RECORDS_PER_BLOCK 15
+
+#define LOG_RECORD_TRUNCATED 0x01   // flags: the frame was longer than LOG_RECORD_MAX_PAYLOAD
+
+struct log_record_t {
+    uint32_t rx_time;   // unixtime
+    int16_t rssi;       // dBm
+    int8_t snr;         // dB
+    uint8_t type;       // MessageType
+    uint8_t from;       // RadioHead 'from' header
+    uint8_t len;        // bytes of payload used
+    uint8_t flags;
+    uint8_t payload[LOG_RECORD_MAX_PAYLOAD];
+};
+
+struct log_block_t {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t record_size;    // LOG_RECORD_HEADER_SIZE; LOG_V1_RECORD_SIZE in version 1
+    uint8_t count;
+    uint8_t reserved;
+    uint32_t sequence;
+    uint32_t crc;
+    uint8_t records[LOG_BLOCK_DATA];
+};
+
+static_assert(offsetof(log_record_t, payload) == LOG_RECORD_HEADER_SIZE,
+              "log_record_t's header must be laid out as it is in the file");
+static_assert(sizeof(log_block_t) == LOG_BLOCK_SIZE, "log_block_t must be LOG_BLOCK_SIZE bytes");
+
+void build_log_record(log_record_t *rec, uint32_t rx_time, int16_t rssi, int8_t snr, uint8_t type, uint8_t from,
+                      const void *frame, uint8_t len);
+
+/// @return The bytes the record takes in a block or a serial record
+inline size_t log_record_size(const log_record_t *rec) { return LOG_RECORD_HEADER_SIZE + rec->len; }
+
+size_t log_record_encode(const log_record_t *rec, uint8_t *out);
+size_t log_record_decode(const uint8_t *in, size_t len, log_record_t *rec);
+
+uint32_t log_block_crc(const log_block_t *block);
+bool verify_log_block(const log_block_t *block);
+
+/**
+ * @brief Fill 512-byte blocks with records.
+ *
+ * add() records until one does not fit or full() (or until the caller
+ * wants the data on the card), then finish() the block, write it and
+ * reset().
+ */
+class BinaryLogEncoder {
+    log_block_t d_block;
+    uint16_t d_used;        // bytes of d_block.records
+    uint32_t d_sequence;
+    uint32_t d_first_ms;    // when the first record in this block was added
+
+public:
+    BinaryLogEncoder(uint32_t sequence = 0);
+
+    void set_sequence(uint32_t sequence) { d_sequence = sequence; }
+
+    bool add(const log_record_t *rec, uint32_t now_ms);
+    const log_block_t *finish();
+    void reset();
+
+    bool empty() const { return d_block.count == 0; }
+    bool full() const { return LOG_BLOCK_DATA - d_used < LOG_BLOCK_MIN_ROOM; }
+
+    /// @return True if the block has records older than 'interval_ms'
+    bool due(uint32_t now_ms, uint32_t interval_ms) const {
+        return !empty() && now_ms - d_first_ms >= interval_ms;
+    }
+};
+
+#endif
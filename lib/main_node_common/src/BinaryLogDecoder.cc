@@ -0,0 +1,105 @@
+/*
+  Decode the binary log. This is used by the host-side decoder, but it
+  builds for the M0 too.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BinaryLogDecoder.h"
+#include "messages.h"
+
+/**
+ * @brief Pass every record in a run of blocks to a callback.
+ *
+ * Blocks that fail verify_log_block() are counted and skipped, so a torn
+ * write costs one block, not the rest of the file.
+ *
+ * @param data The blocks
+ * @param len Length of 'data'; a trailing partial block is ignored
+ * @param callback Called once per record, in order
+ * @param context Passed to the callback
+ * @param stats Value-result parameter; counts are added to it
+ * @return The number of bytes consumed, a multiple of LOG_BLOCK_SIZE
+ */
+size_t decode_log_blocks(const uint8_t *data, size_t len, log_record_callback_t callback, void *context,
+                         log_decode_stats_t *stats) {
+    size_t offset = 0;
+    log_block_t block; // copy so the header is aligned
+    for (; offset + LOG_BLOCK_SIZE <= len; offset += LOG_BLOCK_SIZE) {
+        memcpy(&block, data + offset, LOG_BLOCK_SIZE);
+        if (!verify_log_block(&block)) {
+            ++stats->bad_blocks;
+            continue;
+        }
+
+        if (stats->blocks > 0 && block.sequence != stats->last_sequence + 1)
+            ++stats->sequence_gaps;
+        stats->last_sequence = block.sequence;
+        ++stats->blocks;
+
+        // verify_log_block() checked that the records fit
+        const uint8_t *p = block.records;
+        log_record_t rec;
+        for (uint8_t i = 0; i < block.count; ++i) {
+            size_t n = log_record_decode(p, block.records + LOG_BLOCK_DATA - p, &rec);
+            p += block.version == 1 ? LOG_V1_RECORD_SIZE : n;
+            ++stats->records;
+            callback(&rec, context);
+        }
+    }
+
+    return offset;
+}
+
+/**
+ * @brief Render a record the way log_data() writes it to the text log.
+ *
+ * The record's payload is passed to the same *_to_string() functions
+ * the main node uses, so the output matches Sensor_data.csv.
+ *
+ * @param rec The record
+ * @param extra If true, prefix the line with the receive time, RSSI and SNR
+ * @return A pointer to static storage
+ */
+const char *log_record_to_string(const log_record_t *rec, bool extra) {
+    static char line[256];
+
+    // The *_to_string() functions may read a whole message struct, so
+    // give them a zero-filled, aligned copy of the payload.
+    union {
+        uint8_t bytes[256];
+        uint32_t align;
+    } frame;
+    memset(&frame, 0, sizeof(frame));
+    memcpy(frame.bytes, rec->payload, rec->len);
+
+    const char *csv;
+    switch (rec->type) {
+        case data_packet:
+            csv = data_packet_to_string((packet_t *)frame.bytes, false);
+            break;
+        case data_message:
+            csv = data_message_to_string((data_message_t *)frame.bytes, false);
+            break;
+        case text:
+            csv = text_message_to_string((text_t *)frame.bytes, false);
+            break;
+        case join_request:
+            csv = join_request_to_string((join_request_t *)frame.bytes, false);
+            break;
+        case time_request:
+            csv = time_request_to_string((time_request_t *)frame.bytes, false);
+            break;
+        default:
+            csv = "unrecognized message";
+            break;
+    }
+
+    if (extra)
+        snprintf(line, sizeof(line), "%lu, %d, %d, %s", (unsigned long)rec->rx_time, rec->rssi, rec->snr, csv);
+    else
+        snprintf(line, sizeof(line), "%s", csv);
+
+    return line;
+}
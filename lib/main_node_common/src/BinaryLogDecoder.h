@@ -0,0 +1,24 @@
+#ifndef BinaryLogDecoder_h
+#define BinaryLogDecoder_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BinaryLog.h"
+
+struct log_decode_stats_t {
+    uint32_t blocks;        // good blocks
+    uint32_t bad_blocks;    // bad magic, version or CRC; skipped
+    uint32_t records;
+    uint32_t sequence_gaps; // breaks in the block sequence numbers
+    uint32_t last_sequence;
+};
+
+typedef void (*log_record_callback_t)(const log_record_t *rec, void *context);
+
+size_t decode_log_blocks(const uint8_t *data, size_t len, log_record_callback_t callback, void *context,
+                         log_decode_stats_t *stats);
+
+const char *log_record_to_string(const log_record_t *rec, bool extra);
+
+#endif
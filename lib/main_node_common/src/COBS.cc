@@ -0,0 +1,45 @@
+/*
+  COBS encoding and decoding; see COBS.h.
+*/
+
+#include "COBS.h"
+
+size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_at = 0;     // where the current run's code byte goes
+    size_t o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (in[i] == 0) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = in[i];
+        if (++code == 0xff) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    return o;
+}
+
+size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len)
+            return 0;
+        for (uint8_t k = 1; k < code; ++k) {
+            if (in[i] == 0)
+                return 0;
+            out[o++] = in[i++];
+        }
+        // A run shorter than 254 bytes ends with a zero, except the last
+        if (code != 0xff && i < len)
+            out[o++] = 0;
+    }
+    return o;
+}
@@ -0,0 +1,39 @@
+#ifndef COBS_h
+#define COBS_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Consistent Overhead Byte Stuffing
+ *
+ * The encoded data has no zero bytes, so a zero can mark the end of a
+ * frame in a byte stream and a reader that starts mid-stream (or loses
+ * bytes) finds the next frame at the next zero. The encoding adds one
+ * byte, plus one for every 254 bytes of input.
+ */
+
+/// @return The most bytes cobs_encode() writes for 'len' bytes of input
+#define COBS_MAX_ENCODED(len) ((len) + (len) / 254 + 1)
+
+/**
+ * @brief Encode a frame.
+ * @param in The data
+ * @param len Its length
+ * @param out At least COBS_MAX_ENCODED(len) bytes; the frame delimiter
+ * is not added
+ * @return The number of bytes written to 'out'
+ */
+size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief Decode a frame.
+ * @param in The encoded frame, without the delimiter
+ * @param len Its length
+ * @param out At least 'len' bytes; may be the same as 'in'
+ * @return The number of bytes written to 'out', or 0 if the frame is
+ * not valid COBS (it has a zero, or a code runs past the end)
+ */
+size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef CRC32_h
+#define CRC32_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CRC-32 (IEEE 802.3, the one zlib uses)
+ *
+ * Start with crc = 0 and pass the result of one call as the 'crc' of
+ * the next to checksum data in pieces.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
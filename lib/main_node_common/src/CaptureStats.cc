@@ -0,0 +1,349 @@
+/*
+  Per-node statistics from a capture of the main node's serial output;
+  see CaptureStats.h.
+
+  The lines are parsed by hand, not with sscanf(), because the host tool
+  runs this over multi-gigabyte captures and the lines are not null
+  terminated (they are in a memory-mapped file).
+*/
+
+#include <string.h>
+
+#include "CaptureStats.h"
+
+// A jump in a node's message counter bigger than this is a restart (or a
+// corrupt frame), not that many lost messages
+#define MAX_COUNTER_GAP 1000
+
+static bool starts_with(const char *s, const char *end, const char *prefix, size_t prefix_len) {
+    return (size_t)(end - s) >= prefix_len && memcmp(s, prefix, prefix_len) == 0;
+}
+
+#define STARTS_WITH(s, end, prefix) starts_with((s), (end), (prefix), sizeof(prefix) - 1)
+
+// Return a pointer just past 'needle' in [s, end), or null
+static const char *find_after(const char *s, const char *end, const char *needle, size_t needle_len) {
+    if (needle_len == 0 || (size_t)(end - s) < needle_len)
+        return 0;
+    const char *last = end - needle_len;
+    for (; s <= last; ++s) {
+        if (*s == needle[0] && memcmp(s, needle, needle_len) == 0)
+            return s + needle_len;
+    }
+    return 0;
+}
+
+#define FIND_AFTER(s, end, needle) find_after((s), (end), (needle), sizeof(needle) - 1)
+
+// Parse an optionally signed decimal integer. Return a pointer past it, or null.
+static const char *parse_int(const char *s, const char *end, long *value) {
+    if (!s || s >= end)
+        return 0;
+    bool negative = false;
+    if (*s == '-') {
+        negative = true;
+        ++s;
+    }
+    if (s >= end || *s < '0' || *s > '9')
+        return 0;
+    long v = 0;
+    while (s < end && *s >= '0' && *s <= '9')
+        v = v * 10 + (*s++ - '0');
+    *value = negative ? -v : v;
+    return s;
+}
+
+static const char *parse_hex(const char *s, const char *end, long *value) {
+    if (!s || s >= end)
+        return 0;
+    long v = 0;
+    const char *start = s;
+    for (; s < end; ++s) {
+        char c = *s;
+        if (c >= '0' && c <= '9')
+            v = v * 16 + (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v = v * 16 + (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v = v * 16 + (c - 'A' + 10);
+        else
+            break;
+    }
+    if (s == start)
+        return 0;
+    *value = v;
+    return s;
+}
+
+// The host time, seconds.fraction. Return a pointer past it, or null.
+static const char *parse_time(const char *s, const char *end, double *t) {
+    long whole;
+    s = parse_int(s, end, &whole);
+    if (!s)
+        return 0;
+    double v = whole;
+    if (s < end && *s == '.') {
+        double scale = 0.1;
+        for (++s; s < end && *s >= '0' && *s <= '9'; ++s, scale /= 10)
+            v += (*s - '0') * scale;
+    }
+    *t = v;
+    return s;
+}
+
+static void count(uint32_t *bins, int n, long bin) {
+    if (bin < 0)
+        bin = 0;
+    if (bin >= n)
+        bin = n - 1;
+    ++bins[bin];
+}
+
+static void count_gap(node_link_stats_t &n, double gap) {
+    n.gap_sum += gap;
+    int bin = 0;
+    for (double limit = 1.0; gap >= limit && bin < GAP_BINS - 1; limit *= 2)
+        ++bin;
+    ++n.gaps[bin];
+}
+
+// Classify the step from one message counter value to the next
+static void count_step(node_link_stats_t &n, uint32_t previous, uint32_t message) {
+    if (message == previous + 1)
+        return;
+    if (message == previous)
+        ++n.duplicates;
+    else if (message > previous && message - previous <= MAX_COUNTER_GAP)
+        n.lost += message - previous - 1;
+    else
+        ++n.restarts;
+}
+
+// Add the stats for lines that come after those in 'a' to 'a'
+static void merge_node(node_link_stats_t &a, const node_link_stats_t &b) {
+    if (b.frames) {
+        if (a.frames)
+            count_gap(a, b.first_time - a.last_time);
+        else
+            a.first_time = b.first_time;
+        a.last_time = b.last_time;
+    }
+    a.frames += b.frames;
+    a.gap_sum += b.gap_sum;
+
+    if (b.has_message) {
+        if (a.has_message) {
+            count_step(a, a.last_message, b.first_message);
+        } else {
+            a.has_message = true;
+            a.first_message = b.first_message;
+        }
+        a.last_message = b.last_message;
+    }
+    a.messages += b.messages;
+    a.lost += b.lost;
+    a.duplicates += b.duplicates;
+    a.restarts += b.restarts;
+
+    a.replies += b.replies;
+    a.reply_failures += b.reply_failures;
+
+    for (int i = 0; i < RSSI_BINS; ++i)
+        a.rssi[i] += b.rssi[i];
+    for (int i = 0; i < SNR_BINS; ++i)
+        a.snr[i] += b.snr[i];
+    for (int i = 0; i < LATENCY_BINS; ++i)
+        a.latency[i] += b.latency[i];
+    for (int i = 0; i < RETRANS_BINS; ++i)
+        a.retrans[i] += b.retrans[i];
+    for (int i = 0; i < GAP_BINS; ++i)
+        a.gaps[i] += b.gaps[i];
+}
+
+CaptureStats::CaptureStats() {
+    clear();
+}
+
+void CaptureStats::clear() {
+    memset(d_nodes, 0, sizeof(d_nodes));
+    memset(&d_head, 0, sizeof(d_head));
+    d_current = -1;
+    d_lines = 0;
+    d_bytes = 0;
+    d_boots = 0;
+    d_crashes = 0;
+    memset(d_reset_causes, 0, sizeof(d_reset_causes));
+}
+
+void CaptureStats::add_received(const char *s, const char *end, double host_time) {
+    long from;
+    if (!parse_hex(FIND_AFTER(s, end, "from: 0x"), end, &from) || from < 0 || from >= CAPTURE_NODES)
+        return;
+
+    d_current = from;
+    node_link_stats_t &n = d_nodes[from];
+    if (n.frames)
+        count_gap(n, host_time - n.last_time);
+    else
+        n.first_time = host_time;
+    n.last_time = host_time;
+    ++n.frames;
+}
+
+void CaptureStats::add_data(const char *s, const char *end) {
+    node_link_stats_t &n = current();
+
+    long message;
+    if (parse_int(FIND_AFTER(s, end, "message: "), end, &message) && message >= 0) {
+        if (n.has_message) {
+            count_step(n, n.last_message, message);
+        } else {
+            n.has_message = true;
+            n.first_message = message;
+        }
+        n.last_message = message;
+        ++n.messages;
+    }
+
+    add_signal(s, end);
+}
+
+void CaptureStats::add_signal(const char *s, const char *end) {
+    node_link_stats_t &n = current();
+
+    long rssi, snr;
+    if (parse_int(FIND_AFTER(s, end, "RSSI "), end, &rssi))
+        count(n.rssi, RSSI_BINS, rssi - RSSI_MIN_DBM);
+    if (parse_int(FIND_AFTER(s, end, "SNR "), end, &snr))
+        count(n.snr, SNR_BINS, snr - SNR_MIN_DB);
+}
+
+void CaptureStats::add_reply(const char *s, const char *end, bool acked) {
+    long to;
+    node_link_stats_t &n = parse_hex(FIND_AFTER(s, end, "to: 0x"), end, &to) && to >= 0 && to < CAPTURE_NODES
+                               ? d_nodes[to]
+                               : current();
+
+    if (acked)
+        ++n.replies;
+    else
+        ++n.reply_failures;
+
+    // ", 0 retransmissions, 539 ms"; the old 'reply failed' line has neither
+    long retrans, ms;
+    const char *p = parse_int(FIND_AFTER(s, end, ", "), end, &retrans);
+    if (!p || !STARTS_WITH(p, end, " retransmissions, "))
+        return;
+    count(n.retrans, RETRANS_BINS, retrans);
+    if (acked && parse_int(p + sizeof(" retransmissions, ") - 1, end, &ms))
+        count(n.latency, LATENCY_BINS, ms / LATENCY_BIN_MS);
+}
+
+void CaptureStats::add_line(const char *line, size_t len) {
+    ++d_lines;
+    d_bytes += len + 1;
+
+    const char *end = line + len;
+    if (end > line && end[-1] == '\r')
+        --end;
+
+    double host_time = 0.0;
+    const char *s = parse_time(line, end, &host_time);
+    if (!s || s >= end || *s != ',')
+        return;
+    ++s;
+    if (s < end && *s == '"') {
+        ++s;
+        if (end > s && end[-1] == '"')
+            --end;
+    }
+    if (s >= end)
+        return;
+
+    switch (*s) {
+        case 'R':
+            if (STARTS_WITH(s, end, "Received length: "))
+                add_received(s, end, host_time);
+            else if (STARTS_WITH(s, end, "RFM95 info: "))
+                add_signal(s, end);
+            break;
+        case 'D':
+            if (STARTS_WITH(s, end, "Data: "))
+                add_data(s, end);
+            else if (STARTS_WITH(s, end, "Duplicate: "))
+                ++current().duplicates;     // dropped by the main node
+            break;
+        case '.':
+            if (STARTS_WITH(s, end, "...sent a reply"))
+                add_reply(s, end, true);
+            else if (STARTS_WITH(s, end, "...reply failed"))
+                add_reply(s, end, false);
+            break;
+        case 'b':
+            if (end - s == 4 && memcmp(s, "boot", 4) == 0)
+                ++d_boots;
+            break;
+        case '>':
+            if (STARTS_WITH(s, end, ">>>stack>>>"))
+                ++d_crashes;
+            break;
+        case ' ': {
+            long cause;
+            if (STARTS_WITH(s, end, " ets ") && parse_int(FIND_AFTER(s, end, "rst cause:"), end, &cause))
+                count(d_reset_causes, RESET_CAUSES, cause);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+size_t CaptureStats::add_lines(const char *buf, size_t len) {
+    const char *s = buf;
+    const char *end = buf + len;
+    while (s < end) {
+        const char *nl = (const char *)memchr(s, '\n', end - s);
+        const char *line_end = nl ? nl : end;
+        add_line(s, line_end - s);
+        s = nl ? nl + 1 : end;
+    }
+    return len;
+}
+
+void CaptureStats::merge(const CaptureStats &next) {
+    merge_node(current(), next.d_head);
+    for (int i = 0; i < CAPTURE_NODES; ++i)
+        merge_node(d_nodes[i], next.d_nodes[i]);
+    if (next.d_current >= 0)
+        d_current = next.d_current;
+
+    d_lines += next.d_lines;
+    d_bytes += next.d_bytes;
+    d_boots += next.d_boots;
+    d_crashes += next.d_crashes;
+    for (int i = 0; i < RESET_CAUSES; ++i)
+        d_reset_causes[i] += next.d_reset_causes[i];
+}
+
+uint64_t histogram_total(const uint32_t *bins, int n) {
+    uint64_t total = 0;
+    for (int i = 0; i < n; ++i)
+        total += bins[i];
+    return total;
+}
+
+int histogram_percentile(const uint32_t *bins, int n, double p) {
+    uint64_t total = histogram_total(bins, n);
+    if (total == 0)
+        return -1;
+    uint64_t target = (uint64_t)(p * total);
+    if (target >= total)
+        target = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < n; ++i) {
+        seen += bins[i];
+        if (seen > target)
+            return i;
+    }
+    return n - 1;
+}
@@ -0,0 +1,152 @@
+/*
+  Per-node link and loss statistics from a capture of the main node's
+  serial output (PyNodeLog.py's CSV: the host time, a comma and the line,
+  quoted when it has commas).
+
+  The parser looks at a few kinds of lines and skips everything else,
+  including the ESP8266 panic dumps:
+
+    Received length: 20, from: 0x04, to: 0xff, id: 0x01, header: 0x00
+    Data: node: 4, message: 12, ..., RSSI -52 dBm, SNR 11 dB, ...
+    Duplicate: node: 4, message: 12, dropped
+    RFM95 info: RSSI -60 dBm, SNR 9 dB, ...
+    ...sent a reply, 0 retransmissions, 539 ms[, to: 0x04]
+    ...reply failed, 3 retransmissions, 1650 ms[, to: 0x04]
+    boot
+    >>>stack>>>                         (one per crash dump)
+     ets Jan  8 2013,rst cause:2, ...   (the ESP8266 boot ROM)
+
+  A Data, RFM95 info or reply line belongs to the node of the last
+  Received line. Loss is counted from gaps in each node's message
+  counter; a counter that goes back is a leaf node restart, not loss.
+  The main node drops duplicate messages itself and says so with a
+  Duplicate line.
+
+  The statistics are built so that a capture can be split into pieces,
+  each piece parsed on its own (by its own thread) and the results
+  merged in order: merge() joins the message counters and arrival times
+  across the boundary and gives the lines at the start of a piece that
+  come before its first Received line to the last node of the piece
+  before it.
+*/
+
+#ifndef CaptureStats_h
+#define CaptureStats_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_NODES 256
+
+#define RSSI_MIN_DBM -160       // RSSI histogram: one bin per dB, RSSI_MIN_DBM to 0
+#define RSSI_BINS 161
+#define SNR_MIN_DB -32          // SNR histogram: one bin per dB, SNR_MIN_DB to 31
+#define SNR_BINS 64
+#define LATENCY_BIN_MS 25       // Reply latency: 25 ms bins, the last one is 2 s and over
+#define LATENCY_BINS 81
+#define RETRANS_BINS 8          // 0 to 6 retransmissions; the last bin is 7 and over
+#define GAP_BINS 24             // Inter-arrival: bin 0 is under 1 s, bin k is 2^(k-1) to 2^k s
+#define RESET_CAUSES 8          // ESP8266 'rst cause' 0 to 7
+
+/**
+ * @brief What one leaf node's frames looked like.
+ */
+struct node_link_stats_t {
+    uint32_t frames;            // Received lines
+    uint32_t messages;          // Data lines with a message counter
+    uint32_t lost;              // messages missing from the counter sequence
+    uint32_t duplicates;        // the same counter twice in a row, or a Duplicate line
+    uint32_t restarts;          // the counter went back
+
+    bool has_message;
+    uint32_t first_message;
+    uint32_t last_message;
+
+    double first_time;          // host time of the first and last Received line
+    double last_time;
+    double gap_sum;             // sum of the inter-arrival times, s
+
+    uint32_t replies;
+    uint32_t reply_failures;
+
+    uint32_t rssi[RSSI_BINS];
+    uint32_t snr[SNR_BINS];
+    uint32_t latency[LATENCY_BINS];
+    uint32_t retrans[RETRANS_BINS];
+    uint32_t gaps[GAP_BINS];
+};
+
+/**
+ * @brief Statistics for a capture, or for one piece of one.
+ */
+class CaptureStats {
+    node_link_stats_t d_nodes[CAPTURE_NODES];
+    // Lines at the start of the piece that belong to the node of the last
+    // Received line before it
+    node_link_stats_t d_head;
+
+    int d_current;              // node of the last Received line, or -1
+
+    uint64_t d_lines;
+    uint64_t d_bytes;
+    uint32_t d_boots;
+    uint32_t d_crashes;
+    uint32_t d_reset_causes[RESET_CAUSES];
+
+    node_link_stats_t &current() { return d_current < 0 ? d_head : d_nodes[d_current]; }
+
+    void add_received(const char *s, const char *end, double host_time);
+    void add_data(const char *s, const char *end);
+    void add_signal(const char *s, const char *end);
+    void add_reply(const char *s, const char *end, bool acked);
+
+public:
+    CaptureStats();
+
+    void clear();
+
+    /**
+     * @brief Add one line of the capture.
+     * @param line The line, without its line ending; it need not be null terminated
+     * @param len Its length
+     */
+    void add_line(const char *line, size_t len);
+
+    /**
+     * @brief Add every line in a buffer.
+     * @return The number of bytes used; a last line without a line ending
+     * is used too
+     */
+    size_t add_lines(const char *buf, size_t len);
+
+    /**
+     * @brief Add the statistics for the piece of the capture that follows this one.
+     * @param next Statistics for the lines right after the lines in this object
+     */
+    void merge(const CaptureStats &next);
+
+    const node_link_stats_t &node(uint8_t node) const { return d_nodes[node]; }
+
+    /// @return Data, signal and reply lines seen before any Received line
+    const node_link_stats_t &unattributed() const { return d_head; }
+
+    uint64_t lines() const { return d_lines; }
+    uint64_t bytes() const { return d_bytes; }
+    uint32_t boots() const { return d_boots; }
+    uint32_t crashes() const { return d_crashes; }
+    uint32_t reset_cause(uint8_t cause) const { return cause < RESET_CAUSES ? d_reset_causes[cause] : 0; }
+};
+
+/**
+ * @brief The bin that holds the p'th fraction of the counts.
+ * @param bins The histogram
+ * @param n The number of bins
+ * @param p 0.0 to 1.0
+ * @return The bin index, or -1 if the histogram is empty
+ */
+int histogram_percentile(const uint32_t *bins, int n, double p);
+
+/// @return The number of counts in a histogram
+uint64_t histogram_total(const uint32_t *bins, int n);
+
+#endif
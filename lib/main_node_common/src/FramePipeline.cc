@@ -0,0 +1,122 @@
+/*
+  Decode frames once and pass them to the sinks; see FramePipeline.h.
+*/
+
+#include "FramePipeline.h"
+#include "data_packet.h"
+
+// A single reading, from a legacy packet_t or a data_message_t
+static void one_reading(frame_record_t *record, uint32_t message, uint32_t time, uint16_t battery,
+                        uint16_t last_tx_duration, int16_t temp, uint16_t humidity, uint8_t status) {
+    batch_reading_t &r = record->readings[0];
+    r.message = message;
+    r.time = time;
+    r.battery = battery;
+    r.last_tx_duration = last_tx_duration;
+    r.temp = temp;
+    r.humidity = humidity;
+    r.status = status;
+    record->node_time = time;
+    record->count = 1;
+}
+
+bool decode_frame(const uint8_t *frame, uint8_t len, uint8_t from, uint32_t rx_time, frame_record_t *record) {
+    record->rx_time = rx_time;
+    record->from = from;
+    record->frame = frame;
+    record->len = len;
+    record->type = data_packet;
+    record->batch = false;
+    record->node = from;
+    record->node_time = 0;
+    record->dev_eui = 0;
+    record->count = 0;
+    record->address = 0;
+
+    if (len == 0)
+        return false;
+
+    uint32_t message, time;
+    uint16_t battery, last_tx_duration, humidity;
+    int16_t temp;
+    uint8_t status;
+
+    // Legacy packet_t frames have no type byte; see BatchMessage.h for why
+    // a batch is never this long
+    if (len == sizeof(packet_t)) {
+        record->type = data_packet;
+        parse_data_packet((const packet_t *)frame, &record->node, &message, &time, &battery, &last_tx_duration,
+                          &temp, &humidity, &status);
+        one_reading(record, message, time, battery, last_tx_duration, temp, humidity, status);
+    }
+    else if (is_batch_message(frame, len)) {
+        record->type = data_message;
+        record->batch = true;
+        if (!decode_batch(frame, len, &record->node, &record->node_time, record->readings, &record->count))
+            return false;
+    }
+    else {
+        record->type = get_message_type(frame);
+        switch (record->type) {
+            case data_message:
+                if (len < sizeof(data_message_t)
+                    || !parse_data_message((const data_message_t *)frame, &record->node, &message, &time, &battery,
+                                           &last_tx_duration, &temp, &humidity, &status))
+                    return false;
+                one_reading(record, message, time, battery, last_tx_duration, temp, humidity, status);
+                break;
+
+            case join_request:
+                if (len < sizeof(join_request_t)
+                    || !parse_join_request((const join_request_t *)frame, &record->dev_eui))
+                    return false;
+                break;
+
+            case time_request:
+                if (len < sizeof(time_request_t)
+                    || !parse_time_request((const time_request_t *)frame, &record->node, &record->node_time))
+                    return false;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    record->fresh = record->count < 32 ? (1UL << record->count) - 1 : 0xffffffffUL;
+    return true;
+}
+
+bool FramePipeline::add(FrameSink *sink) {
+    if (d_count == FRAME_MAX_SINKS)
+        return false;
+
+    d_sinks[d_count++] = sink;
+    return true;
+}
+
+uint8_t FramePipeline::dispatch(const frame_record_t &record) {
+    if (!record.batch) {
+        if (record.count && !(record.fresh & 1))
+            return 0;
+        for (uint8_t s = 0; s < d_count; ++s)
+            d_sinks[s]->message(record, record.type, record.frame, record.len, record.count ? 0 : -1);
+        return 1;
+    }
+
+    // Each reading of a batch goes on as a packet_t, built once for all the sinks
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < record.count; ++i) {
+        if (!(record.fresh & (1UL << i)))
+            continue;
+
+        const batch_reading_t &r = record.readings[i];
+        packet_t p;
+        build_data_packet(&p, record.node, r.message, r.time, r.battery, r.last_tx_duration, r.temp, r.humidity,
+                          r.status);
+        for (uint8_t s = 0; s < d_count; ++s)
+            d_sinks[s]->message(record, data_packet, (const uint8_t *)&p, sizeof(packet_t), i);
+        ++sent;
+    }
+    return sent;
+}
@@ -0,0 +1,161 @@
+/*
+  Decode each received frame once and hand it to the sinks.
+
+  loop() used to work a frame's type out from its length and first
+  byte, cast the radio's buffer to each message struct in turn and
+  render the same reading several times: pretty for the console, plain
+  for the SD card and, after parsing the packet again, for the TFT.
+
+  decode_frame() checks a frame and decodes it into a frame_record_t:
+  its type, the node's address and clock and its readings. Everything
+  downstream reads the record. A FramePipeline then passes each message
+  in the record to its sinks, in the order they were added: the frame
+  itself, or for a batch, each new reading as a packet_t of its own, so
+  that a sink sees a batch's readings as it would legacy packets. Each
+  sink formats what it needs, and only when it needs it.
+
+  A frame of exactly sizeof(packet_t) bytes is a legacy packet_t, which
+  has no type byte. Every other frame starts with its type: a
+  MessageType or BATCH_MESSAGE_TYPE.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef FramePipeline_h
+#define FramePipeline_h
+
+#include <stdint.h>
+
+#include "BatchMessage.h"
+#include "messages.h"
+
+#define FRAME_MAX_SINKS 8
+#define FRAME_COUNT_TYPES 8         // FrameCounts counts MessageType values below this
+
+/**
+ * @brief A received frame, decoded.
+ */
+struct frame_record_t {
+    uint32_t rx_time;           // when the radio received it (unixtime)
+    uint8_t from;               // RadioHead's from
+    MessageType type;           // data_packet for a legacy packet_t; a batch is a data_message
+    bool batch;
+    const uint8_t *frame;       // the frame as received; not copied
+    uint8_t len;
+
+    uint8_t node;               // the address in the message, if it has one
+    uint32_t node_time;         // the node's clock: its reading's, its batch's or its time request's
+    uint64_t dev_eui;           // join_request
+
+    uint8_t count;              // readings: 1 for a data packet or message, 0 for the other types
+    uint32_t fresh;             // bit i is set while reading i is not known to be a duplicate
+    batch_reading_t readings[BATCH_MAX_READINGS];
+
+    uint8_t address;            // join_request: the address the node was given; set by the caller
+};
+
+/**
+ * @brief Check and decode a frame.
+ * @param frame The frame; the record points to it
+ * @param len Its length
+ * @param from The node that sent it
+ * @param rx_time When it was received (unixtime)
+ * @param record Value-result: the frame, decoded; every reading is fresh
+ * @return False if the frame is too short for its type or is a malformed
+ * batch. A frame of a type we don't know is decoded with no readings.
+ */
+bool decode_frame(const uint8_t *frame, uint8_t len, uint8_t from, uint32_t rx_time, frame_record_t *record);
+
+/**
+ * @brief Something done with each message the main node receives:
+ * printing, logging, displaying or counting it.
+ */
+class FrameSink {
+public:
+    virtual ~FrameSink() {}
+
+    /**
+     * @brief One message: a frame, or one reading of a batch.
+     * @param record The decoded frame
+     * @param type The message's type; data_packet for a reading of a batch
+     * @param msg The message: the frame, or the reading as a packet_t
+     * @param len The message's length
+     * @param reading The message's reading in record.readings, or -1 if it has none
+     */
+    virtual void message(const frame_record_t &record, MessageType type, const uint8_t *msg, uint8_t len,
+                         int8_t reading) = 0;
+};
+
+/**
+ * @brief Pass the messages in decoded frames to the sinks.
+ */
+class FramePipeline {
+    FrameSink *d_sinks[FRAME_MAX_SINKS];
+    uint8_t d_count;
+
+public:
+    FramePipeline() : d_count(0) {}
+
+    /**
+     * @brief Add a sink. Sinks get each message in the order they were added.
+     * @return False if there are already FRAME_MAX_SINKS sinks
+     */
+    bool add(FrameSink *sink);
+
+    /**
+     * @brief Pass the fresh messages in a frame to each sink.
+     * @return The number of messages passed on
+     */
+    uint8_t dispatch(const frame_record_t &record);
+
+    uint8_t sinks() const { return d_count; }
+};
+
+/**
+ * @brief A sink that counts messages by type.
+ */
+class FrameCounts : public FrameSink {
+    uint32_t d_messages[FRAME_COUNT_TYPES];
+    uint32_t d_unknown;
+    uint32_t d_batched;
+    uint32_t d_malformed;
+
+public:
+    FrameCounts() { reset(); }
+
+    void reset() {
+        for (uint8_t i = 0; i < FRAME_COUNT_TYPES; ++i)
+            d_messages[i] = 0;
+        d_unknown = 0;
+        d_batched = 0;
+        d_malformed = 0;
+    }
+
+    void message(const frame_record_t &record, MessageType type, const uint8_t *, uint8_t, int8_t) {
+        if ((unsigned)type < FRAME_COUNT_TYPES)
+            ++d_messages[type];
+        else
+            ++d_unknown;
+        if (record.batch)
+            ++d_batched;
+    }
+
+    /// Count a frame decode_frame() turned down
+    void malformed() { ++d_malformed; }
+
+    /// @return The number of messages of a type; a batch's readings are data packets
+    uint32_t messages(MessageType type) const {
+        return (unsigned)type < FRAME_COUNT_TYPES ? d_messages[type] : 0;
+    }
+
+    /// @return The number of messages of types FRAME_COUNT_TYPES and up
+    uint32_t unknown() const { return d_unknown; }
+
+    /// @return The number of data packets that came in batches
+    uint32_t batched() const { return d_batched; }
+
+    /// @return The number of frames dropped as malformed
+    uint32_t malformed_frames() const { return d_malformed; }
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*
+  Merge the frames several main nodes receive into one stream, in
+  receive time order and without the frames more than one of them heard.
+
+  host-tools' node_collector reads the serial ports of several main
+  nodes in framed mode (see SerialRecord.h). Each 'F' record is a frame
+  and the main node's receive time (its RTC, in seconds). One main
+  node's frames come in receive time order, but each port is read as
+  its bytes arrive, and a leaf node in range of two main nodes is heard
+  by both.
+
+  add() takes a port's frame. A frame with the same bytes (source, type
+  and payload) as a frame taken within the last INGEST_RECENT frames,
+  and received within INGEST_DUPLICATE_S of it, is a duplicate; the
+  first copy is kept and the duplicate is counted against its port. The
+  payload holds the leaf node's message number and time, so two frames
+  that match are one transmission (or a leaf node's retry, which a main
+  node that heard both would have dropped).
+
+  The frames wait in a heap ordered by receive time. next() returns the
+  earliest one once every open port has sent a frame received at that
+  time or later, so nothing earlier can still come, or once it has
+  waited hold_ms; a quiet port holds the stream back that long and no
+  longer. A frame that comes after a later one was returned is still
+  returned, and counted as late.
+
+  For each port it keeps the lag: from the main node's receive time to
+  when the host read the record, in seconds (this includes the
+  difference between the main node's clock and the host's), and the
+  longest a frame waited here, in ms.
+
+  The sizes are fixed: PORTS ports and PENDING frames waiting. add()
+  drops a frame when PENDING are waiting, so call next() until it
+  returns false after each add().
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef IngestMerge_h
+#define IngestMerge_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "BinaryLog.h"
+#include "CRC32.h"
+
+#define INGEST_RECENT 256           // frames remembered for the duplicate check
+#define INGEST_DUPLICATE_S 30       // main nodes' clocks can be this far apart
+#define INGEST_HOLD_MS 2000
+
+/**
+ * @brief What one port sent the merge.
+ */
+struct ingest_port_stats_t {
+    uint32_t frames;        // taken, not counting duplicates
+    uint32_t duplicates;
+    uint32_t late;          // returned after a frame received later
+    uint32_t dropped;       // the merge was full
+    int32_t lag_min_s;      // host time - main node receive time
+    int32_t lag_max_s;
+    int64_t lag_sum_s;
+    uint32_t hold_max_ms;   // longest a frame waited in the merge
+};
+
+/**
+ * @brief A time-ordered, de-duplicated merge of several ports' frames.
+ * @tparam PORTS The number of ports
+ * @tparam PENDING The most frames that can wait
+ */
+template <uint8_t PORTS, uint16_t PENDING = 256>
+class IngestMerge {
+    struct pending_t {
+        log_record_t rec;
+        uint32_t order;         // ties on receive time go in arrival order
+        uint32_t in_ms;
+        uint8_t port;
+    };
+
+    struct port_t {
+        bool open;
+        bool heard;             // last_rx is from this connection
+        uint32_t last_rx;
+        ingest_port_stats_t stats;
+    };
+
+    struct recent_t {
+        uint32_t key;
+        uint32_t rx_time;
+    };
+
+    pending_t d_pending[PENDING];   // a binary min-heap
+    uint16_t d_count;
+    uint32_t d_order;
+
+    recent_t d_recent[INGEST_RECENT];
+    uint16_t d_recent_count;
+    uint16_t d_recent_next;
+
+    port_t d_ports[PORTS];
+    uint32_t d_hold_ms;
+    uint32_t d_last_out;            // receive time of the last frame returned
+    bool d_has_out;
+
+    static uint32_t key(const log_record_t &rec) {
+        uint32_t crc = crc32_update(0, &rec.type, 3);   // type, from and len
+        return crc32_update(crc, rec.payload, rec.len);
+    }
+
+    bool before(uint16_t a, uint16_t b) const {
+        const pending_t &x = d_pending[a], &y = d_pending[b];
+        return x.rec.rx_time != y.rec.rx_time ? x.rec.rx_time < y.rec.rx_time : (int32_t)(x.order - y.order) < 0;
+    }
+
+    void swap(uint16_t a, uint16_t b) {
+        pending_t t = d_pending[a];
+        d_pending[a] = d_pending[b];
+        d_pending[b] = t;
+    }
+
+    bool duplicate(uint32_t k, uint32_t rx_time) const {
+        for (uint16_t i = 0; i < d_recent_count; ++i) {
+            const recent_t &r = d_recent[i];
+            uint32_t apart = r.rx_time > rx_time ? r.rx_time - rx_time : rx_time - r.rx_time;
+            if (r.key == k && apart <= INGEST_DUPLICATE_S)
+                return true;
+        }
+        return false;
+    }
+
+    bool ready(uint32_t now_ms) const {
+        if (d_count == PENDING || now_ms - d_pending[0].in_ms >= d_hold_ms)
+            return true;
+        for (uint8_t p = 0; p < PORTS; ++p) {
+            const port_t &port = d_ports[p];
+            if (port.open && (!port.heard || port.last_rx < d_pending[0].rec.rx_time))
+                return false;
+        }
+        return true;
+    }
+
+public:
+    /// @param hold_ms The longest a frame waits for the other ports
+    explicit IngestMerge(uint32_t hold_ms = INGEST_HOLD_MS)
+        : d_count(0), d_order(0), d_recent_count(0), d_recent_next(0), d_hold_ms(hold_ms), d_last_out(0),
+          d_has_out(false) {
+        memset(d_ports, 0, sizeof(d_ports));
+        for (uint8_t p = 0; p < PORTS; ++p) {
+            d_ports[p].stats.lag_min_s = INT32_MAX;
+            d_ports[p].stats.lag_max_s = INT32_MIN;
+        }
+    }
+
+    /**
+     * @brief A port was opened or closed. A closed port does not hold
+     * the stream back; an opened one does once it has sent a frame.
+     */
+    void set_open(uint8_t port, bool open) {
+        d_ports[port].open = open;
+        d_ports[port].heard = false;
+    }
+
+    /**
+     * @brief Take a port's frame.
+     * @param now_ms A millisecond clock, for the hold time
+     * @param host_time When the host read the frame, unixtime, for the lag
+     * @return False if it is a duplicate or the merge is full
+     */
+    bool add(uint8_t port, const log_record_t &rec, uint32_t now_ms, uint32_t host_time) {
+        port_t &p = d_ports[port];
+        if (!p.heard || (int32_t)(rec.rx_time - p.last_rx) > 0)
+            p.last_rx = rec.rx_time;
+        p.heard = true;
+
+        uint32_t k = key(rec);
+        if (duplicate(k, rec.rx_time)) {
+            ++p.stats.duplicates;
+            return false;
+        }
+        if (d_count == PENDING) {
+            ++p.stats.dropped;
+            return false;
+        }
+
+        d_recent[d_recent_next] = recent_t{k, rec.rx_time};
+        d_recent_next = (d_recent_next + 1) % INGEST_RECENT;
+        if (d_recent_count < INGEST_RECENT)
+            ++d_recent_count;
+
+        ++p.stats.frames;
+        int32_t lag = (int32_t)(host_time - rec.rx_time);
+        if (lag < p.stats.lag_min_s)
+            p.stats.lag_min_s = lag;
+        if (lag > p.stats.lag_max_s)
+            p.stats.lag_max_s = lag;
+        p.stats.lag_sum_s += lag;
+
+        uint16_t i = d_count++;
+        d_pending[i].rec = rec;
+        d_pending[i].order = d_order++;
+        d_pending[i].in_ms = now_ms;
+        d_pending[i].port = port;
+        for (; i > 0 && before(i, (i - 1) / 2); i = (i - 1) / 2)
+            swap(i, (i - 1) / 2);
+        return true;
+    }
+
+    /**
+     * @brief The next frame in receive time order, if it is ready.
+     * @param all Return it even if it is not; to empty the merge at exit
+     * @param rec Value-result parameter; the frame
+     * @param port Value-result parameter; the port it came from first
+     * @return False if no frame is ready
+     */
+    bool next(uint32_t now_ms, log_record_t *rec, uint8_t *port, bool all = false) {
+        if (d_count == 0 || !(all || ready(now_ms)))
+            return false;
+
+        const pending_t &head = d_pending[0];
+        ingest_port_stats_t &stats = d_ports[head.port].stats;
+        if (now_ms - head.in_ms > stats.hold_max_ms)
+            stats.hold_max_ms = now_ms - head.in_ms;
+        if (d_has_out && head.rec.rx_time < d_last_out)
+            ++stats.late;
+        else
+            d_last_out = head.rec.rx_time;
+        d_has_out = true;
+        *rec = head.rec;
+        *port = head.port;
+
+        d_pending[0] = d_pending[--d_count];
+        for (uint16_t i = 0;;) {
+            uint16_t least = i, l = 2 * i + 1, r = 2 * i + 2;
+            if (l < d_count && before(l, least))
+                least = l;
+            if (r < d_count && before(r, least))
+                least = r;
+            if (least == i)
+                break;
+            swap(i, least);
+            i = least;
+        }
+        return true;
+    }
+
+    /// @return Frames waiting
+    uint16_t pending() const { return d_count; }
+
+    bool open(uint8_t port) const { return d_ports[port].open; }
+    const ingest_port_stats_t &stats(uint8_t port) const { return d_ports[port].stats; }
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+  Adaptive data rate for the leaf nodes.
+
+  The main node listens at SF10, and the leaf nodes all send at SF10 and
+  full power, even the ones we hear at -50 dBm with 10 dB of SNR. Those
+  could send at SF7 in an eighth of the airtime. LinkAdr does what a
+  LoRaWAN network server's ADR does, for one gateway on one channel:
+
+  - It keeps the SNR of each node's last NODE_SNR_HISTORY frames in its
+    registry entry. Once the history is full, the link margin is the
+    best SNR less the demodulator's floor at the node's spreading factor
+    (-7.5 dB at SF7 to -20 dB at SF12) less LINK_ADR_MARGIN_DB. Each
+    LINK_ADR_STEP_DB of margin moves the node one spreading factor
+    faster, down to LINK_ADR_MIN_SF, and then lowers its power by
+    LINK_ADR_STEP_DB. A negative margin raises the power and then the
+    spreading factor, back to the main node's.
+
+  - A change is sent to the node as a link_adr_command_t. The node takes
+    it when it ACKs the command, so the change is made here when the
+    outbound engine reports the ACK (confirm()); until then the node is
+    where it was. The node's history starts over after a change.
+
+  - The radio hears one spreading factor at a time. The main node keeps
+    each node's interval between frames and listens at the node's
+    spreading factor from LINK_ADR_GUARD_S (plus a sixty-fourth of the
+    interval) before its next frame is due until that long after, or
+    until the frame arrives; the rest of the time it listens at its own.
+    When windows overlap, the node due first gets the radio, whether it
+    was moved or not.
+
+  - A window that passes without the node's frame is a miss. After
+    LINK_ADR_MAX_MISSED in a row the node is taken to be back at the
+    main node's settings. A leaf node does the same when that many of
+    its frames go without an ACK, so the two find each other again
+    after a lost command, a reboot or a node that moved.
+
+  Only nodes that speak the newer protocol (data messages and batches)
+  understand the command; legacy packet_t nodes are left alone.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef LinkAdr_h
+#define LinkAdr_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "NodeRegistry.h"
+
+// dB of link margin to keep in hand for fading. Set the value using the
+// platformio.ini file.
+#ifndef LINK_ADR_MARGIN_DB
+#define LINK_ADR_MARGIN_DB 10
+#endif
+
+// The leaf nodes' power when they have not been told otherwise, dBm.
+// Set the value using the platformio.ini file.
+#ifndef LINK_ADR_MAX_TX_POWER
+#define LINK_ADR_MAX_TX_POWER 13
+#endif
+
+#define LINK_ADR_MIN_SF 7
+#define LINK_ADR_MIN_TX_POWER 2     // the RFM95's PA_BOOST output goes down to 2 dBm
+#define LINK_ADR_STEP_DB 3          // dB of margin per step
+#define LINK_ADR_GUARD_S 2          // listen this long either side of a frame's due time
+#define LINK_ADR_MAX_MISSED 3       // missed frames before a node is taken to be back
+
+#define LINK_ADR_MESSAGE_TYPE 0x81
+
+/**
+ * @brief Sent to a leaf node to change its data rate and power.
+ */
+struct link_adr_command_t {
+    uint8_t type;               // LINK_ADR_MESSAGE_TYPE
+    uint8_t spreading_factor;   // 7 to 12
+    int8_t tx_power;            // dBm
+};
+
+/**
+ * @brief The SNR, in tenths of a dB, below which a spreading factor
+ * cannot be demodulated (SX1276 datasheet, table 13).
+ */
+inline int16_t lora_snr_floor_db10(uint8_t spreading_factor) {
+    return -75 - 25 * ((int16_t)spreading_factor - 7);
+}
+
+/**
+ * @brief Decide the leaf nodes' data rates and when to listen for them.
+ */
+class LinkAdr {
+    uint8_t d_default_sf;
+    int8_t d_max_tx_power;
+    uint8_t d_margin_db;
+
+    uint32_t d_commands;
+    uint32_t d_changes;
+    uint32_t d_missed;
+    uint32_t d_fallbacks;
+
+    static uint16_t guard_s(const node_state_t &node) { return LINK_ADR_GUARD_S + node.uplink_interval / 64; }
+
+    // When the node's next frame is due
+    static uint32_t due(const node_state_t &node) {
+        return node.last_seen + (uint32_t)node.uplink_interval * (node.missed + 1);
+    }
+
+    void restart(node_state_t &node) {
+        node.snr_count = 0;
+        node.missed = 0;
+    }
+
+public:
+    /**
+     * @param default_sf The main node's spreading factor; the leaf nodes start there
+     * @param max_tx_power The leaf nodes' power when they start, dBm
+     * @param margin_db Link margin to keep, dB
+     */
+    LinkAdr(uint8_t default_sf, int8_t max_tx_power = LINK_ADR_MAX_TX_POWER, uint8_t margin_db = LINK_ADR_MARGIN_DB)
+        : d_default_sf(default_sf), d_max_tx_power(max_tx_power), d_margin_db(margin_db), d_commands(0),
+          d_changes(0), d_missed(0), d_fallbacks(0) {}
+
+    /// @return The spreading factor the node sends at
+    uint8_t spreading_factor(const node_state_t &node) const {
+        return node.spreading_factor ? node.spreading_factor : d_default_sf;
+    }
+
+    /// @return The power the node sends at, dBm
+    int8_t tx_power(const node_state_t &node) const { return node.tx_power ? node.tx_power : d_max_tx_power; }
+
+    /**
+     * @brief Record a frame from a node: its SNR and when it came.
+     * @note Call this after NodeRegistry::saw_frame(), which sets the node's SNR.
+     * @param node The node's registry entry
+     * @param now When the frame was received (unixtime)
+     * @param last_seen When the node was heard from before this frame; 0 if never
+     */
+    void saw_uplink(node_state_t &node, uint32_t now, uint32_t last_seen) {
+        if (last_seen && now > last_seen) {
+            uint32_t gap = now - last_seen;
+            if (node.uplink_interval) {
+                // Frames lost in between make the gap a multiple of the interval
+                uint32_t frames = (gap + node.uplink_interval / 2) / node.uplink_interval;
+                if (frames > 1)
+                    gap /= frames;
+                node.uplink_interval = (uint16_t)((3UL * node.uplink_interval + gap + 2) / 4);
+            }
+            else {
+                node.uplink_interval = gap < 0xffff ? gap : 0xffff;
+            }
+        }
+        node.missed = 0;
+
+        memmove(node.snr_history + 1, node.snr_history, NODE_SNR_HISTORY - 1);
+        node.snr_history[0] = node.snr;
+        if (node.snr_count < NODE_SNR_HISTORY)
+            ++node.snr_count;
+    }
+
+    /**
+     * @brief Decide whether a node should change its data rate or power.
+     * @param node The node's registry entry
+     * @param command Set to the command to send the node, if any
+     * @return True if the command should be sent. The change is pending
+     * until confirm() is called.
+     */
+    bool check(node_state_t &node, link_adr_command_t *command) {
+        if (node.adr_spreading_factor || node.snr_count < NODE_SNR_HISTORY)
+            return false;
+
+        int8_t best = node.snr_history[0];
+        for (uint8_t i = 1; i < NODE_SNR_HISTORY; ++i) {
+            if (node.snr_history[i] > best)
+                best = node.snr_history[i];
+        }
+
+        uint8_t sf = spreading_factor(node);
+        int8_t power = tx_power(node);
+        int16_t margin = 10 * best - lora_snr_floor_db10(sf) - 10 * d_margin_db;
+        // Round toward minus infinity: a margin of -1 dB is one step short
+        int16_t steps = margin >= 0 ? margin / (10 * LINK_ADR_STEP_DB)
+                                    : -((-margin + 10 * LINK_ADR_STEP_DB - 1) / (10 * LINK_ADR_STEP_DB));
+
+        for (; steps > 0 && sf > LINK_ADR_MIN_SF; --steps)
+            --sf;
+        for (; steps > 0 && power - LINK_ADR_STEP_DB >= LINK_ADR_MIN_TX_POWER; --steps)
+            power -= LINK_ADR_STEP_DB;
+        for (; steps < 0 && power < d_max_tx_power; ++steps)
+            power = power + LINK_ADR_STEP_DB < d_max_tx_power ? power + LINK_ADR_STEP_DB : d_max_tx_power;
+        for (; steps < 0 && sf < d_default_sf; ++steps)
+            ++sf;
+
+        if (sf == spreading_factor(node) && power == tx_power(node))
+            return false;
+
+        node.adr_spreading_factor = sf;
+        node.adr_tx_power = power;
+        command->type = LINK_ADR_MESSAGE_TYPE;
+        command->spreading_factor = sf;
+        command->tx_power = power;
+        ++d_commands;
+        return true;
+    }
+
+    /**
+     * @brief The outbound engine is done with a node's command.
+     * @param node The node's registry entry
+     * @param acked True if the node ACK'd it, and so made the change
+     */
+    void confirm(node_state_t &node, bool acked) {
+        if (!node.adr_spreading_factor)
+            return;
+
+        if (acked) {
+            node.spreading_factor = node.adr_spreading_factor == d_default_sf ? 0 : node.adr_spreading_factor;
+            node.tx_power = node.adr_tx_power == d_max_tx_power ? 0 : node.adr_tx_power;
+            restart(node);
+            ++d_changes;
+        }
+        node.adr_spreading_factor = 0;
+        node.adr_tx_power = 0;
+    }
+
+    /**
+     * @brief The spreading factor to listen at: a moved node's, if one
+     * is due, or the main node's. Also counts missed frames and takes
+     * nodes that missed LINK_ADR_MAX_MISSED back to the main node's settings.
+     * @tparam Registry A NodeRegistry
+     * @param nodes The leaf nodes
+     * @param now The time (unixtime)
+     */
+    template <class Registry>
+    uint8_t listen(Registry &nodes, uint32_t now) {
+        uint8_t sf = d_default_sf;
+        bool window = false;
+        uint32_t first_due = 0;
+        for (uint16_t i = 0; i < nodes.count(); ++i) {
+            node_state_t &node = nodes.entry(i);
+            if (!node.uplink_interval)
+                continue;
+
+            uint16_t guard = guard_s(node);
+            while (node.spreading_factor && (int32_t)(now - due(node)) > guard) {
+                ++d_missed;
+                if (++node.missed >= LINK_ADR_MAX_MISSED) {
+                    node.spreading_factor = 0;
+                    node.tx_power = 0;
+                    restart(node);
+                    ++d_fallbacks;
+                }
+            }
+
+            // A node at the main node's spreading factor is not counted
+            // as missing; its next frame is the next one not yet overdue
+            uint32_t next = due(node);
+            if ((int32_t)(now - next) > guard)
+                next += ((now - next - guard - 1) / node.uplink_interval + 1) * node.uplink_interval;
+
+            if ((int32_t)(next - now) <= guard && (!window || (int32_t)(next - first_due) < 0)) {
+                sf = spreading_factor(node);
+                first_due = next;
+                window = true;
+            }
+        }
+        return sf;
+    }
+
+    uint8_t default_spreading_factor() const { return d_default_sf; }
+
+    /// @return The number of commands check() asked for
+    uint32_t commands() const { return d_commands; }
+
+    /// @return The number of commands the nodes ACK'd
+    uint32_t changes() const { return d_changes; }
+
+    /// @return The number of frames expected from moved nodes and not heard
+    uint32_t missed() const { return d_missed; }
+
+    /// @return The number of times a node was taken back to the main node's settings
+    uint32_t fallbacks() const { return d_fallbacks; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+/*
+  LoRa time on air; see LoRaAirtime.h.
+*/
+
+#include "LoRaAirtime.h"
+
+lora_settings_t lora_settings(uint8_t spreading_factor, uint32_t bandwidth, uint8_t coding_rate) {
+    lora_settings_t s;
+    s.spreading_factor = spreading_factor;
+    s.bandwidth = bandwidth;
+    s.coding_rate = coding_rate;
+    s.preamble = 8;
+    s.explicit_header = true;
+    s.crc = true;
+    return s;
+}
+
+uint32_t lora_symbol_us(const lora_settings_t &s) {
+    return (uint32_t)(((uint64_t)1000000 << s.spreading_factor) / s.bandwidth);
+}
+
+bool lora_low_data_rate(const lora_settings_t &s) {
+    // 2^SF / BW > 16 ms
+    return (uint64_t)1000 * (1UL << s.spreading_factor) > (uint64_t)16 * s.bandwidth;
+}
+
+uint32_t lora_payload_symbols(const lora_settings_t &s, uint16_t len) {
+    int32_t sf = s.spreading_factor;
+    int32_t bits = 8 * (int32_t)len - 4 * sf + 28 + (s.crc ? 16 : 0) - (s.explicit_header ? 0 : 20);
+    int32_t per_block = 4 * (sf - (lora_low_data_rate(s) ? 2 : 0));
+    int32_t blocks = bits > 0 ? (bits + per_block - 1) / per_block : 0;
+    return 8 + blocks * s.coding_rate;
+}
+
+uint32_t lora_airtime_us(const lora_settings_t &s, uint16_t len) {
+    // In quarter symbols: the preamble is n + 4.25 symbols
+    uint64_t quarters = 4 * (uint64_t)s.preamble + 17 + 4 * (uint64_t)lora_payload_symbols(s, len);
+    return (uint32_t)((quarters << s.spreading_factor) * 1000000 / (4 * (uint64_t)s.bandwidth));
+}
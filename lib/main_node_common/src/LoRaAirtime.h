@@ -0,0 +1,63 @@
+/*
+  LoRa time on air.
+
+  From Semtech's SX1272/3/6/7/8 LoRa Modem Designer's Guide (AN1200.13):
+
+    T_sym = 2^SF / BW
+    T_preamble = (n_preamble + 4.25) T_sym
+    n_payload = 8 + max(ceil((8 PL - 4 SF + 28 + 16 CRC - 20 IH)
+                             / (4 (SF - 2 DE))) (CR + 4), 0)
+
+  where PL is the PHY payload in bytes (RadioHead adds its four header
+  bytes to what it is given to send), CRC is 1 with the payload CRC on,
+  IH is 1 with the implicit header, DE is 1 with the low data rate
+  optimization (used when a symbol takes more than 16 ms, as the RFM95
+  driver does) and CR is 1 to 4 for 4/5 to 4/8.
+
+  The time is computed in integers, so the M0 can use it too.
+*/
+
+#ifndef LoRaAirtime_h
+#define LoRaAirtime_h
+
+#include <stdint.h>
+
+#define LORA_RH_HEADER_LEN 4        // RadioHead's to, from, id and flags
+
+/**
+ * @brief The radio settings that set the time on air.
+ */
+struct lora_settings_t {
+    uint8_t spreading_factor;   // 6 to 12
+    uint32_t bandwidth;         // Hz
+    uint8_t coding_rate;        // the denominator of 4/5 to 4/8: 5 to 8
+    uint16_t preamble;          // symbols; RadioHead's default is 8
+    bool explicit_header;
+    bool crc;
+};
+
+/**
+ * @brief The main node's settings, as main-node.cc sets up the radio:
+ * explicit header and CRC on, an 8 symbol preamble.
+ */
+lora_settings_t lora_settings(uint8_t spreading_factor, uint32_t bandwidth, uint8_t coding_rate);
+
+/// @return The time of one symbol, 2^SF / BW, in microseconds, rounded down
+uint32_t lora_symbol_us(const lora_settings_t &s);
+
+/// @return True if the low data rate optimization is used: a symbol is more than 16 ms
+bool lora_low_data_rate(const lora_settings_t &s);
+
+/// @return The number of payload symbols, header included, for a PHY payload of 'len' bytes
+uint32_t lora_payload_symbols(const lora_settings_t &s, uint16_t len);
+
+/**
+ * @brief The time on air of a frame.
+ * @param s The radio settings
+ * @param len The PHY payload length: for RadioHead, what it sends plus
+ * LORA_RH_HEADER_LEN
+ * @return The time in microseconds, rounded down
+ */
+uint32_t lora_airtime_us(const lora_settings_t &s, uint16_t len);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+  Daily log files and their indexes; see LogIndex.h.
+*/
+
+#include "LogIndex.h"
+#include "TextFormat.h"
+
+void log_file_name(uint32_t unixtime, const char *ext, char *name) {
+    date_time_t t;
+    unix_date_time(unixtime, &t);
+    TextSpan(name, LOG_FILE_NAME_LEN).put_uint(t.year, 4, '0').put_uint(t.month, 2, '0').put_uint(t.day, 2, '0')
+        .put('.').put(ext, 3);
+}
+
+log_index_header_t log_index_header() {
+    log_index_header_t h;
+    h.magic = LOG_INDEX_MAGIC;
+    h.version = LOG_INDEX_VERSION;
+    h.entry_size = LOG_INDEX_ENTRY_SIZE;
+    h.reserved[0] = 0;
+    h.reserved[1] = 0;
+    return h;
+}
+
+bool log_index_match(const log_index_entry_t &e, uint32_t from, uint32_t to, int node) {
+    if (e.last_time < from || e.first_time > to)
+        return false;
+    return node < 0 || log_index_has_node(e, (uint8_t)node);
+}
+
+bool LogIndexer::record(uint32_t offset, uint32_t end, uint32_t time, uint8_t node, log_index_entry_t *closed) {
+    // A block ends where its last record ends; anything logged between two
+    // records (a header line) starts a new block
+    bool close = d_open
+                 && (offset != d_end || end - d_block.offset > d_block_bytes
+                     || time - d_block.first_time >= d_block_s || time < d_block.first_time);
+    if (close)
+        finish(closed);
+
+    if (!d_open) {
+        memset(&d_block, 0, sizeof(d_block));
+        d_block.first_time = time;
+        d_block.offset = offset;
+        d_open = true;
+    }
+
+    if (time > d_block.last_time)
+        d_block.last_time = time;
+    d_block.nodes[node / 8] |= 1 << (node % 8);
+    d_end = end;
+
+    return close;
+}
+
+bool LogIndexer::finish(log_index_entry_t *closed) {
+    if (!d_open)
+        return false;
+
+    d_block.length = d_end - d_block.offset;
+    *closed = d_block;
+    d_open = false;
+    return true;
+}
@@ -0,0 +1,141 @@
+/*
+  Daily log files and an index of each one.
+
+  With LOG_ROTATE the text log goes to one file per day, named for the
+  main node's date (YYYYMMDD.CSV), instead of to one file that grows
+  forever. Next to each log file is an index (YYYYMMDD.IDX) that says
+  which part of the file holds which nodes' records for which times, so
+  "node 4 last Tuesday" means reading a few blocks of one file and not
+  the whole card.
+
+  The index is built as records are logged. The log is cut into blocks
+  of whole records, each closed once it holds LOG_INDEX_BLOCK_BYTES or
+  spans LOG_INDEX_BLOCK_S, and each closed block gets one entry:
+
+    index:  magic (4) version (1) entry size (1) reserved (2)
+            entries (48 each)
+    entry:  first time (4) last time (4) offset (4) length (4)
+            nodes (32)
+
+  The times are when the main node received the block's first and last
+  records (not the leaf nodes' clocks), the offset and length are in
+  bytes of the log file and bit n of 'nodes' is set if node n has a
+  record in the block. Lines in the log that are not records (the
+  header written at each boot) fall between blocks. A block's entry is
+  written when it closes or the day ends, so the last block, and one
+  cut short by a reset, have none; a reader takes any part of the log
+  that no entry covers to be a block of unknown times and nodes. An
+  entry of length zero is padding and is skipped. All values are
+  little-endian.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef LogIndex_h
+#define LogIndex_h
+
+#include <stdint.h>
+#include <string.h>
+
+// Close an index block once it has this many bytes of log. Set the value
+// using the platformio.ini file.
+#ifndef LOG_INDEX_BLOCK_BYTES
+#define LOG_INDEX_BLOCK_BYTES 4096
+#endif
+
+// Or once its records span this many seconds
+#ifndef LOG_INDEX_BLOCK_S
+#define LOG_INDEX_BLOCK_S 900
+#endif
+
+#define LOG_INDEX_MAGIC 0x5844494c  // "LIDX"
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_HEADER_SIZE 8
+#define LOG_INDEX_ENTRY_SIZE 48
+
+#define LOG_FILE_NAME_LEN 13        // "YYYYMMDD.CSV" and a null
+
+struct log_index_header_t {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t entry_size;
+    uint8_t reserved[2];
+};
+
+/**
+ * @brief One block of the log.
+ */
+struct log_index_entry_t {
+    uint32_t first_time;        // unixtime, when the main node received the first record
+    uint32_t last_time;         // and the last
+    uint32_t offset;            // of the block's first byte in the log file
+    uint32_t length;            // bytes
+    uint8_t nodes[32];          // bit n is set if node n has a record in the block
+};
+
+static_assert(sizeof(log_index_header_t) == LOG_INDEX_HEADER_SIZE, "log_index_header_t is the wrong size");
+static_assert(sizeof(log_index_entry_t) == LOG_INDEX_ENTRY_SIZE, "log_index_entry_t is the wrong size");
+
+/**
+ * @brief The name of the day's file: YYYYMMDD and the extension.
+ * @param unixtime Any time in the day
+ * @param ext The extension, "CSV" or "IDX"
+ * @param name At least LOG_FILE_NAME_LEN chars
+ */
+void log_file_name(uint32_t unixtime, const char *ext, char *name);
+
+/// @return The index header a new index starts with
+log_index_header_t log_index_header();
+
+/// @return True if the entry's block has a record from 'node'
+inline bool log_index_has_node(const log_index_entry_t &e, uint8_t node) {
+    return e.nodes[node / 8] & (1 << (node % 8));
+}
+
+/**
+ * @brief Might the block hold what a query asks for?
+ * @param e The block's entry
+ * @param from The start of the time range (unixtime)
+ * @param to Its end, inclusive
+ * @param node The node; a negative value for any node
+ */
+bool log_index_match(const log_index_entry_t &e, uint32_t from, uint32_t to, int node);
+
+/**
+ * @brief Cut the log into blocks and make their index entries as the
+ * records are logged.
+ */
+class LogIndexer {
+    log_index_entry_t d_block;
+    bool d_open;                // a block has records
+    uint32_t d_end;             // the end of the block's last record
+    uint32_t d_block_bytes;
+    uint32_t d_block_s;
+
+public:
+    LogIndexer(uint32_t block_bytes = LOG_INDEX_BLOCK_BYTES, uint32_t block_s = LOG_INDEX_BLOCK_S)
+        : d_open(false), d_end(0), d_block_bytes(block_bytes), d_block_s(block_s) {}
+
+    /**
+     * @brief A record was logged.
+     * @param offset Where it starts in the log file
+     * @param end Where it ends
+     * @param time When it was received (unixtime)
+     * @param node The node it came from
+     * @param closed Value-result: the entry of the block the record closed
+     * @return True if the record closed a block; the record starts the next
+     */
+    bool record(uint32_t offset, uint32_t end, uint32_t time, uint8_t node, log_index_entry_t *closed);
+
+    /**
+     * @brief Close the block, if it has records: at the end of the day or the file.
+     * @param closed Value-result: the block's entry
+     * @return True if there was a block to close
+     */
+    bool finish(log_index_entry_t *closed);
+
+    /// @return True if a block has records that are not in the index yet
+    bool open() const { return d_open; }
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+  The host's side of the log download protocol; see LogTransfer.h.
+*/
+
+#include "LogTransfer.h"
+
+size_t encode_log_command(uint8_t type, const void *payload, size_t len, uint8_t *out) {
+    if (len > SERIAL_COMMAND_MAX_PAYLOAD)
+        return 0;
+
+    out[0] = 0;
+    return 1 + encode_serial_record(type, 0, payload, len, out + 1);
+}
+
+LogTransferClient::LogTransferClient(log_info_callback_t info, log_data_callback_t data, void *context)
+    : d_info(info), d_data(data), d_context(context), d_offset(0), d_crc(0), d_rewound(false), d_done(false),
+      d_rewinds(0) {
+    memset(&d_end, 0, sizeof(d_end));
+}
+
+size_t LogTransferClient::ack(uint8_t flags, uint8_t *out) {
+    log_ack_t a;
+    memset(&a, 0, sizeof(a));
+    a.offset = d_offset;
+    a.flags = flags;
+    return encode_log_command(LOG_TRANSFER_ACK, &a, sizeof(a), out);
+}
+
+size_t LogTransferClient::list(uint8_t *out) {
+    d_offset = 0;
+    d_crc = 0;
+    d_rewound = false;
+    d_done = false;
+    return encode_log_command(LOG_TRANSFER_LIST, 0, 0, out);
+}
+
+size_t LogTransferClient::read(const char *name, uint32_t offset, uint32_t length, uint8_t window, uint8_t *out) {
+    log_read_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.offset = offset;
+    req.length = length;
+    req.window = window;
+    strncpy(req.name, name, sizeof(req.name) - 1);
+
+    d_offset = offset;
+    d_crc = 0;
+    d_rewound = false;
+    d_done = false;
+    return encode_log_command(LOG_TRANSFER_READ, &req, sizeof(req), out);
+}
+
+size_t LogTransferClient::cancel(uint8_t *out) {
+    return encode_log_command(LOG_TRANSFER_CANCEL, 0, 0, out);
+}
+
+size_t LogTransferClient::record(const serial_record_t &rec, uint8_t *out) {
+    if (d_done)
+        return 0;
+
+    switch (rec.type) {
+        case LOG_TRANSFER_INFO: {
+            if (rec.len < sizeof(log_file_info_t))
+                return 0;
+            log_file_info_t info;
+            memcpy(&info, rec.payload, sizeof(info));
+            info.name[LOG_TRANSFER_NAME_LEN - 1] = '\0';
+            if (d_info)
+                d_info(&info, d_context);
+            return 0;
+        }
+
+        case LOG_TRANSFER_DATA: {
+            if (rec.len < 4)
+                return 0;
+            uint32_t offset;
+            memcpy(&offset, rec.payload, 4);
+            const uint8_t *data = rec.payload + 4;
+            uint16_t len = rec.len - 4;
+
+            // Something before this chunk is missing: ask once for the
+            // main node to go back to it and drop the chunks until it comes
+            if (offset > d_offset) {
+                if (d_rewound)
+                    return 0;
+                d_rewound = true;
+                ++d_rewinds;
+                return ack(LOG_ACK_REWIND, out);
+            }
+
+            // A chunk sent again after the main node went back: the ACK
+            // for it was lost, so send it again
+            if (offset < d_offset)
+                return ack(0, out);
+
+            d_rewound = false;
+            if (d_data && !d_data(offset, data, len, d_context))
+                return cancel(out);
+            d_crc = crc32_update(d_crc, data, len);
+            d_offset += len;
+            return ack(0, out);
+        }
+
+        case LOG_TRANSFER_END:
+            if (rec.len < sizeof(log_transfer_end_t))
+                return 0;
+            memcpy(&d_end, rec.payload, sizeof(d_end));
+            d_done = true;
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+const char *log_transfer_status_string(uint8_t status) {
+    switch (status) {
+        case log_transfer_ok:
+            return "ok";
+        case log_transfer_no_file:
+            return "no such file";
+        case log_transfer_bad_range:
+            return "offset past the end of the file";
+        case log_transfer_read_error:
+            return "read error";
+        case log_transfer_cancelled:
+            return "cancelled";
+        case log_transfer_timed_out:
+            return "timed out";
+        default:
+            return "unknown status";
+    }
+}
@@ -0,0 +1,545 @@
+/*
+  Download files from the main node's SD card over the serial port.
+
+  Getting the logs off the main node used to mean pulling the card, or
+  capturing the serial output live, which misses whatever was logged
+  while no host was listening. This is a protocol for reading any part
+  of any file on the card while the main node keeps running, carried in
+  SerialRecords (see SerialRecord.h), so the node must be in framed
+  mode ('B'). The host sends its records as commands:
+
+    'L' list the files; no payload
+    'R' read a file: log_read_request_t
+    'A' acknowledge data: log_ack_t
+    'C' cancel the listing or the read; no payload
+
+  and the main node answers with:
+
+    'I' a file: log_file_info_t, one record per file
+    'D' data: the offset in the file (4) and up to LOG_TRANSFER_CHUNK bytes
+    'E' the end of a listing or a read: log_transfer_end_t
+
+  A read sends the range as chunks, each one tagged with its offset in
+  the file. Up to 'window' chunks can be waiting for an 'A', which
+  carries the offset the host has everything before; the main node
+  sends the next chunk when that moves up. A chunk that is lost, or
+  whose CRC is bad, shows as a gap in the offsets: the host drops
+  everything after the gap and sends an 'A' for the gap's offset with
+  LOG_ACK_REWIND set, and the main node goes back and sends from there
+  (go-back-N). If the acknowledged offset stays put for
+  LOG_TRANSFER_RESEND_MS, the main node goes back on its own, and if the
+  host sends nothing for LOG_TRANSFER_IDLE_MS, the read is abandoned.
+
+  The 'E' at the end of a read has the CRC-32 of the whole range, which
+  the host checks against what it wrote. To resume a download that
+  stopped, the host reads from the end of what it has.
+
+  The main node's text output and its frame records go on in between;
+  the host skips them. LogTransferServer reads at most one chunk from
+  the card each time service() is called, and main-node.cc calls it only
+  while no frame is waiting, so the radio comes first. A listing or a
+  read that is asked for is started by service(), too. With a ready
+  check (see set_ready_check()), service() does not touch the card while
+  it is busy programming a write, which SdFat would wait out with the
+  SPI bus held.
+
+  All values are little-endian.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef LogTransfer_h
+#define LogTransfer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "CRC32.h"
+#include "SDLogger.h"   // sd_ready_t
+#include "SerialRecord.h"
+
+// O_RDONLY, for opening the files; SdFat.h defines it on the M0
+#ifndef O_RDONLY
+#include <fcntl.h>
+#endif
+
+// Host to main node
+#define LOG_TRANSFER_LIST 'L'
+#define LOG_TRANSFER_READ 'R'
+#define LOG_TRANSFER_ACK 'A'
+#define LOG_TRANSFER_CANCEL 'C'
+
+// Main node to host
+#define LOG_TRANSFER_INFO 'I'
+#define LOG_TRANSFER_DATA 'D'
+#define LOG_TRANSFER_END 'E'
+
+#define LOG_TRANSFER_CHUNK 240          // data bytes in a 'D' record
+#define LOG_TRANSFER_NAME_LEN 13        // 8.3 and a null
+#define LOG_TRANSFER_MAX_WINDOW 16
+
+// Wire bytes of a full 'D' record
+#define LOG_TRANSFER_CHUNK_ENCODED (COBS_MAX_ENCODED(4 + LOG_TRANSFER_CHUNK + SERIAL_RECORD_OVERHEAD) + 1)
+
+#ifndef LOG_TRANSFER_WINDOW
+#define LOG_TRANSFER_WINDOW 8           // when the request asks for 0
+#endif
+
+#ifndef LOG_TRANSFER_RESEND_MS
+#define LOG_TRANSFER_RESEND_MS 1000
+#endif
+
+#ifndef LOG_TRANSFER_IDLE_MS
+#define LOG_TRANSFER_IDLE_MS 30000
+#endif
+
+#define LOG_ACK_REWIND 0x01             // send again from the ACK's offset
+
+/**
+ * @brief How a listing or a read ended.
+ */
+enum LogTransferStatus {
+    log_transfer_ok = 0,
+    log_transfer_no_file,               // the file could not be opened
+    log_transfer_bad_range,             // the offset is past the end of the file
+    log_transfer_read_error,
+    log_transfer_cancelled,
+    log_transfer_timed_out              // the host stopped acknowledging
+};
+
+struct log_read_request_t {
+    uint32_t offset;                    // the first byte to send
+    uint32_t length;                    // bytes to send; 0 for everything to the end of the file
+    uint8_t window;                     // chunks in flight; 0 for LOG_TRANSFER_WINDOW
+    char name[LOG_TRANSFER_NAME_LEN];
+    uint8_t reserved[2];
+};
+
+struct log_ack_t {
+    uint32_t offset;                    // the host has every byte before this
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+
+struct log_file_info_t {
+    uint32_t size;
+    char name[LOG_TRANSFER_NAME_LEN];
+    uint8_t reserved[3];
+};
+
+struct log_transfer_end_t {
+    uint32_t offset;                    // the range sent: its start
+    uint32_t end;                       // and its end
+    uint32_t crc;                       // CRC-32 of the range
+    uint32_t size;                      // the file's size when the read started
+    uint8_t status;                     // LogTransferStatus
+    uint8_t reserved[3];
+};
+
+struct log_chunk_t {
+    uint32_t offset;
+    uint8_t data[LOG_TRANSFER_CHUNK];
+};
+
+static_assert(sizeof(log_read_request_t) == 24, "log_read_request_t is the wrong size");
+static_assert(sizeof(log_ack_t) == 8, "log_ack_t is the wrong size");
+static_assert(sizeof(log_file_info_t) == 20, "log_file_info_t is the wrong size");
+static_assert(sizeof(log_transfer_end_t) == 20, "log_transfer_end_t is the wrong size");
+static_assert(sizeof(log_read_request_t) <= SERIAL_COMMAND_MAX_PAYLOAD, "A read request must fit in a command");
+
+/**
+ * @brief Counters that describe what LogTransferServer has done.
+ */
+struct log_transfer_stats_t {
+    uint32_t reads;         // read requests
+    uint32_t chunks;        // chunks sent, resends included
+    uint32_t bytes;         // file bytes sent, resends included
+    uint32_t rewinds;       // go-backs the host asked for
+    uint32_t timeouts;      // go-backs on LOG_TRANSFER_RESEND_MS
+    uint32_t failed;        // reads that did not end with log_transfer_ok
+    uint32_t deferred;      // service() calls that left the card alone because it was busy
+};
+
+/**
+ * @brief The main node's side: answer the host's listing and read
+ * commands, a little at a time.
+ *
+ * @tparam FileT The file type (SdFile on the M0); it needs SdFat's
+ * open(), openNext(), getName(), isFile(), fileSize(), seekSet(), read()
+ * and close()
+ * @tparam CriticalSection Type with static lock() and unlock(), held
+ * for each card access
+ * @tparam Out Where the records go (a SerialOut); it needs space() and
+ * write_record()
+ */
+template <class FileT, class CriticalSection, class Out>
+class LogTransferServer {
+    enum State { idle, list_requested, listing, read_requested, reading };
+
+    FileT &d_file;
+    FileT &d_dir;
+    Out &d_out;
+
+    State d_state;
+    uint32_t d_start;           // the range being read
+    uint32_t d_end;
+    uint32_t d_size;
+    uint32_t d_next;            // the next byte to send
+    uint32_t d_acked;           // the host has everything before this
+    uint32_t d_crc;             // of the bytes from d_start to d_crc_end
+    uint32_t d_crc_end;
+    uint8_t d_window;
+    uint32_t d_ack_ms;          // when d_acked last moved up, or the read started
+    uint32_t d_heard_ms;        // when the host last sent anything
+    log_read_request_t d_request;   // the read to start
+
+    log_transfer_stats_t d_stats;
+
+    sd_ready_t d_ready;
+
+    // True if the card can be read now. Counts a deferral if not.
+    bool card_ready() {
+        if (!d_ready || d_ready())
+            return true;
+        ++d_stats.deferred;
+        return false;
+    }
+
+    void close() {
+        CriticalSection::lock();
+        if (d_state == listing)
+            d_dir.close();
+        d_file.close();
+        CriticalSection::unlock();
+        d_state = idle;
+    }
+
+    // End the listing or read. If the output has no room for the 'E' it
+    // is dropped, and the host's timeout covers that.
+    void finish(LogTransferStatus status) {
+        log_transfer_end_t end;
+        memset(&end, 0, sizeof(end));
+        end.status = status;
+        if (d_state == reading) {
+            end.offset = d_start;
+            end.end = d_end;
+            end.crc = d_crc;
+            end.size = d_size;
+            if (status != log_transfer_ok)
+                ++d_stats.failed;
+        }
+        close();
+        d_out.write_record(LOG_TRANSFER_END, &end, sizeof(end));
+    }
+
+    void start_list() {
+        CriticalSection::lock();
+        bool status = d_dir.open("/", O_RDONLY);
+        CriticalSection::unlock();
+        d_state = listing;
+        if (!status)
+            finish(log_transfer_no_file);
+    }
+
+    void start_read(const log_read_request_t &req, uint32_t now_ms) {
+        ++d_stats.reads;
+        char name[LOG_TRANSFER_NAME_LEN];
+        memcpy(name, req.name, sizeof(name));
+        name[LOG_TRANSFER_NAME_LEN - 1] = '\0';
+
+        CriticalSection::lock();
+        bool status = d_file.open(name, O_RDONLY);
+        d_size = status ? d_file.fileSize() : 0;
+        CriticalSection::unlock();
+
+        d_state = reading;
+        d_start = d_end = d_next = d_acked = d_crc_end = req.offset;
+        d_crc = 0;
+        d_window = req.window == 0 ? LOG_TRANSFER_WINDOW
+                   : req.window > LOG_TRANSFER_MAX_WINDOW ? LOG_TRANSFER_MAX_WINDOW : req.window;
+        d_ack_ms = d_heard_ms = now_ms;
+
+        if (!status) {
+            finish(log_transfer_no_file);
+            return;
+        }
+        if (req.offset > d_size) {
+            finish(log_transfer_bad_range);
+            return;
+        }
+        d_end = (req.length == 0 || req.length > d_size - req.offset) ? d_size : req.offset + req.length;
+    }
+
+    void ack(const log_ack_t &a, uint32_t now_ms) {
+        if (d_state != reading || a.offset < d_acked || a.offset > d_next)
+            return;
+
+        if (a.offset > d_acked) {
+            d_acked = a.offset;
+            d_ack_ms = now_ms;
+        }
+        if ((a.flags & LOG_ACK_REWIND) && a.offset < d_next) {
+            d_next = a.offset;
+            d_ack_ms = now_ms;
+            ++d_stats.rewinds;
+        }
+    }
+
+    bool send_info() {
+        if (d_out.space() < SERIAL_RECORD_MAX_ENCODED || !card_ready())
+            return false;
+
+        log_file_info_t info;
+        memset(&info, 0, sizeof(info));
+        CriticalSection::lock();
+        bool more = d_file.openNext(&d_dir, O_RDONLY);
+        bool file = more && d_file.isFile();
+        if (file) {
+            d_file.getName(info.name, sizeof(info.name));
+            info.size = d_file.fileSize();
+        }
+        if (more)
+            d_file.close();
+        CriticalSection::unlock();
+
+        if (!more)
+            finish(log_transfer_ok);
+        else if (file)
+            d_out.write_record(LOG_TRANSFER_INFO, &info, sizeof(info));
+        return true;
+    }
+
+    bool send_chunk(uint32_t now_ms) {
+        if (now_ms - d_heard_ms >= LOG_TRANSFER_IDLE_MS) {
+            finish(log_transfer_timed_out);
+            return true;
+        }
+        if (d_out.space() < LOG_TRANSFER_CHUNK_ENCODED)
+            return false;
+        if (d_acked == d_end) {
+            finish(log_transfer_ok);
+            return true;
+        }
+        if (d_next > d_acked && now_ms - d_ack_ms >= LOG_TRANSFER_RESEND_MS) {
+            d_next = d_acked;
+            d_ack_ms = now_ms;
+            ++d_stats.timeouts;
+        }
+        if (d_next == d_end || d_next - d_acked >= (uint32_t)d_window * LOG_TRANSFER_CHUNK)
+            return false;
+        if (!card_ready())
+            return false;
+
+        log_chunk_t chunk;
+        chunk.offset = d_next;
+        uint32_t n = d_end - d_next < LOG_TRANSFER_CHUNK ? d_end - d_next : LOG_TRANSFER_CHUNK;
+        CriticalSection::lock();
+        bool status = d_file.seekSet(d_next) && d_file.read(chunk.data, n) == (int)n;
+        CriticalSection::unlock();
+        if (!status) {
+            finish(log_transfer_read_error);
+            return true;
+        }
+
+        // Chunks go out in order, so each byte is added to the CRC the
+        // first time it is sent
+        if (d_next == d_crc_end) {
+            d_crc = crc32_update(d_crc, chunk.data, n);
+            d_crc_end += n;
+        }
+        d_out.write_record(LOG_TRANSFER_DATA, &chunk, 4 + n);
+        d_next += n;
+        ++d_stats.chunks;
+        d_stats.bytes += n;
+        return true;
+    }
+
+public:
+    /**
+     * @param file Used to read files and, while listing, for each directory entry
+     * @param dir Used for the directory while listing
+     * @param out The main node's serial output
+     */
+    LogTransferServer(FileT &file, FileT &dir, Out &out)
+        : d_file(file), d_dir(dir), d_out(out), d_state(idle), d_start(0), d_end(0), d_size(0), d_next(0),
+          d_acked(0), d_crc(0), d_crc_end(0), d_window(LOG_TRANSFER_WINDOW), d_ack_ms(0), d_heard_ms(0), d_ready(0) {
+        memset(&d_request, 0, sizeof(d_request));
+        memset(&d_stats, 0, sizeof(d_stats));
+    }
+
+    /**
+     * @brief Set the function service() uses to ask if the card is busy.
+     *
+     * While it returns false, service() does not read the card and
+     * returns false.
+     *
+     * @param ready Returns true if the card is ready; null (the default)
+     * means always ready
+     */
+    void set_ready_check(sd_ready_t ready) { d_ready = ready; }
+
+    /**
+     * @brief A record from the host. A listing or read replaces the one
+     * under way, if there is one; the one replaced gets no 'E'. The new
+     * one is started by service(); this does not touch the card.
+     * @param rec The record
+     * @param now_ms The current time in ms (millis())
+     * @return False if the record is not one of this protocol's
+     */
+    bool command(const serial_record_t &rec, uint32_t now_ms) {
+        d_heard_ms = now_ms;
+        switch (rec.type) {
+            case LOG_TRANSFER_LIST: {
+                if (d_state != idle)
+                    close();
+                d_state = list_requested;
+                return true;
+            }
+
+            case LOG_TRANSFER_READ: {
+                if (rec.len < sizeof(log_read_request_t))
+                    return false;
+                if (d_state != idle)
+                    close();
+                memcpy(&d_request, rec.payload, sizeof(d_request));
+                d_state = read_requested;
+                return true;
+            }
+
+            case LOG_TRANSFER_ACK: {
+                if (rec.len < sizeof(log_ack_t))
+                    return false;
+                log_ack_t a;
+                memcpy(&a, rec.payload, sizeof(a));
+                ack(a, now_ms);
+                return true;
+            }
+
+            case LOG_TRANSFER_CANCEL:
+                if (d_state != idle)
+                    finish(log_transfer_cancelled);
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * @brief Start the listing or read that was asked for, or send the
+     * next file entry or chunk if there is room for it.
+     * @note Call this from loop(); it uses the card at most once.
+     * @param now_ms The current time in ms (millis())
+     * @return True if it did something
+     */
+    bool service(uint32_t now_ms) {
+        switch (d_state) {
+            case list_requested:
+                if (!card_ready())
+                    return false;
+                start_list();
+                return true;
+            case read_requested:
+                if (!card_ready())
+                    return false;
+                start_read(d_request, now_ms);
+                return true;
+            case listing:
+                return send_info();
+            case reading:
+                return send_chunk(now_ms);
+            default:
+                return false;
+        }
+    }
+
+    bool busy() const { return d_state != idle; }
+
+    /// @return True if a read was asked for and service() has not started it
+    bool read_pending() const { return d_state == read_requested; }
+
+    const log_transfer_stats_t &stats() const { return d_stats; }
+};
+
+/**
+ * @brief Build the wire form of a command for the main node: a zero,
+ * then the record (see SerialRecord.h).
+ * @param out At least SERIAL_COMMAND_MAX_ENCODED + 2 bytes
+ * @return The number of bytes to send
+ */
+size_t encode_log_command(uint8_t type, const void *payload, size_t len, uint8_t *out);
+
+typedef void (*log_info_callback_t)(const log_file_info_t *info, void *context);
+typedef bool (*log_data_callback_t)(uint32_t offset, const uint8_t *data, uint16_t len, void *context);
+
+/**
+ * @brief The host's side of a listing or a read.
+ *
+ * Build the request, send it and then pass each record from the main
+ * node to record(), sending back whatever it returns. The data comes
+ * to the data callback in order, each byte once.
+ */
+class LogTransferClient {
+    log_info_callback_t d_info;
+    log_data_callback_t d_data;
+    void *d_context;
+
+    uint32_t d_offset;          // the next byte wanted
+    uint32_t d_crc;             // of what has come since the request
+    bool d_rewound;             // asked to go back to d_offset; skip chunks until it comes
+    bool d_done;
+    log_transfer_end_t d_end;
+    uint32_t d_rewinds;
+
+    size_t ack(uint8_t flags, uint8_t *out);
+
+public:
+    LogTransferClient(log_info_callback_t info, log_data_callback_t data, void *context);
+
+    /// @brief The listing command; see encode_log_command()
+    size_t list(uint8_t *out);
+
+    /**
+     * @brief The read command; see encode_log_command()
+     * @param name The file
+     * @param offset The first byte wanted
+     * @param length Bytes wanted; 0 for everything to the end of the file
+     * @param window Chunks in flight; 0 for the main node's default
+     */
+    size_t read(const char *name, uint32_t offset, uint32_t length, uint8_t window, uint8_t *out);
+
+    /// @brief The cancel command; see encode_log_command()
+    size_t cancel(uint8_t *out);
+
+    /**
+     * @brief A record from the main node. Records that are not part of
+     * the protocol are ignored.
+     * @param rec The record
+     * @param out Value-result: the command to send back, if any; at
+     * least SERIAL_COMMAND_MAX_ENCODED + 2 bytes
+     * @return The number of bytes of 'out' to send
+     */
+    size_t record(const serial_record_t &rec, uint8_t *out);
+
+    /// @return True once the 'E' has come
+    bool done() const { return d_done; }
+
+    /// @return True if the read ended well, with all the data, and its CRC matches
+    bool ok() const {
+        return d_done && d_end.status == log_transfer_ok && d_offset == d_end.end && d_crc == d_end.crc;
+    }
+
+    /// @return The 'E' record
+    const log_transfer_end_t &end() const { return d_end; }
+
+    /// @return The next byte wanted: where a read that stopped resumes
+    uint32_t offset() const { return d_offset; }
+
+    uint32_t rewinds() const { return d_rewinds; }
+};
+
+/// @return The status as text
+const char *log_transfer_status_string(uint8_t status);
+
+#endif
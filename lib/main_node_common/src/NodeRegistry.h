@@ -0,0 +1,589 @@
+/*
+  The main node's table of leaf nodes.
+
+  A leaf node that has no address sends a join_request with its 64-bit
+  DevEUI; the main node gives it a one-byte address and remembers the
+  pairing, so the same node gets the same address when it joins again
+  (after a battery change, say). Nodes with hand-configured addresses
+  get an entry the first time they are heard from.
+
+  Each entry also holds what the main node knows about that node: when
+  it was last heard, its last message number, its link statistics and
+  the data rate it was moved to (see LinkAdr.h).
+
+  Message numbers go through a sliding window, as in IPsec's replay
+  protection: the highest number seen and a bitmap of the 32 numbers
+  below it. A number already in the window is a duplicate (a leaf node
+  retry after our reply was lost) and the caller drops it before it is
+  logged or displayed. Numbers skipped over are counted as lost until
+  they turn up late, inside the window. A leaf node restart is checked
+  for first: a number that goes back to NODE_RESTART_MESSAGE or below,
+  or jumps forward by more than NODE_MAX_COUNTER_GAP, is a restart. So
+  is the highest number again with a different time; a retry is the
+  same frame again, so it carries the same time. That catches a node
+  that restarts before it gets past message 1.
+
+  Lookups are O(1). Frames carry the sender's address, so the packet
+  path goes from the address to the entry through a 256-byte index. A
+  join looks the DevEUI up in an open-addressed (linear probing) hash
+  table of entry numbers that is never more than half full.
+
+  The table is saved to a file on the SD card and loaded at boot. The
+  file has two slots and each save goes to the older one, so a save cut
+  short by a reset leaves the previous table intact:
+
+    slot:   magic (4) version (1) record size (1) count (2)
+            generation (4) crc32 (4) records (count * 64)
+
+  The CRC covers the records. All values are little-endian.
+
+  A save is written a chunk (at most 512 bytes) at a time, one chunk
+  each call to save(), with the header last. After each write the card
+  is busy programming it and SdFat would wait that out, holding the SPI
+  bus, at the start of the next one; with a ready check (see
+  set_ready_check()) save() writes nothing while the card is busy.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef NodeRegistry_h
+#define NodeRegistry_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "CRC32.h"
+#include "SDLogger.h"   // sd_ready_t
+
+#ifndef NODE_REGISTRY_MAX
+#define NODE_REGISTRY_MAX 64        // entries; at most 254
+#endif
+
+// Joining nodes get addresses from here up to NODE_LAST_ADDRESS. The
+// addresses below are left for hand-configured nodes. Set the value
+// using the platformio.ini file.
+#ifndef NODE_JOIN_FIRST_ADDRESS
+#define NODE_JOIN_FIRST_ADDRESS 128
+#endif
+
+#define NODE_LAST_ADDRESS 254       // 255 is RadioHead's broadcast address
+
+// A jump in a node's message number bigger than this is a restart, not loss
+#define NODE_MAX_COUNTER_GAP 1000
+
+// A leaf node starts counting its messages from 0 or 1; going back to
+// one of these is a restart, not a duplicate
+#define NODE_RESTART_MESSAGE 1
+
+#define NODE_SEQUENCE_WINDOW 32     // message numbers tracked below the highest
+
+#define NODE_REGISTRY_MAGIC 0x4e545348  // "HSTN"
+#define NODE_REGISTRY_VERSION 4
+#define NODE_REGISTRY_HEADER_SIZE 16
+#define NODE_REGISTRY_SLOT_SIZE 16384   // room for 254 records
+
+#define NODE_JOINED 0x01            // the address was assigned by a join
+#define NODE_HAS_MESSAGE 0x02       // last_message and window are valid
+#define NODE_CLOCK_SET 0x04         // clock_set is valid; see TimeSync.h
+#define NODE_HAS_MESSAGE_TIME 0x08  // message_time is valid
+
+#define NODE_SNR_HISTORY 8          // frames in snr_history
+
+/**
+ * @brief What the main node knows about a leaf node.
+ */
+struct node_state_t {
+    uint64_t dev_eui;       // 0 for a hand-configured node
+    uint32_t last_seen;     // unixtime of the last frame
+    uint32_t last_message;  // highest message number seen
+    uint32_t window;        // bit i: last_message - i was seen
+    uint32_t frames;
+    uint32_t lost;          // messages missing from the message numbers
+    uint32_t duplicates;    // messages seen again
+    int32_t clock_offset;   // the node's time minus ours, s, at its last message
+    uint32_t clock_set;     // when the node was last sent the time (unixtime)
+    uint16_t uplink_interval;   // s between the node's frames; 0 if not known
+    int16_t rssi;           // of the last frame, dBm
+    int8_t snr;             // dB
+    uint8_t flags;
+    uint8_t address;
+    uint8_t spreading_factor;   // the node was moved to this; 0 for the main node's
+    int8_t tx_power;        // the node was told to send at this, dBm; 0 for its default
+    uint8_t adr_spreading_factor;   // sent to the node, waiting for its ACK; 0 if nothing is
+    int8_t adr_tx_power;
+    uint8_t snr_count;      // frames in snr_history
+    uint8_t missed;         // expected frames not heard since the last one
+    int8_t snr_history[NODE_SNR_HISTORY];   // dB, newest first
+    uint8_t message_time[3];    // low 24 bits of the node's time in last_message, little-endian
+};
+
+static_assert(sizeof(node_state_t) == 64, "node_state_t is a 64-byte record in the registry file");
+
+/**
+ * @brief What a call to NodeRegistry::save() did.
+ */
+enum NodeSaveStatus {
+    node_save_done = 0,     // the header is written and synced; the save is complete
+    node_save_more,         // a chunk was written; call save() again
+    node_save_busy,         // the card was busy; nothing was written
+    node_save_failed        // a write failed; the save was given up
+};
+
+/**
+ * @brief Leaf node entries, found by address or by DevEUI.
+ * @tparam MAX_NODES The number of entries, up to 254
+ */
+template <uint16_t MAX_NODES = NODE_REGISTRY_MAX>
+class NodeRegistry {
+    static_assert(MAX_NODES > 0 && MAX_NODES <= 254, "NodeRegistry MAX_NODES must be 1 to 254");
+
+    static const uint8_t NONE = 0xff;
+
+    // A power of two at least twice MAX_NODES
+    static const uint16_t HASH_SLOTS = MAX_NODES <= 8 ? 16 : MAX_NODES <= 16 ? 32 : MAX_NODES <= 32 ? 64
+                                       : MAX_NODES <= 64 ? 128 : MAX_NODES <= 128 ? 256 : 512;
+
+    node_state_t d_nodes[MAX_NODES];
+    uint16_t d_count;
+    uint8_t d_first_join;           // first address to give a joining node
+
+    uint8_t d_index[256];           // address -> entry, or NONE
+    uint8_t d_hash[HASH_SLOTS];     // DevEUI -> entry, or NONE
+
+    uint32_t d_generation;          // of the last save or load
+    bool d_dirty;                   // changed since the last save started, or the last load
+
+    // The save under way: what is written next, the file position it
+    // goes to, and the CRC of the records written so far
+    enum SavePhase { save_idle, save_fill, save_records, save_header, save_sync };
+    SavePhase d_save_phase;
+    uint32_t d_save_pos;
+    uint32_t d_save_crc;
+    uint16_t d_save_count;          // the records this save writes
+
+    sd_ready_t d_ready;
+
+    static uint16_t hash(uint64_t eui) {
+        // Fibonacci hashing; DevEUIs from one vendor differ in their low bytes
+        return (uint16_t)((eui * 0x9e3779b97f4a7c15ULL) >> 48) & (HASH_SLOTS - 1);
+    }
+
+    // The hash slot that holds 'eui', or the empty slot where it would go
+    uint16_t probe(uint64_t eui) const {
+        uint16_t slot = hash(eui);
+        while (d_hash[slot] != NONE && d_nodes[d_hash[slot]].dev_eui != eui)
+            slot = (slot + 1) & (HASH_SLOTS - 1);
+        return slot;
+    }
+
+    node_state_t *add(uint8_t address, uint64_t dev_eui, uint8_t flags) {
+        if (d_count == MAX_NODES)
+            return 0;
+        uint8_t i = d_count++;
+        node_state_t &n = d_nodes[i];
+        memset(&n, 0, sizeof(n));
+        n.address = address;
+        n.dev_eui = dev_eui;
+        n.flags = flags;
+        d_index[address] = i;
+        if (dev_eui)
+            d_hash[probe(dev_eui)] = i;
+        d_dirty = true;
+        return &n;
+    }
+
+    static uint32_t message_time(const node_state_t &n) {
+        return n.message_time[0] | (uint32_t)n.message_time[1] << 8 | (uint32_t)n.message_time[2] << 16;
+    }
+
+    uint32_t save_slot() const { return ((d_generation + 1) % 2) * NODE_REGISTRY_SLOT_SIZE; }
+
+    // Give up the save under way; what it wrote is in the older slot, so
+    // the last good save is still there
+    NodeSaveStatus save_failed() {
+        d_save_phase = save_idle;
+        d_dirty = true;
+        return node_save_failed;
+    }
+
+public:
+    NodeRegistry(uint8_t first_join_address = NODE_JOIN_FIRST_ADDRESS) : d_first_join(first_join_address), d_ready(0) {
+        clear();
+    }
+
+    /**
+     * @brief Set the function save() and load() use to ask if the card
+     * is busy.
+     *
+     * While it returns false, save() writes nothing and returns
+     * node_save_busy, and load() waits before each read.
+     *
+     * @param ready Returns true if the card is ready; null (the default)
+     * means always ready
+     */
+    void set_ready_check(sd_ready_t ready) { d_ready = ready; }
+
+    void clear() {
+        d_count = 0;
+        memset(d_index, NONE, sizeof(d_index));
+        memset(d_hash, NONE, sizeof(d_hash));
+        d_generation = 0;
+        d_dirty = false;
+        d_save_phase = save_idle;
+    }
+
+    /**
+     * @brief The entry for an address.
+     * @return The entry, or null if the node has not been heard from
+     */
+    node_state_t *node(uint8_t address) {
+        return d_index[address] == NONE ? 0 : &d_nodes[d_index[address]];
+    }
+
+    const node_state_t *node(uint8_t address) const {
+        return d_index[address] == NONE ? 0 : &d_nodes[d_index[address]];
+    }
+
+    /**
+     * @brief The address given to a DevEUI.
+     * @return The address, or 0 if the DevEUI has not joined
+     */
+    uint8_t address_of(uint64_t dev_eui) const {
+        if (dev_eui == 0)
+            return 0;
+        uint8_t i = d_hash[probe(dev_eui)];
+        return i == NONE ? 0 : d_nodes[i].address;
+    }
+
+    /**
+     * @brief Give a joining node an address.
+     * A DevEUI that joined before gets its old address back.
+     * @param dev_eui The node's DevEUI; not 0
+     * @param now The time (unixtime)
+     * @return The address, or 0 if the DevEUI is 0 or there are no
+     * free addresses or entries
+     */
+    uint8_t join(uint64_t dev_eui, uint32_t now) {
+        if (dev_eui == 0)
+            return 0;
+        uint8_t i = d_hash[probe(dev_eui)];
+        if (i != NONE) {
+            d_nodes[i].last_seen = now;
+            return d_nodes[i].address;
+        }
+
+        for (uint16_t address = d_first_join; address <= NODE_LAST_ADDRESS; ++address) {
+            if (d_index[address] != NONE)
+                continue;
+            node_state_t *n = add(address, dev_eui, NODE_JOINED);
+            if (!n)
+                return 0;
+            n->last_seen = now;
+            return address;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Record a frame from a node. A hand-configured node gets an
+     * entry the first time it is heard from.
+     * @return The node's entry, or null if the table is full or 'from'
+     * is not a leaf node address
+     */
+    node_state_t *saw_frame(uint8_t from, uint32_t now, int16_t rssi, int8_t snr) {
+        if (from == 0 || from > NODE_LAST_ADDRESS)
+            return 0;
+        node_state_t *n = node(from);
+        if (!n && !(n = add(from, 0, 0)))
+            return 0;
+        n->last_seen = now;
+        n->rssi = rssi;
+        n->snr = snr;
+        ++n->frames;
+        return n;
+    }
+
+    /**
+     * @brief Record the message number of a data frame, counting the
+     * messages missing before it and duplicates.
+     * @param from The node's address
+     * @param message The message number
+     * @param node_time The node's time in the message (the reading's, for
+     * one reading of a batch)
+     * @return False if the node sent this message before; true if it is
+     * new, or the node has no entry
+     */
+    bool saw_message(uint8_t from, uint32_t message, uint32_t node_time) {
+        node_state_t *n = node(from);
+        if (!n)
+            return true;
+
+        uint32_t highest = n->last_message;
+        bool known = n->flags & NODE_HAS_MESSAGE;
+        bool same_time = !(n->flags & NODE_HAS_MESSAGE_TIME) || message_time(*n) == (node_time & 0xffffff);
+        bool in_window = known && message <= highest && highest - message < NODE_SEQUENCE_WINDOW;
+        uint32_t bit = in_window ? 1UL << (highest - message) : 0;
+
+        if (!known || (message == highest && !same_time) || (message < highest && message <= NODE_RESTART_MESSAGE)
+            || (message > highest && message - highest > NODE_MAX_COUNTER_GAP)) {
+            n->window = 1;
+        }
+        else if (n->window & bit) {
+            ++n->duplicates;
+            return false;
+        }
+        else if (message > highest) {
+            uint32_t gap = message - highest;
+            n->lost += gap - 1;
+            n->window = gap < NODE_SEQUENCE_WINDOW ? n->window << gap | 1 : 1;
+        }
+        else if (in_window) {
+            // Late, and counted as lost when the window moved past it
+            n->window |= bit;
+            if (n->lost)
+                --n->lost;
+            return true;
+        }
+        else {
+            // Older than the window: too late to tell, so let it through
+            return true;
+        }
+
+        n->last_message = message;
+        n->message_time[0] = node_time;
+        n->message_time[1] = node_time >> 8;
+        n->message_time[2] = node_time >> 16;
+        n->flags |= NODE_HAS_MESSAGE | NODE_HAS_MESSAGE_TIME;
+        return true;
+    }
+
+    uint16_t count() const { return d_count; }
+    static uint16_t capacity() { return MAX_NODES; }
+
+    /// @return The i'th entry, 0 <= i < count()
+    node_state_t &entry(uint16_t i) { return d_nodes[i]; }
+    const node_state_t &entry(uint16_t i) const { return d_nodes[i]; }
+
+    /// @return True if an address was assigned or a node added since the last save started
+    bool dirty() const { return d_dirty; }
+
+    /// @return True if a save was started and is not complete
+    bool saving() const { return d_save_phase != save_idle; }
+
+    /// @return The longest probe sequence in the DevEUI hash table
+    uint16_t max_probe() const {
+        uint16_t longest = 0;
+        for (uint16_t i = 0; i < d_count; ++i) {
+            if (!d_nodes[i].dev_eui)
+                continue;
+            uint16_t len = 1;
+            for (uint16_t slot = hash(d_nodes[i].dev_eui); d_hash[slot] != i; slot = (slot + 1) & (HASH_SLOTS - 1))
+                ++len;
+            if (len > longest)
+                longest = len;
+        }
+        return longest;
+    }
+
+    /**
+     * @brief Save the table in the file's older slot, a chunk at a time.
+     *
+     * The first call starts a save of the entries there are then; each
+     * call writes one chunk, in its own critical section. The records go
+     * first and the header last, so the slot is not valid until it is
+     * complete. The CRC is of the records as they were written, so
+     * entries that change while the save is under way are saved as they
+     * were when their chunk was written; a node added while it is under
+     * way makes the table dirty again, for the next save.
+     *
+     * @tparam FileT The file type (SdFile on the M0), open for reading
+     * and writing
+     * @tparam CriticalSection Type with static lock() and unlock()
+     * @return node_save_more until the save is complete
+     */
+    template <class FileT, class CriticalSection>
+    NodeSaveStatus save(FileT &file) {
+        uint32_t slot = save_slot();
+        uint32_t records = slot + NODE_REGISTRY_HEADER_SIZE;
+        if (d_save_phase == save_idle) {
+            // SdFat can't seek past the end of a file: a new file is
+            // extended to the start of the records the first time a slot
+            // is used. fileSize() does not read the card.
+            CriticalSection::lock();
+            uint32_t size = file.fileSize();
+            CriticalSection::unlock();
+            d_save_phase = size < records ? save_fill : save_records;
+            d_save_pos = size < records ? size : records;
+            d_save_crc = 0;
+            d_save_count = d_count;
+            d_dirty = false;
+        }
+
+        if (d_ready && !d_ready())
+            return node_save_busy;
+
+        static const uint8_t zeros[512] = {0};
+        uint32_t end = records + d_save_count * sizeof(node_state_t);
+        uint32_t n;
+        bool status;
+        switch (d_save_phase) {
+            case save_fill:
+                n = records - d_save_pos < 512 ? records - d_save_pos : 512;
+                CriticalSection::lock();
+                status = file.seekSet(d_save_pos) && file.write(zeros, n) == n;
+                CriticalSection::unlock();
+                if (!status)
+                    return save_failed();
+                d_save_pos += n;
+                if (d_save_pos == records)
+                    d_save_phase = save_records;
+                return node_save_more;
+
+            case save_records: {
+                if (d_save_pos < end) {
+                    n = end - d_save_pos < 512 ? end - d_save_pos : 512;
+                    const uint8_t *data = (const uint8_t *)d_nodes + (d_save_pos - records);
+                    CriticalSection::lock();
+                    status = file.seekSet(d_save_pos) && file.write(data, n) == n;
+                    CriticalSection::unlock();
+                    if (!status)
+                        return save_failed();
+                    d_save_crc = crc32_update(d_save_crc, data, n);
+                    d_save_pos += n;
+                }
+                if (d_save_pos == end)
+                    d_save_phase = save_header;
+                return node_save_more;
+            }
+
+            case save_header: {
+                uint8_t header[NODE_REGISTRY_HEADER_SIZE];
+                put_header(header, d_save_count, d_generation + 1, d_save_crc);
+                CriticalSection::lock();
+                status = file.seekSet(slot) && file.write(header, sizeof(header)) == sizeof(header);
+                CriticalSection::unlock();
+                if (!status)
+                    return save_failed();
+                d_save_phase = save_sync;
+                return node_save_more;
+            }
+
+            case save_sync:
+                CriticalSection::lock();
+                status = file.sync();
+                CriticalSection::unlock();
+                if (!status)
+                    return save_failed();
+                ++d_generation;
+                d_save_phase = save_idle;
+                return node_save_done;
+
+            default:
+                return save_failed();
+        }
+    }
+
+    /**
+     * @brief Load the newest good slot of a file written by save().
+     * @note Each read is done in its own critical section, once the card
+     * is ready. This waits for the card; the main node loads the table
+     * at startup, before the radio is listening.
+     * @tparam FileT The file type, open for reading
+     * @tparam CriticalSection Type with static lock() and unlock()
+     * @return True if a table was loaded; if not, the table is empty
+     */
+    template <class FileT, class CriticalSection>
+    bool load(FileT &file) {
+        uint8_t headers[2][NODE_REGISTRY_HEADER_SIZE];
+        bool valid[2];
+        uint16_t count[2];
+        uint32_t generation[2], crc[2];
+        for (int s = 0; s < 2; ++s) {
+            wait_ready();
+            CriticalSection::lock();
+            valid[s] = file.seekSet(s * NODE_REGISTRY_SLOT_SIZE)
+                       && file.read(headers[s], NODE_REGISTRY_HEADER_SIZE) == NODE_REGISTRY_HEADER_SIZE;
+            CriticalSection::unlock();
+            valid[s] = valid[s] && get_header(headers[s], &count[s], &generation[s], &crc[s]);
+        }
+
+        // Try the newer slot first, then the older one
+        int first = valid[1] && (!valid[0] || generation[1] > generation[0]) ? 1 : 0;
+        for (int k = 0; k < 2; ++k) {
+            int s = k == 0 ? first : 1 - first;
+            if (valid[s] && load_slot<FileT, CriticalSection>(file, s * NODE_REGISTRY_SLOT_SIZE, count[s], crc[s])) {
+                d_generation = generation[s];
+                d_dirty = false;
+                return true;
+            }
+        }
+        clear();
+        return false;
+    }
+
+private:
+    // Ask until the card is ready; the bus is free between the checks
+    void wait_ready() const {
+        while (d_ready && !d_ready())
+            ;
+    }
+
+    static void put_u32(uint8_t *p, uint32_t v) {
+        for (int i = 0; i < 4; ++i)
+            p[i] = v >> (8 * i);
+    }
+
+    static uint32_t get_u32(const uint8_t *p) {
+        return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static void put_header(uint8_t *h, uint16_t count, uint32_t generation, uint32_t crc) {
+        put_u32(h, NODE_REGISTRY_MAGIC);
+        h[4] = NODE_REGISTRY_VERSION;
+        h[5] = sizeof(node_state_t);
+        h[6] = count;
+        h[7] = count >> 8;
+        put_u32(h + 8, generation);
+        put_u32(h + 12, crc);
+    }
+
+    static bool get_header(const uint8_t *h, uint16_t *count, uint32_t *generation, uint32_t *crc) {
+        if (get_u32(h) != NODE_REGISTRY_MAGIC || h[4] != NODE_REGISTRY_VERSION || h[5] != sizeof(node_state_t))
+            return false;
+        *count = h[6] | h[7] << 8;
+        *generation = get_u32(h + 8);
+        *crc = get_u32(h + 12);
+        return *count <= MAX_NODES;
+    }
+
+    template <class FileT, class CriticalSection>
+    bool load_slot(FileT &file, uint32_t slot, uint16_t count, uint32_t crc) {
+        clear();
+        uint32_t bytes = count * sizeof(node_state_t);
+        bool status = true;
+        for (uint32_t done = 0; status && done < bytes; done += 512) {
+            uint32_t n = bytes - done < 512 ? bytes - done : 512;
+            wait_ready();
+            CriticalSection::lock();
+            status = file.seekSet(slot + NODE_REGISTRY_HEADER_SIZE + done)
+                     && file.read((uint8_t *)d_nodes + done, n) == (int)n;
+            CriticalSection::unlock();
+        }
+        if (!status || crc32_update(0, d_nodes, bytes) != crc)
+            return false;
+
+        // Rebuild the index and the hash table, skipping anything
+        // inconsistent. add() writes entry d_count, which is never past i.
+        for (uint16_t i = 0; i < count; ++i) {
+            node_state_t r = d_nodes[i];
+            if (r.address == 0 || r.address > NODE_LAST_ADDRESS || d_index[r.address] != NONE
+                || (r.dev_eui && address_of(r.dev_eui)))
+                continue;
+            node_state_t *n = add(r.address, r.dev_eui, r.flags);
+            *n = r;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  Asynchronous outbound message engine for the main node.
+  See OutboundEngine.h
+*/
+
+#include <string.h>
+
+#include "OutboundEngine.h"
+
+OutboundEngine::OutboundEngine(OutboundTransport &transport, uint16_t timeout_ms, uint8_t retries,
+                               outbound_callback_t callback)
+    : d_transport(transport), d_callback(callback), d_head(0), d_count(0), d_state(outbound_idle), d_id(0),
+      d_retransmissions(0), d_acked(false), d_deadline_ms(0), d_timeout_ms(timeout_ms), d_retries(retries),
+      d_sent(0), d_failed(0), d_dropped(0) {
+}
+
+/**
+ * @brief Queue a message for reliable delivery.
+ * @param to Destination node
+ * @param buf The message; it is copied
+ * @param len Length of the message, at most OUTBOUND_MAX_LEN
+ * @param now_ms The current time (millis())
+ * @param tag The caller's; it is passed back in the message's outbound_result_t
+ * @return False if the message is too long or the queue is full
+ */
+bool OutboundEngine::enqueue(uint8_t to, const void *buf, uint8_t len, uint32_t now_ms, uint8_t tag) {
+    if (len > OUTBOUND_MAX_LEN || d_count == OUTBOUND_QUEUE_LEN) {
+        ++d_dropped;
+        return false;
+    }
+
+    entry_t &e = d_queue[(d_head + d_count) % OUTBOUND_QUEUE_LEN];
+    e.to = to;
+    e.len = len;
+    e.tag = tag;
+    memcpy(e.data, buf, len);
+    e.queued_ms = now_ms;
+    ++d_count;
+
+    return true;
+}
+
+/**
+ * @brief Transmit the message at the head of the queue.
+ */
+void OutboundEngine::start(bool retry, uint32_t now_ms) {
+    const entry_t &e = d_queue[d_head];
+    if (!retry) {
+        ++d_id;
+        d_retransmissions = 0;
+        d_acked = false;
+    }
+
+    if (d_transport.start_send(e.to, d_id, e.data, e.len, retry)) {
+        d_state = outbound_transmitting;
+    } else {
+        // The radio would not take the frame; count it as a lost try
+        // and let the timeout decide what comes next.
+        d_state = outbound_waiting_for_ack;
+        d_deadline_ms = now_ms + d_timeout_ms;
+    }
+}
+
+/**
+ * @brief Report the message at the head of the queue and remove it.
+ */
+void OutboundEngine::finish(bool acked, uint32_t now_ms) {
+    const entry_t &e = d_queue[d_head];
+
+    outbound_result_t result;
+    result.to = e.to;
+    result.id = d_id;
+    result.tag = e.tag;
+    result.acked = acked;
+    result.retransmissions = d_retransmissions;
+    result.duration_ms = now_ms - e.queued_ms;
+
+    if (acked)
+        ++d_sent;
+    else
+        ++d_failed;
+
+    d_head = (d_head + 1) % OUTBOUND_QUEUE_LEN;
+    --d_count;
+    d_state = outbound_idle;
+
+    if (d_callback)
+        d_callback(&result);
+}
+
+/**
+ * @brief Advance the state machine; call this every time through loop().
+ *
+ * Never blocks. At most one frame is started per call.
+ *
+ * @param now_ms The current time (millis())
+ */
+void OutboundEngine::service(uint32_t now_ms) {
+    switch (d_state) {
+        case outbound_idle:
+            if (d_count > 0)
+                start(false, now_ms);
+            break;
+
+        case outbound_transmitting:
+            if (d_acked) {
+                finish(true, now_ms);
+            } else if (d_transport.send_done()) {
+                d_state = outbound_waiting_for_ack;
+                d_deadline_ms = now_ms + d_timeout_ms;
+            }
+            break;
+
+        case outbound_waiting_for_ack:
+            if (d_acked) {
+                finish(true, now_ms);
+            } else if ((int32_t)(now_ms - d_deadline_ms) >= 0) {
+                if (d_retransmissions < d_retries) {
+                    ++d_retransmissions;
+                    start(true, now_ms);
+                } else {
+                    finish(false, now_ms);
+                }
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Tell the engine an ACK arrived.
+ *
+ * ACKs that do not match the message in flight (late ACKs for a
+ * message that was already retransmitted and ACK'd, say) are ignored.
+ *
+ * @param from The node that sent the ACK
+ * @param id The header id of the ACK
+ */
+void OutboundEngine::on_ack(uint8_t from, uint8_t id) {
+    if (d_state == outbound_idle)
+        return;
+
+    if (from == d_queue[d_head].to && id == d_id)
+        d_acked = true;
+}
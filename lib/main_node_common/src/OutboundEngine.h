@@ -0,0 +1,130 @@
+/*
+  Asynchronous outbound message engine for the main node.
+
+  RHReliableDatagram::sendtoWait() transmits, then blocks waiting for the
+  ACK and retransmits on each timeout. While it waits it drops any other
+  message that arrives, so a reply to one leaf node (~540 ms in our logs)
+  makes the main node deaf to all the others.
+
+  This engine keeps a small bounded queue of outbound messages and runs
+  the transmit/wait-for-ACK/retry cycle as a state machine advanced by
+  service(), which loop() calls every time through. Frames that arrive
+  while a reply is waiting for its ACK are received and processed as
+  usual; the ACKs are routed to the engine with on_ack().
+
+  The radio is reached through the OutboundTransport interface so the
+  engine can be tested in the native env.
+*/
+
+#ifndef OutboundEngine_h
+#define OutboundEngine_h
+
+#include <stdint.h>
+
+#ifndef OUTBOUND_QUEUE_LEN
+#define OUTBOUND_QUEUE_LEN 4
+#endif
+
+#define OUTBOUND_MAX_LEN 32 // Bytes; our replies are 4 to 12 bytes
+
+/**
+ * @brief How the engine sends a frame.
+ */
+class OutboundTransport {
+public:
+    virtual ~OutboundTransport() {}
+
+    /**
+     * @brief Start sending a frame. Return once the frame is handed to the
+     * radio; do not wait for it to be transmitted.
+     * @param to Destination node
+     * @param id The header id; the ACK must match it
+     * @param retry True if this is a retransmission
+     * @return True if the radio accepted the frame
+     */
+    virtual bool start_send(uint8_t to, uint8_t id, const uint8_t *buf, uint8_t len, bool retry) = 0;
+
+    /// @return True once the frame passed to start_send() is on the air
+    virtual bool send_done() = 0;
+};
+
+/**
+ * @brief The outcome of one outbound message, passed to the completion callback.
+ */
+struct outbound_result_t {
+    uint8_t to;
+    uint8_t id;
+    uint8_t tag;            // what was passed to enqueue()
+    bool acked;
+    uint8_t retransmissions;
+    uint32_t duration_ms;   // enqueue to ACK (or to giving up)
+};
+
+typedef void (*outbound_callback_t)(const outbound_result_t *result);
+
+enum OutboundState {
+    outbound_idle,
+    outbound_transmitting,
+    outbound_waiting_for_ack
+};
+
+/**
+ * @brief Bounded queue of outbound messages and the state machine that sends them.
+ */
+class OutboundEngine {
+    struct entry_t {
+        uint8_t to;
+        uint8_t len;
+        uint8_t tag;
+        uint8_t data[OUTBOUND_MAX_LEN];
+        uint32_t queued_ms;
+    };
+
+    OutboundTransport &d_transport;
+    outbound_callback_t d_callback;
+
+    entry_t d_queue[OUTBOUND_QUEUE_LEN];
+    uint8_t d_head;     // next to send
+    uint8_t d_count;
+
+    OutboundState d_state;
+    uint8_t d_id;
+    uint8_t d_retransmissions;
+    bool d_acked;
+    uint32_t d_deadline_ms;
+
+    uint16_t d_timeout_ms;
+    uint8_t d_retries;
+
+    uint32_t d_sent;
+    uint32_t d_failed;
+    uint32_t d_dropped;
+
+    void start(bool retry, uint32_t now_ms);
+    void finish(bool acked, uint32_t now_ms);
+
+public:
+    /**
+     * @param transport Sends frames
+     * @param timeout_ms Wait this long for an ACK (see RHReliableDatagram::setTimeout())
+     * @param retries Retransmit this many times before giving up
+     * @param callback Called when a message is ACK'd or abandoned; may be null
+     */
+    OutboundEngine(OutboundTransport &transport, uint16_t timeout_ms, uint8_t retries,
+                   outbound_callback_t callback = 0);
+
+    bool enqueue(uint8_t to, const void *buf, uint8_t len, uint32_t now_ms, uint8_t tag = 0);
+    void service(uint32_t now_ms);
+    void on_ack(uint8_t from, uint8_t id);
+
+    /// @return True if nothing is queued or in progress
+    bool idle() const { return d_state == outbound_idle && d_count == 0; }
+    OutboundState state() const { return d_state; }
+    uint8_t queued() const { return d_count; }
+
+    uint32_t sent() const { return d_sent; }
+    uint32_t failed() const { return d_failed; }
+    uint32_t dropped() const { return d_dropped; }
+};
+
+#endif
@@ -0,0 +1,233 @@
+/*
+  Serial ports a host reads together, for host-tools' node_collector.
+  This is Linux only (epoll) and, unlike the rest of this library, does
+  not build for the M0; it is all in this header so that only the host
+  code that includes it compiles it.
+
+  A PortSet is given the ports' paths. It opens each one raw, without
+  blocking, and waits on all of them with one epoll_wait(). When a port
+  has bytes, they go to the data callback. A port that is unplugged (a
+  read returns 0 or fails, or the port hangs up) is closed, and one that
+  is not there, or can't be opened, is tried again every retry_ms. So a
+  main node that is unplugged and plugged back in comes back on its own;
+  use the /dev/serial/by-id/ names, since the ttyACM number can change.
+
+  The state callback is called when a port is opened or closed; a
+  freshly opened main node is in text mode, so that is when to send it
+  'B'. Ports are numbered in the order they were added.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef PortSet_h
+#define PortSet_h
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT_SET_MAX 16
+#define PORT_RETRY_MS 1000
+
+struct port_stats_t {
+    uint32_t opens;
+    uint32_t closes;        // unplugged, or a read failed
+    uint64_t bytes;
+};
+
+typedef void (*port_data_fn_t)(uint8_t port, const uint8_t *data, size_t len, void *context);
+typedef void (*port_state_fn_t)(uint8_t port, bool open, void *context);
+
+/**
+ * @brief Serial ports read with epoll, reopened when they come back.
+ */
+class PortSet {
+    struct port_t {
+        const char *path;
+        int fd;
+        uint32_t retry_ms;      // when to try to open it next
+        port_stats_t stats;
+    };
+
+    port_t d_ports[PORT_SET_MAX];
+    uint8_t d_count;
+    int d_epoll;
+    uint32_t d_retry_ms;
+
+    port_data_fn_t d_data;
+    port_state_fn_t d_state;
+    void *d_context;
+
+    bool open_port(uint8_t i) {
+        port_t &p = d_ports[i];
+        int fd = ::open(p.path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        // Raw; the baud rate does not matter over USB
+        struct termios t;
+        if (tcgetattr(fd, &t) == 0) {
+            cfmakeraw(&t);
+            cfsetspeed(&t, B115200);
+            tcsetattr(fd, TCSANOW, &t);
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = i;
+        if (epoll_ctl(d_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        p.fd = fd;
+        ++p.stats.opens;
+        if (d_state)
+            d_state(i, true, d_context);
+        return true;
+    }
+
+    void close_port(uint8_t i) {
+        port_t &p = d_ports[i];
+        epoll_ctl(d_epoll, EPOLL_CTL_DEL, p.fd, 0);
+        ::close(p.fd);
+        p.fd = -1;
+        p.retry_ms = now_ms() + d_retry_ms;
+        ++p.stats.closes;
+        if (d_state)
+            d_state(i, false, d_context);
+    }
+
+    // Read until the port has nothing more; false if it went away
+    bool drain(uint8_t i) {
+        port_t &p = d_ports[i];
+        uint8_t buf[4096];
+        for (;;) {
+            ssize_t n = ::read(p.fd, buf, sizeof(buf));
+            if (n > 0) {
+                p.stats.bytes += n;
+                d_data(i, buf, n, d_context);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+public:
+    /**
+     * @param data Called with each port's bytes as they are read
+     * @param state Called when a port is opened or closed; may be null
+     * @param retry_ms How often to try a closed port
+     */
+    PortSet(port_data_fn_t data, port_state_fn_t state, void *context, uint32_t retry_ms = PORT_RETRY_MS)
+        : d_count(0), d_epoll(epoll_create1(EPOLL_CLOEXEC)), d_retry_ms(retry_ms), d_data(data), d_state(state),
+          d_context(context) {}
+
+    ~PortSet() {
+        for (uint8_t i = 0; i < d_count; ++i) {
+            if (d_ports[i].fd >= 0)
+                ::close(d_ports[i].fd);
+        }
+        if (d_epoll >= 0)
+            ::close(d_epoll);
+    }
+
+    /// @return A monotonic clock in ms, the one the retries use
+    static uint32_t now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    /**
+     * @brief Add a port; it is opened on the next poll().
+     * @param path Not copied; it must outlive the set
+     * @return The port's number, or -1 if the set is full or epoll failed
+     */
+    int8_t add(const char *path) {
+        if (d_epoll < 0 || d_count == PORT_SET_MAX)
+            return -1;
+        port_t &p = d_ports[d_count];
+        memset(&p, 0, sizeof(p));
+        p.path = path;
+        p.fd = -1;
+        p.retry_ms = now_ms();
+        return d_count++;
+    }
+
+    /**
+     * @brief Open the closed ports that are due, then wait for bytes
+     * and pass them on.
+     * @param timeout_ms The longest to wait; less if a port is due to be
+     * tried sooner
+     * @return The number of ports that had bytes or changed state, or
+     * -1 if epoll_wait() failed (EINTR included, so a signal can stop
+     * the caller's loop)
+     */
+    int poll(int timeout_ms) {
+        int changed = 0;
+        uint32_t now = now_ms();
+        for (uint8_t i = 0; i < d_count; ++i) {
+            port_t &p = d_ports[i];
+            if (p.fd >= 0)
+                continue;
+            int32_t wait = (int32_t)(p.retry_ms - now);
+            if (wait > 0) {
+                if (wait < timeout_ms)
+                    timeout_ms = wait;
+            }
+            else if (open_port(i)) {
+                ++changed;
+            }
+            else {
+                p.retry_ms = now + d_retry_ms;
+                if ((int)d_retry_ms < timeout_ms)
+                    timeout_ms = d_retry_ms;
+            }
+        }
+        if (changed)
+            timeout_ms = 0;
+
+        struct epoll_event events[PORT_SET_MAX];
+        int n = epoll_wait(d_epoll, events, PORT_SET_MAX, timeout_ms);
+        if (n < 0)
+            return -1;
+
+        for (int e = 0; e < n; ++e) {
+            uint8_t i = events[e].data.u32;
+            if (d_ports[i].fd < 0)
+                continue;
+            // Read what is left before a hang-up is acted on
+            bool ok = drain(i);
+            if (!ok || (events[e].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)))
+                close_port(i);
+            ++changed;
+        }
+        return changed;
+    }
+
+    /**
+     * @brief Send a port bytes; a short write is dropped, these are single
+     * commands.
+     * @return False if the port is closed or the write failed
+     */
+    bool write(uint8_t port, const void *data, size_t len) {
+        const port_t &p = d_ports[port];
+        return p.fd >= 0 && ::write(p.fd, data, len) == (ssize_t)len;
+    }
+
+    uint8_t count() const { return d_count; }
+    const char *path(uint8_t port) const { return d_ports[port].path; }
+    bool is_open(uint8_t port) const { return d_ports[port].fd >= 0; }
+    const port_stats_t &stats(uint8_t port) const { return d_ports[port].stats; }
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+  Queue of received frames, filled from the radio's receive-done
+  interrupt and drained by loop().
+
+  RadioHead's RH_RF95 holds one received frame. Once it has one it puts
+  the radio in idle mode and it stays deaf until loop() gets around to
+  reading that frame and calling available() again. Since loop() prints,
+  logs, ACKs and updates the TFT for each frame, a second uplink from
+  another node that arrives in that time is lost.
+
+  With this queue, the DIO0 interrupt handler copies each frame out of
+  the radio, along with the time it arrived and its RSSI and SNR, and
+  puts the radio straight back into receive mode. loop() takes the
+  frames off the queue at its own pace.
+
+  There is one producer (the interrupt handler) and one consumer
+  (loop()), so no lock is needed: the producer writes a slot and then
+  publishes it by advancing the head; the consumer reads a slot and then
+  frees it by advancing the tail. Each index is written by one side only.
+  If the queue is full, the new frame is dropped and counted.
+*/
+
+#ifndef RxQueue_h
+#define RxQueue_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#ifndef RX_QUEUE_DEPTH
+#define RX_QUEUE_DEPTH 8
+#endif
+
+// Payload bytes. Most messages are 15 to 32 bytes, but a batch
+// (BatchMessage.h) can use the whole of RH_RF95_MAX_MESSAGE_LEN.
+#define RX_FRAME_MAX_LEN 251
+
+/**
+ * @brief A received frame and what the radio said about it.
+ */
+struct rx_frame_t {
+    uint32_t rx_ms;     // millis() in the receive-done interrupt
+    int16_t rssi;
+    int8_t snr;
+    uint8_t to;         // RadioHead header
+    uint8_t from;
+    uint8_t id;
+    uint8_t flags;
+    uint8_t len;        // of data
+    uint8_t data[RX_FRAME_MAX_LEN];
+};
+
+/**
+ * @brief Single-producer/single-consumer ring of received frames.
+ * @tparam DEPTH The number of frames held; a power of two
+ */
+template <uint16_t DEPTH = RX_QUEUE_DEPTH>
+class RxQueue {
+    static_assert(DEPTH > 0 && (DEPTH & (DEPTH - 1)) == 0, "RxQueue DEPTH must be a power of two");
+
+    rx_frame_t d_frames[DEPTH];
+
+    // Free-running counts of frames published and freed. head - tail is
+    // the number of frames in the queue.
+    std::atomic<uint32_t> d_head;   // written by the producer
+    std::atomic<uint32_t> d_tail;   // written by the consumer
+
+    // Written by the producer
+    volatile uint32_t d_pushed;
+    volatile uint32_t d_overflows;
+    volatile uint32_t d_oversize;
+    volatile uint16_t d_high_water;
+
+public:
+    RxQueue() : d_head(0), d_tail(0), d_pushed(0), d_overflows(0), d_oversize(0), d_high_water(0) {}
+
+    /**
+     * @brief Get the next free slot.
+     * @note Producer only. Fill the slot and then call commit().
+     * @return The slot, or null if the queue is full. A null return
+     * counts as an overflow; the caller drops the frame.
+     */
+    rx_frame_t *reserve() {
+        uint32_t head = d_head.load(std::memory_order_relaxed);
+        if (head - d_tail.load(std::memory_order_acquire) >= DEPTH) {
+            d_overflows = d_overflows + 1;
+            return 0;
+        }
+        return &d_frames[head % DEPTH];
+    }
+
+    /**
+     * @brief Publish the slot returned by reserve().
+     * @note Producer only
+     */
+    void commit() {
+        uint32_t head = d_head.load(std::memory_order_relaxed) + 1;
+        d_head.store(head, std::memory_order_release);
+
+        d_pushed = d_pushed + 1;
+        uint16_t size = head - d_tail.load(std::memory_order_relaxed);
+        if (size > d_high_water)
+            d_high_water = size;
+    }
+
+    /**
+     * @brief Copy a frame into the queue.
+     * @note Producer only
+     * @return False if the frame was dropped because the queue was full
+     * or the frame was longer than RX_FRAME_MAX_LEN
+     */
+    bool push(uint32_t rx_ms, int16_t rssi, int8_t snr, uint8_t to, uint8_t from, uint8_t id, uint8_t flags,
+              const uint8_t *data, uint8_t len) {
+        if (len > RX_FRAME_MAX_LEN) {
+            d_oversize = d_oversize + 1;
+            return false;
+        }
+
+        rx_frame_t *f = reserve();
+        if (!f)
+            return false;
+
+        f->rx_ms = rx_ms;
+        f->rssi = rssi;
+        f->snr = snr;
+        f->to = to;
+        f->from = from;
+        f->id = id;
+        f->flags = flags;
+        f->len = len;
+        memcpy(f->data, data, len);
+
+        commit();
+        return true;
+    }
+
+    /**
+     * @brief The oldest frame.
+     * @note Consumer only. The frame stays valid until pop().
+     * @return The frame, or null if the queue is empty
+     */
+    const rx_frame_t *front() const {
+        uint32_t tail = d_tail.load(std::memory_order_relaxed);
+        if (d_head.load(std::memory_order_acquire) == tail)
+            return 0;
+        return &d_frames[tail % DEPTH];
+    }
+
+    /**
+     * @brief Free the oldest frame.
+     * @note Consumer only. Call only after front() returned a frame.
+     */
+    void pop() {
+        d_tail.store(d_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const { return front() == 0; }
+
+    uint16_t size() const {
+        return d_head.load(std::memory_order_acquire) - d_tail.load(std::memory_order_acquire);
+    }
+
+    static uint16_t depth() { return DEPTH; }
+
+    /// @return Frames put in the queue
+    uint32_t pushed() const { return d_pushed; }
+    /// @return Frames dropped because the queue was full
+    uint32_t overflows() const { return d_overflows; }
+    /// @return Frames dropped because they were longer than RX_FRAME_MAX_LEN
+    uint32_t oversize() const { return d_oversize; }
+    /// @return The most frames the queue has held
+    uint16_t high_water() const { return d_high_water; }
+};
+
+#endif
@@ -0,0 +1,403 @@
+/*
+  Buffered SD card logger for the main node.
+
+  The original log_data() opened the log file with O_APPEND, wrote one
+  line and closed the file for every message, all with interrupts off.
+  Opening a FAT file for append walks the file's whole cluster chain, so
+  the time the radio was deaf grew with the size of the log.
+
+  This logger keeps the file open, stages records in a fixed RAM ring
+  buffer and writes whole 512-byte sectors. A partially filled sector is
+  written only when it has been waiting longer than the flush interval
+  and the directory entry is updated (sync()) on its own, slower,
+  schedule. Each sector write is done inside its own critical section so
+  the longest the radio waits for the bus is one sector, not one
+  open/seek/write/close cycle.
+
+  After a sector is written the card is busy programming it, sometimes
+  for hundreds of ms, and SdFat waits out that busy time at the start of
+  the next write with the bus held. If a ready check is set (see
+  set_ready_check()), service() leaves the rest of the staged sectors
+  for a later call while the card is busy, so the bus stays free.
+
+  The class is a template on the file type so that the same code runs on
+  the M0 with SdFat's SdFile and in the native env with a stand-in. The
+  CriticalSection type must have static lock() and unlock() methods; on
+  the M0 those take the SPI bus from the SpiArbiter.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef SDLogger_h
+#define SDLogger_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define SD_SECTOR_SIZE 512
+
+#ifndef LOG_FLUSH_INTERVAL_MS
+#define LOG_FLUSH_INTERVAL_MS 5000  // write a partial sector after 5s
+#endif
+
+#ifndef LOG_SYNC_INTERVAL_MS
+#define LOG_SYNC_INTERVAL_MS 60000  // update the directory entry once a minute
+#endif
+
+/**
+ * @brief Counters that describe what the logger has done.
+ */
+struct sd_logger_stats_t {
+    uint32_t records;        // records staged
+    uint32_t bytes;          // bytes staged
+    uint32_t sectors;        // full sectors written
+    uint32_t partial_writes; // partial sectors written on the time policy
+    uint32_t syncs;          // directory entry updates
+    uint32_t dropped;        // records that did not fit in the buffer
+    uint32_t errors;         // failed writes or syncs
+    uint32_t deferred;       // service() calls that left data because the card was busy
+};
+
+typedef bool (*sd_ready_t)();
+
+/**
+ * @brief Log records to a file that stays open, writing whole sectors.
+ *
+ * Byte 'pos' of the file is staged at d_buf[pos % BUF_SIZE]. Because the
+ * buffer is a whole number of sectors, every file sector maps onto a
+ * contiguous run of the buffer and the only place a write must be split
+ * is at the end of the buffer, which is also a sector boundary.
+ *
+ * @tparam FileT The file type (SdFile on the M0)
+ * @tparam CriticalSection Type with static lock() and unlock()
+ * @tparam SECTORS Size of the RAM buffer in sectors
+ */
+template <class FileT, class CriticalSection, uint16_t SECTORS = 4>
+class SDLogger {
+public:
+    static const uint32_t BUF_SIZE = SECTORS * (uint32_t)SD_SECTOR_SIZE;
+
+private:
+    FileT &d_file;
+    bool d_open;
+
+    uint8_t d_buf[BUF_SIZE];
+    uint32_t d_head;        // file position of the next byte to stage
+    uint32_t d_tail;        // file position of the next byte to write
+
+    uint32_t d_flush_interval_ms;
+    uint32_t d_sync_interval_ms;
+    uint32_t d_oldest_ms;   // when the oldest unwritten byte was staged
+    uint32_t d_last_sync_ms;
+    bool d_dirty;           // written but not synced
+    bool d_flush_soon;      // service() writes and syncs everything without waiting
+
+    sd_logger_stats_t d_stats;
+
+    sd_ready_t d_ready;
+
+    // True if the card can take a write now. Counts a deferral if not.
+    bool card_ready() {
+        if (!d_ready || d_ready())
+            return true;
+        ++d_stats.deferred;
+        return false;
+    }
+
+    // Write bytes [d_tail, d_tail + n) to the file. n must not cross the
+    // end of the buffer.
+    bool write_from_tail(uint32_t n) {
+        CriticalSection::lock();
+        size_t written = d_file.write(d_buf + (d_tail % BUF_SIZE), n);
+        CriticalSection::unlock();
+
+        if (written != n) {
+            ++d_stats.errors;
+            return false;
+        }
+
+        d_tail += n;
+        d_dirty = true;
+        return true;
+    }
+
+    // Write everything up to the next sector boundary, or 'limit' if
+    // that comes first.
+    bool write_to_boundary(uint32_t limit) {
+        uint32_t boundary = (d_tail / SD_SECTOR_SIZE + 1) * SD_SECTOR_SIZE;
+        uint32_t end = (limit < boundary) ? limit : boundary;
+        return write_from_tail(end - d_tail);
+    }
+
+public:
+    SDLogger(FileT &file, uint32_t flush_interval_ms = LOG_FLUSH_INTERVAL_MS,
+             uint32_t sync_interval_ms = LOG_SYNC_INTERVAL_MS)
+        : d_file(file), d_open(false), d_head(0), d_tail(0), d_flush_interval_ms(flush_interval_ms),
+          d_sync_interval_ms(sync_interval_ms), d_oldest_ms(0), d_last_sync_ms(0), d_dirty(false),
+          d_flush_soon(false), d_ready(0) {
+        memset(&d_stats, 0, sizeof(d_stats));
+    }
+
+    /**
+     * @brief Set the function service() uses to ask if the card is busy.
+     *
+     * While it returns false, service() and a log() that finds the buffer
+     * full write nothing; the data stays staged, or the record is dropped.
+     * flush() and end() do not use it.
+     *
+     * @param ready Returns true if the card is ready; null (the default)
+     * means always ready
+     */
+    void set_ready_check(sd_ready_t ready) { d_ready = ready; }
+
+    /**
+     * @brief Open (or create) the log file and leave it open.
+     *
+     * A new, empty file is preallocated as one contiguous run of clusters
+     * so that appending never has to search the FAT for free space. An
+     * existing file is appended to; keeping it open means the cluster
+     * chain is walked once, here, and not once per record.
+     *
+     * @param file_name The log file
+     * @param oflag Open flags, normally O_WRONLY | O_CREAT
+     * @param prealloc_bytes Preallocate this many bytes if the file is new;
+     * zero disables preallocation.
+     * @param now_ms The current time in ms (millis())
+     * @return True if the file is open and ready
+     */
+    bool begin(const char *file_name, int oflag, uint32_t prealloc_bytes, uint32_t now_ms) {
+        if (d_open)
+            end();
+
+        CriticalSection::lock();
+        bool status = d_file.open(file_name, oflag);
+        uint32_t size = status ? d_file.fileSize() : 0;
+        if (status && size == 0 && prealloc_bytes > 0) {
+            // preAllocate() fails on a card without a free contiguous run;
+            // that's not fatal, it just means the FAT is used as usual.
+            (void)d_file.preAllocate(prealloc_bytes);
+        }
+        if (status)
+            status = d_file.seekSet(size);
+        CriticalSection::unlock();
+
+        if (!status) {
+            ++d_stats.errors;
+            return false;
+        }
+
+        d_open = true;
+        d_head = d_tail = size;
+        d_last_sync_ms = now_ms;
+        d_dirty = false;
+        d_flush_soon = false;
+        return true;
+    }
+
+    /**
+     * @brief Write all staged data, sync and close the file.
+     */
+    void end() {
+        if (!d_open)
+            return;
+        flush();
+        CriticalSection::lock();
+        d_file.close();
+        CriticalSection::unlock();
+        d_open = false;
+    }
+
+    /**
+     * @brief Stage one record; a CR/LF is appended.
+     *
+     * This only copies into RAM. If the buffer does not have room, the
+     * full sectors are written right away to make space, unless the card
+     * is busy; if there is still no room, the record is dropped and
+     * counted.
+     *
+     * @param data The record, a null-terminated string
+     * @param now_ms The current time in ms (millis())
+     * @return True if the record was staged
+     */
+    bool log(const char *data, uint32_t now_ms) {
+        uint32_t len = strlen(data);
+        if (!make_room(len + 2, now_ms))
+            return false;
+
+        stage((const uint8_t *)data, len);
+        stage((const uint8_t *)"\r\n", 2);
+        return true;
+    }
+
+    /**
+     * @brief Stage one binary record, as is.
+     * @see log()
+     * @param data The record
+     * @param len Its length in bytes
+     * @param now_ms The current time in ms (millis())
+     * @return True if the record was staged
+     */
+    bool write(const void *data, uint32_t len, uint32_t now_ms) {
+        if (!make_room(len, now_ms))
+            return false;
+
+        stage((const uint8_t *)data, len);
+        return true;
+    }
+
+    /**
+     * @brief Write any staged sectors; apply the flush and sync policies.
+     *
+     * Call this from loop(). It writes every complete sector, a partial
+     * sector once the oldest staged byte is older than the flush interval,
+     * and syncs the file once the sync interval has passed since the last
+     * sync and there is something to sync (both at once after
+     * flush_soon()). Each sector is written in its own critical section;
+     * with a ready check, nothing more is written once the card reports
+     * it is busy.
+     *
+     * @param now_ms The current time in ms (millis())
+     */
+    void service(uint32_t now_ms) {
+        if (!d_open)
+            return;
+
+        if (!write_sectors(true))
+            return;
+
+        if (d_head != d_tail && (d_flush_soon || now_ms - d_oldest_ms >= d_flush_interval_ms)) {
+            while (d_head != d_tail) {
+                if (!card_ready())
+                    return;
+                if (!write_to_boundary(d_head))
+                    break;
+            }
+            if (d_head == d_tail)
+                ++d_stats.partial_writes;
+        }
+
+        if (d_dirty && (d_flush_soon || now_ms - d_last_sync_ms >= d_sync_interval_ms)) {
+            if (!card_ready())
+                return;
+            sync();
+            d_last_sync_ms = now_ms;
+        }
+
+        if (d_head == d_tail && !d_dirty)
+            d_flush_soon = false;
+    }
+
+    /**
+     * @brief Have service() write everything that is staged, the partial
+     * sector too, and sync the file, without waiting for the flush and
+     * sync intervals. It still leaves the card alone while it is busy.
+     * flushing() is true until it is done.
+     */
+    void flush_soon() { d_flush_soon = d_open; }
+
+    /// @return True if flush_soon() was called and service() has not finished
+    bool flushing() const { return d_flush_soon; }
+
+    /**
+     * @brief Write everything that is staged and sync the file.
+     */
+    void flush() {
+        if (!d_open)
+            return;
+        while (d_head != d_tail) {
+            if (!write_to_boundary(d_head))
+                break;
+        }
+        sync();
+        if (d_head == d_tail && !d_dirty)
+            d_flush_soon = false;
+    }
+
+    /**
+     * @brief Write the complete sectors that are staged.
+     *
+     * When the file did not start on a sector boundary the first write
+     * is short; after that, every write is one full, aligned sector.
+     *
+     * @param check_ready If true, stop when the card is busy
+     * @return False if it stopped because the card was busy or a write
+     * failed
+     */
+    bool write_sectors(bool check_ready = false) {
+        while (d_head - d_tail >= SD_SECTOR_SIZE - (d_tail % SD_SECTOR_SIZE)) {
+            if (check_ready && !card_ready())
+                return false;
+            bool full = d_tail % SD_SECTOR_SIZE == 0;
+            if (!write_to_boundary(d_head))
+                return false;
+            if (full)
+                ++d_stats.sectors;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Update the file's directory entry so a power loss keeps the data.
+     */
+    void sync() {
+        if (!d_dirty)
+            return;
+        CriticalSection::lock();
+        bool status = d_file.sync();
+        CriticalSection::unlock();
+        if (status) {
+            d_dirty = false;
+            ++d_stats.syncs;
+        } else {
+            ++d_stats.errors;
+        }
+    }
+
+    bool is_open() const { return d_open; }
+
+    /// @return Bytes staged but not yet written
+    uint32_t pending() const { return d_head - d_tail; }
+
+    /// @return The file position of the next staged byte
+    uint32_t position() const { return d_head; }
+
+    const sd_logger_stats_t &stats() const { return d_stats; }
+
+private:
+    // Make room for a record of 'need' bytes and count it
+    bool make_room(uint32_t need, uint32_t now_ms) {
+        if (!d_open)
+            return false;
+
+        if (BUF_SIZE - (d_head - d_tail) < need) {
+            // The caller is on the frame path: don't wait for a busy card
+            write_sectors(true);
+            if (BUF_SIZE - (d_head - d_tail) < need) {
+                ++d_stats.dropped;
+                return false;
+            }
+        }
+
+        if (d_head == d_tail)
+            d_oldest_ms = now_ms;
+
+        ++d_stats.records;
+        d_stats.bytes += need;
+        return true;
+    }
+
+    void stage(const uint8_t *data, uint32_t len) {
+        while (len > 0) {
+            uint32_t offset = d_head % BUF_SIZE;
+            uint32_t n = BUF_SIZE - offset;
+            if (n > len)
+                n = len;
+            memcpy(d_buf + offset, data, n);
+            d_head += n;
+            data += n;
+            len -= n;
+        }
+    }
+};
+
+#endif
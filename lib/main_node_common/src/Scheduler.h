@@ -0,0 +1,232 @@
+/*
+  A cooperative scheduler for the main node's loop().
+
+  loop() used to do everything on every pass, and setup() spent up to
+  SERIAL_WAIT_TIME (10 s) blinking the LED with delay() while it waited
+  for the USB serial port. Nothing else ran while it waited; on the
+  ESP8266 a wait like that also starves the SDK, which is where the
+  "Panic ... __yield" dumps in test_data_no_ant.csv come from.
+
+  Here loop() calls service() and every task is a function that runs to
+  completion and returns. There are two kinds:
+
+    poll    run on every pass, first: the radio and the serial port
+    timed   run when due, earliest deadline first, at most one a pass
+
+  A timed task with a period is next due one period after it was due;
+  if it ran more than a period late, one period after it ran, so a task
+  that was held up does not run in a burst to catch up. A task with
+  period 0 is due on every pass (it drains a buffer that fills on its
+  own), but it still waits its turn in deadline order, so the periodic
+  tasks are not starved by it.
+
+  A task that can't do its work now returns false (the SD card tasks do
+  while frames wait in the RX queue). It stays due and the next task in
+  deadline order gets the pass.
+
+  Since at most one timed task runs a pass, the time between two runs of
+  the radio task is at most the poll tasks plus the longest timed task.
+  The scheduler measures that gap, and each task's runs, its longest run
+  and how late it started, so a task that breaks the bound shows up.
+
+  The Clock type has static ms() and us(); on the M0 they are millis()
+  and micros(). The task table is fixed at TASKS entries.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define SCHEDULER_TASKS 12
+
+/**
+ * @brief A task; it runs to completion.
+ * @return False if it could not do its work now and should be asked
+ * again on the next pass. Poll tasks' results are ignored.
+ */
+typedef bool (*task_fn_t)();
+
+/**
+ * @brief What a task has done.
+ */
+struct task_stats_t {
+    uint32_t runs;
+    uint32_t deferred;      // times it returned false
+    uint32_t max_run_us;
+    uint32_t max_late_ms;   // longest from due to started; timed tasks only
+};
+
+/**
+ * @brief Poll tasks and deadline-ordered timed tasks.
+ * @tparam Clock Type with static ms() and us()
+ * @tparam TASKS The most tasks that can be added
+ */
+template <class Clock, uint8_t TASKS = SCHEDULER_TASKS>
+class Scheduler {
+    static_assert(TASKS > 0 && TASKS <= 32, "Scheduler TASKS must be 1 to 32");
+
+    struct task_t {
+        task_fn_t fn;
+        const char *name;
+        uint32_t period_ms;
+        uint32_t due_ms;
+        bool poll;
+        bool active;
+        task_stats_t stats;
+    };
+
+    task_t d_tasks[TASKS];
+    uint8_t d_count;
+
+    uint32_t d_passes;
+    uint32_t d_last_poll_us;        // when the poll tasks last started
+    uint32_t d_max_poll_gap_us;
+
+    int8_t add(task_fn_t fn, const char *name, bool poll, uint32_t period_ms, uint32_t delay_ms) {
+        if (d_count == TASKS)
+            return -1;
+
+        task_t &t = d_tasks[d_count];
+        memset(&t, 0, sizeof(t));
+        t.fn = fn;
+        t.name = name;
+        t.poll = poll;
+        t.active = true;
+        t.period_ms = period_ms;
+        t.due_ms = Clock::ms() + delay_ms;
+        return d_count++;
+    }
+
+    uint32_t run(task_t &t, bool *done) {
+        uint32_t start = Clock::us();
+        *done = t.fn();
+        uint32_t us = Clock::us() - start;
+
+        if (*done)
+            ++t.stats.runs;
+        else
+            ++t.stats.deferred;
+        if (us > t.stats.max_run_us)
+            t.stats.max_run_us = us;
+        return us;
+    }
+
+    // The due timed task with the earliest deadline, not in 'tried'; -1 if none
+    int8_t earliest(uint32_t now, uint32_t tried) const {
+        int8_t best = -1;
+        uint32_t best_late = 0;
+        for (uint8_t i = 0; i < d_count; ++i) {
+            const task_t &t = d_tasks[i];
+            if (t.poll || !t.active || (tried & (1UL << i)))
+                continue;
+            uint32_t late = now - t.due_ms;
+            if ((int32_t)late < 0)
+                continue;
+            if (best < 0 || late > best_late) {
+                best = i;
+                best_late = late;
+            }
+        }
+        return best;
+    }
+
+public:
+    Scheduler() : d_count(0) { reset_stats(); }
+
+    /**
+     * @brief Add a task that runs on every pass.
+     * @return The task's number, or -1 if the table is full
+     */
+    int8_t poll(task_fn_t fn, const char *name) { return add(fn, name, true, 0, 0); }
+
+    /**
+     * @brief Add a timed task.
+     * @param period_ms How often it runs; 0 for every pass
+     * @param delay_ms How long from now until it first runs
+     * @return The task's number, or -1 if the table is full
+     */
+    int8_t every(task_fn_t fn, uint32_t period_ms, const char *name, uint32_t delay_ms = 0) {
+        return add(fn, name, false, period_ms, delay_ms);
+    }
+
+    /// @brief Stop a task; a task may stop itself
+    void stop(int8_t task) {
+        if (task >= 0 && task < d_count)
+            d_tasks[task].active = false;
+    }
+
+    /// @brief Start a stopped task, or move a timed task's deadline to now
+    void wake(int8_t task) {
+        if (task < 0 || task >= d_count)
+            return;
+        d_tasks[task].active = true;
+        d_tasks[task].due_ms = Clock::ms();
+    }
+
+    /**
+     * @brief Run the poll tasks, then the due timed task with the
+     * earliest deadline. Call this from loop().
+     * @return True if a timed task ran
+     */
+    bool service() {
+        uint32_t now_us = Clock::us();
+        if (d_passes++ > 0 && now_us - d_last_poll_us > d_max_poll_gap_us)
+            d_max_poll_gap_us = now_us - d_last_poll_us;
+        d_last_poll_us = now_us;
+
+        bool done;
+        for (uint8_t i = 0; i < d_count; ++i) {
+            if (d_tasks[i].poll && d_tasks[i].active)
+                run(d_tasks[i], &done);
+        }
+
+        uint32_t now = Clock::ms();
+        uint32_t tried = 0;
+        int8_t i;
+        while ((i = earliest(now, tried)) >= 0) {
+            task_t &t = d_tasks[i];
+            uint32_t late = now - t.due_ms;
+            run(t, &done);
+            if (!done) {
+                tried |= 1UL << i;
+                continue;
+            }
+
+            if (late > t.stats.max_late_ms)
+                t.stats.max_late_ms = late;
+            if (t.period_ms == 0)
+                t.due_ms = now;
+            else if (late < t.period_ms)
+                t.due_ms += t.period_ms;
+            else
+                t.due_ms = now + t.period_ms;
+            return true;
+        }
+        return false;
+    }
+
+    uint8_t count() const { return d_count; }
+    const char *name(uint8_t task) const { return d_tasks[task].name; }
+    const task_stats_t &stats(uint8_t task) const { return d_tasks[task].stats; }
+    bool active(uint8_t task) const { return d_tasks[task].active; }
+
+    /// @return Calls to service()
+    uint32_t passes() const { return d_passes; }
+
+    /// @return The longest time between two passes of the poll tasks
+    uint32_t max_poll_gap_us() const { return d_max_poll_gap_us; }
+
+    void reset_stats() {
+        for (uint8_t i = 0; i < d_count; ++i)
+            memset(&d_tasks[i].stats, 0, sizeof(task_stats_t));
+        d_passes = 0;
+        d_last_poll_us = 0;
+        d_max_poll_gap_us = 0;
+    }
+};
+
+#endif
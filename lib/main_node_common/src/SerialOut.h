@@ -0,0 +1,265 @@
+/*
+  Buffered, non-blocking output to the main node's serial port.
+
+  The main node printed each line with Serial.println() and then called
+  Serial.flush(). On the M0 the serial port is USB CDC: print() waits
+  for the host to take each 64-byte packet (giving up after 70 ms if it
+  doesn't) and flush() waits for all of it, so a slow host, or a port
+  that is open but not being read, stalled loop() and with it the
+  radio, the SD card and the replies.
+
+  SerialOut stages output in a fixed RAM ring and service() hands the
+  port only as many bytes as it says it can take without blocking
+  (availableForWrite()). Output is staged a line at a time: a line that
+  does not fit in the ring is dropped whole and counted, so the host
+  never sees half a line; in text mode a note with the number of lines
+  dropped goes out once there is room again.
+
+  There are two modes:
+
+    text    the lines, as they were printed
+    framed  each line is sent as a SerialRecord (see SerialRecord.h):
+            COBS framed, with a sequence number and a CRC. The main node
+            also sends each received frame as a binary record, so the
+            host need not parse the text.
+
+  The class is a template on the port type so that the same code runs
+  with the M0's Serial and with stand-ins on the host. The port needs
+  availableForWrite() and write(const uint8_t *, size_t).
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef SerialOut_h
+#define SerialOut_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "SerialRecord.h"
+#include "TextFormat.h"
+
+#ifndef SERIAL_OUT_BUFFER
+#define SERIAL_OUT_BUFFER 2048      // bytes of RAM for staged output
+#endif
+
+#define SERIAL_LINE_MAX 255         // longer lines are staged in pieces
+
+enum SerialMode {
+    serial_text,
+    serial_framed
+};
+
+/**
+ * @brief Counters that describe what SerialOut has done.
+ */
+struct serial_out_stats_t {
+    uint32_t lines;         // lines staged
+    uint32_t records;       // binary records staged
+    uint32_t bytes;         // bytes staged
+    uint32_t written;       // bytes the port took
+    uint32_t dropped;       // lines and records that did not fit
+    uint16_t high_water;    // the most bytes staged at once
+};
+
+typedef void (*serial_line_hook_t)(const char *line);
+
+/**
+ * @brief Stage serial output and send it when the port has room.
+ * @tparam Port The serial port type
+ * @tparam SIZE Bytes in the ring
+ */
+template <class Port, uint16_t SIZE = SERIAL_OUT_BUFFER>
+class SerialOut {
+    static_assert(SIZE >= SERIAL_RECORD_MAX_ENCODED, "SerialOut SIZE must hold the largest record");
+
+    Port &d_port;
+
+    uint8_t d_buf[SIZE];
+    // Free-running counts of bytes staged and sent; head - tail are waiting
+    uint32_t d_head;
+    uint32_t d_tail;
+
+    // The line being printed, with room for a null
+    char d_line[SERIAL_LINE_MAX + 1];
+    uint16_t d_line_len;
+
+    SerialMode d_mode;
+    uint8_t d_sequence;         // of the next record
+    uint32_t d_unreported;      // lines dropped since the last note
+    serial_line_hook_t d_line_hook;
+
+    serial_out_stats_t d_stats;
+
+    uint16_t room() const { return SIZE - (d_head - d_tail); }
+
+    // Copy to the ring; the caller has checked room()
+    void put(const void *data, uint16_t len) {
+        const uint8_t *p = (const uint8_t *)data;
+        uint16_t at = d_head % SIZE;
+        uint16_t first = len < SIZE - at ? len : SIZE - at;
+        memcpy(d_buf + at, p, first);
+        memcpy(d_buf, p + first, len - first);
+        d_head += len;
+
+        d_stats.bytes += len;
+        if (SIZE - room() > d_stats.high_water)
+            d_stats.high_water = SIZE - room();
+    }
+
+    bool put_record(uint8_t type, const void *payload, uint8_t len) {
+        uint8_t wire[SERIAL_RECORD_MAX_ENCODED];
+        uint16_t n = encode_serial_record(type, d_sequence++, payload, len, wire);
+        if (n > room())
+            return false;
+        put(wire, n);
+        return true;
+    }
+
+    // Stage a line; 'end' is true if it ends with a line ending
+    void put_line(bool end) {
+        d_line[d_line_len] = '\0';
+        if (end && d_line_hook)
+            d_line_hook(d_line);
+
+        if (d_unreported && d_mode == serial_text) {
+            char note[48];
+            TextSpan text(note, sizeof(note));
+            text.put("Serial output dropped ").put_uint(d_unreported).put(" lines\r\n");
+            size_t n = text.length();
+            if (n + d_line_len <= room()) {
+                put(note, n);
+                d_unreported = 0;
+            }
+        }
+
+        bool staged;
+        if (d_mode == serial_text) {
+            staged = d_line_len <= room();
+            if (staged)
+                put(d_line, d_line_len);
+        } else {
+            // The record holds the text without its line ending
+            uint16_t len = d_line_len;
+            while (end && len > 0 && (d_line[len - 1] == '\n' || d_line[len - 1] == '\r'))
+                --len;
+            staged = put_record(SERIAL_RECORD_TEXT, d_line, len);
+        }
+
+        if (staged) {
+            ++d_stats.lines;
+        } else {
+            ++d_stats.dropped;
+            ++d_unreported;
+        }
+        d_line_len = 0;
+    }
+
+public:
+    SerialOut(Port &port, SerialMode mode = serial_text)
+        : d_port(port), d_head(0), d_tail(0), d_line_len(0), d_mode(mode), d_sequence(0), d_unreported(0),
+          d_line_hook(0) {
+        memset(&d_stats, 0, sizeof(d_stats));
+        // Whatever the port sent before this (the boot ROM, say) ends at this delimiter
+        if (mode == serial_framed) {
+            const uint8_t zero = 0;
+            put(&zero, 1);
+        }
+    }
+
+    /**
+     * @brief Stage text. A line is staged when its line ending is written.
+     * @return len; text that does not fit is counted, not refused
+     */
+    size_t write(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            d_line[d_line_len++] = data[i];
+            if (data[i] == '\n')
+                put_line(true);
+            else if (d_line_len == SERIAL_LINE_MAX)
+                put_line(false);
+        }
+        return len;
+    }
+
+    /**
+     * @brief Stage a binary record.
+     * @note Framed mode only; in text mode the record is not sent.
+     * @param type The record type, SERIAL_RECORD_FRAME for example
+     * @param payload The record
+     * @param len Up to SERIAL_RECORD_MAX_PAYLOAD bytes
+     * @return True if the record was staged
+     */
+    bool write_record(uint8_t type, const void *payload, uint8_t len) {
+        if (d_mode != serial_framed || len > SERIAL_RECORD_MAX_PAYLOAD)
+            return false;
+        if (!put_record(type, payload, len)) {
+            ++d_stats.dropped;
+            return false;
+        }
+        ++d_stats.records;
+        return true;
+    }
+
+    /**
+     * @brief Switch between text and framed output.
+     * Text already staged is sent as it was staged. Switching to framed
+     * mode starts with a delimiter so the host's reader starts clean.
+     */
+    void set_mode(SerialMode mode) {
+        if (mode == d_mode)
+            return;
+        if (d_line_len)
+            put_line(false);
+        d_mode = mode;
+        if (mode == serial_framed && room() > 0) {
+            const uint8_t zero = 0;
+            put(&zero, 1);
+        }
+    }
+
+    SerialMode mode() const { return d_mode; }
+
+    /// @brief Call 'hook' with each line, without its line ending, as it is staged
+    void set_line_hook(serial_line_hook_t hook) { d_line_hook = hook; }
+
+    /**
+     * @brief Send staged output, as much as the port says it can take
+     * without waiting.
+     * @note Call this from loop(). The port is asked once per call; on
+     * the M0's USB serial port that is one 64-byte packet.
+     * @return The number of bytes sent
+     */
+    uint16_t service() {
+        int avail = d_port.availableForWrite();
+        uint16_t sent = 0;
+        while (d_head != d_tail && sent < avail) {
+            uint16_t at = d_tail % SIZE;
+            uint32_t len = d_head - d_tail;
+            if (len > (uint32_t)(SIZE - at))
+                len = SIZE - at;
+            if (len > (uint32_t)(avail - sent))
+                len = avail - sent;
+
+            size_t n = d_port.write(d_buf + at, len);
+            if (n == 0)
+                break;
+            d_tail += n;
+            sent += n;
+            d_stats.written += n;
+        }
+        return sent;
+    }
+
+    bool empty() const { return d_head == d_tail; }
+
+    /// @return Bytes staged and not yet sent
+    uint16_t size() const { return d_head - d_tail; }
+
+    /// @return Bytes that can be staged now
+    uint16_t space() const { return room(); }
+
+    const serial_out_stats_t &stats() const { return d_stats; }
+};
+
+#endif
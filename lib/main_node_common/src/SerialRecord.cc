@@ -0,0 +1,105 @@
+/*
+  Serial record encoding and decoding; see SerialRecord.h.
+*/
+
+#include <string.h>
+
+#include "CRC32.h"
+#include "SerialRecord.h"
+
+size_t encode_serial_record(uint8_t type, uint8_t sequence, const void *payload, size_t len, uint8_t *out) {
+    if (len > SERIAL_RECORD_MAX_PAYLOAD)
+        return 0;
+
+    uint8_t raw[SERIAL_RECORD_MAX_PAYLOAD + SERIAL_RECORD_OVERHEAD];
+    raw[0] = type;
+    raw[1] = sequence;
+    memcpy(raw + 2, payload, len);
+    uint32_t crc = crc32_update(0, raw, len + 2);
+    for (int i = 0; i < 4; ++i)
+        raw[len + 2 + i] = crc >> (8 * i);
+
+    size_t n = cobs_encode(raw, len + SERIAL_RECORD_OVERHEAD, out);
+    out[n++] = 0;
+    return n;
+}
+
+bool decode_serial_record(uint8_t *frame, size_t len, serial_record_t *rec) {
+    if (len > SERIAL_RECORD_MAX_ENCODED - 1)
+        return false;
+    size_t n = cobs_decode(frame, len, frame);
+    if (n < SERIAL_RECORD_OVERHEAD || n > SERIAL_RECORD_MAX_PAYLOAD + SERIAL_RECORD_OVERHEAD)
+        return false;
+
+    uint32_t crc = 0;
+    for (int i = 0; i < 4; ++i)
+        crc |= (uint32_t)frame[n - 4 + i] << (8 * i);
+    if (crc != crc32_update(0, frame, n - 4))
+        return false;
+
+    rec->type = frame[0];
+    rec->sequence = frame[1];
+    rec->len = n - SERIAL_RECORD_OVERHEAD;
+    rec->payload = frame + 2;
+    return true;
+}
+
+SerialRecordReader::SerialRecordReader(serial_record_callback_t callback, void *context)
+    : d_len(0), d_overrun(false), d_has_sequence(false), d_sequence(0), d_callback(callback), d_context(context) {
+    memset(&d_stats, 0, sizeof(d_stats));
+}
+
+void SerialRecordReader::end_frame() {
+    serial_record_t rec;
+    if (d_overrun || !decode_serial_record(d_buf, d_len, &rec)) {
+        ++d_stats.bad;
+    } else {
+        if (d_has_sequence)
+            d_stats.lost += (uint8_t)(rec.sequence - d_sequence - 1);
+        d_has_sequence = true;
+        d_sequence = rec.sequence;
+        ++d_stats.records;
+        d_callback(&rec, d_context);
+    }
+    d_len = 0;
+    d_overrun = false;
+}
+
+void SerialRecordReader::add(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] == 0) {
+            if (d_len > 0 || d_overrun)
+                end_frame();
+        } else if (d_len < sizeof(d_buf)) {
+            d_buf[d_len++] = data[i];
+        } else {
+            d_overrun = true;
+        }
+    }
+}
+
+SerialCommandInput SerialCommandReader::add(uint8_t c, serial_record_t *rec) {
+    if (!d_in_record) {
+        if (c != 0)
+            return serial_command_char;
+        d_in_record = true;
+        d_len = 0;
+        d_overrun = false;
+        return serial_command_pending;
+    }
+
+    if (c != 0) {
+        if (d_len < sizeof(d_buf))
+            d_buf[d_len++] = c;
+        else
+            d_overrun = true;
+        return serial_command_pending;
+    }
+
+    d_in_record = false;
+    if (d_len == 0)
+        return serial_command_pending;
+    if (d_overrun || !decode_serial_record(d_buf, d_len, rec))
+        return serial_command_bad;
+    return serial_command_record;
+}
@@ -0,0 +1,149 @@
+/*
+  Binary records on the main node's serial port.
+
+  In framed mode (see SerialOut.h) the main node sends records instead
+  of lines of text. Each record is COBS encoded and followed by a zero
+  byte, so a host that opens the port mid-stream, or loses bytes, picks
+  up again at the next record:
+
+    record: type (1) sequence (1) payload (0 to 250) crc32 (4)
+
+  The CRC covers the type, sequence and payload and is little-endian.
+  The sequence goes up by one for each record the main node makes,
+  including the ones it drops because the host is not keeping up, so a
+  gap in the sequence is that many lost records.
+
+  Record types:
+
+    'T' a line of text, without its line ending; what text mode prints
+    'F' a received frame as a binary log record (see BinaryLog.h,
+        log_record_encode()): the receive time, RSSI, SNR, source and
+        the frame itself
+
+  LogTransfer.h adds the records of the log download protocol.
+
+  The host sends the main node single-character commands ('B', 'T',
+  'S'). It can also send records, for the commands that take arguments:
+  a zero byte, then the record in the form above, zero delimiter and
+  all. SerialCommandReader separates the two.
+*/
+
+#ifndef SerialRecord_h
+#define SerialRecord_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "COBS.h"
+
+#define SERIAL_RECORD_TEXT 'T'
+#define SERIAL_RECORD_FRAME 'F'
+
+#define SERIAL_RECORD_MAX_PAYLOAD 250
+#define SERIAL_RECORD_OVERHEAD 6    // type, sequence and crc32
+// The most bytes a record takes on the wire, with its delimiter
+#define SERIAL_RECORD_MAX_ENCODED (COBS_MAX_ENCODED(SERIAL_RECORD_MAX_PAYLOAD + SERIAL_RECORD_OVERHEAD) + 1)
+
+/**
+ * @brief A decoded record. The payload points into the decoder's buffer.
+ */
+struct serial_record_t {
+    uint8_t type;
+    uint8_t sequence;
+    uint8_t len;
+    const uint8_t *payload;
+};
+
+/**
+ * @brief Build the wire form of a record.
+ * @param out At least SERIAL_RECORD_MAX_ENCODED bytes
+ * @return The number of bytes written to 'out', including the zero
+ * delimiter, or 0 if 'len' is more than SERIAL_RECORD_MAX_PAYLOAD
+ */
+size_t encode_serial_record(uint8_t type, uint8_t sequence, const void *payload, size_t len, uint8_t *out);
+
+/**
+ * @brief Decode one record, in place.
+ * @param frame The bytes between two zero delimiters; overwritten
+ * @param len Their number
+ * @param rec The record; its payload points into 'frame'
+ * @return False if the frame is not valid COBS, is too short or too
+ * long or its CRC is wrong
+ */
+bool decode_serial_record(uint8_t *frame, size_t len, serial_record_t *rec);
+
+struct serial_reader_stats_t {
+    uint32_t records;       // good records
+    uint32_t bad;           // frames that failed to decode; skipped
+    uint32_t lost;          // records missing from the sequence
+};
+
+typedef void (*serial_record_callback_t)(const serial_record_t *rec, void *context);
+
+/**
+ * @brief Split a byte stream into records.
+ *
+ * Feed it bytes as they come from the port. Bytes before the first
+ * delimiter (text the node printed before it switched to framed mode,
+ * or a record cut off when the port was opened) count as one bad frame.
+ */
+class SerialRecordReader {
+    uint8_t d_buf[SERIAL_RECORD_MAX_ENCODED];
+    size_t d_len;
+    bool d_overrun;         // the current frame is longer than any record
+    bool d_has_sequence;
+    uint8_t d_sequence;     // of the last good record
+    serial_reader_stats_t d_stats;
+
+    serial_record_callback_t d_callback;
+    void *d_context;
+
+    void end_frame();
+
+public:
+    SerialRecordReader(serial_record_callback_t callback, void *context);
+
+    void add(const uint8_t *data, size_t len);
+
+    const serial_reader_stats_t &stats() const { return d_stats; }
+};
+
+/**
+ * @brief What SerialCommandReader::add() made of a byte.
+ */
+enum SerialCommandInput {
+    serial_command_char,        // a single-character command
+    serial_command_pending,     // part of a record
+    serial_command_record,      // the end of a good record
+    serial_command_bad          // the end of a record that did not decode
+};
+
+#define SERIAL_COMMAND_MAX_PAYLOAD 32
+#define SERIAL_COMMAND_MAX_ENCODED COBS_MAX_ENCODED(SERIAL_COMMAND_MAX_PAYLOAD + SERIAL_RECORD_OVERHEAD)
+
+/**
+ * @brief Pick the records out of what the host sends the main node.
+ *
+ * Outside a record each byte is a command; a zero starts a record and
+ * the next zero ends it. Two zeros in a row are an empty record, which
+ * is how a host that lost its place gets back to commands.
+ */
+class SerialCommandReader {
+    uint8_t d_buf[SERIAL_COMMAND_MAX_ENCODED];
+    uint8_t d_len;
+    bool d_in_record;
+    bool d_overrun;
+
+public:
+    SerialCommandReader() : d_len(0), d_in_record(false), d_overrun(false) {}
+
+    /**
+     * @brief Take one byte from the host.
+     * @param c The byte
+     * @param rec Value-result: the record, for serial_command_record;
+     * its payload points into the reader and is good until the next call
+     */
+    SerialCommandInput add(uint8_t c, serial_record_t *rec);
+};
+
+#endif
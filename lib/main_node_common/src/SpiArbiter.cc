@@ -0,0 +1,69 @@
+/*
+  Arbitration of the shared SPI bus; see SpiArbiter.h.
+*/
+
+#include <string.h>
+
+#include "SpiArbiter.h"
+
+SpiArbiter::SpiArbiter(SpiBus &bus, uint32_t budget_us)
+    : d_bus(bus), d_budget_us(budget_us), d_owner(-1), d_start_us(0), d_conflicts(0) {
+    reset_stats();
+}
+
+/**
+ * @brief Take the bus for one bounded transfer.
+ *
+ * The radio's interrupt handler can only run between holds by the other
+ * devices, so a device that is not the radio must release the bus within
+ * the budget. A conflict (the bus is already held) is counted and the
+ * new owner takes over; on the M0 that can only happen if the radio's
+ * interrupt was not masked.
+ *
+ * @param device The device that will use the bus
+ */
+void SpiArbiter::acquire(SpiDevice device) {
+    if (d_owner != -1)
+        ++d_conflicts;
+
+    d_bus.begin(device);
+    d_owner = device;
+    d_start_us = d_bus.now_us();
+}
+
+/**
+ * @brief Give up the bus and record how long it was held.
+ * @param device The device passed to acquire()
+ */
+void SpiArbiter::release(SpiDevice device) {
+    uint32_t held = d_bus.now_us() - d_start_us;
+
+    spi_hold_stats_t &s = d_stats[device];
+    ++s.holds;
+    s.total_us += held;
+    if (held > s.max_us)
+        s.max_us = held;
+    if (device != spi_radio && held > d_budget_us)
+        ++s.over_budget;
+
+    d_owner = -1;
+    d_bus.end(device);
+}
+
+void SpiArbiter::reset_stats() {
+    memset(d_stats, 0, sizeof(d_stats));
+    d_conflicts = 0;
+}
+
+const char *SpiArbiter::device_name(SpiDevice device) {
+    switch (device) {
+        case spi_radio:
+            return "radio";
+        case spi_sd:
+            return "sd";
+        case spi_tft:
+            return "tft";
+        default:
+            return "?";
+    }
+}
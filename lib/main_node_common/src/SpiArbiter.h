@@ -0,0 +1,114 @@
+/*
+  Arbitration of the SPI bus the RF95, the SD card and the ST7735 share.
+
+  The bus used to be shared by toggling chip selects by hand
+  (yield_spi_to_sd()/yield_spi_to_rf95()) and by turning all interrupts
+  off around SD card operations. That kept the RF95's interrupt handler,
+  which uses the bus, from running in the middle of an SD transfer, but
+  it also held off every other interrupt, and for as long as the card
+  took, not for as long as the transfer took.
+
+  Every use of the bus by the SD card or the TFT now goes through
+  acquire() and release(). Through the SpiBus interface, acquire()
+  starts a transaction with that device's SPISettings and masks only the
+  radio's interrupt; release() ends it and the radio's interrupt, if it
+  is pending, runs right away. The radio has priority in the sense that
+  matters for the RF95: the longest it can wait for the bus is one hold
+  by another device, so the callers keep each hold short by splitting
+  long transfers (SDLogger writes at most one sector per hold and skips
+  the bus while the card is busy; TFTLogView clears the screen in
+  bands). The arbiter times each hold and keeps the worst case for each
+  device so the latency budget can be checked on the real hardware.
+
+  The radio's interrupt handler calls acquire()/release() too, so its
+  own time on the bus is measured, but that never masks anything.
+*/
+
+#ifndef SpiArbiter_h
+#define SpiArbiter_h
+
+#include <stdint.h>
+
+// The longest another device should hold the bus, in us. The RF95
+// needs its receive-done interrupt handled before it can listen again;
+// 4 ms is half the eight-symbol preamble at SF7/125kHz. Set the value
+// using the platformio.ini file.
+#ifndef SPI_HOLD_BUDGET_US
+#define SPI_HOLD_BUDGET_US 4000
+#endif
+
+enum SpiDevice {
+    spi_radio = 0,
+    spi_sd,
+    spi_tft,
+    spi_device_count
+};
+
+/**
+ * @brief How the arbiter reaches the hardware.
+ */
+class SpiBus {
+public:
+    virtual ~SpiBus() {}
+
+    /**
+     * @brief Give the bus to a device.
+     * Start a transaction with the device's settings and make sure the
+     * other devices are deselected. For any device other than the radio,
+     * mask the radio's interrupt.
+     */
+    virtual void begin(SpiDevice device) = 0;
+
+    /// @brief End the transaction begin() started; unmask the radio's interrupt
+    virtual void end(SpiDevice device) = 0;
+
+    /// @return A free-running microsecond clock (micros())
+    virtual uint32_t now_us() = 0;
+};
+
+/**
+ * @brief What one device did with the bus.
+ */
+struct spi_hold_stats_t {
+    uint32_t holds;         // acquire()/release() pairs
+    uint32_t max_us;        // the longest hold
+    uint32_t total_us;      // all holds
+    uint32_t over_budget;   // holds longer than the budget
+};
+
+/**
+ * @brief One owner of the SPI bus at a time, with hold times per device.
+ */
+class SpiArbiter {
+    SpiBus &d_bus;
+    uint32_t d_budget_us;
+
+    volatile int8_t d_owner;    // a SpiDevice, or -1
+    uint32_t d_start_us;
+    uint32_t d_conflicts;
+
+    spi_hold_stats_t d_stats[spi_device_count];
+
+public:
+    SpiArbiter(SpiBus &bus, uint32_t budget_us = SPI_HOLD_BUDGET_US);
+
+    void acquire(SpiDevice device);
+    void release(SpiDevice device);
+
+    /// @return The device that holds the bus, or -1
+    int8_t owner() const { return d_owner; }
+
+    uint32_t budget_us() const { return d_budget_us; }
+
+    /// @return Times acquire() was called while another device held the
+    /// bus. Anything but zero means the radio's interrupt was not masked.
+    uint32_t conflicts() const { return d_conflicts; }
+
+    const spi_hold_stats_t &stats(SpiDevice device) const { return d_stats[device]; }
+
+    void reset_stats();
+
+    static const char *device_name(SpiDevice device);
+};
+
+#endif
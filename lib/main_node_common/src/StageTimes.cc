@@ -0,0 +1,62 @@
+/*
+  Stage time histograms; see StageTimes.h.
+*/
+
+#include <string.h>
+
+#include "StageTimes.h"
+
+void StageTimes::reset() {
+    memset(d_stats, 0, sizeof(d_stats));
+}
+
+/**
+ * @brief Record one time for a stage.
+ * @param stage The stage
+ * @param us How long it took
+ */
+void StageTimes::add(Stage stage, uint32_t us) {
+    stage_stats_t &s = d_stats[stage];
+    ++s.count;
+    s.total_us += us;
+    if (us > s.max_us)
+        s.max_us = us;
+    ++s.bins[bin(us)];
+}
+
+int StageTimes::percentile_bin(Stage stage, uint8_t percent) const {
+    const stage_stats_t &s = d_stats[stage];
+    if (s.count == 0)
+        return -1;
+
+    // The first bin where the count so far passes percent% of the total
+    uint64_t target = (uint64_t)s.count * percent;
+    uint64_t seen = 0;
+    for (int i = 0; i < STAGE_BINS; ++i) {
+        seen += s.bins[i];
+        if (seen * 100 > target)
+            return i;
+    }
+    return bin(s.max_us);
+}
+
+const char *StageTimes::stage_name(Stage stage) {
+    switch (stage) {
+        case stage_receive:
+            return "receive";
+        case stage_render:
+            return "render";
+        case stage_serial:
+            return "serial";
+        case stage_log:
+            return "log";
+        case stage_reply:
+            return "reply";
+        case stage_tft:
+            return "tft";
+        case stage_frame:
+            return "frame";
+        default:
+            return "?";
+    }
+}
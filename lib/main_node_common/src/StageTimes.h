@@ -0,0 +1,90 @@
+/*
+  How long each stage of handling a received frame takes in loop().
+
+  Each stage has a fixed-size log-scale histogram of its times in
+  microseconds: bin 0 is 0 us and bin k is 2^(k-1) to 2^k - 1 us, so 24
+  bins reach past four seconds in 112 bytes a stage. The percentiles
+  read from it are the upper limit of a bin, good to a factor of two,
+  which is what is needed to find the stage that takes the time.
+
+  The main node times the stages with micros(). The Feather M0's SAMD21
+  is a Cortex-M0+, which has no DWT cycle counter; micros() on it
+  resolves 1 us and costs a few, which is well below the stages timed.
+  All of this compiles out when STAGE_TIMING is 0; see main-node.cc.
+*/
+
+#ifndef StageTimes_h
+#define StageTimes_h
+
+#include <stdint.h>
+
+#define STAGE_BINS 24       // the last bin is 2^22 us (4.2 s) and over
+
+enum Stage {
+    stage_receive = 0,      // getting the frame from the RX queue and ACKing it
+    stage_render,           // decoding the frame and the *_to_string() calls
+    stage_serial,           // printing to the console
+    stage_log,              // log_data() and log_frame()
+    stage_reply,            // queuing the reply
+    stage_tft,              // queuing the data line; display_task() draws it
+    stage_frame,            // all of the above, and the rest, for one frame
+    stage_count
+};
+
+/**
+ * @brief The times of one stage.
+ */
+struct stage_stats_t {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t bins[STAGE_BINS];
+};
+
+/**
+ * @brief Histograms of stage times.
+ */
+class StageTimes {
+    stage_stats_t d_stats[stage_count];
+
+public:
+    StageTimes() { reset(); }
+
+    void reset();
+
+    /// @return The histogram bin for a time
+    static uint8_t bin(uint32_t us) {
+        uint8_t b = us ? 32 - __builtin_clz(us) : 0;
+        return b < STAGE_BINS ? b : STAGE_BINS - 1;
+    }
+
+    /// @return The largest time in a bin; the last bin has no limit
+    static uint32_t bin_limit_us(uint8_t bin) { return bin ? (1UL << bin) - 1 : 0; }
+
+    void add(Stage stage, uint32_t us);
+
+    /**
+     * @brief Add the time since a start time to a stage and make now the
+     * start of the next stage.
+     * @param stage The stage that just ended
+     * @param start_us When it started; set to now_us
+     * @param now_us The time
+     */
+    void lap(Stage stage, uint32_t &start_us, uint32_t now_us) {
+        add(stage, now_us - start_us);
+        start_us = now_us;
+    }
+
+    const stage_stats_t &stats(Stage stage) const { return d_stats[stage]; }
+
+    /**
+     * @brief The bin that holds a percentile of a stage's times.
+     * @param percent 0 to 100
+     * @return The bin, or -1 if the stage has no times
+     */
+    int percentile_bin(Stage stage, uint8_t percent) const;
+
+    static const char *stage_name(Stage stage);
+};
+
+#endif
@@ -0,0 +1,246 @@
+/*
+  The scrolling list of leaf node data lines shown on the TFT.
+
+  tft_display_data_packet() used to redraw the whole screen for each
+  packet: fillScreen() for the header, then all 11 lines, after copying
+  every line up one slot in a 11 x 161 byte array. On the shared SPI bus
+  that is a full 160 x 128 frame per uplink.
+
+  The ST7735's hardware vertical scroll would be the obvious fix, but it
+  scrolls along the panel's 160-pixel side. The display runs in landscape
+  (setRotation(1)), where that axis is horizontal, so it cannot move the
+  text lines up. Instead, in incremental mode, once the screen is full a
+  new line replaces the oldest one in place and a short red rule under
+  the newest line shows where the list 'wraps'. Each packet then costs
+  one text row plus two one-pixel rules on the bus.
+
+  The lines are kept in a ring; nothing is copied when a line is added.
+  queue_line() only stores a line and refresh() draws one queued line,
+  so the main node can draw from a task of its own, off the frame path.
+
+  The display shares the SPI bus with the radio. Each drawing call is
+  made while holding the bus (BusLock), and the screen is cleared in
+  bands of TFT_CHUNK_ROWS rows instead of one 40 kB fillScreen(), so the
+  radio never waits for more than one band or one line of text.
+
+  The class is a template on the graphics type so it can be tested in
+  the native env with a mock that counts pixels and SPI bytes. On the M0
+  GFX is Adafruit_ST7735.
+*/
+
+#ifndef TFTLogView_h
+#define TFTLogView_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define TFT_LOG_LINES 11        // 11 lines can be displayed
+#define TFT_LOG_CHARS 27        // 26 characters fit across the screen, plus the null
+
+#define TFT_LOG_BLACK 0x0000    // ST77XX_BLACK
+#define TFT_LOG_RED 0xF800      // ST77XX_RED
+#define TFT_LOG_GREEN 0x07E0    // ST77XX_GREEN
+
+// Rows per band when the screen is cleared; 16 rows is 5 kB on the bus.
+// Set the value using the platformio.ini file.
+#ifndef TFT_CHUNK_ROWS
+#define TFT_CHUNK_ROWS 16
+#endif
+
+/**
+ * @brief A BusLock for a display that has the bus to itself.
+ */
+struct TFTNoLock {
+    static void lock() {}
+    static void unlock() {}
+};
+
+/**
+ * @brief The header and data lines on the TFT
+ *
+ * The display shows the header, which is underlined, and 11 lines of
+ * text below that using the default font. Each line of text has two rows
+ * of 'leading,' so the height of a text line is 10 pixels. Because the
+ * header starts 2 pixels from the left edge and 3 from the top, the first
+ * row of text starts at 2, 15 and each subsequent row is 10 pixels more
+ * below that (2 and 25, 2 and 35, ...).
+ *
+ * @tparam GFX Adafruit_GFX or something that looks like it
+ * @tparam BusLock Type with static lock() and unlock() that claim the SPI bus
+ */
+template <class GFX, class BusLock = TFTNoLock>
+class TFTLogView {
+    GFX &d_tft;
+    bool d_incremental;
+
+    char d_text[TFT_LOG_LINES][TFT_LOG_CHARS];
+    uint8_t d_count;    // lines held, up to TFT_LOG_LINES
+    uint8_t d_newest;   // slot of the newest line
+    uint8_t d_pending;  // newest lines not yet drawn
+    uint8_t d_shown;    // rows with a line drawn in them
+
+    static int16_t row_y(uint8_t row) { return 15 + 10 * row; }
+
+    void draw_line(uint8_t row, const char *text) {
+        d_tft.setCursor(2, row_y(row));
+        BusLock::lock();
+        d_tft.print(text);
+        BusLock::unlock();
+    }
+
+    // The rule under the newest line, drawn in 'color'
+    void draw_marker(uint8_t row, uint16_t color) {
+        BusLock::lock();
+        d_tft.drawFastHLine(2, row_y(row) + 9, d_tft.width() - 4, color);
+        BusLock::unlock();
+    }
+
+    void fill_rows(int16_t y, int16_t h, uint16_t color) {
+        BusLock::lock();
+        d_tft.fillRect(0, y, d_tft.width(), h, color);
+        BusLock::unlock();
+    }
+
+    // fillScreen(), a band at a time
+    void clear_screen() {
+        int16_t height = d_tft.height();
+        for (int16_t y = 0; y < height; y += TFT_CHUNK_ROWS)
+            fill_rows(y, (height - y < TFT_CHUNK_ROWS) ? height - y : TFT_CHUNK_ROWS, TFT_LOG_BLACK);
+    }
+
+public:
+    /**
+     * @param tft The display
+     * @param incremental If true, add_line() only draws the new line;
+     * if false, it redraws the whole screen with the newest line at the
+     * bottom, the way the display always worked.
+     */
+    TFTLogView(GFX &tft, bool incremental = true)
+        : d_tft(tft), d_incremental(incremental), d_count(0), d_newest(TFT_LOG_LINES - 1), d_pending(0),
+          d_shown(0) {
+        memset(d_text, 0, sizeof(d_text));
+    }
+
+    void set_incremental(bool incremental) { d_incremental = incremental; }
+
+    /**
+     * @brief Clear the screen and write the leaf node data header.
+     *
+     * Once this is called, all the lines need to be redrawn.
+     */
+    void draw_header() {
+        clear_screen();
+
+        d_tft.setCursor(2, 3);
+        d_tft.setTextColor(TFT_LOG_RED);
+        d_tft.setTextSize(1);
+        BusLock::lock();
+        d_tft.print("Node time  C  %rh bat stat");
+        BusLock::unlock();
+
+        BusLock::lock();
+        d_tft.drawFastHLine(2, 13, d_tft.width() - 4, TFT_LOG_RED);
+        BusLock::unlock();
+    }
+
+    /**
+     * @brief Redraw everything.
+     *
+     * In incremental mode the lines stay in their slots; otherwise they
+     * are drawn oldest first so the newest is at the bottom.
+     */
+    void redraw() {
+        d_pending = 0;
+        d_shown = d_count;
+        draw_header();
+        d_tft.setTextColor(TFT_LOG_GREEN);
+
+        for (uint8_t i = 0; i < d_count; ++i) {
+            if (d_incremental)
+                draw_line(i, d_text[i]);
+            else
+                draw_line(i, line(i));
+        }
+
+        if (d_incremental && d_count == TFT_LOG_LINES)
+            draw_marker(d_newest, TFT_LOG_RED);
+    }
+
+    /**
+     * @brief Add a line; refresh() draws it.
+     *
+     * If more lines are queued than fit on the screen before refresh()
+     * catches up, only the newest TFT_LOG_LINES are drawn.
+     * @param text The text; only the first TFT_LOG_CHARS - 1 characters fit
+     */
+    void queue_line(const char *text) {
+        d_newest = (d_newest + 1) % TFT_LOG_LINES;
+        strncpy(d_text[d_newest], text, TFT_LOG_CHARS - 1);
+        d_text[d_newest][TFT_LOG_CHARS - 1] = '\0';
+        if (d_count < TFT_LOG_LINES)
+            ++d_count;
+        if (d_pending < TFT_LOG_LINES)
+            ++d_pending;
+    }
+
+    /**
+     * @brief Draw the oldest line queued but not yet drawn; in full
+     * redraw mode, redraw the screen.
+     * @return False if there was nothing to draw
+     */
+    bool refresh() {
+        if (d_pending == 0)
+            return false;
+
+        if (!d_incremental) {
+            redraw();
+            return true;
+        }
+
+        uint8_t row = (d_newest + TFT_LOG_LINES + 1 - d_pending) % TFT_LOG_LINES;
+        uint8_t previous = (row + TFT_LOG_LINES - 1) % TFT_LOG_LINES;
+        --d_pending;
+
+        // While the screen is filling, the new line goes under the others
+        // just as it always did. After that, it replaces the oldest line.
+        if (d_shown == TFT_LOG_LINES)
+            draw_marker(previous, TFT_LOG_BLACK);
+        else
+            ++d_shown;
+
+        fill_rows(row_y(row), 10, TFT_LOG_BLACK);
+        d_tft.setTextColor(TFT_LOG_GREEN);
+        draw_line(row, d_text[row]);
+
+        if (d_shown == TFT_LOG_LINES)
+            draw_marker(row, TFT_LOG_RED);
+        return true;
+    }
+
+    /// @return The number of lines queued but not drawn
+    uint8_t pending() const { return d_pending; }
+
+    /**
+     * @brief Add a line and show it.
+     * @param text The text; only the first TFT_LOG_CHARS - 1 characters fit
+     */
+    void add_line(const char *text) {
+        queue_line(text);
+        while (refresh())
+            ;
+    }
+
+    /// @return The number of lines held
+    uint8_t count() const { return d_count; }
+
+    /**
+     * @brief Get a line by age
+     * @param i 0 is the oldest line, count() - 1 the newest
+     */
+    const char *line(uint8_t i) const {
+        uint8_t oldest = (d_newest + TFT_LOG_LINES + 1 - d_count) % TFT_LOG_LINES;
+        return d_text[(oldest + i) % TFT_LOG_LINES];
+    }
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+  A grid on the TFT with one row per leaf node: its address, how long
+  ago it was heard, and its last temperature, humidity, battery voltage
+  and RSSI.
+
+  The scrolling list (TFTLogView.h) shows the last 11 data lines, so a
+  node that goes quiet scrolls off the screen, which is when it matters.
+  Here a node keeps its row, and its age keeps growing.
+
+  heard() and reading() only store the values; they are called on the
+  frame path. refresh() draws one row: it formats the row's cells and
+  repaints only the cells whose text is not what is on the screen, each
+  as a small filled rectangle and its text. tick() moves the clock the
+  ages are worked out from; the main node calls it from a low-rate
+  task, and a cell is repainted only when its age's text changes
+  (seconds for the first minute, then minutes, hours and days).
+
+  There are TFT_GRID_ROWS rows. A node that is heard when they are all
+  in use takes the row of the node heard least recently.
+
+  Like TFTLogView this is a template on the graphics type and the bus
+  lock, and it clears the screen in bands of TFT_CHUNK_ROWS rows.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef TFTNodeGrid_h
+#define TFTNodeGrid_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "TFTLogView.h"
+#include "TextFormat.h"
+
+#define TFT_GRID_ROWS TFT_LOG_LINES     // the rows of text under the header
+#define TFT_GRID_CELLS 6
+#define TFT_GRID_CELL_CHARS 6           // the widest cell, plus the null
+#define TFT_GRID_CHAR_WIDTH 6           // pixels, in the default font
+#define TFT_GRID_CHAR_HEIGHT 8
+
+/**
+ * @brief The node grid on the TFT.
+ * @tparam GFX Adafruit_GFX or something that looks like it
+ * @tparam BusLock Type with static lock() and unlock() that claim the SPI bus
+ */
+template <class GFX, class BusLock = TFTNoLock>
+class TFTNodeGrid {
+    enum cell { cell_node, cell_age, cell_temp, cell_humidity, cell_battery, cell_rssi };
+
+    struct row_t {
+        uint8_t address;            // 0: the row is not in use
+        bool has_reading;
+        bool dirty;                 // a cell may need to be repainted
+        uint32_t seen;              // unixtime
+        int16_t rssi;
+        int16_t temp;               // hundredths
+        uint16_t humidity;
+        uint16_t battery;
+        char shown[TFT_GRID_CELLS][TFT_GRID_CELL_CHARS];     // what is on the screen
+    };
+
+    GFX &d_tft;
+    row_t d_rows[TFT_GRID_ROWS];
+    uint32_t d_now;
+    uint8_t d_next;                 // the row refresh() looks at first
+
+    // Where each cell starts, in characters, and its width; the text is
+    // right-aligned in it. The RSSI is shown without its minus sign.
+    static uint8_t cell_col(uint8_t c) {
+        static const uint8_t cols[TFT_GRID_CELLS] = {0, 4, 8, 14, 18, 23};
+        return cols[c];
+    }
+
+    static uint8_t cell_width(uint8_t c) {
+        static const uint8_t widths[TFT_GRID_CELLS] = {3, 3, 5, 3, 4, 3};
+        return widths[c];
+    }
+
+    static int16_t row_y(uint8_t row) { return 15 + 10 * row; }
+
+    void fill(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+        BusLock::lock();
+        d_tft.fillRect(x, y, w, h, color);
+        BusLock::unlock();
+    }
+
+    // fillScreen(), a band at a time
+    void clear_screen() {
+        int16_t height = d_tft.height();
+        for (int16_t y = 0; y < height; y += TFT_CHUNK_ROWS)
+            fill(0, y, d_tft.width(), (height - y < TFT_CHUNK_ROWS) ? height - y : TFT_CHUNK_ROWS, TFT_LOG_BLACK);
+    }
+
+    void format_age(TextSpan &text, uint32_t age) const {
+        if (age < 60)
+            text.put_uint(age).put('s');
+        else if (age < 3600)
+            text.put_uint(age / 60).put('m');
+        else if (age < 48 * 3600UL)
+            text.put_uint(age / 3600).put('h');
+        else
+            text.put_uint(age / 86400 < 99 ? age / 86400 : 99).put('d');
+    }
+
+    // A value too wide for its cell is cut off
+    void format(const row_t &r, uint8_t c, char text[TFT_GRID_CELL_CHARS]) const {
+        TextSpan span(text, cell_width(c) + 1);
+        switch (c) {
+            case cell_node:
+                span.put_uint(r.address);
+                break;
+            case cell_age:
+                if (r.seen)
+                    format_age(span, d_now > r.seen ? d_now - r.seen : 0);
+                break;
+            case cell_temp:
+                if (r.has_reading)
+                    span.put_centi(r.temp, 1);
+                break;
+            case cell_humidity:
+                if (r.has_reading)
+                    span.put_uint(r.humidity / 100);
+                break;
+            case cell_battery:
+                if (r.has_reading)
+                    span.put_centi(r.battery, 2);
+                break;
+            case cell_rssi:
+                if (r.rssi)
+                    span.put_uint(r.rssi < 0 ? -r.rssi : r.rssi);
+                break;
+        }
+    }
+
+    void draw_cell(uint8_t row, uint8_t c, const char *text) {
+        int16_t x = 2 + TFT_GRID_CHAR_WIDTH * cell_col(c);
+        fill(x, row_y(row), TFT_GRID_CHAR_WIDTH * cell_width(c), TFT_GRID_CHAR_HEIGHT, TFT_LOG_BLACK);
+
+        size_t len = strlen(text);
+        d_tft.setCursor(x + TFT_GRID_CHAR_WIDTH * (cell_width(c) - len), row_y(row));
+        BusLock::lock();
+        d_tft.print(text);
+        BusLock::unlock();
+    }
+
+    // The row for 'address': its own, a free one or the least recently heard
+    row_t &row_for(uint8_t address) {
+        uint8_t oldest = 0;
+        for (uint8_t i = 0; i < TFT_GRID_ROWS; ++i) {
+            if (d_rows[i].address == address)
+                return d_rows[i];
+            if (d_rows[oldest].address && (!d_rows[i].address || d_rows[i].seen < d_rows[oldest].seen))
+                oldest = i;
+        }
+
+        row_t &r = d_rows[oldest];
+        r.address = address;
+        r.has_reading = false;
+        r.seen = 0;
+        r.rssi = 0;
+        r.dirty = true;
+        return r;
+    }
+
+public:
+    explicit TFTNodeGrid(GFX &tft) : d_tft(tft), d_now(0), d_next(0) { memset(d_rows, 0, sizeof(d_rows)); }
+
+    /**
+     * @brief Clear the screen and write the grid's header. The rows are
+     * drawn by refresh().
+     */
+    void redraw() {
+        clear_screen();
+
+        d_tft.setCursor(2, 3);
+        d_tft.setTextColor(TFT_LOG_RED);
+        d_tft.setTextSize(1);
+        BusLock::lock();
+        d_tft.print(" ID age     C %rh  bat-dBm");
+        BusLock::unlock();
+
+        BusLock::lock();
+        d_tft.drawFastHLine(2, 13, d_tft.width() - 4, TFT_LOG_RED);
+        BusLock::unlock();
+
+        for (uint8_t i = 0; i < TFT_GRID_ROWS; ++i) {
+            memset(d_rows[i].shown, 0, sizeof(d_rows[i].shown));
+            d_rows[i].dirty = d_rows[i].address != 0;
+        }
+    }
+
+    /**
+     * @brief A frame from a node.
+     * @param address The node; 0 is not shown
+     * @param when When it was received, unixtime
+     * @param rssi Its RSSI, dBm
+     */
+    void heard(uint8_t address, uint32_t when, int16_t rssi) {
+        if (address == 0)
+            return;
+        row_t &r = row_for(address);
+        r.seen = when;
+        r.rssi = rssi;
+        r.dirty = true;
+        if (when > d_now)
+            d_now = when;
+    }
+
+    /**
+     * @brief A node's reading; call heard() for its frame first.
+     * @param temp In hundredths of a degree C
+     * @param humidity In hundredths of a percent
+     * @param battery In hundredths of a volt
+     */
+    void reading(uint8_t address, int16_t temp, uint16_t humidity, uint16_t battery) {
+        if (address == 0)
+            return;
+        row_t &r = row_for(address);
+        r.has_reading = true;
+        r.temp = temp;
+        r.humidity = humidity;
+        r.battery = battery;
+        r.dirty = true;
+    }
+
+    /**
+     * @brief Move the clock the ages are worked out from; refresh()
+     * repaints the ages whose text changed.
+     * @param now Unixtime
+     */
+    void tick(uint32_t now) {
+        d_now = now;
+        for (uint8_t i = 0; i < TFT_GRID_ROWS; ++i)
+            d_rows[i].dirty |= d_rows[i].seen != 0;
+    }
+
+    /**
+     * @brief Repaint the changed cells of the next row that may have
+     * changed.
+     * @return False if no row had to be looked at
+     */
+    bool refresh() {
+        for (uint8_t n = 0; n < TFT_GRID_ROWS; ++n) {
+            uint8_t i = (d_next + n) % TFT_GRID_ROWS;
+            row_t &r = d_rows[i];
+            if (!r.dirty)
+                continue;
+
+            r.dirty = false;
+            d_next = (i + 1) % TFT_GRID_ROWS;
+            d_tft.setTextColor(TFT_LOG_GREEN);
+            char text[TFT_GRID_CELL_CHARS];
+            for (uint8_t c = 0; c < TFT_GRID_CELLS; ++c) {
+                format(r, c, text);
+                if (strcmp(text, r.shown[c]) == 0)
+                    continue;
+                draw_cell(i, c, text);
+                strcpy(r.shown[c], text);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /// @return The number of rows in use
+    uint8_t rows() const {
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < TFT_GRID_ROWS; ++i)
+            n += d_rows[i].address != 0;
+        return n;
+    }
+
+    /**
+     * @brief The text shown in a cell, once refresh() has drawn it
+     * @param c 0 to 5: address, age, temperature, humidity, battery, RSSI
+     */
+    const char *cell_text(uint8_t row, uint8_t c) const { return d_rows[row].shown[c]; }
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  Integer-only formatting; see TextFormat.h.
+*/
+
+#include "TextFormat.h"
+
+// Howard Hinnant's civil_from_days(), for days since 1970-01-01
+static void civil_from_days(int32_t z, int32_t *y, unsigned *m, unsigned *d) {
+    z += 719468;
+    const int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int32_t)yoe + era * 400 + (*m <= 2);
+}
+
+void unix_date_time(uint32_t unixtime, date_time_t *dt) {
+    int32_t y;
+    unsigned m, d;
+    civil_from_days(unixtime / 86400, &y, &m, &d);
+    dt->year = y;
+    dt->month = m;
+    dt->day = d;
+    uint32_t s = unixtime % 86400;
+    dt->hour = s / 3600;
+    dt->minute = (s / 60) % 60;
+    dt->second = s % 60;
+}
+
+TextSpan::TextSpan(char *text, size_t size) : d_text(text), d_size(size), d_len(0), d_truncated(false) {
+    d_text[0] = '\0';
+}
+
+TextSpan &TextSpan::put(char c) {
+    if (d_len + 1 < d_size) {
+        d_text[d_len++] = c;
+        d_text[d_len] = '\0';
+    }
+    else {
+        d_truncated = true;
+    }
+    return *this;
+}
+
+TextSpan &TextSpan::put(const char *s, size_t max) {
+    for (size_t i = 0; i < max && s[i]; ++i) {
+        if (d_len + 1 == d_size) {
+            d_truncated = true;
+            break;
+        }
+        d_text[d_len++] = s[i];
+    }
+    d_text[d_len] = '\0';
+    return *this;
+}
+
+void TextSpan::put_number(uint32_t magnitude, bool negative, uint8_t width, char pad) {
+    char digits[10];
+    uint8_t n = 0;
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+
+    // A space pads before the sign, a zero after it
+    uint8_t len = n + negative;
+    if (pad != '0')
+        for (; len < width; ++len)
+            put(pad);
+    if (negative)
+        put('-');
+    for (; len < width; ++len)
+        put('0');
+    while (n)
+        put(digits[--n]);
+}
+
+TextSpan &TextSpan::put_uint(uint32_t value, uint8_t width, char pad) {
+    put_number(value, false, width, pad);
+    return *this;
+}
+
+TextSpan &TextSpan::put_int(int32_t value, uint8_t width, char pad) {
+    uint32_t magnitude = value < 0 ? 0 - (uint32_t)value : (uint32_t)value;
+    put_number(magnitude, value < 0, width, pad);
+    return *this;
+}
+
+TextSpan &TextSpan::put_centi(int32_t centi, uint8_t decimals, uint8_t width) {
+    bool negative = centi < 0;
+    uint32_t magnitude = negative ? 0 - (uint32_t)centi : (uint32_t)centi;
+
+    uint32_t whole, fraction = 0;
+    switch (decimals) {
+        case 0:
+            whole = (magnitude + 50) / 100;
+            break;
+        case 1:
+            magnitude = (magnitude + 5) / 10;
+            whole = magnitude / 10;
+            fraction = magnitude % 10;
+            break;
+        default:
+            decimals = 2;
+            whole = magnitude / 100;
+            fraction = magnitude % 100;
+            break;
+    }
+
+    // The whole part takes what the point and the decimals leave of the width
+    uint8_t rest = decimals ? decimals + 1 : 0;
+    put_number(whole, negative, width > rest ? width - rest : 0, ' ');
+    if (decimals) {
+        put('.');
+        put_number(fraction, false, decimals, '0');
+    }
+    return *this;
+}
+
+TextSpan &TextSpan::put_hex(uint32_t value, uint8_t digits) {
+    char hex[8];
+    uint8_t n = 0;
+    do {
+        hex[n++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+
+    for (uint8_t i = n; i < digits; ++i)
+        put('0');
+    while (n)
+        put(hex[--n]);
+    return *this;
+}
+
+TextSpan &TextSpan::put_iso8601(uint32_t unixtime) {
+    date_time_t t;
+    unix_date_time(unixtime, &t);
+    put_uint(t.year, 4, '0').put('-').put_uint(t.month, 2, '0').put('-').put_uint(t.day, 2, '0');
+    put('T').put_uint(t.hour, 2, '0').put(':').put_uint(t.minute, 2, '0').put(':').put_uint(t.second, 2, '0');
+    return *this;
+}
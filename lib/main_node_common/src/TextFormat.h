@@ -0,0 +1,109 @@
+/*
+  Integer-only text formatting into a buffer the caller owns.
+
+  The main node's renderers used snprintf(). The TFT's data line
+  printed temp / 100.0 and battery / 100.0 with %3.1f and %3.2f, which
+  on the M0's Cortex-M0+ (no FPU) pulls in double-precision soft-float
+  and the floating point printf. iso8601_date_time() built its string
+  with eleven strncat() calls, each of which scans the string from the
+  start, into a static buffer.
+
+  TextSpan appends to the caller's buffer. It never writes past the end
+  and always leaves the text null-terminated; text that does not fit is
+  cut off and truncated() says so. It has no static state and does not
+  allocate.
+
+  Readings are in centi-units (hundredths of a degree, of a volt, of a
+  percent), so put_centi() prints them with one or two decimals using
+  integer arithmetic. Rounding to one decimal is half away from zero on
+  the decimal value. %3.1f rounded the nearest double instead, which
+  differs on some ties: 20.45 was 20.4, and is 20.5 here.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef TextFormat_h
+#define TextFormat_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ISO8601_CHARS 20    // 2021-03-16T15:38:32 and the null
+
+/**
+ * @brief A unixtime broken into its UTC fields.
+ */
+struct date_time_t {
+    uint16_t year;
+    uint8_t month;      // 1 to 12
+    uint8_t day;        // 1 to 31
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+};
+
+void unix_date_time(uint32_t unixtime, date_time_t *dt);
+
+/**
+ * @brief Text appended to a fixed buffer.
+ *
+ * The put methods return the span, so a line can be built in one
+ * expression:
+ *
+ *     TextSpan line(text, sizeof(text));
+ *     line.put("node ").put_uint(node).put(", ").put_centi(temp, 1);
+ */
+class TextSpan {
+    char *d_text;
+    size_t d_size;
+    size_t d_len;
+    bool d_truncated;
+
+    void put_number(uint32_t magnitude, bool negative, uint8_t width, char pad);
+
+public:
+    /**
+     * @param text The buffer; it is made an empty string
+     * @param size Its size, including the null; at least 1
+     */
+    TextSpan(char *text, size_t size);
+
+    /// @brief Append a string, or at most 'max' characters of it
+    TextSpan &put(const char *s, size_t max = (size_t)-1);
+
+    TextSpan &put(char c);
+
+    /**
+     * @brief Append a number in decimal, as %u or %0Nu do
+     * @param width Pad to at least this many characters
+     * @param pad With this, on the left; ' ' or '0'
+     */
+    TextSpan &put_uint(uint32_t value, uint8_t width = 0, char pad = ' ');
+
+    /// @brief Append a signed number, as %d or %0Nd do
+    TextSpan &put_int(int32_t value, uint8_t width = 0, char pad = ' ');
+
+    /**
+     * @brief Append a value in hundredths as a decimal number, as %N.1f
+     * or %N.2f would print centi / 100.0
+     * @param decimals 0, 1 or 2
+     * @param width Pad with spaces on the left to at least this many characters
+     */
+    TextSpan &put_centi(int32_t centi, uint8_t decimals, uint8_t width = 0);
+
+    /// @brief Append a number in lower case hex, zero padded to 'digits', as %0Nx does
+    TextSpan &put_hex(uint32_t value, uint8_t digits = 0);
+
+    /// @brief Append a unixtime as an ISO 8601 UTC date and time, 2021-03-16T15:38:32
+    TextSpan &put_iso8601(uint32_t unixtime);
+
+    const char *c_str() const { return d_text; }
+
+    /// @return The number of characters in the text, without the null
+    size_t length() const { return d_len; }
+
+    /// @return True if something did not fit
+    bool truncated() const { return d_truncated; }
+};
+
+#endif
@@ -0,0 +1,43 @@
+/*
+  The TFT's data lines and the console's time; see TextLines.h.
+*/
+
+#include "TextLines.h"
+
+/**
+ * @brief Write a unixtime as an ISO 8601 date and time to 'text'
+ * @return text
+ */
+char *iso8601_date_time(uint32_t unixtime, char text[ISO8601_CHARS]) {
+    TextSpan(text, ISO8601_CHARS).put_iso8601(unixtime);
+    return text;
+}
+
+/**
+ * @brief Write decoded packet values to display to 'text'
+ */
+void tft_get_data_line(const packet_t *data, unsigned int min, unsigned int sec, char text[DATA_LINE_CHARS])
+{
+    uint8_t node;
+    batch_reading_t reading;
+
+    parse_data_packet(data, &node, &reading.message, &reading.time, &reading.battery, &reading.last_tx_duration,
+                      &reading.temp, &reading.humidity, &reading.status);
+
+    tft_get_reading_line(node, reading, min, sec, text);
+}
+
+/**
+ * @brief Write a reading that is already decoded to 'text', as tft_get_data_line() does
+ *
+ * The line is what "%u %02u:%02u %3.1f %u %3.2f 0x%02x" made of the node,
+ * the time, temp / 100.0, humidity / 100, battery / 100.0 and status.
+ */
+void tft_get_reading_line(uint8_t node, const batch_reading_t &reading, unsigned int min, unsigned int sec,
+                          char text[DATA_LINE_CHARS])
+{
+    TextSpan line(text, DATA_LINE_CHARS);
+    line.put_uint(node).put(' ').put_uint(min, 2, '0').put(':').put_uint(sec, 2, '0').put(' ');
+    line.put_centi(reading.temp, 1, 3).put(' ').put_uint(reading.humidity / 100).put(' ');
+    line.put_centi(reading.battery, 2, 3).put(" 0x").put_hex(reading.status, 2);
+}
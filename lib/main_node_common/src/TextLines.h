@@ -0,0 +1,31 @@
+/*
+  The text the main node makes of a reading for the TFT and of a time
+  for the console. The messages themselves are rendered by
+  Soil_Sensor_Common's *_to_string() functions.
+
+  These used to be in src/, where only the M0 build could reach them.
+  Here the native tests and host-tools/codec_bench run the same code as
+  the main node. They format with TextSpan (TextFormat.h): integers
+  only, into the caller's buffer.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef TextLines_h
+#define TextLines_h
+
+#include <stdint.h>
+
+#include "BatchMessage.h"
+#include "TextFormat.h"
+#include "data_packet.h"
+
+#define DATA_LINE_CHARS 161
+
+char *iso8601_date_time(uint32_t unixtime, char text[ISO8601_CHARS]);
+
+void tft_get_data_line(const packet_t *data, unsigned int min, unsigned int sec, char text[DATA_LINE_CHARS]);
+void tft_get_reading_line(uint8_t node, const batch_reading_t &reading, unsigned int min, unsigned int sec,
+                          char text[DATA_LINE_CHARS]);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+  Cached real time clock.
+
+  Every DS3231.now() is an I2C burst, and loop() was calling it four
+  times for each data packet: for the 'Current time' line, twice for the
+  TFT line's minute and second (which could disagree if a second ticked
+  over between the reads) and again for the reply.
+
+  The time service reads the RTC once and then advances from millis().
+  If the DS3231's 1Hz square wave output is wired to an interrupt pin,
+  on_tick() is called on each falling edge (when the DS3231's seconds
+  register changes); that ties the millis() phase to the RTC's seconds
+  and so the service also knows the milliseconds. Without the square
+  wave, millis() drifts relative to the RTC (by up to a few seconds a
+  day), so the RTC is read again every 'resync interval.'
+
+  Callers get one consistent timestamp by calling now() once per packet
+  and passing that value around.
+
+  The RTC type must have now() returning something with unixtime(), like
+  RTClib's RTC_DS3231. CriticalSection is the same as for SDLogger; it
+  guards the values on_tick() changes.
+*/
+
+#ifndef TimeService_h
+#define TimeService_h
+
+#include <stdint.h>
+
+#ifndef TIME_RESYNC_INTERVAL_MS
+#define TIME_RESYNC_INTERVAL_MS 3600000UL  // one hour
+#endif
+
+// If the square wave stops for this long, go back to the resync schedule
+#define TIME_TICK_TIMEOUT_MS 3000
+
+template <class RTC, class CriticalSection>
+class TimeService {
+    RTC &d_rtc;
+
+    volatile uint32_t d_base_unix;  // the time at d_base_ms
+    volatile uint32_t d_base_ms;
+    volatile bool d_disciplined;    // true while the 1Hz ticks are arriving
+    volatile uint32_t d_ticks;
+
+    uint32_t d_resync_interval_ms;
+    uint32_t d_last_read_ms;
+    uint32_t d_rtc_reads;
+
+    void read_rtc(uint32_t now_ms) {
+        uint32_t t = d_rtc.now().unixtime();
+        ++d_rtc_reads;
+
+        CriticalSection::lock();
+        d_base_unix = t;
+        d_base_ms = now_ms;
+        d_disciplined = false;
+        CriticalSection::unlock();
+
+        d_last_read_ms = now_ms;
+    }
+
+public:
+    TimeService(RTC &rtc, uint32_t resync_interval_ms = TIME_RESYNC_INTERVAL_MS)
+        : d_rtc(rtc), d_base_unix(0), d_base_ms(0), d_disciplined(false), d_ticks(0),
+          d_resync_interval_ms(resync_interval_ms), d_last_read_ms(0), d_rtc_reads(0) {}
+
+    /**
+     * @brief Read the RTC. Call this in setup(), after the RTC is set.
+     * @param now_ms millis()
+     */
+    void begin(uint32_t now_ms) {
+        read_rtc(now_ms);
+    }
+
+    /**
+     * @brief The RTC's seconds just changed.
+     *
+     * Call this from the interrupt handler for the DS3231 1Hz square wave
+     * (falling edge).
+     *
+     * @param now_ms millis()
+     */
+    void on_tick(uint32_t now_ms) {
+        uint32_t elapsed = now_ms - d_base_ms;
+        if (d_disciplined) {
+            // Round, so a late or early interrupt does not lose a second
+            d_base_unix = d_base_unix + (elapsed + 500) / 1000;
+        } else {
+            // The first tick after an RTC read: the time read was valid at
+            // some point in the second that just ended.
+            d_base_unix = d_base_unix + elapsed / 1000 + 1;
+            d_disciplined = true;
+        }
+        d_base_ms = now_ms;
+        ++d_ticks;
+    }
+
+    /**
+     * @brief Read the RTC again if it's time. Call this from loop(),
+     * not from the packet path.
+     * @param now_ms millis()
+     */
+    void service(uint32_t now_ms) {
+        CriticalSection::lock();
+        bool disciplined = d_disciplined;
+        uint32_t since_tick = now_ms - d_base_ms;
+        CriticalSection::unlock();
+
+        if (disciplined && since_tick < TIME_TICK_TIMEOUT_MS)
+            return;
+
+        if (disciplined || now_ms - d_last_read_ms >= d_resync_interval_ms)
+            read_rtc(now_ms);
+    }
+
+    /**
+     * @brief The time at now_ms.
+     * @param now_ms millis(), or an earlier millis() value such as when a
+     * queued frame was received; that may be before the last RTC read.
+     * @param ms If not null, value-result parameter for the milliseconds;
+     * only meaningful when disciplined() is true.
+     * @return The time as unixtime
+     */
+    uint32_t now(uint32_t now_ms, uint16_t *ms = 0) const {
+        CriticalSection::lock();
+        uint32_t base_unix = d_base_unix;
+        uint32_t base_ms = d_base_ms;
+        CriticalSection::unlock();
+
+        int32_t elapsed = (int32_t)(now_ms - base_ms);
+        if (elapsed < 0) {
+            uint32_t before = (uint32_t)(-elapsed);
+            uint32_t seconds = (before + 999) / 1000;
+            if (ms)
+                *ms = seconds * 1000 - before;
+            return base_unix - seconds;
+        }
+
+        if (ms)
+            *ms = elapsed % 1000;
+        return base_unix + elapsed / 1000;
+    }
+
+    /// @return True if the 1Hz square wave is setting the phase
+    bool disciplined() const { return d_disciplined; }
+
+    /// @return The number of times the RTC was read over I2C
+    uint32_t rtc_reads() const { return d_rtc_reads; }
+
+    uint32_t ticks() const { return d_ticks; }
+};
+
+#endif
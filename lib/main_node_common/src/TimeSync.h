@@ -0,0 +1,101 @@
+/*
+  When to send a leaf node the time.
+
+  The main node used to send the time after every legacy data packet:
+  a downlink, with its own airtime and ACK, for every uplink. The leaf
+  nodes' clocks drift by tens of ppm, a second or two a day, so nearly
+  all of those replies changed nothing.
+
+  Data packets, data messages and time requests all carry the node's
+  idea of the time. TimeSync compares that with the main node's time
+  when the frame was received and keeps the difference, the node's
+  clock offset, in its registry entry. The node is sent the time only
+  when its clock is off by the bound or more, or will be by its next
+  message at the rate it has drifted since its clock was last set.
+  (Time requests are always answered; that is up to the caller.) The
+  caller records that the clock was set only once the node has ACK'd
+  the reply; until then the node is due the time at its next message.
+
+  Both times are whole seconds and the node's is from before it sent
+  the frame, so an offset is good to a second or so; keep the bound at
+  two seconds or more.
+
+  James Gallagher 10/17/26
+*/
+
+#ifndef TimeSync_h
+#define TimeSync_h
+
+#include <stdint.h>
+
+#include "NodeRegistry.h"
+
+// Send a node the time when its clock is this many seconds off. Set the
+// value using the platformio.ini file.
+#ifndef TIME_SYNC_MAX_ERROR_S
+#define TIME_SYNC_MAX_ERROR_S 2
+#endif
+
+// Estimate a node's drift rate only when its clock was set at least
+// this long ago; over less, the one-second resolution swamps it
+#define TIME_SYNC_MIN_BASELINE_S 3600
+
+/**
+ * @brief Decide which leaf nodes need the time.
+ */
+class TimeSync {
+    uint16_t d_max_error_s;
+    uint32_t d_checks;
+    uint32_t d_corrections;
+
+public:
+    TimeSync(uint16_t max_error_s = TIME_SYNC_MAX_ERROR_S)
+        : d_max_error_s(max_error_s), d_checks(0), d_corrections(0) {}
+
+    /**
+     * @brief Record the time in a node's message and decide whether the
+     * node's clock needs to be set.
+     * @param node The node's registry entry
+     * @param node_time The time in the message
+     * @param now The main node's time when the message was received
+     * @param next_s How long until the node's next message, in seconds
+     * (the time since its last one will do); 0 if not known
+     * @return True if the node should be sent the time
+     */
+    bool check(node_state_t &node, uint32_t node_time, uint32_t now, uint32_t next_s) {
+        ++d_checks;
+        int32_t offset = (int32_t)(node_time - now);
+        node.clock_offset = offset;
+
+        // Where the offset will be by the next message: the offset was
+        // zero when the clock was set and has grown at a steady rate since
+        int64_t expected = offset;
+        uint32_t since_set = now - node.clock_set;
+        if ((node.flags & NODE_CLOCK_SET) && next_s && since_set >= TIME_SYNC_MIN_BASELINE_S)
+            expected += (int64_t)offset * next_s / since_set;
+
+        return offset <= -d_max_error_s || offset >= d_max_error_s || expected <= -d_max_error_s
+               || expected >= d_max_error_s;
+    }
+
+    /**
+     * @brief The node ACK'd a reply with the time.
+     * @param node The node's registry entry
+     * @param now The time it was sent
+     */
+    void set(node_state_t &node, uint32_t now) {
+        node.clock_set = now;
+        node.flags |= NODE_CLOCK_SET;
+        ++d_corrections;
+    }
+
+    uint16_t max_error_s() const { return d_max_error_s; }
+
+    /// @return The number of times check() was called
+    uint32_t checks() const { return d_checks; }
+
+    /// @return The number of times set() was called
+    uint32_t corrections() const { return d_corrections; }
+};
+
+#endif
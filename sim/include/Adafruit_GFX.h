@@ -0,0 +1,51 @@
+/*
+  Host stand-in for Adafruit_GFX. Nothing is drawn; the ST7735 stand-in
+  counts the bytes the real driver would send over SPI and charges the
+  virtual clock for them. The byte model is the one in
+  test/native_0/MockGFX.h.
+*/
+
+#ifndef Adafruit_GFX_h
+#define Adafruit_GFX_h
+
+#include <Arduino.h>
+
+class Adafruit_GFX : public Print {
+protected:
+    int16_t _width, _height;
+    int16_t cursor_x, cursor_y;
+
+    /// Send a 'pixels' pixel address window
+    virtual void window(uint32_t pixels) = 0;
+
+public:
+    Adafruit_GFX(int16_t w, int16_t h) : _width(w), _height(h), cursor_x(0), cursor_y(0) {}
+
+    int16_t width() const { return _width; }
+    int16_t height() const { return _height; }
+
+    void setRotation(uint8_t r) {
+        if (r & 1) {
+            int16_t t = _width;
+            _width = _height;
+            _height = t;
+        }
+    }
+
+    void setTextWrap(bool) {}
+    void setTextColor(uint16_t) {}
+    void setTextSize(uint8_t) {}
+    void setCursor(int16_t x, int16_t y) {
+        cursor_x = x;
+        cursor_y = y;
+    }
+
+    void fillScreen(uint16_t) { window((uint32_t)_width * _height); }
+    void fillRect(int16_t, int16_t, int16_t w, int16_t h, uint16_t) { window((uint32_t)w * h); }
+    void drawFastHLine(int16_t, int16_t, int16_t w, uint16_t) { window(w); }
+    void drawFastVLine(int16_t, int16_t, int16_t h, uint16_t) { window(h); }
+
+    size_t write(uint8_t c) override;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef Adafruit_ST7735_h
+#define Adafruit_ST7735_h
+
+#include <Adafruit_GFX.h>
+
+#define INITR_GREENTAB 0x00
+#define INITR_REDTAB 0x01
+#define INITR_BLACKTAB 0x02
+
+#define ST77XX_BLACK 0x0000
+#define ST77XX_WHITE 0xFFFF
+#define ST77XX_RED 0xF800
+#define ST77XX_GREEN 0x07E0
+#define ST77XX_BLUE 0x001F
+
+class Adafruit_ST7735 : public Adafruit_GFX {
+protected:
+    void window(uint32_t pixels) override;
+
+public:
+    Adafruit_ST7735(int8_t cs, int8_t dc, int8_t rst) : Adafruit_GFX(128, 160) {}
+    void initR(uint8_t options = INITR_GREENTAB);
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef Adafruit_ST7789_h
+#define Adafruit_ST7789_h
+
+#include <Adafruit_ST7735.h>
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  Host stand-in for the parts of the Arduino core main-node.cc uses.
+  See SimHAL.h
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define RISING 3
+#define LED_BUILTIN 13
+
+#define DEC 10
+#define HEX 16
+
+// The sketch
+void setup();
+void loop();
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void noInterrupts();
+void interrupts();
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int irq, void (*isr)(), int mode);
+
+
+char *itoa(int value, char *str, int base);
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+/**
+ * @brief Enough of Arduino's Print for the main node's output.
+ */
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t len);
+
+    size_t print(const char *s);
+    size_t print(const __FlashStringHelper *s) { return print(reinterpret_cast<const char *>(s)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double d, int digits = 2);
+
+    size_t println() { return print("\r\n"); }
+    template <class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <class T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+};
+
+/**
+ * @brief The USB serial port; output goes to the file set with
+ * sim_set_serial_output(). See SimHAL.cc for how the host reads it.
+ */
+class SimSerial : public Print {
+public:
+    void begin(unsigned long) {}
+    operator bool() const { return true; }
+    int available() { return 0; }
+    int read() { return -1; }
+    void flush();
+    int availableForWrite();
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t len) override;
+};
+
+extern SimSerial Serial;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+  Host stand-in for RadioHead's RHDatagram.
+*/
+
+#ifndef RHDatagram_h
+#define RHDatagram_h
+
+#include <RHGenericDriver.h>
+
+class RHDatagram {
+public:
+    RHDatagram(RHGenericDriver &driver, uint8_t thisAddress = 0) : _driver(driver), _thisAddress(thisAddress) {}
+    virtual ~RHDatagram() {}
+
+    bool init();
+    void setThisAddress(uint8_t thisAddress);
+    bool sendto(uint8_t *buf, uint8_t len, uint8_t address);
+    bool recvfrom(uint8_t *buf, uint8_t *len, uint8_t *from = NULL, uint8_t *to = NULL, uint8_t *id = NULL,
+                  uint8_t *flags = NULL);
+    bool available() { return _driver.available(); }
+    bool waitPacketSent() { return _driver.waitPacketSent(); }
+
+    void setHeaderTo(uint8_t to) { _driver.setHeaderTo(to); }
+    void setHeaderFrom(uint8_t from) { _driver.setHeaderFrom(from); }
+    void setHeaderId(uint8_t id) { _driver.setHeaderId(id); }
+    void setHeaderFlags(uint8_t set, uint8_t clear = 0xff) { _driver.setHeaderFlags(set, clear); }
+
+    uint8_t thisAddress() { return _thisAddress; }
+
+protected:
+    RHGenericDriver &_driver;
+    uint8_t _thisAddress;
+};
+
+#endif
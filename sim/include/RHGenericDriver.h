@@ -0,0 +1,85 @@
+/*
+  Host stand-in for RadioHead's RHGenericDriver. Only what the main node
+  and AsyncReliableDatagram use is here; the radio itself is modeled in
+  sim/src/SimRadio.cc.
+*/
+
+#ifndef RHGenericDriver_h
+#define RHGenericDriver_h
+
+#include <Arduino.h>
+
+#define RH_BROADCAST_ADDRESS 0xff
+
+#define RH_FLAGS_NONE 0x00
+#define RH_FLAGS_ACK 0x80
+#define RH_FLAGS_RETRY 0x40
+
+#define RH_CAD_DEFAULT_TIMEOUT 10000
+
+#define RH_INTERRUPT_ATTR
+
+class RHGenericDriver {
+public:
+    typedef enum {
+        RHModeInitialising = 0,
+        RHModeSleep,
+        RHModeIdle,
+        RHModeTx,
+        RHModeRx,
+        RHModeCad
+    } RHMode;
+
+    RHGenericDriver();
+    virtual ~RHGenericDriver() {}
+
+    virtual bool init() { return true; }
+    virtual bool available() = 0;
+    virtual bool recv(uint8_t *buf, uint8_t *len) = 0;
+    virtual bool send(const uint8_t *data, uint8_t len) = 0;
+    virtual uint8_t maxMessageLength() = 0;
+    virtual bool waitPacketSent();
+    RHMode mode() { return _mode; }
+
+    void setThisAddress(uint8_t address) { _thisAddress = address; }
+    void setHeaderTo(uint8_t to) { _txHeaderTo = to; }
+    void setHeaderFrom(uint8_t from) { _txHeaderFrom = from; }
+    void setHeaderId(uint8_t id) { _txHeaderId = id; }
+    void setHeaderFlags(uint8_t set, uint8_t clear = 0xff) {
+        _txHeaderFlags &= ~clear;
+        _txHeaderFlags |= set;
+    }
+
+    uint8_t headerTo() { return _rxHeaderTo; }
+    uint8_t headerFrom() { return _rxHeaderFrom; }
+    uint8_t headerId() { return _rxHeaderId; }
+    uint8_t headerFlags() { return _rxHeaderFlags; }
+
+    int16_t lastRssi() { return _lastRssi; }
+    uint16_t rxBad() { return _rxBad; }
+    uint16_t rxGood() { return _rxGood; }
+    uint16_t txGood() { return _txGood; }
+
+    void setCADTimeout(unsigned long cad_timeout) { _cad_timeout = cad_timeout; }
+    void setPromiscuous(bool promiscuous) { _promiscuous = promiscuous; }
+
+protected:
+    volatile RHMode _mode;
+    uint8_t _thisAddress;
+    bool _promiscuous;
+    uint8_t _txHeaderTo;
+    uint8_t _txHeaderFrom;
+    uint8_t _txHeaderId;
+    uint8_t _txHeaderFlags;
+    volatile uint8_t _rxHeaderTo;
+    volatile uint8_t _rxHeaderFrom;
+    volatile uint8_t _rxHeaderId;
+    volatile uint8_t _rxHeaderFlags;
+    volatile int16_t _lastRssi;
+    volatile uint16_t _rxBad;
+    volatile uint16_t _rxGood;
+    volatile uint16_t _txGood;
+    unsigned long _cad_timeout;
+};
+
+#endif
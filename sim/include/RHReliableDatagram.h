@@ -0,0 +1,27 @@
+/*
+  Host stand-in for RadioHead's RHReliableDatagram. sendtoWait() and
+  recvfromAck() are not here; the main node uses AsyncReliableDatagram.
+*/
+
+#ifndef RHReliableDatagram_h
+#define RHReliableDatagram_h
+
+#include <RHDatagram.h>
+
+class RHReliableDatagram : public RHDatagram {
+public:
+    RHReliableDatagram(RHGenericDriver &driver, uint8_t thisAddress = 0)
+        : RHDatagram(driver, thisAddress), _timeout(200), _retries(3) {}
+
+    void setTimeout(uint16_t timeout) { _timeout = timeout; }
+    void setRetries(uint8_t retries) { _retries = retries; }
+
+protected:
+    /// Send an ACK for the message 'id' from 'from' and wait for it to go
+    void acknowledge(uint8_t id, uint8_t from);
+
+    uint16_t _timeout;
+    uint8_t _retries;
+};
+
+#endif
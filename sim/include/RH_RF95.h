@@ -0,0 +1,58 @@
+/*
+  Host stand-in for RadioHead's RH_RF95. The members a subclass can use
+  are the ones RH_RF95 makes protected. The frames it receives come from
+  the simulation's traffic list and it raises its interrupt pin when a
+  frame has arrived or a transmission is done; see SimRadio.cc.
+*/
+
+#ifndef RH_RF95_h
+#define RH_RF95_h
+
+#include <RHGenericDriver.h>
+
+#define RH_RF95_HEADER_LEN 4
+#define RH_RF95_MAX_PAYLOAD_LEN 255
+#define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
+
+class RH_RF95 : public RHGenericDriver {
+public:
+    RH_RF95(uint8_t slaveSelectPin = 10, uint8_t interruptPin = 2);
+
+    bool init() override;
+    bool available() override;
+    bool recv(uint8_t *buf, uint8_t *len) override;
+    bool send(const uint8_t *data, uint8_t len) override;
+    uint8_t maxMessageLength() override { return RH_RF95_MAX_MESSAGE_LEN; }
+
+    void setModeIdle();
+    void setModeRx();
+    void setModeTx();
+
+    bool setFrequency(float centre);
+    void setTxPower(int8_t power, bool useRFO = false);
+    void setSpreadingFactor(uint8_t sf);
+    void setSignalBandwidth(long sbw);
+    void setCodingRate4(uint8_t denominator);
+
+    int lastSNR() { return _lastSNR; }
+
+protected:
+    void handleInterrupt();
+    void validateRxBuf();
+    void clearRxBuf();
+
+    volatile uint8_t _bufLen;
+    uint8_t _buf[RH_RF95_MAX_PAYLOAD_LEN];
+    volatile bool _rxBufValid;
+
+private:
+    static void isr0();
+    static RH_RF95 *_deviceForInterrupt;
+
+    void setMode(RHMode mode);
+
+    uint8_t _interruptPin;
+    int8_t _lastSNR;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  Host stand-in for RTClib's DateTime and RTC_DS3231. The clock reads the
+  simulation's virtual time; each now() costs an I2C transaction.
+*/
+
+#ifndef RTClib_h
+#define RTClib_h
+
+#include <Arduino.h>
+
+enum Ds3231SqwPinMode { DS3231_OFF = 0x1C, DS3231_SquareWave1Hz = 0x00 };
+
+class DateTime {
+    uint16_t yOff;  // years since 2000, like RTClib
+    uint8_t m, d, hh, mm, ss;
+
+public:
+    DateTime(uint32_t t = 0);
+    DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0);
+    DateTime(const __FlashStringHelper *date, const __FlashStringHelper *time);
+
+    uint16_t year() const { return 2000 + yOff; }
+    uint8_t month() const { return m; }
+    uint8_t day() const { return d; }
+    uint8_t hour() const { return hh; }
+    uint8_t minute() const { return mm; }
+    uint8_t second() const { return ss; }
+    uint32_t unixtime() const;
+};
+
+class RTC_DS3231 {
+public:
+    bool begin() { return true; }
+    bool lostPower() { return false; }
+    void adjust(const DateTime &dt);
+    DateTime now();
+    void writeSqwPinMode(Ds3231SqwPinMode) {}
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+  Host stand-in for SdFat. Files are host files in the directory set with
+  sim_set_sd_dir(); writes and syncs cost virtual time.
+*/
+
+#ifndef SdFat_h
+#define SdFat_h
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#define SPI_FULL_SPEED 0
+#define SPI_HALF_SPEED 1
+
+class SdSpiCard {
+public:
+    bool isBusy();
+};
+
+class SdFat {
+public:
+    bool begin(uint8_t csPin, uint8_t spiSpeed = SPI_FULL_SPEED);
+    SdSpiCard *card();
+};
+
+class SdFile {
+    FILE *d_fp;
+    DIR *d_dir;             // open("/") opens the card's directory
+    char d_name[64];
+
+public:
+    SdFile() : d_fp(0), d_dir(0) { d_name[0] = '\0'; }
+    ~SdFile() { close(); }
+
+    bool open(const char *path, int oflag = O_RDONLY);
+    // Opens the next file in 'dir'; subdirectories are skipped
+    bool openNext(SdFile *dir, int oflag = O_RDONLY);
+    bool getName(char *name, size_t size);
+    bool isFile() const { return d_fp != 0; }
+    bool close();
+    bool isOpen() const { return d_fp != 0 || d_dir != 0; }
+    size_t write(const void *buf, size_t count);
+    int read(void *buf, size_t count);
+    bool sync();
+    uint32_t fileSize() const;
+    bool seekSet(uint32_t pos);
+    bool preAllocate(uint32_t length);
+};
+
+#endif
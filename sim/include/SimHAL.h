@@ -0,0 +1,94 @@
+/*
+  Control interface for the host-native simulation of the main node.
+
+  The files in sim/include stand in for the Arduino core and the
+  libraries main-node.cc uses (RadioHead, RTClib, SdFat, Adafruit GFX)
+  so the real setup() and loop() run on Linux. Time is virtual: it
+  advances only when the stand-ins charge for work (SPI transfers,
+  airtime, I2C reads, delay()) and, if cpu_scale is set, by the host CPU
+  time the main node code uses, scaled to the M0.
+
+  The radio stand-in delivers frames from a traffic list (see
+  sim_traffic_*()), which sim_main.cc builds from a capture file.
+*/
+
+#ifndef SimHAL_h
+#define SimHAL_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Virtual time
+uint64_t sim_now_us();
+void sim_advance_us(uint64_t us);
+void sim_set_cpu_scale(double scale);
+
+// Call these around setup() and loop() so that, with a cpu_scale > 0,
+// only the node's own CPU time is charged to the virtual clock
+void sim_node_enter();
+void sim_node_leave();
+
+/**
+ * @brief A frame in the simulated air, sent by a leaf node.
+ */
+struct sim_frame_t {
+    uint64_t arrival_us;    // when the last bit arrives (RxDone)
+    uint8_t from;
+    uint8_t to;
+    uint8_t id;
+    uint8_t flags;
+    int16_t rssi;
+    int8_t snr;
+    std::vector<uint8_t> data;
+
+    // Filled in by the simulation
+    bool read;
+    uint64_t read_us;       // when the interrupt handler took it from the radio
+    uint64_t handled_us;    // when the node printed its 'Received' line
+    uint64_t done_us;       // when that loop() returned
+    const char *lost;       // why the radio lost it, or null
+};
+
+void sim_traffic_add(const sim_frame_t &frame);
+std::vector<sim_frame_t> &sim_traffic();
+uint64_t sim_next_event_us();
+
+// Radio settings/costs that sim_main.cc reports. The airtime is for a
+// RadioHead message of 'len' bytes (the four header bytes are added) at
+// the radio's current settings.
+uint32_t sim_airtime_us(uint8_t len);
+uint32_t sim_radio_tx_count();
+uint32_t sim_radio_acks_sent();
+
+
+// The DS3231 stand-in reads this time at virtual time zero
+void sim_set_rtc(uint32_t unixtime);
+
+// The SD card stand-in writes its files here
+void sim_set_sd_dir(const std::string &dir);
+const std::string &sim_sd_dir();
+uint64_t sim_sd_bytes();
+
+// How long each SdFile::write() keeps the card busy. SD cards sometimes
+// take hundreds of ms (wear leveling, erase).
+void sim_set_sd_write_us(uint32_t us);
+
+// Where the stand-in Serial writes; null discards the output
+void sim_set_serial_output(FILE *out);
+
+// The host stops reading the serial port at this virtual time
+void sim_set_serial_stop_us(uint64_t us);
+
+// Bytes the TFT stand-in would have sent over SPI
+uint64_t sim_tft_spi_bytes();
+
+// Between the stand-ins: the radio raises its interrupt pin, and the
+// clock hands it the radio events (sim_next_event_us()) as they fall due.
+void sim_raise_interrupt(uint8_t pin);
+void sim_radio_event();
+
+#endif
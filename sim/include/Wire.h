@@ -0,0 +1,12 @@
+#ifndef Wire_h
+#define Wire_h
+
+class TwoWire {
+public:
+    void begin() {}
+    void begin(int, int) {}
+};
+
+extern TwoWire Wire;
+
+#endif
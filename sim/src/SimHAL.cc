@@ -0,0 +1,492 @@
+/*
+  The virtual clock and the Arduino core, DS3231, SD card and TFT
+  stand-ins. The radio is in SimRadio.cc.
+
+  The costs below are rough figures for the Feather M0; they are there so
+  the things loop() does take time relative to the radio's airtime.
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include <Adafruit_ST7735.h>
+#include <Arduino.h>
+#include <RTClib.h>
+#include <SPI.h>
+#include <SdFat.h>
+#include <Wire.h>
+
+#include "SimHAL.h"
+
+#define SERIAL_NS_PER_BYTE 1000     // USB CDC, as the host drains it
+#define SERIAL_PACKET_BYTES 64      // USB CDC bulk packet; one is in flight at a time
+#define SERIAL_TX_TIMEOUT_US 70000  // the SAMD core gives up on a packet the host doesn't take
+#define RTC_READ_US 900             // address, register and 7 bytes at 100kHz I2C
+#define SD_NS_PER_BYTE 2000         // SPI_HALF_SPEED
+#define SD_WRITE_US 800             // after each write() the card is busy programming; see sim_set_sd_write_us()
+#define SD_BUSY_POLL_BYTES 2        // SdSpiCard::isBusy(): one byte read with the card selected
+#define SD_SYNC_US 3000             // directory entry and FAT updates
+#define TFT_NS_PER_BYTE 670         // 12MHz SPI
+#define TFT_WINDOW_BYTES 11         // CASET, RASET, RAMWR
+#define TFT_GLYPH_PIXELS 15         // pixels lit in an average 5x7 glyph
+#define TFT_CHAR_WIDTH 6
+
+SimSerial Serial;
+SPIClass SPI;
+TwoWire Wire;
+
+static uint64_t now_us = 0;
+static uint64_t charged_ns = 0;   // sub-microsecond costs not yet charged
+
+static double cpu_scale = 0.0;
+static bool in_node = false;
+static uint64_t cpu_mark_ns = 0;
+
+static uint32_t rtc_base = 0;
+static std::string sd_dir = ".";
+static uint64_t sd_bytes = 0;
+static uint32_t sd_write_us = SD_WRITE_US;
+static uint64_t sd_busy_until_us = 0;
+static SdSpiCard sd_card;
+static FILE *serial_out = stdout;
+static uint64_t serial_stop_us = UINT64_MAX;
+static uint32_t serial_in_flight = 0;       // bytes of the last packet the host hasn't taken
+static uint64_t serial_drained_us = 0;
+static bool serial_timed_out = false;
+static uint64_t tft_spi_bytes = 0;
+
+#define MAX_INTERRUPTS 64
+static void (*isrs[MAX_INTERRUPTS])() = {0};
+static uint64_t pending_interrupts = 0;
+static bool interrupts_enabled = true;
+static bool in_isr = false;
+static bool advancing = false;
+
+static uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Move the clock to 't', handing the radio each event that falls due on
+ * the way. If the radio's handling of an event (its interrupt handler)
+ * takes time, the clock just moves; the outer call picks up any events
+ * that passed.
+ */
+static void advance_to(uint64_t t) {
+    if (advancing) {
+        if (t > now_us)
+            now_us = t;
+        return;
+    }
+
+    advancing = true;
+    for (;;) {
+        uint64_t event = sim_next_event_us();
+        if (event > t && event > now_us)
+            break;
+        if (event > now_us)
+            now_us = event;
+        sim_radio_event();
+    }
+    if (t > now_us)
+        now_us = t;
+    advancing = false;
+}
+
+// Charge the CPU time the node used since the last call
+static void charge_cpu() {
+    if (!in_node || cpu_scale <= 0.0)
+        return;
+    uint64_t t = thread_cpu_ns();
+    uint64_t us = (uint64_t)((t - cpu_mark_ns) * cpu_scale / 1000.0);
+    cpu_mark_ns = t;
+    if (us)
+        advance_to(now_us + us);
+}
+
+static void charge_ns(uint64_t ns) {
+    charged_ns += ns;
+    uint64_t us = charged_ns / 1000;
+    charged_ns %= 1000;
+    if (us)
+        advance_to(now_us + us);
+}
+
+static void dispatch_interrupts() {
+    while (pending_interrupts && interrupts_enabled && !in_isr) {
+        int irq = __builtin_ctzll(pending_interrupts);
+        pending_interrupts &= ~(1ULL << irq);
+        if (isrs[irq]) {
+            in_isr = true;
+            isrs[irq]();
+            in_isr = false;
+        }
+    }
+}
+
+void sim_raise_interrupt(uint8_t pin) {
+    if (pin >= MAX_INTERRUPTS)
+        return;
+    pending_interrupts |= 1ULL << pin;
+    dispatch_interrupts();
+}
+
+uint64_t sim_now_us() {
+    charge_cpu();
+    return now_us;
+}
+
+void sim_advance_us(uint64_t us) {
+    charge_cpu();
+    advance_to(now_us + us);
+}
+
+void sim_set_cpu_scale(double scale) { cpu_scale = scale; }
+
+void sim_node_enter() {
+    in_node = true;
+    cpu_mark_ns = thread_cpu_ns();
+}
+
+void sim_node_leave() {
+    charge_cpu();
+    in_node = false;
+}
+
+void sim_set_rtc(uint32_t unixtime) { rtc_base = unixtime; }
+
+void sim_set_sd_dir(const std::string &dir) { sd_dir = dir; }
+const std::string &sim_sd_dir() { return sd_dir; }
+uint64_t sim_sd_bytes() { return sd_bytes; }
+void sim_set_sd_write_us(uint32_t us) { sd_write_us = us; }
+
+void sim_set_serial_output(FILE *out) { serial_out = out; }
+void sim_set_serial_stop_us(uint64_t us) { serial_stop_us = us; }
+
+uint64_t sim_tft_spi_bytes() { return tft_spi_bytes; }
+
+// Arduino core
+
+unsigned long millis() { return sim_now_us() / 1000; }
+
+unsigned long micros() { return sim_now_us(); }
+
+void delay(unsigned long ms) { sim_advance_us(ms * 1000ULL); }
+
+void delayMicroseconds(unsigned int us) { sim_advance_us(us); }
+
+// Busy-waits call yield(); let time pass so they end
+void yield() { sim_advance_us(10); }
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t, uint8_t) {}
+
+int digitalRead(uint8_t) { return HIGH; }
+
+// An interrupt raised while interrupts are off, or while an interrupt
+// handler runs, is held until they are on again or the handler returns.
+void noInterrupts() { interrupts_enabled = false; }
+
+void interrupts() {
+    interrupts_enabled = true;
+    dispatch_interrupts();
+}
+
+int digitalPinToInterrupt(int pin) { return pin; }
+
+void attachInterrupt(int irq, void (*isr)(), int) {
+    if (irq >= 0 && irq < MAX_INTERRUPTS)
+        isrs[irq] = isr;
+}
+
+char *itoa(int value, char *str, int base) {
+    if (base == 16)
+        sprintf(str, "%x", value);
+    else
+        sprintf(str, "%d", value);
+    return str;
+}
+
+// Print
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+    size_t n = 0;
+    while (len--)
+        n += write(*buf++);
+    return n;
+}
+
+size_t Print::print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+size_t Print::print(long n, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", n);
+    return print(buf);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", n);
+    return print(buf);
+}
+
+size_t Print::print(double d, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, d);
+    return print(buf);
+}
+
+// The host takes the packet in flight at SERIAL_NS_PER_BYTE, until
+// serial_stop_us
+static void serial_drain() {
+    uint64_t until = std::min(now_us, serial_stop_us);
+    if (until > serial_drained_us) {
+        uint64_t bytes = (until - serial_drained_us) * 1000 / SERIAL_NS_PER_BYTE;
+        serial_in_flight -= std::min<uint64_t>(bytes, serial_in_flight);
+        if (serial_in_flight == 0)
+            serial_timed_out = false;
+    }
+    serial_drained_us = now_us;
+}
+
+// Like the SAMD core's CDC port, which always reports one packet
+int SimSerial::availableForWrite() { return SERIAL_PACKET_BYTES - 1; }
+
+size_t SimSerial::write(uint8_t c) { return write(&c, 1); }
+
+/**
+ * Send 'buf' a packet at a time, as the SAMD core does: each packet waits
+ * for the host to take the one before it. If the host has stopped
+ * reading, the first packet that waits gives up after
+ * SERIAL_TX_TIMEOUT_US and, until the host takes that packet, later
+ * writes fail at once.
+ */
+size_t SimSerial::write(const uint8_t *buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        serial_drain();
+        if (serial_in_flight > 0) {
+            if (now_us < serial_stop_us) {
+                charge_ns((uint64_t)serial_in_flight * SERIAL_NS_PER_BYTE);
+            } else {
+                if (!serial_timed_out) {
+                    serial_timed_out = true;
+                    advance_to(now_us + SERIAL_TX_TIMEOUT_US);
+                }
+                break;
+            }
+            serial_drain();
+        }
+
+        size_t n = std::min<size_t>(len - sent, SERIAL_PACKET_BYTES);
+        if (serial_out)
+            fwrite(buf + sent, 1, n, serial_out);
+        serial_in_flight = n;
+        sent += n;
+    }
+    return sent;
+}
+
+void SimSerial::flush() {
+    if (serial_out)
+        fflush(serial_out);
+}
+
+// DS3231
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+DateTime::DateTime(uint32_t t) {
+    time_t tt = t;
+    struct tm tm;
+    gmtime_r(&tt, &tm);
+    yOff = tm.tm_year + 1900 - 2000;
+    m = tm.tm_mon + 1;
+    d = tm.tm_mday;
+    hh = tm.tm_hour;
+    mm = tm.tm_min;
+    ss = tm.tm_sec;
+}
+
+DateTime::DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+    : yOff(year >= 2000 ? year - 2000 : year), m(month), d(day), hh(hour), mm(min), ss(sec) {}
+
+DateTime::DateTime(const __FlashStringHelper *date, const __FlashStringHelper *time) {
+    // "Mar 16 2021", "09:38:35"
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *ds = reinterpret_cast<const char *>(date);
+    const char *ts = reinterpret_cast<const char *>(time);
+    char mon[4] = {0};
+    unsigned day = 1, year = 2000, hour = 0, min = 0, sec = 0;
+    sscanf(ds, "%3s %u %u", mon, &day, &year);
+    sscanf(ts, "%u:%u:%u", &hour, &min, &sec);
+    const char *p = strstr(months, mon);
+    yOff = year - 2000;
+    m = p ? (p - months) / 3 + 1 : 1;
+    d = day;
+    hh = hour;
+    mm = min;
+    ss = sec;
+}
+
+uint32_t DateTime::unixtime() const {
+    return days_from_civil(year(), m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+void RTC_DS3231::adjust(const DateTime &dt) {
+    sim_advance_us(RTC_READ_US);
+    rtc_base = dt.unixtime() - (uint32_t)(sim_now_us() / 1000000);
+}
+
+DateTime RTC_DS3231::now() {
+    sim_advance_us(RTC_READ_US);
+    return DateTime(rtc_base + (uint32_t)(sim_now_us() / 1000000));
+}
+
+// SD card
+
+// Like SdFat, a command to a busy card first waits, with the card
+// selected, until it is done programming the last write
+static void sd_wait_ready() {
+    if (sim_now_us() < sd_busy_until_us)
+        advance_to(sd_busy_until_us);
+}
+
+bool SdFat::begin(uint8_t, uint8_t) { return true; }
+
+SdSpiCard *SdFat::card() { return &sd_card; }
+
+bool SdSpiCard::isBusy() {
+    charge_ns(SD_BUSY_POLL_BYTES * SD_NS_PER_BYTE);
+    return sim_now_us() < sd_busy_until_us;
+}
+
+bool SdFile::open(const char *path, int oflag) {
+    close();
+    if (strcmp(path, "/") == 0) {
+        d_dir = opendir(sd_dir.c_str());
+        return d_dir != 0;
+    }
+    std::string name = sd_dir + "/" + path;
+    d_fp = fopen(name.c_str(), "r+b");
+    if (!d_fp && (oflag & O_CREAT))
+        d_fp = fopen(name.c_str(), "w+b");
+    if (d_fp)
+        snprintf(d_name, sizeof(d_name), "%s", path);
+    return d_fp != 0;
+}
+
+bool SdFile::openNext(SdFile *dir, int oflag) {
+    close();
+    if (!dir->d_dir)
+        return false;
+    while (struct dirent *e = readdir(dir->d_dir)) {
+        if (e->d_type == DT_REG && open(e->d_name, oflag))
+            return true;
+    }
+    return false;
+}
+
+bool SdFile::getName(char *name, size_t size) {
+    if (!d_fp)
+        return false;
+    snprintf(name, size, "%s", d_name);
+    return true;
+}
+
+bool SdFile::close() {
+    if (d_dir) {
+        closedir(d_dir);
+        d_dir = 0;
+        return true;
+    }
+    if (!d_fp)
+        return false;
+    fclose(d_fp);
+    d_fp = 0;
+    return true;
+}
+
+size_t SdFile::write(const void *buf, size_t count) {
+    if (!d_fp)
+        return 0;
+    sd_wait_ready();
+    charge_ns((uint64_t)count * SD_NS_PER_BYTE);
+    size_t n = fwrite(buf, 1, count, d_fp);
+    sd_bytes += n;
+    sd_busy_until_us = sim_now_us() + sd_write_us;
+    return n;
+}
+
+int SdFile::read(void *buf, size_t count) {
+    if (!d_fp)
+        return -1;
+    sd_wait_ready();
+    charge_ns((uint64_t)count * SD_NS_PER_BYTE);
+    return fread(buf, 1, count, d_fp);
+}
+
+bool SdFile::sync() {
+    if (!d_fp)
+        return false;
+    sd_wait_ready();
+    sim_advance_us(SD_SYNC_US);
+    return fflush(d_fp) == 0;
+}
+
+uint32_t SdFile::fileSize() const {
+    if (!d_fp)
+        return 0;
+    long pos = ftell(d_fp);
+    fseek(d_fp, 0, SEEK_END);
+    long size = ftell(d_fp);
+    fseek(d_fp, pos, SEEK_SET);
+    return size;
+}
+
+// Like SdFat, this can't seek past the end of the file
+bool SdFile::seekSet(uint32_t pos) { return d_fp && pos <= fileSize() && fseek(d_fp, pos, SEEK_SET) == 0; }
+
+// Like SdFat, this reserves clusters but does not change the file size
+bool SdFile::preAllocate(uint32_t) { return d_fp != 0; }
+
+// TFT
+
+size_t Adafruit_GFX::write(uint8_t c) {
+    if (c == '\n') {
+        cursor_x = 0;
+        cursor_y += 8;
+        return 1;
+    }
+    if (cursor_x < _width && c != ' ' && c != '\r') {
+        // Classic font, no background: one address window per pixel
+        for (int i = 0; i < TFT_GLYPH_PIXELS; ++i)
+            window(1);
+    }
+    cursor_x += TFT_CHAR_WIDTH;
+    return 1;
+}
+
+void Adafruit_ST7735::window(uint32_t pixels) {
+    uint64_t bytes = TFT_WINDOW_BYTES + 2ULL * pixels;
+    tft_spi_bytes += bytes;
+    charge_ns(bytes * TFT_NS_PER_BYTE);
+}
+
+void Adafruit_ST7735::initR(uint8_t) {
+    // The init command list, then the panel's required delays
+    tft_spi_bytes += 100;
+    sim_advance_us(500000);
+}
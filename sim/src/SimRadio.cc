@@ -0,0 +1,331 @@
+/*
+  The RFM95 stand-in and the air between it and the leaf nodes.
+
+  The model follows what RH_RF95 does with the real radio:
+  - A frame is received only if the radio was in receive mode for all of
+    its airtime. The radio then raises DIO0 and the interrupt handler
+    reads the frame.
+  - RH_RF95's handler puts the radio in idle mode after a good frame and
+    it stays there, deaf, until available() is called again after the
+    frame has been read.
+  - The radio is half duplex; frames that arrive while it transmits are
+    lost. When a transmission ends the radio raises DIO0.
+  - Two frames that overlap in the air are lost (the later one here).
+
+  A leaf node ACKs each non-ACK frame the main node sends it.
+*/
+
+#include <string.h>
+
+#include <RHReliableDatagram.h>
+#include <RH_RF95.h>
+
+#include "LoRaAirtime.h"
+#include "SimHAL.h"
+
+#define LEAF_TURNAROUND_US 5000   // leaf node: RxDone to starting its ACK
+#define LORA_PREAMBLE 8
+
+// RadioHead's hardware_spi runs at 1MHz. The interrupt handler makes
+// about eight register accesses (IRQ flags, FIFO pointers, RSSI, SNR)
+// and reads a received frame out of the FIFO.
+#define RADIO_SPI_US_PER_BYTE 8
+#define HANDLER_REGISTER_BYTES 16
+
+static std::vector<sim_frame_t> traffic;
+static std::vector<size_t> pending;     // traffic not yet in the air, by arrival
+static uint64_t last_arrival = 0;       // the last frame in the air
+
+// The radio, as opposed to the driver's idea of it
+static RHGenericDriver::RHMode radio_mode = RHGenericDriver::RHModeInitialising;
+static uint64_t mode_since = 0;
+static uint8_t irq_pin = 0xff;
+static int rx_done = -1;                // frame waiting in the FIFO for the handler
+static bool tx_done = false;
+static bool tx_active = false;
+static uint64_t tx_start = 0;
+static uint64_t tx_end = 0;
+static bool rx_unread = false;          // the driver holds a frame not yet read
+
+static uint8_t spreading_factor = 7;    // the RFM95 defaults
+static long bandwidth = 125000;
+static uint8_t coding_rate = 5;
+
+static uint32_t tx_count = 0;
+static uint32_t acks_sent = 0;
+
+RH_RF95 *RH_RF95::_deviceForInterrupt = 0;
+
+uint32_t sim_airtime_us(uint8_t len) {
+    lora_settings_t s = lora_settings(spreading_factor, bandwidth, coding_rate);
+    s.preamble = LORA_PREAMBLE;
+    return lora_airtime_us(s, len + RH_RF95_HEADER_LEN);
+}
+
+uint32_t sim_radio_tx_count() { return tx_count; }
+uint32_t sim_radio_acks_sent() { return acks_sent; }
+
+void sim_traffic_add(const sim_frame_t &frame) {
+    traffic.push_back(frame);
+    size_t i = traffic.size() - 1;
+    std::vector<size_t>::iterator p = pending.end();
+    while (p != pending.begin() && traffic[*(p - 1)].arrival_us > frame.arrival_us)
+        --p;
+    pending.insert(p, i);
+}
+
+std::vector<sim_frame_t> &sim_traffic() { return traffic; }
+
+uint64_t sim_next_event_us() {
+    uint64_t next = UINT64_MAX;
+    if (!pending.empty())
+        next = traffic[pending.front()].arrival_us;
+    if (tx_active && tx_end < next)
+        next = tx_end;
+    return next;
+}
+
+// A non-ACK frame from the main node reached 'to'; it ACKs it
+static void leaf_ack(uint8_t to, uint8_t id) {
+    if (to == RH_BROADCAST_ADDRESS)
+        return;
+
+    sim_frame_t ack = sim_frame_t();
+    ack.from = to;
+    ack.to = 0;
+    ack.id = id;
+    ack.flags = RH_FLAGS_ACK;
+    ack.rssi = -60;
+    ack.snr = 10;
+    ack.data.push_back('!');
+    ack.arrival_us = tx_end + LEAF_TURNAROUND_US + sim_airtime_us(ack.data.size());
+    sim_traffic_add(ack);
+}
+
+static void arrive(sim_frame_t &f) {
+    uint64_t start = f.arrival_us - sim_airtime_us(f.data.size());
+    bool collided = last_arrival > start;
+    if (f.arrival_us > last_arrival)
+        last_arrival = f.arrival_us;
+
+    if (collided)
+        f.lost = "collision";
+    else if (tx_end > start && tx_start < f.arrival_us)
+        f.lost = "radio transmitting";
+    else if (radio_mode != RHGenericDriver::RHModeRx || mode_since > start || rx_done >= 0)
+        f.lost = rx_unread || rx_done >= 0 ? "unread frame in radio" : "radio not listening";
+    else {
+        rx_done = &f - &traffic[0];
+        sim_raise_interrupt(irq_pin);
+    }
+}
+
+void sim_radio_event() {
+    uint64_t now = sim_now_us();
+
+    if (tx_active && tx_end <= now) {
+        tx_active = false;
+        tx_done = true;
+        sim_raise_interrupt(irq_pin);
+    }
+
+    while (!pending.empty() && traffic[pending.front()].arrival_us <= now) {
+        size_t i = pending.front();
+        pending.erase(pending.begin());
+        arrive(traffic[i]);
+    }
+}
+
+RHGenericDriver::RHGenericDriver()
+    : _mode(RHModeInitialising), _thisAddress(RH_BROADCAST_ADDRESS), _promiscuous(false),
+      _txHeaderTo(RH_BROADCAST_ADDRESS), _txHeaderFrom(RH_BROADCAST_ADDRESS), _txHeaderId(0), _txHeaderFlags(0),
+      _rxHeaderTo(0), _rxHeaderFrom(0), _rxHeaderId(0), _rxHeaderFlags(0), _lastRssi(0), _rxBad(0), _rxGood(0),
+      _txGood(0), _cad_timeout(0) {}
+
+bool RHGenericDriver::waitPacketSent() {
+    while (_mode == RHModeTx)
+        yield();
+    return true;
+}
+
+RH_RF95::RH_RF95(uint8_t, uint8_t interruptPin)
+    : _bufLen(0), _rxBufValid(false), _interruptPin(interruptPin), _lastSNR(0) {}
+
+bool RH_RF95::init() {
+    _deviceForInterrupt = this;
+    irq_pin = digitalPinToInterrupt(_interruptPin);
+    attachInterrupt(irq_pin, isr0, RISING);
+    setModeIdle();
+    return true;
+}
+
+void RH_RF95::isr0() {
+    if (_deviceForInterrupt)
+        _deviceForInterrupt->handleInterrupt();
+}
+
+void RH_RF95::setMode(RHMode mode) {
+    if (_mode == mode)
+        return;
+    _mode = mode;
+    radio_mode = mode;
+    mode_since = sim_now_us();
+}
+
+void RH_RF95::setModeIdle() { setMode(RHModeIdle); }
+void RH_RF95::setModeRx() { setMode(RHModeRx); }
+void RH_RF95::setModeTx() { setMode(RHModeTx); }
+
+void RH_RF95::handleInterrupt() {
+    int rx = rx_done;
+    rx_done = -1;
+    bool tx = tx_done;
+    tx_done = false;
+
+    uint32_t spi_bytes = HANDLER_REGISTER_BYTES;
+    if (rx >= 0 && _mode == RHModeRx)
+        spi_bytes += 1 + RH_RF95_HEADER_LEN + traffic[rx].data.size();
+    sim_advance_us(spi_bytes * RADIO_SPI_US_PER_BYTE);
+
+    if (rx >= 0) {
+        sim_frame_t &f = traffic[rx];
+        if (_mode != RHModeRx) {
+            // The driver changed mode before the handler ran
+            f.lost = "radio not listening";
+        }
+        else {
+            f.read = true;
+            f.read_us = sim_now_us();
+            _buf[0] = f.to;
+            _buf[1] = f.from;
+            _buf[2] = f.id;
+            _buf[3] = f.flags;
+            memcpy(_buf + RH_RF95_HEADER_LEN, f.data.data(), f.data.size());
+            _bufLen = RH_RF95_HEADER_LEN + f.data.size();
+            _lastRssi = f.rssi;
+            _lastSNR = f.snr;
+            validateRxBuf();
+            if (_rxBufValid)
+                setModeIdle();
+            else
+                f.lost = "not for this node";
+        }
+    }
+
+    if (tx) {
+        if (_mode == RHModeTx) {
+            ++_txGood;
+            setModeIdle();
+        }
+    }
+}
+
+void RH_RF95::validateRxBuf() {
+    if (_bufLen < RH_RF95_HEADER_LEN)
+        return;
+    _rxHeaderTo = _buf[0];
+    _rxHeaderFrom = _buf[1];
+    _rxHeaderId = _buf[2];
+    _rxHeaderFlags = _buf[3];
+    if (_promiscuous || _rxHeaderTo == _thisAddress || _rxHeaderTo == RH_BROADCAST_ADDRESS) {
+        ++_rxGood;
+        _rxBufValid = true;
+        rx_unread = true;
+    }
+}
+
+void RH_RF95::clearRxBuf() {
+    _rxBufValid = false;
+    _bufLen = 0;
+    rx_unread = false;
+}
+
+bool RH_RF95::available() {
+    if (_mode == RHModeTx)
+        return false;
+    setModeRx();
+    return _rxBufValid;
+}
+
+bool RH_RF95::recv(uint8_t *buf, uint8_t *len) {
+    if (!available())
+        return false;
+
+    if (buf && len) {
+        uint8_t n = _bufLen - RH_RF95_HEADER_LEN;
+        if (*len > n)
+            *len = n;
+        memcpy(buf, _buf + RH_RF95_HEADER_LEN, *len);
+    }
+    clearRxBuf();
+    return true;
+}
+
+bool RH_RF95::send(const uint8_t *data, uint8_t len) {
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+        return false;
+
+    waitPacketSent();   // a frame already being sent
+    setModeIdle();
+
+    tx_start = sim_now_us();
+    tx_end = tx_start + sim_airtime_us(len);
+    tx_active = true;
+    ++tx_count;
+    if (_txHeaderFlags & RH_FLAGS_ACK)
+        ++acks_sent;
+    else
+        leaf_ack(_txHeaderTo, _txHeaderId);
+
+    setModeTx();
+    return true;
+}
+
+bool RH_RF95::setFrequency(float) { return true; }
+void RH_RF95::setTxPower(int8_t, bool) {}
+void RH_RF95::setSpreadingFactor(uint8_t sf) { spreading_factor = sf; }
+void RH_RF95::setSignalBandwidth(long sbw) { bandwidth = sbw; }
+void RH_RF95::setCodingRate4(uint8_t denominator) { coding_rate = denominator; }
+
+// RadioHead's datagram layers, as they are in the library
+
+bool RHDatagram::init() {
+    bool ret = _driver.init();
+    if (ret)
+        setThisAddress(_thisAddress);
+    return ret;
+}
+
+void RHDatagram::setThisAddress(uint8_t thisAddress) {
+    _driver.setThisAddress(thisAddress);
+    _driver.setHeaderFrom(thisAddress);
+    _thisAddress = thisAddress;
+}
+
+bool RHDatagram::sendto(uint8_t *buf, uint8_t len, uint8_t address) {
+    setHeaderTo(address);
+    return _driver.send(buf, len);
+}
+
+bool RHDatagram::recvfrom(uint8_t *buf, uint8_t *len, uint8_t *from, uint8_t *to, uint8_t *id, uint8_t *flags) {
+    if (_driver.recv(buf, len)) {
+        if (from)
+            *from = _driver.headerFrom();
+        if (to)
+            *to = _driver.headerTo();
+        if (id)
+            *id = _driver.headerId();
+        if (flags)
+            *flags = _driver.headerFlags();
+        return true;
+    }
+    return false;
+}
+
+void RHReliableDatagram::acknowledge(uint8_t id, uint8_t from) {
+    setHeaderId(id);
+    setHeaderFlags(RH_FLAGS_ACK);
+    uint8_t ack = '!';
+    sendto(&ack, sizeof(ack), from);
+    waitPacketSent();
+}
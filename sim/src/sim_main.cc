@@ -0,0 +1,406 @@
+/*
+  Run the main node's setup() and loop() on the host against radio
+  traffic replayed from a capture of its serial output (for example,
+  test_data_no_ant.csv) and report how long each frame took to handle
+  and which frames were dropped, and why.
+
+  main_node_sim [-s speed] [-g max_gap] [-n nodes] [-w sd_write_ms] [-c cpu_scale] [-i idle_ms]
+                [-d sd_dir] [-o serial_out] [-q serial_stop_s] capture.csv
+
+  -s  replay the capture this many times faster (default 1)
+  -g  the longest gap between frames, in seconds, after -s (default 60)
+  -n  replay each frame as if this many nodes sent it, one right after
+      the other (default 1). The copies differ only in their source
+      address.
+  -w  the SD card is busy this long after each write (default 0.8)
+  -c  charge the node's host CPU time times this to the virtual clock
+      (default 0, which makes runs repeatable)
+  -i  when loop() has nothing to do, call it again after this many ms,
+      or at the next radio event if that is sooner (default 10)
+  -d  write the SD card files here (default: a new directory in /tmp)
+  -o  write the node's serial output here (default: discard it)
+  -q  the host stops reading the serial port this many seconds after
+      the first frame arrives (default: it never stops)
+
+  Data packets are rebuilt from the 'Data:' lines; other frames (the old
+  text messages) are replayed as the text on their 'Got:' lines.
+
+  setup() may hold the bus for the SD card past the budget (it flushes
+  the log's header); after that, no SD card hold may. If one does, the
+  report says so and the exit status is EXIT_FAILURE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <RHGenericDriver.h>
+
+#include "BufferedSerial.h"
+#include "OutboundEngine.h"
+#include "SimHAL.h"
+#include "SpiArbiter.h"
+#include "data_packet.h"
+
+// In main-node.cc
+extern OutboundEngine outbound;
+extern SpiArbiter spi_arbiter;
+extern BufferedSerial<SimSerial> console;
+
+#define DRAIN_US 10000000ULL   // keep running this long after the last frame
+#define COPY_GAP_US 1000        // between the copies of a frame (-n)
+
+struct options_t {
+    double speed;
+    double max_gap_s;
+    unsigned nodes;
+    double sd_write_ms;
+    double cpu_scale;
+    uint32_t idle_ms;
+    std::string sd_dir;
+    const char *serial_out;
+    double serial_stop_s;   // < 0 for never
+};
+
+struct capture_frame_t {
+    double host_time;
+    sim_frame_t frame;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s speed] [-g max_gap] [-n nodes] [-w sd_write_ms] [-c cpu_scale] [-i idle_ms] "
+                    "[-d sd_dir] [-o serial_out] [-q serial_stop_s] capture.csv\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// The text after the timestamp, without the quotes
+static const char *line_text(char *line) {
+    char *text = strchr(line, ',');
+    if (!text)
+        return "";
+    ++text;
+    if (*text == '"')
+        ++text;
+    char *end = text + strlen(text);
+    while (end > text && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == '"'))
+        *--end = '\0';
+    return text;
+}
+
+static bool parse_rssi_snr(const char *text, sim_frame_t *f) {
+    const char *p = strstr(text, "RSSI ");
+    int rssi, snr;
+    if (!p || sscanf(p, "RSSI %d dBm, SNR %d dB", &rssi, &snr) != 2)
+        return false;
+    f->rssi = rssi;
+    f->snr = snr;
+    return true;
+}
+
+/**
+ * @brief Read the frames the main node printed in a capture
+ * @return The frames in the order they were received
+ */
+static std::vector<capture_frame_t> read_capture(FILE *in) {
+    std::vector<capture_frame_t> frames;
+    capture_frame_t cf;
+    bool open = false;      // a 'Received' line waiting for its data
+    unsigned len = 0;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        double host_time = atof(line);
+        const char *text = line_text(line);
+
+        unsigned from, to, id, flags;
+        if (sscanf(text, "Received length: %u, from: 0x%x, to: 0x%x, id: 0x%x, header: 0x%x", &len, &from, &to,
+                   &id, &flags) == 5) {
+            cf = capture_frame_t();
+            cf.host_time = host_time;
+            cf.frame.from = from;
+            cf.frame.to = to;
+            cf.frame.id = id;
+            cf.frame.flags = flags;
+            cf.frame.data.assign(len, 0);
+            open = true;
+            continue;
+        }
+
+        if (!open)
+            continue;
+
+        unsigned node, message, time, battery, tx_dur, humidity, status;
+        int temp;
+        if (sscanf(text, "Data: node: %u, message: %u, time: %u, Vbat %u v, Tx dur %u ms, T: %d C, RH: %u %%, "
+                         "status: 0x%x", &node, &message, &time, &battery, &tx_dur, &temp, &humidity, &status) == 8
+            && len == sizeof(packet_t)) {
+            build_data_packet((packet_t *)cf.frame.data.data(), node, message, time, battery, tx_dur, temp,
+                              humidity, status);
+            if (parse_rssi_snr(text, &cf.frame)) {
+                frames.push_back(cf);
+                open = false;
+            }
+        }
+        else if (strncmp(text, "Got: ", 5) == 0) {
+            const char *payload = text + 5;
+            memcpy(cf.frame.data.data(), payload, std::min((size_t)len, strlen(payload)));
+        }
+        else if (strncmp(text, "RFM95 info: ", 12) == 0 && parse_rssi_snr(text, &cf.frame)) {
+            frames.push_back(cf);
+            open = false;
+        }
+    }
+
+    return frames;
+}
+
+// Frames whose 'Received' line was printed in the current loop()
+static std::vector<size_t> handled_now;
+
+/**
+ * Match a 'Received' line to the frame the radio delivered most recently
+ * with that source and id.
+ */
+static void serial_line(const char *line) {
+    unsigned len, from, to, id;
+    if (sscanf(line, "Received length: %u, from: 0x%x, to: 0x%x, id: 0x%x", &len, &from, &to, &id) != 4)
+        return;
+
+    std::vector<sim_frame_t> &traffic = sim_traffic();
+    size_t match = traffic.size();
+    for (size_t i = 0; i < traffic.size(); ++i) {
+        const sim_frame_t &f = traffic[i];
+        if (f.read && !f.handled_us && f.from == from && f.id == id && !(f.flags & RH_FLAGS_ACK)
+            && (match == traffic.size() || f.read_us > traffic[match].read_us))
+            match = i;
+    }
+
+    if (match < traffic.size()) {
+        traffic[match].handled_us = sim_now_us();
+        handled_now.push_back(match);
+    }
+}
+
+static double ms(uint64_t us) { return us / 1000.0; }
+
+static void print_latency(const char *name, std::vector<uint64_t> &v) {
+    if (v.empty())
+        return;
+    std::sort(v.begin(), v.end());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < v.size(); ++i)
+        sum += v[i];
+    printf("%-28s mean %8.1f  p50 %8.1f  p95 %8.1f  p99 %8.1f  max %8.1f ms\n", name, ms(sum / v.size()),
+           ms(v[v.size() / 2]), ms(v[v.size() * 95 / 100]), ms(v[v.size() * 99 / 100]), ms(v.back()));
+}
+
+int main(int argc, char *argv[]) {
+    options_t opts = {1.0, 60.0, 1, 0.8, 0.0, 10, "", 0, -1.0};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:g:n:w:c:i:d:o:q:h")) != -1) {
+        switch (opt) {
+            case 's':
+                opts.speed = atof(optarg);
+                break;
+            case 'g':
+                opts.max_gap_s = atof(optarg);
+                break;
+            case 'n':
+                opts.nodes = atoi(optarg);
+                break;
+            case 'w':
+                opts.sd_write_ms = atof(optarg);
+                break;
+            case 'c':
+                opts.cpu_scale = atof(optarg);
+                break;
+            case 'i':
+                opts.idle_ms = atoi(optarg);
+                break;
+            case 'd':
+                opts.sd_dir = optarg;
+                break;
+            case 'o':
+                opts.serial_out = optarg;
+                break;
+            case 'q':
+                opts.serial_stop_s = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || opts.speed <= 0 || opts.nodes == 0 || opts.idle_ms == 0)
+        usage(argv[0]);
+
+    FILE *in = fopen(argv[optind], "r");
+    if (!in) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    std::vector<capture_frame_t> capture = read_capture(in);
+    fclose(in);
+    if (capture.empty()) {
+        fprintf(stderr, "No frames in %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.sd_dir.empty()) {
+        char dir[] = "/tmp/main_node_sim.XXXXXX";
+        if (!mkdtemp(dir)) {
+            perror("mkdtemp");
+            return EXIT_FAILURE;
+        }
+        opts.sd_dir = dir;
+    }
+    sim_set_sd_dir(opts.sd_dir);
+
+    FILE *serial = 0;
+    if (opts.serial_out && !(serial = fopen(opts.serial_out, "w"))) {
+        perror(opts.serial_out);
+        return EXIT_FAILURE;
+    }
+    sim_set_serial_output(serial);
+    console.out().set_line_hook(serial_line);
+    sim_set_cpu_scale(opts.cpu_scale);
+    sim_set_sd_write_us((uint32_t)(opts.sd_write_ms * 1000));
+    sim_set_rtc((uint32_t)capture[0].host_time);
+
+    sim_node_enter();
+    setup();
+    sim_node_leave();
+    const uint32_t sd_over_budget_at_setup = spi_arbiter.stats(spi_sd).over_budget;
+
+    // The capture's times are when the main node printed each frame. It
+    // printed a frame sent to it after it had sent the ACK, so the frame
+    // arrived an ACK's airtime earlier. Leaving that in would put the
+    // leaf node's next frame on the air during the ACK.
+    const double ack_s = sim_airtime_us(1) / 1e6;
+    for (size_t i = 0; i < capture.size(); ++i) {
+        if (capture[i].frame.to != RH_BROADCAST_ADDRESS)
+            capture[i].host_time -= ack_s;
+    }
+
+    // The first frame arrives a second after setup() returns
+    uint64_t arrival = sim_now_us() + 1000000;
+    if (opts.serial_stop_s >= 0)
+        sim_set_serial_stop_us(arrival + (uint64_t)(opts.serial_stop_s * 1e6));
+    for (size_t i = 0; i < capture.size(); ++i) {
+        if (i > 0) {
+            double gap = (capture[i].host_time - capture[i - 1].host_time) / opts.speed;
+            arrival += (uint64_t)(std::min(std::max(gap, 0.0), opts.max_gap_s) * 1e6);
+        }
+        // The copies go out back to back, 1 ms apart
+        sim_frame_t f = capture[i].frame;
+        f.arrival_us = arrival;
+        for (unsigned n = 0; n < opts.nodes; ++n) {
+            sim_traffic_add(f);
+            f.from = (f.from + 1) % RH_BROADCAST_ADDRESS;
+            f.arrival_us += sim_airtime_us(f.data.size()) + COPY_GAP_US;
+        }
+    }
+
+    const uint64_t idle_us = opts.idle_ms * 1000ULL;
+    uint64_t loops = 0;
+    std::map<std::string, uint32_t> lost;
+
+    while (sim_now_us() < arrival + DRAIN_US || !outbound.idle()) {
+        uint64_t before = sim_now_us();
+
+        sim_node_enter();
+        loop();
+        sim_node_leave();
+        ++loops;
+
+        uint64_t now = sim_now_us();
+        for (size_t i = 0; i < handled_now.size(); ++i)
+            sim_traffic()[handled_now[i]].done_us = now;
+        bool busy = !handled_now.empty();
+        handled_now.clear();
+
+        // An idle loop() is called again after idle_us, or when the radio
+        // has something, whichever is sooner
+        if (!busy && now - before < idle_us) {
+            uint64_t next = std::min(sim_next_event_us(), before + idle_us);
+            if (next > now)
+                sim_advance_us(next - now);
+            else if (now == before)
+                sim_advance_us(1);
+        }
+    }
+
+    std::vector<uint64_t> latency, read_delay;
+    uint32_t handled = 0, leaf_acks = 0, leaf_acks_lost = 0;
+    std::vector<sim_frame_t> &traffic = sim_traffic();
+    for (size_t i = 0; i < traffic.size(); ++i) {
+        const sim_frame_t &f = traffic[i];
+        if (f.flags & RH_FLAGS_ACK) {
+            ++leaf_acks;
+            if (f.lost)
+                ++leaf_acks_lost;
+            continue;
+        }
+        if (f.lost) {
+            ++lost[f.lost];
+            continue;
+        }
+        if (!f.read) {
+            ++lost["never read"];
+            continue;
+        }
+        if (!f.handled_us) {
+            ++lost["not handled (duplicate id or RX queue full)"];
+            continue;
+        }
+        ++handled;
+        latency.push_back(f.done_us - f.arrival_us);
+        read_delay.push_back(f.handled_us - f.arrival_us);
+    }
+
+    printf("Replayed %zu frames x %u nodes from %s over %.1f s of virtual time (%llu calls to loop())\n",
+           capture.size(), opts.nodes, argv[optind], sim_now_us() / 1e6, (unsigned long long)loops);
+    printf("Airtime of a %zu byte data packet: %.1f ms\n", sizeof(packet_t), ms(sim_airtime_us(sizeof(packet_t))));
+    printf("Handled: %u\n", handled);
+    uint32_t dropped = 0;
+    for (std::map<std::string, uint32_t>::const_iterator i = lost.begin(); i != lost.end(); ++i) {
+        printf("Dropped, %s: %u\n", i->first.c_str(), i->second);
+        dropped += i->second;
+    }
+    printf("Dropped, total: %u\n", dropped);
+    print_latency("Arrival to processing:", read_delay);
+    print_latency("Arrival to loop() return:", latency);
+    printf("Replies: %u ACK'd, %u failed, %u not queued; leaf ACKs lost: %u of %u\n", outbound.sent(),
+           outbound.failed(), outbound.dropped(), leaf_acks_lost, leaf_acks);
+    printf("Radio: %u frames sent, %u of them ACKs\n", sim_radio_tx_count(), sim_radio_acks_sent());
+    printf("SD: %llu bytes written to %s\n", (unsigned long long)sim_sd_bytes(), sim_sd_dir().c_str());
+    printf("TFT: %llu bytes over SPI\n", (unsigned long long)sim_tft_spi_bytes());
+    for (uint8_t i = 0; i < spi_device_count; ++i) {
+        const spi_hold_stats_t &s = spi_arbiter.stats((SpiDevice)i);
+        printf("SPI bus, %s: %u holds, max %.2f ms, mean %.3f ms, %u over the %.1f ms budget\n",
+               SpiArbiter::device_name((SpiDevice)i), s.holds, ms(s.max_us), s.holds ? ms(s.total_us) / s.holds : 0.0,
+               s.over_budget, ms(spi_arbiter.budget_us()));
+    }
+    printf("SPI bus conflicts: %u\n", spi_arbiter.conflicts());
+    const serial_out_stats_t &so = console.out().stats();
+    printf("Serial: %u lines staged, %u bytes sent of %u, %u lines dropped, %u bytes staged at most\n", so.lines,
+           so.written, so.bytes, so.dropped, so.high_water);
+
+    if (serial)
+        fclose(serial);
+
+    const uint32_t sd_over_budget = spi_arbiter.stats(spi_sd).over_budget - sd_over_budget_at_setup;
+    if (sd_over_budget > 0) {
+        printf("FAIL: %u SD card holds after setup() were over the budget\n", sd_over_budget);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
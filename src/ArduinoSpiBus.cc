@@ -0,0 +1,60 @@
+/*
+  The main node's SPI bus; see ArduinoSpiBus.h and SpiArbiter.h.
+*/
+
+#include <Arduino.h>
+
+#include "ArduinoSpiBus.h"
+
+ArduinoSpiBus::ArduinoSpiBus(uint8_t radio_cs, uint8_t sd_cs, uint8_t tft_cs) {
+    d_cs[spi_radio] = radio_cs;
+    d_cs[spi_sd] = sd_cs;
+    d_cs[spi_tft] = tft_cs;
+}
+
+void ArduinoSpiBus::mask_radio() {
+#if defined(ARDUINO_ARCH_SAMD)
+    NVIC_DisableIRQ(EIC_IRQn);
+#else
+    noInterrupts();
+#endif
+}
+
+void ArduinoSpiBus::unmask_radio() {
+#if defined(ARDUINO_ARCH_SAMD)
+    NVIC_EnableIRQ(EIC_IRQn);
+#else
+    interrupts();
+#endif
+}
+
+/**
+ * @brief Give the bus to 'device'.
+ *
+ * The radio's own transfers are made by RadioHead, from its interrupt
+ * handler, so for the radio this only deselects the others.
+ */
+void ArduinoSpiBus::begin(SpiDevice device) {
+    if (device != spi_radio)
+        mask_radio();
+
+    for (uint8_t i = 0; i < spi_device_count; ++i) {
+        if (i != device)
+            digitalWrite(d_cs[i], HIGH);
+    }
+
+    if (device != spi_radio)
+        SPI.beginTransaction(d_settings[device]);
+}
+
+void ArduinoSpiBus::end(SpiDevice device) {
+    if (device == spi_radio)
+        return;
+
+    SPI.endTransaction();
+    unmask_radio();
+}
+
+uint32_t ArduinoSpiBus::now_us() {
+    return micros();
+}
@@ -0,0 +1,76 @@
+/*
+  Non-blocking sends for RHReliableDatagram. The ACK/retry logic lives in
+  OutboundEngine; this class is the part that talks to RadioHead.
+*/
+
+#include <string.h>
+
+#include "AsyncReliableDatagram.h"
+
+AsyncReliableDatagram::AsyncReliableDatagram(RHGenericDriver &driver, uint8_t this_address)
+    : RHReliableDatagram(driver, this_address), d_engine(0) {
+    memset(d_seen_ids, 0, sizeof(d_seen_ids));
+}
+
+/**
+ * @brief Load the frame into the radio and start transmitting it.
+ * @note RH_RF95::send() waits for a frame already being transmitted
+ * (e.g., an ACK) and for channel activity detection, but not for this
+ * frame to finish.
+ */
+bool AsyncReliableDatagram::start_send(uint8_t to, uint8_t id, const uint8_t *buf, uint8_t len, bool retry) {
+    setHeaderId(id);
+    if (retry)
+        setHeaderFlags(RH_FLAGS_RETRY, RH_FLAGS_ACK);
+    else
+        setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK | RH_FLAGS_RETRY);
+
+    return sendto((uint8_t *)buf, len, to);
+}
+
+bool AsyncReliableDatagram::send_done() {
+    return _driver.mode() != RHGenericDriver::RHModeTx;
+}
+
+/**
+ * @brief Receive a message, ACK it and pass any ACKs to the outbound engine.
+ *
+ * This follows RHReliableDatagram::recvfromAck(): messages to this node
+ * are ACK'd, and a message marked as a retry with the same header id as
+ * the last one from that node is a retransmission and is not returned.
+ * A first transmission is always returned: a leaf node that reboots
+ * starts its ids over, so its first message can reuse the last id.
+ *
+ * @return True if a new message was copied to 'buf'
+ */
+bool AsyncReliableDatagram::recvfromAckAsync(uint8_t *buf, uint8_t *len, uint8_t *from, uint8_t *to, uint8_t *id,
+                                             uint8_t *flags) {
+    uint8_t _from, _to, _id, _flags;
+    if (!available() || !recvfrom(buf, len, &_from, &_to, &_id, &_flags))
+        return false;
+
+    if (_flags & RH_FLAGS_ACK) {
+        if (_to == _thisAddress && d_engine)
+            d_engine->on_ack(_from, _id);
+        return false;
+    }
+
+    if (_to == _thisAddress)
+        acknowledge(_id, _from);
+
+    if (_id == d_seen_ids[_from] && (_flags & RH_FLAGS_RETRY))
+        return false;
+
+    d_seen_ids[_from] = _id;
+
+    if (from)
+        *from = _from;
+    if (to)
+        *to = _to;
+    if (id)
+        *id = _id;
+    if (flags)
+        *flags = _flags;
+
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+  Receive frames in the RF95's interrupt handler; see RxQueue.h.
+*/
+
+#include <Arduino.h>
+
+#include "QueuedRF95.h"
+
+QueuedRF95 *QueuedRF95::s_instance = 0;
+
+QueuedRF95::QueuedRF95(uint8_t slave_select_pin, uint8_t interrupt_pin)
+    : RH_RF95(slave_select_pin, interrupt_pin), d_interrupt_pin(interrupt_pin), d_arbiter(0), d_rssi(0), d_snr(0),
+      d_rx_ms(0) {}
+
+/**
+ * @brief Initialize the radio and take over its interrupt.
+ * @note There is one QueuedRF95.
+ */
+bool QueuedRF95::init() {
+    if (!RH_RF95::init())
+        return false;
+
+    // RH_RF95::init() attached its own handler; replace it
+    s_instance = this;
+    attachInterrupt(digitalPinToInterrupt(d_interrupt_pin), isr, RISING);
+    return true;
+}
+
+void RH_INTERRUPT_ATTR QueuedRF95::isr() {
+    s_instance->on_interrupt();
+}
+
+void QueuedRF95::on_interrupt() {
+    bool was_tx = _mode == RHModeTx;
+
+    if (d_arbiter)
+        d_arbiter->acquire(spi_radio);
+
+    handleInterrupt();
+
+    if (_rxBufValid) {
+        d_queue.push(millis(), RH_RF95::lastRssi(), RH_RF95::lastSNR(), _buf[0], _buf[1], _buf[2], _buf[3],
+                     _buf + RH_RF95_HEADER_LEN, _bufLen - RH_RF95_HEADER_LEN);
+        clearRxBuf();
+        setModeRx();
+    }
+    else if (was_tx && _mode == RHModeIdle) {
+        setModeRx();
+    }
+
+    if (d_arbiter)
+        d_arbiter->release(spi_radio);
+}
+
+/**
+ * @return True if there is a frame in the queue
+ */
+bool QueuedRF95::available() {
+    if (!d_queue.empty())
+        return true;
+
+    // Something other than the interrupt handler left the radio idle
+    if (_mode == RHModeIdle)
+        setModeRx();
+
+    return false;
+}
+
+/**
+ * @brief Take the oldest frame off the queue.
+ *
+ * Sets the header values RHDatagram::recvfrom() reads, and the values
+ * lastRssi(), lastSNR() and last_rx_ms() return.
+ */
+bool QueuedRF95::recv(uint8_t *buf, uint8_t *len) {
+    const rx_frame_t *f = d_queue.front();
+    if (!f)
+        return false;
+
+    _rxHeaderTo = f->to;
+    _rxHeaderFrom = f->from;
+    _rxHeaderId = f->id;
+    _rxHeaderFlags = f->flags;
+    d_rssi = f->rssi;
+    d_snr = f->snr;
+    d_rx_ms = f->rx_ms;
+
+    if (buf && len) {
+        if (*len > f->len)
+            *len = f->len;
+        memcpy(buf, f->data, *len);
+    }
+
+    d_queue.pop();
+    return true;
+}
@@ -5,7 +5,11 @@
   This code implements a simple display that shows a header and 11 lines 
   of text, one line for each leaf node data packet received. The display
   adds the newest line at the bottom after scrolling the existing lines
-  up.
+  up, or (TFT_INCREMENTAL) draws it over the oldest line once the screen
+  is full so only one line is sent to the display.
+
+  The other mode is a grid with a row for each leaf node (TFTNodeGrid);
+  both are kept up to date and tft_show_grid() picks the one shown.
 
   James Gallagher 1/19/22
  
@@ -47,11 +51,15 @@
 
 #include <SPI.h>
 
+#include "ArduinoSpiBus.h"   // The display shares the SPI bus
+#include "TFTDisplay.h"
+#include "TFTLogView.h"      // The header and lines of text
+#include "TFTNodeGrid.h"     // A row per leaf node
 #include "data_packet.h"     // Decode information in a data packet
 
 // For the breakout board, you can use any 2 or 3 pins.
 // These pins will also work for the 1.8" TFT shield.
-#define TFT_CS         6
+// TFT_CS is in TFTDisplay.h
 #define TFT_RST        9 // Or set to -1 and connect to Arduino RESET pin
 #define TFT_DC         5
 
@@ -71,6 +79,26 @@ Adafruit_ST7735 tft = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_RST);
 // For ST7735-based displays, we will use this call
 //Adafruit_ST7735 tft = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_MOSI, TFT_SCLK, TFT_RST);
 
+// If TFT_INCREMENTAL is 1, each new packet draws only its own line; once
+// the screen is full the newest line replaces the oldest. If 0, the whole
+// screen is redrawn for each packet with the newest line at the bottom.
+#ifndef TFT_INCREMENTAL
+#define TFT_INCREMENTAL 1
+#endif
+
+// The lines of text; they persist between calls and are kept in a ring.
+// Each drawing call holds the SPI bus.
+TFTLogView<Adafruit_ST7735, SpiHold<spi_tft> > tft_log(tft, TFT_INCREMENTAL);
+
+// If TFT_GRID is 1, the display starts with the node grid instead of the
+// lines of text
+#ifndef TFT_GRID
+#define TFT_GRID 0
+#endif
+
+TFTNodeGrid<Adafruit_ST7735, SpiHold<spi_tft> > tft_grid(tft);
+bool tft_grid_shown = TFT_GRID;
+
 /**
  * @brief Write the leaf node data header.
  * 
@@ -80,97 +108,87 @@ Adafruit_ST7735 tft = Adafruit_ST7735(TFT_CS, TFT_DC, TFT_RST);
  */
 void tft_display_header() 
 {
-    tft.fillScreen(ST77XX_BLACK);
-
-    tft.setCursor(2, 3);
-    tft.setTextColor(ST77XX_RED);
-    tft.setTextSize(1); 
-    tft.println("Node time  C  %rh bat stat");
-
-    tft.drawFastHLine(2, 13, tft.width()-4, ST77XX_RED);
+    if (tft_grid_shown)
+        tft_grid.redraw();
+    else
+        tft_log.draw_header();
 }
 
-#define DATA_LINE_CHARS 161
-
 /**
- * @brief Write decoded packet values to display to 'text'
+ * @brief Display information in the packet to the TFT.
+ * 
+ * The display can show the header, which is underlined, and 11 lines of
+ * text below that. See TFTLogView for the layout and for how much of the
+ * screen is redrawn. The line is drawn later, by tft_refresh().
  */
-void tft_get_data_line(const packet_t *data, unsigned int min, unsigned int sec, char text[DATA_LINE_CHARS])
+void tft_display_data_packet(const char text[DATA_LINE_CHARS])
 {
-    uint8_t node;
-    uint32_t message; // not used
-    uint32_t time;  // not used
-    uint16_t battery;
-    uint16_t last_tx_duration; // not used
-    int16_t temp;
-    uint16_t humidity;
-    uint8_t status;
-
-    parse_data_packet(data, &node, &message, &time, &battery, &last_tx_duration, &temp, &humidity, &status);
-
-#if 0
-    unsigned int min = DS3231.now().minute();
-    unsigned int sec = DS3231.now().second();
-#endif
-
-    // write the current line of text to the array 'text'
-    snprintf((char *)text, DATA_LINE_CHARS, "%u %02u:%02u %3.1f %u %3.2f 0x%02x",
-                 node, min, sec, temp/100.0, humidity/100, battery/100.0, (unsigned int)status);
+    tft_log.queue_line(text);
+}
 
+/**
+ * @brief Draw a line queued by tft_display_data_packet() or, with the
+ * grid shown, a row that changed
+ * @return False if there was nothing to draw
+ */
+bool tft_refresh()
+{
+    if (tft_grid_shown)
+        return tft_grid.refresh();
+    return tft_log.refresh();
 }
 
-#define MAX_LINE 11          // 11 lines can be displayed
+/**
+ * @brief A frame from a leaf node, for the grid
+ * @param when When it was received, unixtime
+ */
+void tft_node_heard(uint8_t node, uint32_t when, int16_t rssi)
+{
+    tft_grid.heard(node, when, rssi);
+}
 
-// Global storage holds the line text and current line.
-char tft_line_text[MAX_LINE][DATA_LINE_CHARS] = {};
-unsigned int tft_current_line = 0;
+/**
+ * @brief A leaf node's reading, for the grid; the values are in hundredths
+ */
+void tft_node_reading(uint8_t node, int16_t temp, uint16_t humidity, uint16_t battery)
+{
+    tft_grid.reading(node, temp, humidity, battery);
+}
 
 /**
- * @brief Display information in the packet to the TFT.
- * 
- * The display can show the header, which is underlined, and 11 lines of
- * text below that using the default font. Each line of text has two rows
- * of 'leading.' so the height of a text line is 10 pixels. Because the header
- * starts 2 pixels from the left edge and 3 from the top, the first row of 
- * text starts at 2, 15 and each subsequent row is 10 pixels more below that
- * (2 and 25, 2 and 35, ...).
+ * @brief Bring the grid's ages up to date; tft_refresh() draws the ones
+ * that changed
  */
-void tft_display_data_packet(const char text[DATA_LINE_CHARS])
+void tft_tick(uint32_t now)
 {
-    // copy the current line of text so it will persist between calls
-    memcpy(tft_line_text[tft_current_line], text, DATA_LINE_CHARS); 
+    tft_grid.tick(now);
+}
 
-    // display header
-    tft_display_header();
+/**
+ * @brief Show the node grid or the lines of text; the screen is redrawn
+ * if that changes what is shown
+ */
+void tft_show_grid(bool grid)
+{
+    if (grid == tft_grid_shown)
+        return;
+    tft_grid_shown = grid;
+    if (grid)
+        tft_grid.redraw();
+    else
+        tft_log.redraw();
+}
 
-    // Change color and (re)write the lines, including the current line
-    tft.setTextColor(ST77XX_GREEN);
-    for (unsigned int line = 0; line <= tft_current_line; ++line) {
-        tft.setCursor(2, 15 + (10 * line));
-        tft.println(tft_line_text[line]);
-    }
-    
-    // once the screen is full, only add a line at the bottom,
-    // so tft_current_line doesn't get updated and stays at 10. Once
-    // that happens, start 'scrolling' the lines up.
-    if (tft_current_line < MAX_LINE-1) {
-        ++tft_current_line;
-    }
-    else {
-        // scroll lines up if we need to make space for the next line
-        // when this function is called again.
-        for (unsigned int line = 0; line < MAX_LINE-1; ++line) {
-            memcpy(tft_line_text[line], tft_line_text[line+1], DATA_LINE_CHARS);
-        }
-    }
+bool tft_showing_grid()
+{
+    return tft_grid_shown;
 }
 
 #define LANDSCAPE_1 1        // landscape with upper left near pins; used in tft_setup()
 
-void tft_setup() 
+void tft_setup(Print &out)
 {
-    // If the serial port is connected and initialized ...
-    Serial.print(F("Hello! ST77xx TFT Test..."));
+    out.print(F("Hello! ST77xx TFT Test..."));
 
     // Use this initializer if using a 1.8" TFT screen:
     tft.initR(INITR_BLACKTAB);      // Init ST7735S chip, black tab
@@ -183,7 +201,7 @@ void tft_setup()
     // may end up with a black screen some times, or all the time.
     // tft.setSPISpeed(40000000);
 
-    Serial.println(F(" TFT Initialized"));
+    out.println(F(" TFT Initialized"));
 
     tft.setRotation(LANDSCAPE_1);
     tft.setTextWrap(false);
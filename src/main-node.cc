@@ -23,7 +23,28 @@
 #include <SdFat.h>
 #include <Wire.h>
 
+#include "ArduinoSpiBus.h"
+#include "AsyncReliableDatagram.h"
+#include "BatchMessage.h"
+#include "BinaryLog.h"
+#include "BufferedSerial.h"
+#include "FramePipeline.h"
+#include "LinkAdr.h"
+#include "LogIndex.h"
+#include "LogTransfer.h"
+#include "NodeRegistry.h"
+#include "OutboundEngine.h"
+#include "QueuedRF95.h"
+#include "SDLogger.h"
+#include "Scheduler.h"
+#include "SerialOut.h"
+#include "SpiArbiter.h"
+#include "StageTimes.h"
 #include "TFTDisplay.h"
+#include "TextFormat.h"
+#include "TextLines.h"
+#include "TimeService.h"
+#include "TimeSync.h"
 #include "data_packet.h"
 #include "messages.h"
 
@@ -64,9 +85,68 @@
 
 #endif
 
+// If SERIAL_FRAMED is 1, the main node starts in framed mode: its output
+// is COBS-framed binary records (see SerialRecord.h) instead of text. The
+// host can switch modes by sending 'B' (framed) or 'T' (text). Use
+// host-tools/serial_decoder to read the records. Set the value using the
+// platformio.ini file.
+#ifndef SERIAL_FRAMED
+#define SERIAL_FRAMED 0
+#endif
+
+// Everything the main node prints goes through this; loop() sends it
+// when the port has room, so a slow or absent host never stalls loop().
+BufferedSerial<decltype(Serial)> console(Serial, SERIAL_FRAMED ? serial_framed : serial_text);
+
+/**
+ * @brief The scheduler's clock.
+ */
+struct ArduinoClock {
+    static uint32_t ms() { return millis(); }
+    static uint32_t us() { return micros(); }
+};
+
+// loop() is one pass of this; the tasks are added at the end of setup()
+Scheduler<ArduinoClock> scheduler;
+
+// SPI clock rates for the transactions the arbiter starts. SdFat's
+// SPI_HALF_SPEED is 12MHz on the M0; Adafruit_SPITFT's default is 24MHz.
+#define SD_SPI_HZ 12000000
+#define TFT_SPI_HZ 24000000
+
+// The RF95, the SD card and the TFT share the SPI bus. The SD card and
+// the TFT take it from the arbiter for one bounded transfer at a time
+// (see SpiHold); while they hold it the radio's interrupt waits.
+ArduinoSpiBus spi_bus(RFM95_CS, SD_CS, TFT_CS);
+SpiArbiter spi_arbiter(spi_bus);
+
+// Report the worst-case bus hold times this often
+#define SPI_REPORT_INTERVAL_MS 3600000UL  // one hour
+
+/**
+ * @brief Critical section for the time service, which is updated by the
+ * RTC's square wave interrupt.
+ */
+struct InterruptsOff {
+    static void lock() { noInterrupts(); }
+    static void unlock() { interrupts(); }
+};
+
 // Real time clock
 RTC_DS3231 DS3231; // we are using the DS3231 RTC
 
+// The DS3231 is read once at startup (and then once an hour); after that
+// the time comes from millis(). If the DS3231's SQW pin is wired to the
+// M0, define RTC_SQW_PIN (using platformio.ini) and the 1Hz square wave
+// will keep millis() in step with the RTC's seconds.
+TimeService<RTC_DS3231, InterruptsOff> time_service(DS3231);
+
+#ifdef RTC_SQW_PIN
+void rtc_tick_isr() {
+    time_service.on_tick(millis());
+}
+#endif
+
 // Since this is a compile-time option, first set it, compile and upload the
 // code. That will set the time to something close to the real time (there is
 // some error due to the upload time). Then clear the option, rebuild and
@@ -90,16 +170,50 @@ RTC_DS3231 DS3231; // we are using the DS3231 RTC
 #define CODING_RATE 5
 // RH_CAD_DEFAULT_TIMEOUT 10seconds
 
-// Should the main node send a reply to a leaf node? If so, that
-// reply will be a time code and the leaf node may reset its internal
-// clock to that time. If this time is in the past relative to the
-// leaf node's boot time value, it may never wake up.
+// Should the main node send the time to a leaf node whose clock is off
+// (see TimeSync.h)? The leaf node may reset its internal clock to that
+// time. If this time is in the past relative to the leaf node's boot
+// time value, it may never wake up. Time requests are answered either
+// way. Set the value using the platformio.ini file.
+#ifndef REPLY
 #define REPLY 1
+#endif
+
+// 6 octets + preamble at SF = 10, CR = 5, BW = 125kHz is 327ms
+// or 207ms, depending on who you ask... Either way, it's more than
+// 200, which is the default. Setting the timeout to 400ms seems
+// to improve the success rate at getting the replay back to the
+// leaf node. jhrg 11/4/20
+// The leaf node's ACK (1 byte plus RadioHead's 4) is 247.8 ms on the
+// air at these settings (LoRaAirtime.h), so 400 leaves about 150 ms for
+// the leaf node to turn round; host-tools/src/lora_channel.cc has the
+// numbers for other settings.
+#define REPLY_TIMEOUT 400   // ms
+#define REPLY_RETRIES 3     // RHReliableDatagram's default
+
+// If LINK_ADR is 1, leaf nodes with a strong link are moved to a faster
+// spreading factor or a lower power and the main node listens for each
+// one at its spreading factor when its next frame is due (see
+// LinkAdr.h). The leaf nodes must understand link_adr_command_t. Set the
+// value using the platformio.ini file.
+#ifndef LINK_ADR
+#define LINK_ADR 0
+#endif
 
-// Singleton instance of the radio driver
-RH_RF95 rf95(RFM95_CS, RFM95_INT);
+#define REPLY_TAG_LINK_ADR 1    // the outbound engine's tag for a link_adr_command_t
+#define REPLY_TAG_TIME 2        // ... for the time, bare or in a time_response_t
+
+// Singleton instance of the radio driver. Received frames are queued by
+// its interrupt handler so the radio keeps listening while loop() works.
+QueuedRF95 rf95(RFM95_CS, RFM95_INT);
 // Singleton instance for the reliable datagram manager
-RHReliableDatagram rf95_manager(rf95, MAIN_NODE_ADDRESS);
+AsyncReliableDatagram rf95_manager(rf95, MAIN_NODE_ADDRESS);
+
+void reply_done(const outbound_result_t *result);
+
+// Replies are queued and sent from loop() so that the main node keeps
+// receiving while it waits for the leaf node's ACK.
+OutboundEngine outbound(rf95_manager, REPLY_TIMEOUT, REPLY_RETRIES, reply_done);
 
 // Singletons for the SD card objects
 SdFat sd;    // File system object.
@@ -107,105 +221,426 @@ SdFile file; // Log file.
 
 #define FILE_NAME "Sensor_data.csv"
 
+// A new log file is preallocated as one contiguous run this size
+#define LOG_PREALLOCATE_BYTES (16UL * 1024 * 1024)
+
 bool sd_card_status = false; // true == SD card init'd
 
-// Given a DateTime instance, return a pointer to static string that holds
-// an ISO 8601 print representation of the object.
-
-char *iso8601_date_time(DateTime &t) {
-    static char date_time_str[32];
-
-    char val[12];
-    date_time_str[0] = '\0';
-    strncat(date_time_str, itoa(t.year(), val, 10), sizeof(date_time_str) - 1);
-    strncat(date_time_str, "-", sizeof(date_time_str) - 1);
-    if (t.month() < 10)
-        strncat(date_time_str, "0", sizeof(date_time_str) - 1);
-    strncat(date_time_str, itoa(t.month(), val, 10), sizeof(date_time_str) - 1);
-    strncat(date_time_str, "-", sizeof(date_time_str) - 1);
-    if (t.day() < 10)
-        strncat(date_time_str, "0", sizeof(date_time_str) - 1);
-    strncat(date_time_str, itoa(t.day(), val, 10), sizeof(date_time_str) - 1);
-    strncat(date_time_str, "T", sizeof(date_time_str) - 1);
-    if (t.hour() < 10)
-        strncat(date_time_str, "0", sizeof(date_time_str) - 1);
-    strncat(date_time_str, itoa(t.hour(), val, 10), sizeof(date_time_str) - 1);
-    strncat(date_time_str, ":", sizeof(date_time_str) - 1);
-    if (t.minute() < 10)
-        strncat(date_time_str, "0", sizeof(date_time_str) - 1);
-    strncat(date_time_str, itoa(t.minute(), val, 10), sizeof(date_time_str) - 1);
-    strncat(date_time_str, ":", sizeof(date_time_str) - 1);
-    if (t.second() < 10)
-        strncat(date_time_str, "0", sizeof(date_time_str) - 1);
-    strncat(date_time_str, itoa(t.second(), val, 10), sizeof(date_time_str) - 1);
-
-    return date_time_str;
-}
-
-/**
-    @brief RF95 off the SPI bus to enable SD card access
+// The log file stays open; records are staged in RAM and written a
+// sector at a time from loop().
+SDLogger<SdFile, SpiHold<spi_sd> > sd_logger(file);
+
+// The host lists and downloads the files on the card over the serial
+// port with host-tools/log_download (see LogTransfer.h). Its commands
+// come as records among the single-character commands.
+SdFile transfer_file;
+SdFile transfer_dir;
+LogTransferServer<SdFile, SpiHold<spi_sd>, SerialOut<decltype(Serial)> > log_transfer(transfer_file, transfer_dir,
+                                                                                      console.out());
+SerialCommandReader command_reader;
+
+// If LOG_ROTATE is 1, the text log goes to a new file each day, named for
+// the date (YYYYMMDD.CSV), instead of to FILE_NAME, and each day's file
+// has an index next to it (YYYYMMDD.IDX; see LogIndex.h) that
+// host-tools/log_query uses to read only the blocks a query needs. Set
+// the value using the platformio.ini file.
+#ifndef LOG_ROTATE
+#define LOG_ROTATE 0
+#endif
+
+#if LOG_ROTATE
+// The preallocated clusters past the end of a day's file are not freed,
+// so a day's file gets less than the single log. A day of 32 nodes
+// reporting every five minutes is about 500 KB.
+#define LOG_ROTATE_PREALLOCATE_BYTES (1024UL * 1024)
+
+SdFile index_file;
+SDLogger<SdFile, SpiHold<spi_sd>, 1> index_logger(index_file);
+LogIndexer log_indexer;
+uint32_t log_day = 0;   // the day of the open files, days since 1970-01-01; 0 until they are open
+#endif
+
+// If BINARY_LOG is 1, received frames are written to BINARY_FILE_NAME
+// as fixed-size binary records instead of as text to FILE_NAME. Use
+// host-tools/log_decoder to turn that file into the text log. Set the
+// value using the platformio.ini file.
+#ifndef BINARY_LOG
+#define BINARY_LOG 0
+#endif
+
+// The leaf nodes: joined nodes' addresses and what is known about each
+// node. Saved to NODES_FILE_NAME when a node joins and once an hour.
+#define NODES_FILE_NAME "Nodes.dat"
+#define NODES_SAVE_INTERVAL_MS 3600000UL    // one hour
+
+NodeRegistry<> nodes;
+TimeSync time_sync;
+#if LINK_ADR
+LinkAdr link_adr(SPREADING_FACTOR);
+uint8_t listen_sf = SPREADING_FACTOR;   // the radio's spreading factor now
+#endif
+SdFile nodes_file;
+bool nodes_file_status = false;
+
+#if BINARY_LOG
+#define BINARY_FILE_NAME "Sensor_data.bin"
+// Write a partially filled block after this long
+#define BINARY_FLUSH_INTERVAL 600000UL // 10 minutes
+
+SdFile bin_file;
+SDLogger<SdFile, SpiHold<spi_sd>, 2> bin_logger(bin_file);
+BinaryLogEncoder bin_encoder;
+
+static_assert(sizeof(packet_t) <= LOG_RECORD_MAX_PAYLOAD, "packet_t must fit in a binary log record");
+static_assert(LOG_RECORD_MAX_SIZE <= SERIAL_RECORD_MAX_PAYLOAD, "a binary log record must fit in an 'F' record");
+#endif
+
+// If STAGE_TIMING is 1, loop() times each stage of handling a frame (see
+// StageTimes.h). A summary is printed once every STAGE_REPORT_INTERVAL_MS
+// and the histograms when 'S' is sent to the main node. If it is 0, the
+// timing compiles out. Set the value using the platformio.ini file.
+#ifndef STAGE_TIMING
+#define STAGE_TIMING 0
+#endif
+
+#if STAGE_TIMING
+#define STAGE_REPORT_INTERVAL_MS 3600000UL  // one hour
+
+StageTimes stage_times;
+void print_stage_times(bool histograms);
+
+// STAGE_START() starts a clock; STAGE_LAP() charges the time since the
+// clock started, or since the last lap, to a stage; STAGE_SKIP() starts
+// the clock over without charging the time to any stage (the frame
+// sinks time their own stages)
+#define STAGE_START(clock) uint32_t clock = micros()
+#define STAGE_LAP(clock, stage) stage_times.lap(stage, clock, micros())
+#define STAGE_SKIP(clock) clock = micros()
+#else
+#define STAGE_START(clock)
+#define STAGE_LAP(clock, stage)
+#define STAGE_SKIP(clock)
+#endif
+
+/**
+   @brief Is the SD card done programming the last sector?
+   SdFat would wait for the card, holding the SPI bus, at the start of
+   the next write; the loggers use this to leave the writes for later.
+   @return True if the card is ready
 */
-void yield_spi_to_sd() {
-    //digitalWrite(SD_CS, LOW);
-    digitalWrite(RFM95_CS, HIGH);
+bool sd_card_ready() {
+    spi_arbiter.acquire(spi_sd);
+    bool busy = sd.card()->isBusy();
+    spi_arbiter.release(spi_sd);
+    return !busy;
 }
 
 /**
-    @brief RF95 off the SPI bus to enable SD card access
+   @brief Open the text log file and write a header for this run.
+   @param file_name open/create this file, append if it exists
+   @param prealloc_bytes Preallocate this many bytes if the file is new
+   @return False if the file could not be opened
 */
-void yield_spi_to_rf95() {
-    digitalWrite(SD_CS, HIGH);
-    //digitalWrite(RFM95_CS, LOW);
+bool open_text_log(const char *file_name, uint32_t prealloc_bytes) {
+    if (!sd_logger.begin(file_name, O_WRONLY | O_CREAT, prealloc_bytes, millis())) {
+        console.println(F("Couldn't write file header"));
+        sd_card_status = false;
+        return false;
+    }
+
+    sd_logger.log("# Start Log", millis());
+    sd_logger.log("# Node, Message, Time, Battery V, Last TX Dur ms, Temp C, Hum %, Status", millis());
+    sd_logger.flush();
+    return true;
 }
 
 /**
-   @brief Write a header for the new log file.
+   @brief Open the log files and write a header for this run.
+   With LOG_ROTATE the text log is opened later, by rotate_log(), once
+   the time is known.
    @param file_name open/create this file, append if it exists
-   @note Claim the SPI bus
 */
 void write_header(const char *file_name) {
     if (!sd_card_status)
         return;
 
-    yield_spi_to_sd();
+#if !LOG_ROTATE
+    if (!open_text_log(file_name, LOG_PREALLOCATE_BYTES))
+        return;
+#endif
+
+#if BINARY_LOG
+    if (!bin_logger.begin(BINARY_FILE_NAME, O_WRONLY | O_CREAT, LOG_PREALLOCATE_BYTES, millis())) {
+        console.println(F("Couldn't open the binary log"));
+        sd_card_status = false;
+        return;
+    }
+
+    // A block torn by a power loss is skipped by the decoder; start the
+    // new blocks on a block boundary.
+    static const uint8_t zeros[LOG_BLOCK_SIZE] = {0};
+    uint32_t partial = bin_logger.position() % LOG_BLOCK_SIZE;
+    if (partial)
+        bin_logger.write(zeros, LOG_BLOCK_SIZE - partial, millis());
+    bin_encoder.set_sequence(bin_logger.position() / LOG_BLOCK_SIZE);
+#endif
+}
+
+#if LOG_ROTATE
+/**
+   @brief Write the open block's index entry and close the day's files
+*/
+void close_log() {
+    log_index_entry_t entry;
+    if (log_indexer.finish(&entry))
+        index_logger.write(&entry, sizeof(entry), millis());
+    index_logger.end();
+    sd_logger.end();
+    log_day = 0;
+}
+
+/**
+   @brief Start the day's log and index files if the day has changed.
+   Both are appended to if they exist, e.g., after a reset.
+   @param now The time (unixtime)
+*/
+void rotate_log(uint32_t now) {
+    if (!sd_card_status || now / 86400 == log_day)
+        return;
+
+    if (log_day)
+        close_log();
 
-    noInterrupts(); // disable interrupts
+    char name[LOG_FILE_NAME_LEN];
+    log_file_name(now, "CSV", name);
+    console.print(F("Log file: "));
+    console.println(name);
+    if (!open_text_log(name, LOG_ROTATE_PREALLOCATE_BYTES))
+        return;
 
-    if (!file.open(file_name, O_WRONLY | O_CREAT | O_APPEND)) {
-        Serial.println(F("Couldn't write file header"));
+    log_file_name(now, "IDX", name);
+    if (!index_logger.begin(name, O_WRONLY | O_CREAT, 0, millis())) {
+        console.println(F("Couldn't open the log index"));
         sd_card_status = false;
         return;
     }
 
-    file.println(F("# Start Log"));
-    file.println(F("# Node, Message, Time, Battery V, Last TX Dur ms, Temp C, Hum %, Status"));
-    file.close();
+    uint32_t size = index_logger.position();
+    if (size == 0) {
+        log_index_header_t header = log_index_header();
+        index_logger.write(&header, sizeof(header), millis());
+    }
+    else if (size > LOG_INDEX_HEADER_SIZE && (size - LOG_INDEX_HEADER_SIZE) % LOG_INDEX_ENTRY_SIZE) {
+        // An entry torn by a power loss; pad it out to an empty entry,
+        // which readers skip
+        static const uint8_t zeros[LOG_INDEX_ENTRY_SIZE] = {0};
+        index_logger.write(zeros, LOG_INDEX_ENTRY_SIZE - (size - LOG_INDEX_HEADER_SIZE) % LOG_INDEX_ENTRY_SIZE,
+                           millis());
+    }
+    index_logger.flush();
 
-    interrupts(); // enable interrupts
+    log_day = now / 86400;
+}
+#endif
+
+/**
+   @brief Open the node registry's file and load the table saved in it.
+   The file stays open.
+*/
+void load_nodes() {
+    if (!sd_card_status)
+        return;
+
+    spi_arbiter.acquire(spi_sd);
+    nodes_file_status = nodes_file.open(NODES_FILE_NAME, O_RDWR | O_CREAT);
+    spi_arbiter.release(spi_sd);
+    if (!nodes_file_status) {
+        console.println(F("Couldn't open the node registry"));
+        return;
+    }
+
+    if (nodes.load<SdFile, SpiHold<spi_sd> >(nodes_file)) {
+        console.print(F("Node registry: "));
+        console.print(nodes.count(), DEC);
+        console.println(F(" nodes"));
+    }
+
+    // The grid shows the known nodes, quiet ones too
+    for (uint16_t i = 0; i < nodes.count(); ++i)
+        tft_node_heard(nodes.entry(i).address, nodes.entry(i).last_seen, nodes.entry(i).rssi);
+}
+
+/**
+   @brief Save the node registry; at once if a node was added, otherwise
+   once every NODES_SAVE_INTERVAL_MS. A save is written a chunk a call.
+   @return False if the card was busy and nothing was written
+*/
+bool save_nodes() {
+    static uint32_t last_save_ms = 0;
+    if (!nodes_file_status)
+        return true;
+    if (!nodes.saving()) {
+        if (!nodes.dirty() && millis() - last_save_ms < NODES_SAVE_INTERVAL_MS)
+            return true;
+        last_save_ms = millis();
+    }
+
+    switch (nodes.save<SdFile, SpiHold<spi_sd> >(nodes_file)) {
+        case node_save_busy:
+            return false;
+        case node_save_failed:
+            console.println(F("Couldn't save the node registry"));
+            return true;
+        default:
+            return true;
+    }
 }
 
 /**
    @brief log data
-   write data to the log, append a new line
-   @param file_name open for append
+   Stage data for the log, append a new line. The SD card is not touched
+   here; service_log() writes the data.
+   With LOG_ROTATE the line is also added to the day's index.
    @param data write this char string
-   @note Claim the SPI bus (calls yield_spi_to_sd()().
+   @param rx_time When the line's frame was received (unixtime)
+   @param node The node that sent it
 */
-void log_data(const char *file_name, const char *data) {
+void log_data(const char *data, uint32_t rx_time, uint8_t node) {
     if (!sd_card_status)
         return;
 
-    yield_spi_to_sd();
-    noInterrupts(); // disable interrupts
+    uint32_t offset = sd_logger.position();
+    if (!sd_logger.log(data, millis())) {
+        console.print(F("Failed to log data."));
+        return;
+    }
 
-    if (file.open(file_name, O_WRONLY | O_CREAT | O_APPEND)) {
-        file.println(data);
-        file.close();
-    } else {
-        Serial.print(F("Failed to log data."));
+#if LOG_ROTATE
+    log_index_entry_t entry;
+    if (log_indexer.record(offset, sd_logger.position(), rx_time, node, &entry))
+        index_logger.write(&entry, sizeof(entry), millis());
+#else
+    (void)offset;
+    (void)rx_time;
+    (void)node;
+#endif
+}
+
+/**
+   @brief log a received frame to the binary log
+   Does nothing unless BINARY_LOG is 1.
+   @param rx_time When the frame was received (unixtime)
+   @param type The frame's message type
+   @param from The node that sent the frame
+   @param frame The frame
+   @param len Length of the frame
+*/
+void log_frame(uint32_t rx_time, MessageType type, uint8_t from, const uint8_t *frame, uint8_t len) {
+#if BINARY_LOG
+    if (!sd_card_status)
+        return;
+
+    log_record_t rec;
+    build_log_record(&rec, rx_time, rf95.lastRssi(), rf95.lastSNR(), type, from, frame, len);
+    if (!bin_encoder.add(&rec, millis())) {
+        bin_logger.write(bin_encoder.finish(), LOG_BLOCK_SIZE, millis());
+        bin_encoder.reset();
+        bin_encoder.add(&rec, millis());
     }
+#endif
+}
+
+/**
+   @brief Write staged log data to the SD card, if it's time
+   @note Each sector write holds the SPI bus on its own.
+*/
+void service_log() {
+    if (!sd_card_status)
+        return;
+
+    sd_logger.service(millis());
+#if LOG_ROTATE
+    index_logger.service(millis());
+#endif
+#if BINARY_LOG
+    if (bin_encoder.full() || bin_encoder.due(millis(), BINARY_FLUSH_INTERVAL)) {
+        bin_logger.write(bin_encoder.finish(), LOG_BLOCK_SIZE, millis());
+        bin_encoder.reset();
+    }
+    bin_logger.service(millis());
+#endif
+}
 
-    interrupts(); // enable interrupts
+/**
+   @brief In framed mode, send a received frame to the host as a binary record
+   @param rx_time When the frame was received (unixtime)
+   @param type The frame's message type
+   @param from The node that sent the frame
+   @param frame The frame
+   @param len Length of the frame
+*/
+void send_frame_record(uint32_t rx_time, MessageType type, uint8_t from, const uint8_t *frame, uint8_t len) {
+    if (console.out().mode() != serial_framed)
+        return;
+
+    log_record_t rec;
+    build_log_record(&rec, rx_time, rf95.lastRssi(), rf95.lastSNR(), type, from, frame, len);
+    uint8_t buf[LOG_RECORD_MAX_SIZE];
+    console.out().write_record(SERIAL_RECORD_FRAME, buf, log_record_encode(&rec, buf));
+}
+
+void print_frame_counts();
+void print_task_stats();
+
+/**
+   @brief Switch the serial output mode when the host asks: 'B' for framed
+   binary records, 'T' for text; print the message counts, the task
+   times (and, with STAGE_TIMING, the stage times) for 'S'; switch the TFT
+   between the lines of text and the node grid for 'D'. Pass command
+   records to the log transfer.
+*/
+void read_serial_commands() {
+    while (Serial.available() > 0) {
+        uint8_t c = Serial.read();
+        serial_record_t rec;
+        SerialCommandInput input = command_reader.add(c, &rec);
+        if (input == serial_command_record) {
+            // A read sees everything logged up to now: log_task() writes
+            // it, between frames and not while the card is busy, and then
+            // transfer_task() starts the read
+            if (rec.type == LOG_TRANSFER_READ && sd_card_status) {
+                sd_logger.flush_soon();
+#if LOG_ROTATE
+                index_logger.flush_soon();
+#endif
+            }
+            log_transfer.command(rec, millis());
+        }
+        if (input != serial_command_char)
+            continue;
+
+        switch (c) {
+            case 'B':
+                console.out().set_mode(serial_framed);
+                break;
+            case 'T':
+                console.out().set_mode(serial_text);
+                break;
+            case 'S':
+                print_frame_counts();
+                print_task_stats();
+#if STAGE_TIMING
+                print_stage_times(true);
+#endif
+                break;
+            case 'D':
+                tft_tick(time_service.now(millis()));
+                tft_show_grid(!tft_showing_grid());
+                break;
+            default:
+                break;
+        }
+    }
 }
 
 void status_on() {
@@ -216,71 +651,391 @@ void status_off() {
     digitalWrite(LED_BUILTIN, LOW);
 }
 
-void yield(unsigned long duration_ms) {
-    unsigned long start = millis();
-    do {
-        yield();
-    } while (millis() - start < duration_ms);
+/**
+ * @brief Print the radio's link statistics and, if given, the node's
+ * lost and duplicate message counts
+ * @param node The sender's entry in the node registry, or null
+ */
+void print_rfm95_info(const node_state_t *node) {
+    console.print(F("RSSI "));
+    console.print(rf95.lastRssi(), DEC);
+    console.print(F(" dBm, SNR "));
+    console.print(rf95.lastSNR(), DEC);
+    console.print(F(" dB, good/bad packets: "));
+    console.print(rf95.rxGood(), DEC);
+    console.print(F("/"));
+    if (!node) {
+        console.println(rf95.rxBad(), DEC);
+        return;
+    }
+    console.print(rf95.rxBad(), DEC);
+    console.print(F(", lost/duplicate messages: "));
+    console.print(node->lost, DEC);
+    console.print(F("/"));
+    console.println(node->duplicates, DEC);
+}
+
+/**
+ * @brief Report frames the RX queue dropped since the last report
+ */
+void report_rx_queue() {
+    static uint32_t reported = 0;
+    uint32_t dropped = rf95.queue().overflows() + rf95.queue().oversize();
+    if (dropped == reported)
+        return;
+
+    reported = dropped;
+    console.print(F("RX queue dropped frames: "));
+    console.print(rf95.queue().overflows(), DEC);
+    console.print(F(" full, "));
+    console.print(rf95.queue().oversize(), DEC);
+    console.print(F(" too long, high water: "));
+    console.println(rf95.queue().high_water(), DEC);
+}
+
+/**
+ * @brief Print the worst-case and mean SPI bus hold time for each device
+ * @note A task, run once every SPI_REPORT_INTERVAL_MS
+ */
+bool report_spi_bus() {
+    console.print(F("SPI bus hold, max/mean us (over budget): "));
+    for (uint8_t i = 0; i < spi_device_count; ++i) {
+        const spi_hold_stats_t &s = spi_arbiter.stats((SpiDevice)i);
+        if (i > 0)
+            console.print(F(", "));
+        console.print(SpiArbiter::device_name((SpiDevice)i));
+        console.print(F(" "));
+        console.print(s.max_us, DEC);
+        console.print(F("/"));
+        console.print(s.holds ? s.total_us / s.holds : 0, DEC);
+        console.print(F(" ("));
+        console.print(s.over_budget, DEC);
+        console.print(F(")"));
+    }
+    console.print(F(", conflicts: "));
+    console.println(spi_arbiter.conflicts(), DEC);
+    return true;
+}
+
+/**
+ * @brief Print each task's runs, times it could not run, longest run and
+ * most late it started, and the longest gap between radio polls
+ */
+void print_task_stats() {
+    for (uint8_t i = 0; i < scheduler.count(); ++i) {
+        const task_stats_t &s = scheduler.stats(i);
+        console.print(F("Task "));
+        console.print(scheduler.name(i));
+        console.print(F(": "));
+        console.print(s.runs, DEC);
+        console.print(F(" runs, "));
+        console.print(s.deferred, DEC);
+        console.print(F(" deferred, max run us: "));
+        console.print(s.max_run_us, DEC);
+        console.print(F(", max late ms: "));
+        console.println(s.max_late_ms, DEC);
+    }
+    console.print(F("Longest gap between radio polls, us: "));
+    console.println(scheduler.max_poll_gap_us(), DEC);
+}
+
+#if STAGE_TIMING
+/**
+ * @brief Print each stage's count, mean, median, 95th percentile and
+ * maximum in us, and the failures counted elsewhere
+ * @param histograms If true, print the histograms too, as 'limit:count'
+ * for each bin that is not empty
+ */
+void print_stage_times(bool histograms) {
+    for (uint8_t i = 0; i < stage_count; ++i) {
+        const stage_stats_t &s = stage_times.stats((Stage)i);
+        console.print(F("Stage "));
+        console.print(StageTimes::stage_name((Stage)i));
+        console.print(F(": "));
+        console.print(s.count, DEC);
+        if (s.count) {
+            console.print(F(", mean/p50/p95/max us: "));
+            console.print((uint32_t)(s.total_us / s.count), DEC);
+            console.print(F("/<"));
+            console.print(StageTimes::bin_limit_us(stage_times.percentile_bin((Stage)i, 50)) + 1, DEC);
+            console.print(F("/<"));
+            console.print(StageTimes::bin_limit_us(stage_times.percentile_bin((Stage)i, 95)) + 1, DEC);
+            console.print(F("/"));
+            console.print(s.max_us, DEC);
+        }
+        console.println();
+
+        if (histograms && s.count) {
+            console.print(F("   "));
+            for (uint8_t b = 0; b < STAGE_BINS; ++b) {
+                if (!s.bins[b])
+                    continue;
+                console.print(F(" "));
+                console.print(StageTimes::bin_limit_us(b), DEC);
+                console.print(F(":"));
+                console.print(s.bins[b], DEC);
+            }
+            console.println();
+        }
+    }
+
+    console.print(F("RX queue overflows: "));
+    console.print(rf95.queue().overflows(), DEC);
+    console.print(F(", SD errors: "));
+    console.print(sd_logger.stats().errors, DEC);
+    console.print(F(", replies failed/not queued: "));
+    console.print(outbound.failed(), DEC);
+    console.print(F("/"));
+    console.println(outbound.dropped(), DEC);
+}
+
+/**
+ * @brief Print the stage times and start over, so each summary covers
+ * one interval
+ * @note A task, run once every STAGE_REPORT_INTERVAL_MS
+ */
+bool report_stage_times() {
+    print_stage_times(false);
+    stage_times.reset();
+    return true;
 }
+#endif
+
+/**
+ * @brief Log each message to the binary log and, in framed mode, send
+ * it to the host as a record; see log_frame() and send_frame_record()
+ */
+class RecordSink : public FrameSink {
+public:
+    void message(const frame_record_t &record, MessageType type, const uint8_t *msg, uint8_t len, int8_t) {
+        STAGE_START(lap);
+        // With BINARY_LOG, this replaces TextLogSink
+        log_frame(record.rx_time, type, record.from, msg, len);
+        STAGE_LAP(lap, stage_log);
+        send_frame_record(record.rx_time, type, record.from, msg, len);
+        STAGE_LAP(lap, stage_serial);
+    }
+};
+
+/**
+ * @brief Print each message to the console, pretty-printed
+ */
+class ConsoleSink : public FrameSink {
+public:
+    void message(const frame_record_t &record, MessageType type, const uint8_t *msg, uint8_t, int8_t) {
+        STAGE_START(lap);
+        const node_state_t *node = nodes.node(record.from);
+        switch (type) {
+            case data_packet:               // Compatibility with the original packet_t
+            case data_message: {            // New data message with type indicator
+                char *data = type == data_packet ? data_packet_to_string((packet_t *)msg, /* pretty */ true)
+                                                 : data_message_to_string((data_message_t *)msg, /* pretty */ true);
+                STAGE_LAP(lap, stage_render);
+                console.print(F("Data: "));
+                console.print(data);
+
+                console.print(F(", "));
+                print_rfm95_info(node);
+                break;
+            }
+
+            case text:
+                console.print(F("Got: "));
+                console.println(text_message_to_string((text_t *)msg, true /*pretty*/));
+
+                console.print(F("RFM95 info: "));
+                print_rfm95_info(node);
+                break;
+
+            case join_request:
+                console.print(F("Join request: "));
+                console.print(join_request_to_string((join_request_t *)msg, /* pretty */ true));
+                console.print(F(", address: "));
+                console.println(record.address, DEC);
+                break;
+
+            case time_request:
+                console.print(F("Time request: "));
+                console.print(time_request_to_string((time_request_t *)msg, /* pretty */ true));
+
+                console.print(F(", "));
+                print_rfm95_info(node);
+                break;
+
+            default:
+                console.println(F("Got unrecognized message."));
+        }
+        STAGE_LAP(lap, stage_serial);
+    }
+};
+
+/**
+ * @brief Log each message to the SD card as text, not pretty-printed.
+ * Nothing is formatted with BINARY_LOG or without a card.
+ */
+class TextLogSink : public FrameSink {
+public:
+    void message(const frame_record_t &record, MessageType type, const uint8_t *msg, uint8_t, int8_t) {
+        if (BINARY_LOG || !sd_card_status)
+            return;
+
+        STAGE_START(lap);
+        const char *line;
+        switch (type) {
+            case data_packet:
+                line = data_packet_to_string((packet_t *)msg, false);
+                break;
+            case data_message:
+                line = data_message_to_string((data_message_t *)msg, false);
+                break;
+            case text:
+                line = text_message_to_string((text_t *)msg, false /*pretty*/);
+                break;
+            case join_request:
+                line = join_request_to_string((join_request_t *)msg, false);
+                break;
+            case time_request:
+                line = time_request_to_string((time_request_t *)msg, false);
+                break;
+            default:
+                return;
+        }
+        STAGE_LAP(lap, stage_render);
+        log_data(line, record.rx_time, record.node);
+        STAGE_LAP(lap, stage_log);
+    }
+};
+
+/**
+ * @brief Show each data packet's reading on the TFT: the time is when
+ * it was received, or for a batch's reading, when it was taken. The node
+ * grid gets every message but a join request, whose sender has no
+ * address yet.
+ */
+class TftSink : public FrameSink {
+public:
+    void message(const frame_record_t &record, MessageType type, const uint8_t *, uint8_t, int8_t reading) {
+        if (type != data_packet) {
+            if (type != join_request)
+                tft_node_heard(record.from, record.rx_time, rf95.lastRssi());
+            return;
+        }
+
+        STAGE_START(lap);
+        const batch_reading_t &r = record.readings[reading];
+        tft_node_heard(record.node, record.rx_time, rf95.lastRssi());
+        tft_node_reading(record.node, r.temp, r.humidity, r.battery);
+        DateTime t(record.batch ? r.time : record.rx_time);
+        char text[DATA_LINE_CHARS];
+        tft_get_reading_line(record.node, r, t.minute(), t.second(), text);
+        tft_display_data_packet(text);
+        STAGE_LAP(lap, stage_tft);
+    }
+};
+
+// Each received frame is decoded once and each message in it goes to
+// these, in this order
+FramePipeline pipeline;
+RecordSink record_sink;
+ConsoleSink console_sink;
+TextLogSink text_log_sink;
+TftSink tft_sink;
+FrameCounts frame_counts;
 
-void print_rfm95_info() {
-    Serial.print(F("RSSI "));
-    Serial.print(rf95.lastRssi(), DEC);
-    Serial.print(F(" dBm, SNR "));
-    Serial.print(rf95.lastSNR(), DEC);
-    Serial.print(F(" dB, good/bad packets: "));
-    Serial.print(rf95.rxGood(), DEC);
-    Serial.print(F("/"));
-    Serial.println(rf95.rxBad(), DEC);
+/**
+ * @brief Print the number of messages of each type, and of frames dropped
+ */
+void print_frame_counts() {
+    console.print(F("Messages, packets/batched/data/text/join/time: "));
+    console.print(frame_counts.messages(data_packet), DEC);
+    console.print(F("/"));
+    console.print(frame_counts.batched(), DEC);
+    console.print(F("/"));
+    console.print(frame_counts.messages(data_message), DEC);
+    console.print(F("/"));
+    console.print(frame_counts.messages(text), DEC);
+    console.print(F("/"));
+    console.print(frame_counts.messages(join_request), DEC);
+    console.print(F("/"));
+    console.print(frame_counts.messages(time_request), DEC);
+    console.print(F(", unrecognized: "));
+    console.print(frame_counts.unknown(), DEC);
+    console.print(F(", malformed: "));
+    console.println(frame_counts.malformed_frames(), DEC);
 }
 
+#define MSG_LEN 128
+
 #define SERIAL_WAIT_TIME 10000      // 10s
 #define ONE_SECOND 1000             // ms
+#define TFT_AGE_INTERVAL_MS 5000    // how often the node grid's ages are brought up to date
+
+// When setup() started the serial port; the status LED blinks until the
+// host opens it or for SERIAL_WAIT_TIME after this
+uint32_t serial_wait_start_ms = 0;
+
+bool radio_task();
+bool serial_task();
+bool status_led_task();
+bool log_task();
+bool display_task();
+bool tft_age_task();
+bool transfer_task();
+bool nodes_task();
+
+// The status LED task stops itself
+int8_t status_led = -1;
 
 void setup() {
     pinMode(LED_BUILTIN, OUTPUT);
     pinMode(RFM95_RST, OUTPUT);
     pinMode(RFM95_CS, OUTPUT);
+    digitalWrite(RFM95_CS, HIGH);   // keep the radio off the bus until it's set up
+
+    spi_bus.set_settings(spi_sd, SPISettings(SD_SPI_HZ, MSBFIRST, SPI_MODE0));
+    spi_bus.set_settings(spi_tft, SPISettings(TFT_SPI_HZ, MSBFIRST, SPI_MODE0));
 
-    long start_time = millis();
+    // Don't wait for the host to open the port; what is printed until it
+    // does waits in the console's buffer. See status_led_task().
+    serial_wait_start_ms = millis();
     Serial.begin(BAUD_RATE);
-    // wait for the Serial interface to come up or for the SERIAL_WAIT_TIME
-    while (!Serial && (millis() - start_time < SERIAL_WAIT_TIME)) {
-        status_on();
-        delay(ONE_SECOND);
-        status_off();
-        delay(ONE_SECOND);
-    }
 
-    Serial.println(F("boot"));
+    console.println(F("boot"));
 
     int sda = I2C_SDA;
     int scl = I2C_SCL;
     Wire.begin(sda, scl);
 
-    tft_setup();
+    tft_setup(console);
 
     // Initialize the SD card
-    yield_spi_to_sd();
-
-    Serial.print(F("Initializing SD card..."));
+    console.print(F("Initializing SD card..."));
 
     // Initialize at the highest speed supported by the board that is
     // not over 50 MHz. Try a lower speed if SPI errors occur.
     if (sd.begin(SD_CS, SPI_HALF_SPEED)) { //, SD_SCK_MHZ(50))) {
-        Serial.println(F(" OK"));
+        console.println(F(" OK"));
         sd_card_status = true;
+        sd_logger.set_ready_check(sd_card_ready);
+        nodes.set_ready_check(sd_card_ready);
+        log_transfer.set_ready_check(sd_card_ready);
+#if LOG_ROTATE
+        index_logger.set_ready_check(sd_card_ready);
+#endif
+#if BINARY_LOG
+        bin_logger.set_ready_check(sd_card_ready);
+#endif
     } else {
-        Serial.println(F(" Couldn't init the SD Card"));
+        console.println(F(" Couldn't init the SD Card"));
         sd_card_status = false;
     }
 
     // Write data header.
     write_header(FILE_NAME);
 
-    yield_spi_to_rf95();
+    load_nodes();
 
-    Serial.print(F("Starting receiver..."));
+    console.print(F("Starting receiver..."));
 
     // LORA manual reset
     digitalWrite(RFM95_RST, LOW);
@@ -289,14 +1044,11 @@ void setup() {
     delay(20);
 
     if (rf95_manager.init()) {
-        Serial.println(F(" OK"));
+        console.println(F(" OK"));
 
-        // 6 octets + preamble at SF = 10, CR = 5, BW = 125kHz is 327ms
-        // or 207ms, depending on who you ask... Either way, it's more than
-        // 200, which is the default. Setting the timeout to 400ms seems
-        // to improve the success rate at getting the replay back to the
-        // leaf node. jhrg 11/4/20
-        rf95_manager.setTimeout(400);
+        rf95_manager.setTimeout(REPLY_TIMEOUT);
+        rf95_manager.set_engine(&outbound);
+        rf95.set_arbiter(&spi_arbiter);
 
         // Setup ISM FREQUENCY
         rf95.setFrequency(FREQUENCY);
@@ -311,21 +1063,21 @@ void setup() {
         // Set the CAD timeout to 10s
         rf95.setCADTimeout(RH_CAD_DEFAULT_TIMEOUT);
 
-        Serial.print(F("Listening on frequency: "));
-        Serial.println(FREQUENCY);
+        console.print(F("Listening on frequency: "));
+        console.println(FREQUENCY);
     } else {
-        Serial.println(F(" receiver initialization failed"));
+        console.println(F(" receiver initialization failed"));
     }
 
     if (!DS3231.begin()) {
-        Serial.println("Couldn't find DS3231");
+        console.println("Couldn't find DS3231");
     }
 
     if (DS3231.lostPower() || ADJUST_TIME) {
         if (ADJUST_TIME)
-            Serial.println("ADJUST_TIME option set, set time to compiled value");
+            console.println("ADJUST_TIME option set, set time to compiled value");
         else
-            Serial.println("RTC lost power, let's set the time!");
+            console.println("RTC lost power, let's set the time!");
         // When time needs to be set on a new device, or after a power loss, the
         // following line sets the RTC to the date & time this sketch was compiled
         DS3231.adjust(DateTime(F(__DATE__), F(__TIME__)));
@@ -334,186 +1086,422 @@ void setup() {
         // rtc.adjust(DateTime(2014, 1, 21, 3, 0, 0));
     }
 
-    Serial.print(F("Startup time: "));
-    DateTime t = DS3231.now();
-    Serial.println(iso8601_date_time(t));
+    time_service.begin(millis());
+#if LOG_ROTATE
+    rotate_log(time_service.now(millis()));
+#endif
+
+#ifdef RTC_SQW_PIN
+    DS3231.writeSqwPinMode(DS3231_SquareWave1Hz);
+    pinMode(RTC_SQW_PIN, INPUT_PULLUP); // SQW is open drain
+    attachInterrupt(digitalPinToInterrupt(RTC_SQW_PIN), rtc_tick_isr, FALLING);
+#endif
+
+    pipeline.add(&record_sink);
+    pipeline.add(&console_sink);
+    pipeline.add(&text_log_sink);
+    pipeline.add(&tft_sink);
+    pipeline.add(&frame_counts);
+
+    // The radio and the serial port are polled on every pass of loop();
+    // one of the rest runs a pass, the one due first. See Scheduler.h.
+    scheduler.poll(radio_task, "radio");
+    scheduler.poll(serial_task, "serial");
+    status_led = scheduler.every(status_led_task, ONE_SECOND, "status LED");
+    scheduler.every(log_task, 0, "log");
+    scheduler.every(display_task, 0, "display");
+    scheduler.every(tft_age_task, TFT_AGE_INTERVAL_MS, "TFT ages", TFT_AGE_INTERVAL_MS);
+    scheduler.every(transfer_task, 0, "log transfer");
+    scheduler.every(nodes_task, 0, "node registry");
+    scheduler.every(report_spi_bus, SPI_REPORT_INTERVAL_MS, "SPI report", SPI_REPORT_INTERVAL_MS);
+#if STAGE_TIMING
+    scheduler.every(report_stage_times, STAGE_REPORT_INTERVAL_MS, "stage report", STAGE_REPORT_INTERVAL_MS);
+#endif
 
-    Serial.flush();
+    console.print(F("Startup time: "));
+    char date_time[ISO8601_CHARS];
+    console.println(iso8601_date_time(time_service.now(millis()), date_time));
 
     status_off();
 }
 
 /**
- * @brief Send a reply that includes a time code (unixtime)
- * @note Resets the rf95 manager's retransmissions counter
- * @param from The node number
- * @param msg
+ * @brief Report the fate of a queued reply
+ * @note Called by the outbound engine from loop()
+ * @param result What happened
  */
-void send_time_as_reply(uint8_t from)
+void reply_done(const outbound_result_t *result)
 {
-    char msg[RH_RF95_MAX_MESSAGE_LEN];
-    yield_spi_to_rf95();
-    uint32_t now = DS3231.now().unixtime();
-    unsigned long start = millis();
-    if (rf95_manager.sendtoWait((uint8_t *)&now, sizeof(now), from)) {
-        snprintf(msg, RH_RF95_MAX_MESSAGE_LEN, "...sent a reply, %ld retransmissions, %ld ms", rf95_manager.retransmissions(),
-                 millis() - start);
-        Serial.println(msg);
-        Serial.flush();
-    } else {
-        snprintf(msg, RH_RF95_MAX_MESSAGE_LEN, "...reply failed, %ld retransmissions, %ld ms", rf95_manager.retransmissions(),
-                 millis() - start);
-        Serial.println(msg);
-        Serial.flush();
+    char msg[MSG_LEN];
+    TextSpan(msg, MSG_LEN).put("...").put(result->acked ? "sent a reply" : "reply failed").put(", ")
+        .put_uint(result->retransmissions).put(" retransmissions, ").put_uint(result->duration_ms).put(" ms, to: 0x")
+        .put_hex(result->to, 2);
+    console.println(msg);
+
+    // The node's clock is set only if it got the time; what it was sent
+    // was the time when the reply was queued
+    node_state_t *node = nodes.node(result->to);
+    if (result->tag == REPLY_TAG_TIME && result->acked && node)
+        time_sync.set(*node, time_service.now(millis() - result->duration_ms));
+
+#if LINK_ADR
+    if (result->tag == REPLY_TAG_LINK_ADR && node) {
+        if (result->acked) {
+            TextSpan(msg, MSG_LEN).put("Node ").put_uint(node->address).put(" now at SF")
+                .put_uint(node->adr_spreading_factor).put(", ").put_int(node->adr_tx_power).put(" dBm");
+            console.println(msg);
+        }
+        link_adr.confirm(*node, result->acked);
     }
+#endif
+}
 
-    rf95_manager.resetRetransmissions();
+/**
+ * @brief Queue a reply that includes a time code (unixtime)
+ * @note The reply is sent from loop(); see reply_done()
+ * @param from The node number
+ * @param now The time to send
+ */
+void send_time_as_reply(uint8_t from, uint32_t now)
+{
+    if (!outbound.enqueue(from, &now, sizeof(now), millis(), REPLY_TAG_TIME)) {
+        console.println(F("...reply failed, outbound queue full"));
+    }
 }
 
-#define MSG_LEN 128
+/**
+ * @brief Queue the response to a join request: the node's address
+ * @note The reply is sent from loop(); see reply_done()
+ * @param to The node's address before it joined
+ * @param node The address it was given
+ * @param dev_eui Its DevEUI
+ */
+void send_join_response(uint8_t to, uint8_t node, uint64_t dev_eui)
+{
+    join_response_t jr;
+    build_join_response(&jr, node, dev_eui);
+
+    if (!outbound.enqueue(to, &jr, sizeof(join_response_t), millis())) {
+        console.println(F("...reply failed, outbound queue full"));
+    }
+}
 
 /**
- * @brief Send the response to a time request
- * @note Resets the rf95 manager's retransmissions counter
+ * @brief Queue the response to a time request
+ * @note The reply is sent from loop(); see reply_done()
  * @param to The node number
+ * @param now The time to send
  */
-void send_time_response(uint8_t to)
+void send_time_response(uint8_t to, uint32_t now)
 {
-    yield_spi_to_rf95();
-
     time_response_t tr;
-    build_time_response(&tr, MAIN_NODE_ADDRESS, DS3231.now().unixtime());
-
-    unsigned long start = millis();
-    if (rf95_manager.sendtoWait((uint8_t *)&tr, sizeof(time_response_t), to)) {
-        char msg[MSG_LEN];
-        snprintf(msg, MSG_LEN, "...sent a reply, %ld retransmissions, %ld ms", rf95_manager.retransmissions(), millis() - start);
-        Serial.println(msg);
-        Serial.flush();
-    } else {
-        char msg[MSG_LEN];
-        snprintf(msg, MSG_LEN, "...reply failed, %ld retransmissions, %ld ms", rf95_manager.retransmissions(), millis() - start);
-        Serial.println(msg);
-        Serial.flush();
+    build_time_response(&tr, MAIN_NODE_ADDRESS, now);
+
+    if (!outbound.enqueue(to, &tr, sizeof(time_response_t), millis(), REPLY_TAG_TIME)) {
+        console.println(F("...reply failed, outbound queue full"));
     }
+}
+
+#if REPLY
+/**
+ * @brief Send a node the time if its clock is off; see TimeSync.h
+ * @param node The node's registry entry, or null
+ * @param type The type of the node's frame. A legacy data packet is
+ * answered with the bare time, anything else with a time_response_t.
+ * @param node_time The time in the node's frame
+ * @param now Our time when the frame was received
+ * @param last_seen When the node was heard from before this frame; 0 if never
+ */
+void sync_node_time(node_state_t *node, MessageType type, uint32_t node_time, uint32_t now, uint32_t last_seen)
+{
+    if (!node)
+        return;
+
+    uint32_t next_s = last_seen && now > last_seen ? now - last_seen : 0;
+    if (!time_sync.check(*node, node_time, now, next_s))
+        return;
 
-    rf95_manager.resetRetransmissions();
+    console.print(F("Clock of node "));
+    console.print(node->address, DEC);
+    console.print(F(" is off by "));
+    console.print(node->clock_offset, DEC);
+    console.print(F(" s, sending the time; clocks set "));
+    console.print(time_sync.corrections(), DEC);
+    console.print(F(" times in "));
+    console.print(time_sync.checks(), DEC);
+    console.println(F(" messages"));
+
+    if (type == data_packet)
+        send_time_as_reply(node->address, now);
+    else
+        send_time_response(node->address, now);
 }
+#endif
 
-uint8_t rf95_buf[RH_RF95_MAX_MESSAGE_LEN];
+#if LINK_ADR
+/**
+ * @brief Record a frame's SNR and arrival and move the node to a faster
+ * spreading factor or lower power, or back, if its link calls for it;
+ * see LinkAdr.h
+ * @note Only for nodes that send data messages or batches; legacy
+ * packet_t nodes don't understand the command.
+ * @param node The node's registry entry, or null
+ * @param now When the frame was received (unixtime)
+ * @param last_seen When the node was heard from before this frame; 0 if never
+ */
+void adapt_link(node_state_t *node, uint32_t now, uint32_t last_seen)
+{
+    if (!node)
+        return;
 
-void loop() {
-    yield_spi_to_rf95();
+    link_adr.saw_uplink(*node, now, last_seen);
+    link_adr_command_t command;
+    if (!link_adr.check(*node, &command))
+        return;
 
-    if (rf95_manager.available()) {
-        status_on();
+    char msg[MSG_LEN];
+    TextSpan(msg, MSG_LEN).put("Link ADR: node ").put_uint(node->address).put(", SF")
+        .put_uint(link_adr.spreading_factor(*node)).put(", ").put_int(link_adr.tx_power(*node)).put(" dBm -> SF")
+        .put_uint(command.spreading_factor).put(", ").put_int(command.tx_power).put(" dBm");
+    console.println(msg);
 
-        Serial.println();
-        Serial.print(F("Current time: "));
-        DateTime t = DS3231.now();
-        Serial.println(iso8601_date_time(t));
+    if (!outbound.enqueue(node->address, &command, sizeof(command), millis(), REPLY_TAG_LINK_ADR)) {
+        console.println(F("...reply failed, outbound queue full"));
+        link_adr.confirm(*node, false);
+    }
+}
 
-        uint8_t len = sizeof(rf95_buf);
-        uint8_t from, to, id, header;
-        char msg[256];
-        if (rf95_manager.recvfromAck(rf95_buf, &len, &from, &to, &id, &header)) {
+/**
+ * @brief Listen at the spreading factor of the moved node whose frame
+ * is due, or at SPREADING_FACTOR; see LinkAdr.h
+ * @note The radio is left alone while a reply is on its way (it goes
+ * out at the node's spreading factor) or received frames wait to be read.
+ * @param now The time (unixtime)
+ */
+void service_link_adr(uint32_t now)
+{
+    static uint32_t checked = 0;
+    if (now == checked || !outbound.idle() || !rf95.queue().empty())
+        return;
 
-            if (len == sizeof(packet_t)) {  // Backward compatibility hack for packet_t
-                snprintf(msg, 256,
-                         "Received length: %d, from: 0x%02x, to: 0x%02x, id: 0x%02x, header: 0x%02x, type: %s",
-                         len, from, to, id, header, "data packet");
-            }
-            else {
-                snprintf(msg, 256,
-                         "Received length: %d, from: 0x%02x, to: 0x%02x, id: 0x%02x, header: 0x%02x, type: %s",
-                         len, from, to, id, header,
-                         get_message_type_string(get_message_type((char *) rf95_buf)));
+    checked = now;
+    uint8_t sf = link_adr.listen(nodes, now);
+    if (sf != listen_sf) {
+        rf95.setSpreadingFactor(sf);
+        listen_sf = sf;
+    }
+}
+#endif
 
-            }
+uint8_t rf95_buf[RH_RF95_MAX_MESSAGE_LEN];
 
-            Serial.println(msg);
-            Serial.flush();
+/**
+ * @brief Take a frame off the RX queue, if there is one, and handle it:
+ * print, log and display it and queue the replies
+ */
+void receive_frame() {
+    uint8_t len = sizeof(rf95_buf);
+    uint8_t from, to, id, header;
+    STAGE_START(frame_start);
+    STAGE_START(lap);
+    if (rf95_manager.recvfromAckAsync(rf95_buf, &len, &from, &to, &id, &header)) {
+        STAGE_LAP(lap, stage_receive);
+        status_on();
 
-            MessageType type = (len == sizeof(packet_t)) ? data_packet : get_message_type((char *)rf95_buf);
+        report_rx_queue();
 
-            switch (type) {
-                case data_packet: {             // Compatibility with the original packet_t
-                    // Print received packet
-                    Serial.print(F("Data: "));
-                    Serial.print(data_packet_to_string((packet_t *)rf95_buf, /* pretty */ true));
+        console.println();
+        // One timestamp for everything done with this packet: when the
+        // radio received it, which may be a while ago if frames queued up
+        DateTime t(time_service.now(rf95.last_rx_ms()));
 
-                    Serial.print(F(", "));
-                    print_rfm95_info();
+        console.print(F("Current time: "));
+        char date_time[ISO8601_CHARS];
+        console.println(iso8601_date_time(t.unixtime(), date_time));
 
-                    // log reading to the SD card
-                    const char *pretty_buf = data_packet_to_string((packet_t *)rf95_buf, false);
-                    log_data(FILE_NAME, pretty_buf);
+        // Decode the frame once; the sinks and the replies work from the record
+        static frame_record_t record;
+        bool decoded = decode_frame(rf95_buf, len, from, t.unixtime(), &record);
+        STAGE_LAP(lap, stage_render);
 
-#if REPLY
-                    send_time_as_reply(from);
-#endif
+        char msg[256];
+        TextSpan(msg, sizeof(msg)).put("Received length: ").put_uint(len).put(", from: 0x").put_hex(from, 2)
+            .put(", to: 0x").put_hex(to, 2).put(", id: 0x").put_hex(id, 2).put(", header: 0x").put_hex(header, 2)
+            .put(", type: ")
+            .put(record.batch ? "data batch"
+                              : record.type == data_packet ? "data packet" : get_message_type_string(record.type));
+        console.println(msg);
+        STAGE_LAP(lap, stage_serial);
+
+        const node_state_t *last = nodes.node(from);
+        uint32_t last_seen = last ? last->last_seen : 0;
+        node_state_t *node = nodes.saw_frame(from, t.unixtime(), rf95.lastRssi(), rf95.lastSNR());
+
+        if (!decoded) {
+            console.println(F("Malformed frame, dropped"));
+            frame_counts.malformed();
+            STAGE_LAP(frame_start, stage_frame);
+            status_off();
+            return;
+        }
 
-                    char text[DATA_LINE_CHARS];
-                    tft_get_data_line((packet_t *)rf95_buf, DS3231.now().minute(), DS3231.now().second(), text);
-                    tft_display_data_packet(text);
+        // A leaf node sends a message again when our ACK to it was lost.
+        // Drop the copy here, before it is logged or displayed. If the
+        // node's clock needed setting, that was done for the first copy.
+        for (uint8_t i = 0; i < record.count; ++i) {
+            if (nodes.saw_message(from, record.readings[i].message, record.readings[i].time))
+                continue;
+
+            record.fresh &= ~(1UL << i);
+            console.print(F("Duplicate: node: "));
+            console.print(from, DEC);
+            console.print(F(", message: "));
+            console.print(record.readings[i].message, DEC);
+            console.println(F(", dropped"));
+        }
+        // A batch is answered even if all of it was seen before
+        if (record.count && !record.fresh && !record.batch) {
+            STAGE_LAP(frame_start, stage_frame);
+            status_off();
+            return;
+        }
 
-                    break;
-                }
+        // Record the EUI and assign a byte node number before the join
+        // request is printed; a node that joined before gets its old number
+        if (record.type == join_request)
+            record.address = nodes.join(record.dev_eui, t.unixtime());
 
-                // This case depends on changes in soil_sensor_common on the message_changes branch
-                // jhrg 6/25/23
-                case data_message: {            // New data message with type indicator
-                    // Print received packet
-                    Serial.print(F("Data: "));
-                    Serial.print(data_message_to_string((data_message_t *)rf95_buf, /* pretty */ true));
+        pipeline.dispatch(record);
+        STAGE_SKIP(lap);
 
-                    Serial.print(F(", "));
-                    print_rfm95_info();
+        switch (record.type) {
+            case data_packet:
+            case data_message:
+#if REPLY
+                // A batch is answered as a data message is, with a time_response_t
+                sync_node_time(node, record.type, record.node_time, t.unixtime(), last_seen);
+#endif
+#if LINK_ADR
+                // Legacy packet_t nodes don't understand the command
+                if (record.type == data_message)
+                    adapt_link(node, t.unixtime(), last_seen);
+#endif
+                STAGE_LAP(lap, stage_reply);
+                break;
+
+            case join_request:
+                if (record.address)
+                    send_join_response(from, record.address, record.dev_eui);
+                break;
+
+            case time_request:
+                // Always answered; the node's offset is recorded first
+                if (node)
+                    time_sync.check(*node, record.node_time, t.unixtime(), 0);
+                send_time_response(from, t.unixtime());
+                STAGE_LAP(lap, stage_reply);
+                break;
+
+            default:
+                break;
+        }
 
-                    // log reading to the SD card, not pretty-printed
-                    const char *buf = data_message_to_string((data_message_t *)rf95_buf, false);
-                    log_data(FILE_NAME, buf);
-                    break;
-                }
+        STAGE_LAP(frame_start, stage_frame);
+        status_off();
+    }
+}
 
-                case text: {
-                    Serial.print(F("Got: "));
-                    // Add a null to the end of the packet and print as text
-                    //rf95_buf[len] = 0;
-                    Serial.println(text_message_to_string((text_t *)rf95_buf, true /*pretty*/));
+/**
+ * @brief Keep the clock, send the queued replies and handle a received frame
+ * @note A poll task; it runs on every pass of loop()
+ */
+bool radio_task() {
+    time_service.service(millis());
+    outbound.service(millis());
+#if LINK_ADR
+    service_link_adr(time_service.now(millis()));
+#endif
+    receive_frame();
+    return true;
+}
 
-                    Serial.print(F("RFM95 info: "));
-                    print_rfm95_info();
+/**
+ * @brief Read the host's commands and send it what was printed
+ * @note A poll task
+ */
+bool serial_task() {
+    read_serial_commands();
+    console.service();
+    return true;
+}
+
+/**
+ * @brief Blink the status LED, once a second, until the host opens the
+ * serial port or for SERIAL_WAIT_TIME; setup() used to wait for that
+ * with delay()
+ */
+bool status_led_task() {
+    static bool on = false;
+    if (Serial || millis() - serial_wait_start_ms >= SERIAL_WAIT_TIME) {
+        status_off();
+        scheduler.stop(status_led);
+        return true;
+    }
 
-                    log_data(FILE_NAME, text_message_to_string((text_t *)rf95_buf, false /*pretty*/));
-                    break;
-                }
- 
-                case join_request:
-                    // extract the EUI. Record it and assign a byte node number.
-                    break;
+    on = !on;
+    if (on)
+        status_on();
+    else
+        status_off();
+    return true;
+}
 
-                case time_request: {
-                    Serial.print(F("Time request: "));
-                    Serial.print(time_request_to_string((time_request_t *)rf95_buf, /* pretty */ true));
+// The radio comes first: the tasks that use the SD card or the display
+// don't run while frames are queued
 
-                    Serial.print(F(", "));
-                    print_rfm95_info();
+bool log_task() {
+    if (!rf95.queue().empty())
+        return false;
+#if LOG_ROTATE
+    rotate_log(time_service.now(millis()));
+#endif
+    service_log();
+    return true;
+}
 
-                    
+bool display_task() {
+    if (!rf95.queue().empty())
+        return false;
+    tft_refresh();
+    return true;
+}
 
-                    // log reading to the SD card, not pretty-printed
-                    const char *buf = time_request_to_string((time_request_t *)rf95_buf, false);
-                    log_data(FILE_NAME, buf);
-                    break;
-                }
+// Only moves the grid's clock; display_task() draws the ages that changed
+bool tft_age_task() {
+    tft_tick(time_service.now(millis()));
+    return true;
+}
 
+bool transfer_task() {
+    if (!rf95.queue().empty())
+        return false;
+#if LOG_ROTATE
+    if (log_transfer.read_pending() && (sd_logger.flushing() || index_logger.flushing()))
+        return false;
+#else
+    if (log_transfer.read_pending() && sd_logger.flushing())
+        return false;
+#endif
+    log_transfer.service(millis());
+    return true;
+}
 
-                default:
-                    Serial.println(F("Got unrecognized message."));
-            }
-        }
+bool nodes_task() {
+    if (!rf95.queue().empty())
+        return false;
+    return save_nodes();
+}
 
-        status_off();
-    }
+void loop() {
+    scheduler.service();
 }
@@ -0,0 +1,72 @@
+#ifndef MockGFX_h
+#define MockGFX_h
+
+#include <stdint.h>
+#include <string.h>
+
+// A stand-in for Adafruit_ST7735 that draws nothing but counts what the
+// real driver would send over SPI. The model follows Adafruit_SPITFT:
+// a filled rectangle or fast line is one address window (CASET, RASET,
+// RAMWR: 11 bytes) plus two bytes per pixel; text in the classic font
+// with no background color is drawn one pixel at a time, each with its
+// own address window. A 5x7 glyph lights about 15 pixels on average.
+
+#define MOCK_WIDTH 160
+#define MOCK_HEIGHT 128
+#define MOCK_WINDOW_BYTES 11
+#define MOCK_GLYPH_PIXELS 15
+#define MOCK_CHAR_WIDTH 6
+
+class MockGFX {
+    int16_t d_x = 0;
+    int16_t d_y = 0;
+
+    void window(uint32_t pixels) {
+        this->pixels += pixels;
+        spi_bytes += MOCK_WINDOW_BYTES + 2 * pixels;
+    }
+
+public:
+    uint32_t pixels = 0;
+    uint32_t spi_bytes = 0;
+    uint32_t full_screens = 0;
+
+    void reset_counts() {
+        pixels = spi_bytes = full_screens = 0;
+    }
+
+    int16_t width() const { return MOCK_WIDTH; }
+    int16_t height() const { return MOCK_HEIGHT; }
+
+    void fillScreen(uint16_t) {
+        ++full_screens;
+        window(MOCK_WIDTH * MOCK_HEIGHT);
+    }
+
+    void fillRect(int16_t, int16_t, int16_t w, int16_t h, uint16_t) {
+        window(w * h);
+    }
+
+    void drawFastHLine(int16_t, int16_t, int16_t w, uint16_t) {
+        window(w);
+    }
+
+    void setCursor(int16_t x, int16_t y) {
+        d_x = x;
+        d_y = y;
+    }
+
+    void setTextColor(uint16_t) {}
+    void setTextSize(uint8_t) {}
+
+    void print(const char *text) {
+        for (; *text && d_x < MOCK_WIDTH; ++text, d_x += MOCK_CHAR_WIDTH) {
+            if (*text == ' ')
+                continue;
+            pixels += MOCK_GLYPH_PIXELS;
+            spi_bytes += MOCK_GLYPH_PIXELS * (MOCK_WINDOW_BYTES + 2);
+        }
+    }
+};
+
+#endif
@@ -1,6 +1,11 @@
 #include <unity.h>
 
+#include <stdio.h>
+
+#include "MockGFX.h"
 #include "TFTDisplay.h"
+#include "TFTLogView.h"
+#include "TFTNodeGrid.h"
 #include "data_packet.h"
 
 // tft_get_data_line(const packet_t *data, unsigned int min, unsigned int sec, char text[DATA_LINE_CHARS])
@@ -21,10 +26,255 @@ void test_tft_get_data_line() {
     //TEST_ASSERT_EQUAL(join_request, get_message_type((void*)&jr));
 }
 
+#define TEST_LINE "4 38:35 20.4 29 4.16 0x00"
+
+void test_log_view_ring_order() {
+    MockGFX gfx;
+    TFTLogView<MockGFX> view(gfx);
+    char text[32];
+    for (int i = 0; i < 15; ++i) {
+        snprintf(text, sizeof(text), "line %d", i);
+        view.add_line(text);
+    }
+
+    TEST_ASSERT_EQUAL(TFT_LOG_LINES, view.count());
+    TEST_ASSERT_EQUAL_STRING("line 4", view.line(0));
+    TEST_ASSERT_EQUAL_STRING("line 14", view.line(TFT_LOG_LINES - 1));
+}
+
+// Bytes sent to the display for one packet once the screen is full
+uint32_t bytes_per_packet(bool incremental) {
+    MockGFX gfx;
+    TFTLogView<MockGFX> view(gfx, incremental);
+    view.draw_header();
+    for (int i = 0; i < 2 * TFT_LOG_LINES; ++i)
+        view.add_line(TEST_LINE);
+
+    gfx.reset_counts();
+    view.add_line(TEST_LINE);
+    return gfx.spi_bytes;
+}
+
+void test_incremental_sends_one_row() {
+    MockGFX gfx;
+    TFTLogView<MockGFX> view(gfx, true);
+    view.draw_header();
+    for (int i = 0; i < 2 * TFT_LOG_LINES; ++i)
+        view.add_line(TEST_LINE);
+
+    gfx.reset_counts();
+    view.add_line(TEST_LINE);
+    TEST_ASSERT_EQUAL(0, gfx.full_screens);
+    // One 10-pixel text row plus the two rules that mark the newest line
+    TEST_ASSERT_TRUE(gfx.pixels <= MOCK_WIDTH * 10 + 2 * MOCK_WIDTH + 26 * MOCK_GLYPH_PIXELS);
+    TEST_ASSERT_TRUE(gfx.pixels >= MOCK_WIDTH * 10 + 2 * (MOCK_WIDTH - 4));
+
+    uint32_t full = bytes_per_packet(false);
+    uint32_t incremental = bytes_per_packet(true);
+    printf("TFT SPI bytes per packet: full redraw %u, incremental %u\n", full, incremental);
+    TEST_ASSERT_TRUE(incremental * 5 < full);
+}
+
+// Queued lines are drawn by refresh(), one a call; a burst longer than
+// the screen draws only the lines that are still on it
+void test_queued_lines_draw_later() {
+    MockGFX gfx;
+    TFTLogView<MockGFX> view(gfx, true);
+    char text[32];
+    for (int i = 0; i < 15; ++i) {
+        snprintf(text, sizeof(text), "line %d", i);
+        view.queue_line(text);
+    }
+    TEST_ASSERT_EQUAL(0, gfx.spi_bytes);
+    TEST_ASSERT_EQUAL(TFT_LOG_LINES, view.pending());
+    TEST_ASSERT_EQUAL_STRING("line 14", view.line(TFT_LOG_LINES - 1));
+
+    int refreshes = 0;
+    while (view.refresh())
+        ++refreshes;
+    TEST_ASSERT_EQUAL(TFT_LOG_LINES, refreshes);
+    TEST_ASSERT_EQUAL(0, view.pending());
+    TEST_ASSERT_EQUAL(0, gfx.full_screens);
+
+    // Then one line costs what add_line() does
+    view.queue_line(TEST_LINE);
+    gfx.reset_counts();
+    TEST_ASSERT_TRUE(view.refresh());
+    TEST_ASSERT_FALSE(view.refresh());
+    TEST_ASSERT_EQUAL(bytes_per_packet(true), gfx.spi_bytes);
+}
+
+// Record the most bytes sent to the display in one hold of the bus and
+// the bytes sent without holding it
+static MockGFX *held_gfx = 0;
+struct CountingBusLock {
+    static uint32_t start;
+    static uint32_t worst;
+    static uint32_t outside;
+    static uint32_t released;
+    static void lock() {
+        outside += held_gfx->spi_bytes - released;
+        start = held_gfx->spi_bytes;
+    }
+    static void unlock() {
+        if (held_gfx->spi_bytes - start > worst)
+            worst = held_gfx->spi_bytes - start;
+        released = held_gfx->spi_bytes;
+    }
+};
+
+uint32_t CountingBusLock::start = 0;
+uint32_t CountingBusLock::worst = 0;
+uint32_t CountingBusLock::outside = 0;
+uint32_t CountingBusLock::released = 0;
+
+void test_bus_holds_are_bounded() {
+    MockGFX gfx;
+    held_gfx = &gfx;
+    TFTLogView<MockGFX, CountingBusLock> view(gfx, false);
+    for (int i = 0; i < 2 * TFT_LOG_LINES; ++i)
+        view.add_line(TEST_LINE);
+    view.redraw();
+    CountingBusLock::outside += gfx.spi_bytes - CountingBusLock::released;
+
+    printf("TFT longest bus hold: %u bytes\n", CountingBusLock::worst);
+    TEST_ASSERT_EQUAL(0, CountingBusLock::outside);
+    // A band of the screen, not the whole screen
+    TEST_ASSERT_TRUE(CountingBusLock::worst <= MOCK_WINDOW_BYTES + 2 * MOCK_WIDTH * TFT_CHUNK_ROWS);
+    TEST_ASSERT_TRUE(CountingBusLock::worst < 2 * MOCK_WIDTH * MOCK_HEIGHT / 4);
+    TEST_ASSERT_EQUAL(0, gfx.full_screens);
+}
+
+#define T0 1615909112UL
+
+typedef TFTNodeGrid<MockGFX> Grid;
+
+// The most bytes a grid cell 'chars' wide costs: its rectangle and a
+// glyph in every character
+static uint32_t cell_bytes(uint32_t chars) {
+    return MOCK_WINDOW_BYTES + 2 * chars * TFT_GRID_CHAR_WIDTH * TFT_GRID_CHAR_HEIGHT +
+           chars * MOCK_GLYPH_PIXELS * (MOCK_WINDOW_BYTES + 2);
+}
+
+static void grid_packet(Grid &grid, uint8_t node, uint32_t when, int16_t temp, int16_t rssi = -52) {
+    grid.heard(node, when, rssi);
+    grid.reading(node, temp, 2962, 416);
+}
+
+static void draw_all(Grid &grid) {
+    while (grid.refresh())
+        ;
+}
+
+void test_grid_rows() {
+    MockGFX gfx;
+    Grid grid(gfx);
+    grid.redraw();
+    grid_packet(grid, 4, T0, 2043);
+    grid.heard(12, T0 - 7200, -110);    // known, but no reading since boot
+    draw_all(grid);
+
+    TEST_ASSERT_EQUAL(2, grid.rows());
+    const char *row0[] = {"4", "0s", "20.4", "29", "4.16", "52"};
+    for (uint8_t c = 0; c < TFT_GRID_CELLS; ++c)
+        TEST_ASSERT_EQUAL_STRING(row0[c], grid.cell_text(0, c));
+    TEST_ASSERT_EQUAL_STRING("2h", grid.cell_text(1, 1));
+    TEST_ASSERT_EQUAL_STRING("", grid.cell_text(1, 2));
+    TEST_ASSERT_EQUAL_STRING("110", grid.cell_text(1, 5));
+    TEST_ASSERT_EQUAL(0, gfx.full_screens);
+}
+
+// A new packet with only a new temperature repaints the temperature
+// cell and nothing else
+void test_grid_repaints_changed_cells() {
+    MockGFX gfx;
+    Grid grid(gfx);
+    grid.redraw();
+    for (uint8_t node = 1; node <= TFT_GRID_ROWS; ++node)
+        grid_packet(grid, node, T0, 2043);
+    draw_all(grid);
+
+    gfx.reset_counts();
+    grid_packet(grid, 4, T0, 2043);
+    draw_all(grid);
+    TEST_ASSERT_EQUAL(0, gfx.spi_bytes);
+
+    grid_packet(grid, 4, T0, 2051);
+    TEST_ASSERT_EQUAL(0, gfx.spi_bytes);    // nothing is drawn on the frame path
+    TEST_ASSERT_TRUE(grid.refresh());
+    TEST_ASSERT_FALSE(grid.refresh());
+    TEST_ASSERT_EQUAL_STRING("20.5", grid.cell_text(3, 2));
+    TEST_ASSERT_EQUAL(MOCK_WINDOW_BYTES + 2 * 5 * TFT_GRID_CHAR_WIDTH * TFT_GRID_CHAR_HEIGHT +
+                          4 * MOCK_GLYPH_PIXELS * (MOCK_WINDOW_BYTES + 2),
+                      gfx.spi_bytes);
+
+    // The worst packet changes every cell but the address
+    gfx.reset_counts();
+    grid_packet(grid, 4, T0 + 600, -1234, -120);
+    grid.reading(4, -1234, 10000, 999);
+    draw_all(grid);
+    uint32_t bound = cell_bytes(3) + cell_bytes(5) + cell_bytes(3) + cell_bytes(4) + cell_bytes(3);
+    uint32_t full_row = MOCK_WINDOW_BYTES + 2 * MOCK_WIDTH * 10 + 26 * MOCK_GLYPH_PIXELS * (MOCK_WINDOW_BYTES + 2);
+    printf("TFT grid SPI bytes per packet: %u (bound %u), a full row %u\n", gfx.spi_bytes, bound, full_row);
+    TEST_ASSERT_LESS_OR_EQUAL(bound, gfx.spi_bytes);
+    TEST_ASSERT_LESS_THAN(full_row, gfx.spi_bytes);
+}
+
+// Ages are repainted when their text changes, not on every tick
+void test_grid_age_ticks() {
+    MockGFX gfx;
+    Grid grid(gfx);
+    grid.redraw();
+    grid_packet(grid, 4, T0, 2043);
+    grid_packet(grid, 5, T0 - 3 * 3600, 2043);
+    draw_all(grid);
+
+    gfx.reset_counts();
+    grid.tick(T0 + 5);
+    draw_all(grid);
+    TEST_ASSERT_EQUAL_STRING("5s", grid.cell_text(0, 1));
+    TEST_ASSERT_EQUAL_STRING("3h", grid.cell_text(1, 1));
+    TEST_ASSERT_LESS_OR_EQUAL(cell_bytes(3), gfx.spi_bytes);
+
+    // Once a node's age is in minutes most ticks draw nothing
+    grid.tick(T0 + 125);
+    draw_all(grid);
+    TEST_ASSERT_EQUAL_STRING("2m", grid.cell_text(0, 1));
+    gfx.reset_counts();
+    grid.tick(T0 + 130);
+    draw_all(grid);
+    TEST_ASSERT_EQUAL(0, gfx.spi_bytes);
+}
+
+// A twelfth node takes the row of the node heard least recently
+void test_grid_full() {
+    MockGFX gfx;
+    Grid grid(gfx);
+    grid.redraw();
+    for (uint8_t node = 1; node <= TFT_GRID_ROWS; ++node)
+        grid_packet(grid, node, T0 + (node == 3 ? 0 : node), 2043);
+    draw_all(grid);
+
+    grid_packet(grid, 200, T0 + 20, 1800);
+    draw_all(grid);
+    TEST_ASSERT_EQUAL(TFT_GRID_ROWS, grid.rows());
+    TEST_ASSERT_EQUAL_STRING("200", grid.cell_text(2, 0));
+    TEST_ASSERT_EQUAL_STRING("18.0", grid.cell_text(2, 2));
+    TEST_ASSERT_EQUAL_STRING("1", grid.cell_text(0, 0));
+}
+
 int main( int argc, char **argv) {
     UNITY_BEGIN();
 
     RUN_TEST(test_tft_get_data_line);
+    RUN_TEST(test_log_view_ring_order);
+    RUN_TEST(test_incremental_sends_one_row);
+    RUN_TEST(test_queued_lines_draw_later);
+    RUN_TEST(test_bus_holds_are_bounded);
+    RUN_TEST(test_grid_rows);
+    RUN_TEST(test_grid_repaints_changed_cells);
+    RUN_TEST(test_grid_age_ticks);
+    RUN_TEST(test_grid_full);
    
     UNITY_END();
 }
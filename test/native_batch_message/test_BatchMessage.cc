@@ -0,0 +1,149 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BatchMessage.h"
+#include "LoRaAirtime.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define NOW 1615909112UL
+
+// Readings every five minutes that drift the way the soil sensors' do
+static void make_readings(batch_reading_t *r, uint8_t count, unsigned seed) {
+    srand(seed);
+    for (uint8_t i = 0; i < count; ++i) {
+        r[i].message = 1000 + i;
+        r[i].time = NOW - 300 * (count - i) + rand() % 3;
+        r[i].battery = 416 - i / 8;
+        r[i].last_tx_duration = 370 + rand() % 20;
+        r[i].temp = 2043 - 3 * i + rand() % 5;
+        r[i].humidity = 2962 + rand() % 40;
+        r[i].status = i == 5 ? 0x20 : 0;
+    }
+}
+
+static bool same(const batch_reading_t &a, const batch_reading_t &b) {
+    return a.message == b.message && a.time == b.time && a.battery == b.battery
+           && a.last_tx_duration == b.last_tx_duration && a.temp == b.temp && a.humidity == b.humidity
+           && a.status == b.status;
+}
+
+void test_round_trip() {
+    for (uint8_t count = 1; count <= BATCH_MAX_READINGS; ++count) {
+        batch_reading_t in[BATCH_MAX_READINGS];
+        make_readings(in, count, count);
+        uint8_t buf[BATCH_MAX_SIZE];
+        uint8_t len = encode_batch(4, NOW, in, count, buf, sizeof(buf));
+        TEST_ASSERT_TRUE(len > sizeof(packet_t));
+        TEST_ASSERT_TRUE(is_batch_message(buf, len));
+
+        batch_reading_t out[BATCH_MAX_READINGS];
+        uint8_t node, n;
+        uint32_t now;
+        TEST_ASSERT_TRUE(decode_batch(buf, len, &node, &now, out, &n));
+        TEST_ASSERT_EQUAL(4, node);
+        TEST_ASSERT_EQUAL(NOW, now);
+        TEST_ASSERT_EQUAL(count, n);
+        for (uint8_t i = 0; i < count; ++i)
+            TEST_ASSERT_TRUE(same(in[i], out[i]));
+    }
+}
+
+// Deltas of any size, both ways, and the extremes of each field
+void test_extremes() {
+    batch_reading_t in[4];
+    memset(in, 0, sizeof(in));
+    for (int i = 0; i < 4; ++i)
+        in[i].message = 0xfffffffe + i;     // the message number wraps
+    in[0].temp = -32768;
+    in[1].temp = 32767;
+    in[2].temp = 0;
+    in[0].battery = 65535;
+    in[1].humidity = 65535;
+    in[3].last_tx_duration = 65535;
+    in[3].status = 0xff;
+    in[1].time = 0;
+    in[2].time = 4000000000UL;
+    in[3].time = 4000000000UL;
+
+    uint8_t buf[BATCH_MAX_SIZE];
+    uint8_t len = encode_batch(200, 4000000100UL, in, 4, buf, sizeof(buf));
+    TEST_ASSERT_TRUE(len > 0);
+
+    batch_reading_t out[BATCH_MAX_READINGS];
+    uint8_t node, n;
+    uint32_t now;
+    TEST_ASSERT_TRUE(decode_batch(buf, len, &node, &now, out, &n));
+    TEST_ASSERT_EQUAL(4, n);
+    for (uint8_t i = 0; i < 4; ++i)
+        TEST_ASSERT_TRUE(same(in[i], out[i]));
+}
+
+void test_rejects() {
+    batch_reading_t in[BATCH_MAX_READINGS];
+    make_readings(in, 8, 1);
+    uint8_t buf[BATCH_MAX_SIZE];
+
+    // Readings the encoder won't take
+    TEST_ASSERT_EQUAL(0, encode_batch(4, NOW, in, 0, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, encode_batch(4, in[7].time - 1, in, 8, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, encode_batch(4, NOW, in, 8, buf, 20));         // too small
+    batch_reading_t gap[2] = {in[0], in[2]};
+    TEST_ASSERT_EQUAL(0, encode_batch(4, NOW, gap, 2, buf, sizeof(buf)));
+    batch_reading_t back[2] = {in[1], in[0]};
+    back[1].message = back[0].message + 1;
+    TEST_ASSERT_EQUAL(0, encode_batch(4, NOW, back, 2, buf, sizeof(buf)));
+
+    // Frames the decoder won't take
+    uint8_t len = encode_batch(4, NOW, in, 8, buf, sizeof(buf));
+    batch_reading_t out[BATCH_MAX_READINGS];
+    uint8_t node, n;
+    uint32_t now;
+    for (uint8_t cut = 0; cut < len; ++cut)
+        TEST_ASSERT_FALSE(decode_batch(buf, cut, &node, &now, out, &n));
+    buf[len] = 7;
+    TEST_ASSERT_FALSE(decode_batch(buf, len + 1, &node, &now, out, &n));
+    buf[2] = 0;
+    TEST_ASSERT_FALSE(decode_batch(buf, len, &node, &now, out, &n));
+    buf[2] = BATCH_MAX_READINGS + 1;
+    TEST_ASSERT_FALSE(decode_batch(buf, len, &node, &now, out, &n));
+}
+
+// Airtime per reading at the main node's settings, SF10/125kHz/4:5,
+// for a packet_t, a data_message_t and batches of 2 to 32 readings
+void test_airtime_per_reading() {
+    lora_settings_t s = lora_settings(10, 125000, 5);
+    uint32_t packet_us = lora_airtime_us(s, sizeof(packet_t) + LORA_RH_HEADER_LEN);
+    uint32_t message_us = lora_airtime_us(s, sizeof(data_message_t) + LORA_RH_HEADER_LEN);
+    printf("Airtime per reading at SF10/125kHz: packet_t (%u bytes) %.1f ms, data_message_t (%u bytes) %.1f ms\n",
+           (unsigned)sizeof(packet_t), packet_us / 1e3, (unsigned)sizeof(data_message_t), message_us / 1e3);
+
+    uint32_t last = packet_us;
+    const uint8_t counts[] = {2, 4, 8, 16, 32};
+    for (size_t c = 0; c < sizeof(counts); ++c) {
+        batch_reading_t in[BATCH_MAX_READINGS];
+        make_readings(in, counts[c], 1);
+        uint8_t buf[BATCH_MAX_SIZE];
+        uint8_t len = encode_batch(4, NOW, in, counts[c], buf, sizeof(buf));
+        uint32_t us = lora_airtime_us(s, len + LORA_RH_HEADER_LEN) / counts[c];
+        printf("    batch of %2u: %3u bytes, %.1f ms a reading (%.0f%% of packet_t)\n", counts[c], len, us / 1e3,
+               100.0 * us / packet_us);
+        TEST_ASSERT_TRUE(us < last);
+        last = us;
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_extremes);
+    RUN_TEST(test_rejects);
+    RUN_TEST(test_airtime_per_reading);
+
+    UNITY_END();
+}
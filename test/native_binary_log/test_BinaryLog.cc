@@ -0,0 +1,238 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "BinaryLog.h"
+#include "BinaryLogDecoder.h"
+#include "CRC32.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define BENCH_RECORDS 200000
+
+void test_crc32_check_value() {
+    TEST_ASSERT_EQUAL_UINT32(0xcbf43926, crc32_update(0, "123456789", 9));
+    uint32_t crc = crc32_update(0, "1234", 4);
+    TEST_ASSERT_EQUAL_UINT32(0xcbf43926, crc32_update(crc, "56789", 5));
+}
+
+// Encode 'n' data packets into blocks appended to 'out'
+void encode_packets(int n, std::vector<uint8_t> &out) {
+    BinaryLogEncoder encoder;
+    packet_t data;
+    log_record_t rec;
+    for (int i = 0; i < n; ++i) {
+        build_data_packet(&data, 4, i, 1615887488 + i, 416, 0, 2043, 2962, 0);
+        build_log_record(&rec, 1615909112 + i, -52, 11, data_packet, 4, &data, sizeof(data));
+        if (!encoder.add(&rec, i)) {
+            const uint8_t *block = (const uint8_t *)encoder.finish();
+            out.insert(out.end(), block, block + LOG_BLOCK_SIZE);
+            encoder.reset();
+            encoder.add(&rec, i);
+        }
+    }
+    if (!encoder.empty()) {
+        const uint8_t *block = (const uint8_t *)encoder.finish();
+        out.insert(out.end(), block, block + LOG_BLOCK_SIZE);
+    }
+}
+
+struct collect_t {
+    std::vector<log_record_t> records;
+};
+
+void collect(const log_record_t *rec, void *context) {
+    ((collect_t *)context)->records.push_back(*rec);
+}
+
+void count(const log_record_t *rec, void *context) {
+    *(uint32_t *)context += rec->len;
+}
+
+void test_block_layout() {
+    TEST_ASSERT_EQUAL(512, sizeof(log_block_t));
+    TEST_ASSERT_TRUE(sizeof(packet_t) <= LOG_RECORD_MAX_PAYLOAD);
+
+    // At least as many data packets to a block as version 1's fixed records held
+    int n = LOG_BLOCK_DATA / (LOG_RECORD_HEADER_SIZE + sizeof(packet_t));
+    TEST_ASSERT_TRUE(n >= LOG_V1_RECORDS_PER_BLOCK);
+    std::vector<uint8_t> file;
+    encode_packets(n, file);
+    TEST_ASSERT_EQUAL(LOG_BLOCK_SIZE, file.size());
+    TEST_ASSERT_EQUAL(n, ((const log_block_t *)file.data())->count);
+    encode_packets(n + 1, file);
+    TEST_ASSERT_EQUAL(3 * LOG_BLOCK_SIZE, file.size());
+}
+
+void test_round_trip_reproduces_csv() {
+    std::vector<uint8_t> file;
+    encode_packets(40, file);
+    TEST_ASSERT_EQUAL(3 * LOG_BLOCK_SIZE, file.size());
+
+    collect_t c;
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    TEST_ASSERT_EQUAL(file.size(), decode_log_blocks(file.data(), file.size(), collect, &c, &stats));
+    TEST_ASSERT_EQUAL(40, stats.records);
+    TEST_ASSERT_EQUAL(3, stats.blocks);
+    TEST_ASSERT_EQUAL(0, stats.sequence_gaps);
+
+    packet_t data;
+    build_data_packet(&data, 4, 7, 1615887488 + 7, 416, 0, 2043, 2962, 0);
+    char expected[256];
+    snprintf(expected, sizeof(expected), "%s", data_packet_to_string(&data, false));
+    TEST_ASSERT_EQUAL_STRING(expected, log_record_to_string(&c.records[7], false));
+
+    const char *extra = log_record_to_string(&c.records[7], true);
+    TEST_ASSERT_TRUE(strncmp(extra, "1615909119, -52, 11, ", 21) == 0);
+}
+
+void test_bad_block_is_skipped() {
+    std::vector<uint8_t> file;
+    encode_packets(45, file);
+    file[LOG_BLOCK_SIZE + 100] ^= 0xff; // corrupt a record in block 2
+
+    collect_t c;
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    decode_log_blocks(file.data(), file.size(), collect, &c, &stats);
+    TEST_ASSERT_EQUAL(1, stats.bad_blocks);
+    TEST_ASSERT_EQUAL(45 - ((const log_block_t *)&file[LOG_BLOCK_SIZE])->count, stats.records);
+    TEST_ASSERT_EQUAL(1, stats.sequence_gaps);
+}
+
+// Text and join requests are logged whole and decode as the text log has them
+void test_text_and_join_round_trip() {
+    text_t t;
+    memset(&t, 0, sizeof(t));
+    t.type = text;
+    const char *words = "a text message longer than version 1's twenty-one bytes";
+    t.len = strlen(words);
+    memcpy(t.text, words, t.len);
+    join_request_t jr;
+    build_join_request(&jr, 0x0123456789abcdefULL);
+
+    BinaryLogEncoder encoder;
+    log_record_t rec;
+    build_log_record(&rec, 1615909112, -52, 11, text, 4, &t, sizeof(t));
+    TEST_ASSERT_EQUAL(sizeof(t), rec.len);
+    TEST_ASSERT_FALSE(rec.flags & LOG_RECORD_TRUNCATED);
+    TEST_ASSERT_TRUE(encoder.add(&rec, 0));
+    build_log_record(&rec, 1615909113, -52, 11, join_request, 0, &jr, sizeof(jr));
+    TEST_ASSERT_TRUE(encoder.add(&rec, 0));
+    const log_block_t *block = encoder.finish();
+
+    collect_t c;
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    decode_log_blocks((const uint8_t *)block, LOG_BLOCK_SIZE, collect, &c, &stats);
+    TEST_ASSERT_EQUAL(2, stats.records);
+
+    char expected[256];
+    snprintf(expected, sizeof(expected), "%s", text_message_to_string(&t, false));
+    TEST_ASSERT_EQUAL_STRING(expected, log_record_to_string(&c.records[0], false));
+    snprintf(expected, sizeof(expected), "%s", join_request_to_string(&jr, false));
+    TEST_ASSERT_EQUAL_STRING(expected, log_record_to_string(&c.records[1], false));
+}
+
+void test_long_frame_truncated() {
+    uint8_t frame[LOG_RECORD_MAX_PAYLOAD + 12];
+    memset(frame, 'x', sizeof(frame));
+    log_record_t rec;
+    build_log_record(&rec, 0, 0, 0, text, 2, frame, sizeof(frame));
+    TEST_ASSERT_EQUAL(LOG_RECORD_MAX_PAYLOAD, rec.len);
+    TEST_ASSERT_TRUE(rec.flags & LOG_RECORD_TRUNCATED);
+
+    // The longest record fits in an empty block, but there is not room for two
+    BinaryLogEncoder encoder;
+    TEST_ASSERT_TRUE(encoder.add(&rec, 0));
+    TEST_ASSERT_FALSE(encoder.full());
+    TEST_ASSERT_FALSE(encoder.add(&rec, 0));
+}
+
+// A block written before records were variable length
+void test_version_1_block() {
+    log_block_t block;
+    memset(&block, 0, sizeof(block));
+    block.magic = LOG_BLOCK_MAGIC;
+    block.version = 1;
+    block.record_size = LOG_V1_RECORD_SIZE;
+    block.count = 2;
+    packet_t data;
+    for (uint8_t i = 0; i < 2; ++i) {
+        build_data_packet(&data, 4, i, 1615887488 + i, 416, 0, 2043, 2962, 0);
+        log_record_t rec;
+        build_log_record(&rec, 1615909112 + i, -52, 11, data_packet, 4, &data, sizeof(data));
+        log_record_encode(&rec, block.records + i * LOG_V1_RECORD_SIZE);
+    }
+    block.crc = log_block_crc(&block);
+
+    collect_t c;
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    decode_log_blocks((const uint8_t *)&block, LOG_BLOCK_SIZE, collect, &c, &stats);
+    TEST_ASSERT_EQUAL(0, stats.bad_blocks);
+    TEST_ASSERT_EQUAL(2, c.records.size());
+    char expected[256];
+    snprintf(expected, sizeof(expected), "%s", data_packet_to_string(&data, false));
+    TEST_ASSERT_EQUAL_STRING(expected, log_record_to_string(&c.records[1], false));
+}
+
+void benchmark_encode_decode() {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<uint8_t> file;
+    file.reserve((BENCH_RECORDS / LOG_V1_RECORDS_PER_BLOCK + 1) * LOG_BLOCK_SIZE);
+    auto start = clock::now();
+    encode_packets(BENCH_RECORDS, file);
+    double encode_s = std::chrono::duration<double>(clock::now() - start).count();
+
+    uint32_t bytes = 0;
+    log_decode_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    start = clock::now();
+    decode_log_blocks(file.data(), file.size(), count, &bytes, &stats);
+    double decode_s = std::chrono::duration<double>(clock::now() - start).count();
+
+    // What the text log costs: render each packet the way log_data() did
+    packet_t data;
+    size_t text_bytes = 0;
+    start = clock::now();
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        build_data_packet(&data, 4, i, 1615887488 + i, 416, 0, 2043, 2962, 0);
+        text_bytes += strlen(data_packet_to_string(&data, false)) + 2;
+    }
+    double text_s = std::chrono::duration<double>(clock::now() - start).count();
+
+    printf("Binary log, %d records\n", BENCH_RECORDS);
+    printf("    encode: %8.1f ns/record, %7.1f MB/s of blocks\n", 1e9 * encode_s / BENCH_RECORDS,
+           file.size() / encode_s / 1e6);
+    printf("    decode: %8.1f ns/record, %7.1f MB/s of blocks\n", 1e9 * decode_s / BENCH_RECORDS,
+           file.size() / decode_s / 1e6);
+    printf("    text:   %8.1f ns/record (data_packet_to_string)\n", 1e9 * text_s / BENCH_RECORDS);
+    printf("    bytes/record: binary %.1f, text %.1f\n", (double)file.size() / BENCH_RECORDS,
+           (double)text_bytes / BENCH_RECORDS);
+
+    TEST_ASSERT_EQUAL(BENCH_RECORDS, stats.records);
+    TEST_ASSERT_EQUAL(0, stats.bad_blocks);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_crc32_check_value);
+    RUN_TEST(test_block_layout);
+    RUN_TEST(test_round_trip_reproduces_csv);
+    RUN_TEST(test_bad_block_is_skipped);
+    RUN_TEST(test_text_and_join_round_trip);
+    RUN_TEST(test_long_frame_truncated);
+    RUN_TEST(test_version_1_block);
+    RUN_TEST(benchmark_encode_decode);
+
+    UNITY_END();
+}
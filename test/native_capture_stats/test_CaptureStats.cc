@@ -0,0 +1,160 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "CaptureStats.h"
+
+// Lines in the format of test_data_no_ant.csv
+static const char *capture =
+    "1615909112.642242,\n"
+    "1615909112.6453362,Current time: 2021-03-16T09:38:35\n"
+    "1615909112.6478689,\"Received length: 20, from: 0x04, to: 0xff, id: 0x01, header: 0x00\"\n"
+    "1615909112.661931,\"Data: node: 4, message: 1, time: 1615887488, Vbat 416 v, Tx dur 0 ms, T: 2043 C, RH: 2962 %, "
+    "status: 0x00, RSSI -52 dBm, SNR 11 dB, good/bad packets: 1/0\"\n"
+    "1615909113.193884,\"...sent a reply, 0 retransmissions, 539 ms\"\n"
+    "1615909120.5,\"Received length: 20, from: 0x04, to: 0xff, id: 0x02, header: 0x00\"\n"
+    "1615909120.51,\"Data: node: 4, message: 4, time: 1615887500, Vbat 416 v, Tx dur 0 ms, T: 1864 C, RH: 3365 %, "
+    "status: 0x20, RSSI -60 dBm, SNR -3 dB, good/bad packets: 2/0\"\n"
+    "1615909120.6,\"...reply failed, 3 retransmissions, 1650 ms, to: 0x04\"\n"
+    "1615909121.0,User exception (panic/abort/assert\n"
+    "1615909121.0,>>>stack>>>\n"
+    "1615909121.0,3ffffca0:  3ffe8020 00000000 00000010 4023f794  \n"
+    "1615909121.0,<<<stack<<<\n"
+    "1615909121.1,\" ets Jan  8 2013,rst cause:2, boot mode:(3,0)\"\n"
+    "1615909121.2,boot\n"
+    "1615909130.0,\"Received length: 15, from: 0x03, to: 0xff, id: 0x07, header: 0x00\"\n"
+    "1615909130.0,\"Got: 3: t:19434, o:20\"\n"
+    "1615909130.0,\"RFM95 info: RSSI -70 dBm, SNR 9 dB, good/bad packets: 3/0\"\n"
+    "1615909136.5,\"Received length: 20, from: 0x04, to: 0xff, id: 0x03, header: 0x00\"\n"
+    "1615909136.51,\"Data: node: 4, message: 4, time: 1615887510, Vbat 416 v, Tx dur 0 ms, T: 1864 C, RH: 3365 %, "
+    "status: 0x20, RSSI -61 dBm, SNR 8 dB, good/bad packets: 4/0\"\n"
+    "1615909137.0,\"...sent a reply, 1 retransmissions, 1100 ms, to: 0x04\"\n"
+    "1615909140.5,\"Received length: 20, from: 0x04, to: 0xff, id: 0x05, header: 0x00\"\n"
+    "1615909140.5,\"Duplicate: node: 4, message: 4, dropped\"\n"
+    "1615909152.5,\"Received length: 20, from: 0x04, to: 0xff, id: 0x04, header: 0x00\"\n"
+    "1615909152.51,\"Data: node: 4, message: 1, time: 1615887520, Vbat 416 v, Tx dur 0 ms, T: 1864 C, RH: 3365 %, "
+    "status: 0x20, RSSI -62 dBm, SNR 8 dB, good/bad packets: 5/0\"\n";
+
+void test_parse_capture() {
+    CaptureStats stats;
+    stats.add_lines(capture, strlen(capture));
+
+    TEST_ASSERT_EQUAL(24, stats.lines());
+    TEST_ASSERT_EQUAL(1, stats.boots());
+    TEST_ASSERT_EQUAL(1, stats.crashes());
+    TEST_ASSERT_EQUAL(1, stats.reset_cause(2));
+
+    const node_link_stats_t &n4 = stats.node(4);
+    TEST_ASSERT_EQUAL(5, n4.frames);
+    TEST_ASSERT_EQUAL(4, n4.messages);
+    TEST_ASSERT_EQUAL(2, n4.lost);          // 1 -> 4
+    TEST_ASSERT_EQUAL(2, n4.duplicates);    // 4 -> 4 and the Duplicate line
+    TEST_ASSERT_EQUAL(1, n4.restarts);      // 4 -> 1
+    TEST_ASSERT_EQUAL(2, n4.replies);
+    TEST_ASSERT_EQUAL(1, n4.reply_failures);
+    TEST_ASSERT_EQUAL(1, n4.rssi[-52 - RSSI_MIN_DBM]);
+    TEST_ASSERT_EQUAL(1, n4.snr[-3 - SNR_MIN_DB]);
+    TEST_ASSERT_EQUAL(1, n4.latency[539 / LATENCY_BIN_MS]);
+    TEST_ASSERT_EQUAL(1, n4.latency[1100 / LATENCY_BIN_MS]);
+    TEST_ASSERT_EQUAL(1, n4.retrans[0]);
+    TEST_ASSERT_EQUAL(1, n4.retrans[1]);
+    TEST_ASSERT_EQUAL(1, n4.retrans[3]);
+    // Gaps of 7.9 and 4 (4 to 8 s), 12 (8 to 16 s) and 16 s (16 to 32 s)
+    TEST_ASSERT_EQUAL(2, n4.gaps[3]);
+    TEST_ASSERT_EQUAL(1, n4.gaps[4]);
+    TEST_ASSERT_EQUAL(1, n4.gaps[5]);
+
+    // A text message: a frame and a signal report but no counter
+    const node_link_stats_t &n3 = stats.node(3);
+    TEST_ASSERT_EQUAL(1, n3.frames);
+    TEST_ASSERT_EQUAL(0, n3.messages);
+    TEST_ASSERT_EQUAL(1, n3.rssi[-70 - RSSI_MIN_DBM]);
+
+    TEST_ASSERT_EQUAL(0, stats.unattributed().messages);
+}
+
+static bool same_node(const node_link_stats_t &a, const node_link_stats_t &b) {
+    return a.frames == b.frames && a.messages == b.messages && a.lost == b.lost && a.duplicates == b.duplicates &&
+           a.restarts == b.restarts && a.replies == b.replies && a.reply_failures == b.reply_failures &&
+           memcmp(a.rssi, b.rssi, sizeof(a.rssi)) == 0 && memcmp(a.snr, b.snr, sizeof(a.snr)) == 0 &&
+           memcmp(a.latency, b.latency, sizeof(a.latency)) == 0 &&
+           memcmp(a.retrans, b.retrans, sizeof(a.retrans)) == 0 && memcmp(a.gaps, b.gaps, sizeof(a.gaps)) == 0;
+}
+
+// Splitting the capture into pieces at any line and merging the pieces
+// gives the same answer as one pass, including for the Data and reply
+// lines that end up at the start of a piece, apart from their Received line
+void test_split_and_merge() {
+    static CaptureStats whole;
+    whole.clear();
+    whole.add_lines(capture, strlen(capture));
+
+    size_t len = strlen(capture);
+    for (size_t split = 0; split < len; ++split) {
+        if (split > 0 && capture[split - 1] != '\n')
+            continue;
+        for (size_t split2 = split; split2 <= len; ++split2) {
+            if (split2 < len && split2 > 0 && capture[split2 - 1] != '\n')
+                continue;
+
+            static CaptureStats a, b, c;
+            a.clear();
+            b.clear();
+            c.clear();
+            a.add_lines(capture, split);
+            b.add_lines(capture + split, split2 - split);
+            c.add_lines(capture + split2, len - split2);
+            a.merge(b);
+            a.merge(c);
+
+            char msg[64];
+            snprintf(msg, sizeof(msg), "split at %zu and %zu", split, split2);
+            TEST_ASSERT_TRUE_MESSAGE(same_node(whole.node(4), a.node(4)), msg);
+            TEST_ASSERT_TRUE_MESSAGE(same_node(whole.node(3), a.node(3)), msg);
+            TEST_ASSERT_EQUAL_MESSAGE(whole.lines(), a.lines(), msg);
+            TEST_ASSERT_EQUAL_MESSAGE(whole.crashes(), a.crashes(), msg);
+            TEST_ASSERT_EQUAL_MESSAGE(0, a.unattributed().replies, msg);
+        }
+    }
+}
+
+void test_malformed_lines_are_skipped() {
+    static const char *junk = "\n,\n1615909112.6,\n1615909112.6,\"\n1615909112.6,\"Received length: 20, from: 0x\"\n"
+                              "not a time,Received length: 20, from: 0x04\n"
+                              "1615909112.6,\"Data: node: 4, message: , RSSI dBm\"\n"
+                              "1615909112.6,\"...sent a reply\"\n";
+    CaptureStats stats;
+    stats.add_lines(junk, strlen(junk));
+
+    TEST_ASSERT_EQUAL(8, stats.lines());
+    TEST_ASSERT_EQUAL(0, stats.node(4).frames);
+    TEST_ASSERT_EQUAL(0, stats.unattributed().messages);
+    TEST_ASSERT_EQUAL(1, stats.unattributed().replies);
+}
+
+void test_histogram_percentile() {
+    uint32_t bins[10] = {0};
+    TEST_ASSERT_EQUAL(-1, histogram_percentile(bins, 10, 0.5));
+    bins[2] = 50;
+    bins[7] = 50;
+    TEST_ASSERT_EQUAL(100, histogram_total(bins, 10));
+    TEST_ASSERT_EQUAL(2, histogram_percentile(bins, 10, 0.0));
+    TEST_ASSERT_EQUAL(2, histogram_percentile(bins, 10, 0.49));
+    TEST_ASSERT_EQUAL(7, histogram_percentile(bins, 10, 0.5));
+    TEST_ASSERT_EQUAL(7, histogram_percentile(bins, 10, 1.0));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse_capture);
+    RUN_TEST(test_split_and_merge);
+    RUN_TEST(test_malformed_lines_are_skipped);
+    RUN_TEST(test_histogram_percentile);
+
+    UNITY_END();
+}
@@ -0,0 +1,229 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "BatchMessage.h"
+#include "FramePipeline.h"
+#include "RxQueue.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define NOW 1615909112UL
+
+// A frame the size of a packet_t is taken for one, so a data message
+// goes out with a byte to spare if it is that size
+#define MESSAGE_LEN (sizeof(data_message_t) + (sizeof(data_message_t) == sizeof(packet_t)))
+
+struct padded_message_t {
+    data_message_t m;
+    uint8_t spare;
+};
+
+// Keeps what it is given, and where it came in the order of all sinks
+class RecordingSink : public FrameSink {
+public:
+    static int s_calls;
+
+    int order[BATCH_MAX_READINGS];
+    MessageType types[BATCH_MAX_READINGS];
+    packet_t packets[BATCH_MAX_READINGS];
+    int8_t readings[BATCH_MAX_READINGS];
+    uint8_t count;
+
+    RecordingSink() : count(0) {}
+
+    void message(const frame_record_t &, MessageType type, const uint8_t *msg, uint8_t len, int8_t reading) {
+        order[count] = s_calls++;
+        types[count] = type;
+        readings[count] = reading;
+        if (len == sizeof(packet_t))
+            memcpy(&packets[count], msg, sizeof(packet_t));
+        ++count;
+    }
+};
+
+int RecordingSink::s_calls = 0;
+
+void test_decode_packet_and_message() {
+    packet_t p;
+    build_data_packet(&p, 4, 12, NOW, 416, 370, 2043, 2962, 0x20);
+    frame_record_t record;
+    TEST_ASSERT_TRUE(decode_frame((const uint8_t *)&p, sizeof(p), 4, NOW + 1, &record));
+    TEST_ASSERT_EQUAL(data_packet, record.type);
+    TEST_ASSERT_FALSE(record.batch);
+    TEST_ASSERT_EQUAL(4, record.node);
+    TEST_ASSERT_EQUAL(NOW, record.node_time);
+    TEST_ASSERT_EQUAL(NOW + 1, record.rx_time);
+    TEST_ASSERT_EQUAL(1, record.count);
+    TEST_ASSERT_EQUAL(1, record.fresh);
+    TEST_ASSERT_EQUAL(12, record.readings[0].message);
+    TEST_ASSERT_EQUAL(2043, record.readings[0].temp);
+    TEST_ASSERT_EQUAL(0x20, record.readings[0].status);
+
+    padded_message_t pm;
+    build_data_message(&pm.m, 5, 13, NOW, 416, 370, -150, 2962, 0);
+    TEST_ASSERT_TRUE(decode_frame((const uint8_t *)&pm, MESSAGE_LEN, 5, NOW, &record));
+    TEST_ASSERT_EQUAL(data_message, record.type);
+    TEST_ASSERT_EQUAL(5, record.node);
+    TEST_ASSERT_EQUAL(-150, record.readings[0].temp);
+
+    // A data message too short to hold its fields is turned down
+    if (sizeof(data_message_t) - 1 != sizeof(packet_t))
+        TEST_ASSERT_FALSE(decode_frame((const uint8_t *)&pm, sizeof(data_message_t) - 1, 5, NOW, &record));
+    TEST_ASSERT_FALSE(decode_frame((const uint8_t *)&pm, 0, 5, NOW, &record));
+}
+
+void test_batch_goes_out_as_packets() {
+    batch_reading_t in[3];
+    for (uint8_t i = 0; i < 3; ++i) {
+        in[i].message = 100 + i;
+        in[i].time = NOW - 300 * (3 - i);
+        in[i].battery = 416;
+        in[i].last_tx_duration = 370;
+        in[i].temp = 2043 + i;
+        in[i].humidity = 2962;
+        in[i].status = 0;
+    }
+    uint8_t buf[BATCH_MAX_SIZE];
+    uint8_t len = encode_batch(7, NOW, in, 3, buf, sizeof(buf));
+
+    frame_record_t record;
+    TEST_ASSERT_TRUE(decode_frame(buf, len, 7, NOW + 1, &record));
+    TEST_ASSERT_TRUE(record.batch);
+    TEST_ASSERT_EQUAL(data_message, record.type);
+    TEST_ASSERT_EQUAL(NOW, record.node_time);
+    TEST_ASSERT_EQUAL(3, record.count);
+    TEST_ASSERT_EQUAL(7, record.fresh);
+
+    // The middle reading is a duplicate
+    record.fresh &= ~2UL;
+    FramePipeline pipeline;
+    RecordingSink a, b;
+    pipeline.add(&a);
+    pipeline.add(&b);
+    RecordingSink::s_calls = 0;
+    TEST_ASSERT_EQUAL(2, pipeline.dispatch(record));
+
+    TEST_ASSERT_EQUAL(2, a.count);
+    TEST_ASSERT_EQUAL(data_packet, a.types[1]);
+    TEST_ASSERT_EQUAL(0, a.readings[0]);
+    TEST_ASSERT_EQUAL(2, a.readings[1]);
+    TEST_ASSERT_EQUAL(7, a.packets[1].node);
+    TEST_ASSERT_EQUAL(102, a.packets[1].message);
+    TEST_ASSERT_EQUAL(2045, a.packets[1].temp);
+    TEST_ASSERT_EQUAL(NOW - 300, a.packets[1].time);
+
+    // Each reading goes to every sink before the next reading
+    TEST_ASSERT_EQUAL(0, a.order[0]);
+    TEST_ASSERT_EQUAL(1, b.order[0]);
+    TEST_ASSERT_EQUAL(2, a.order[1]);
+
+    // A batch cut short is malformed
+    TEST_ASSERT_FALSE(decode_frame(buf, len - 1, 7, NOW, &record));
+}
+
+// The largest batch fits in the RX queue and comes out whole
+void test_full_batch_through_rx_queue() {
+    TEST_ASSERT_TRUE(RX_FRAME_MAX_LEN >= BATCH_MAX_SIZE);
+
+    batch_reading_t in[BATCH_MAX_READINGS];
+    for (uint8_t i = 0; i < BATCH_MAX_READINGS; ++i) {
+        in[i].message = 70000 + i;
+        in[i].time = NOW - 120 * (BATCH_MAX_READINGS - i) + (i % 3);
+        in[i].battery = 416 - (i % 2);
+        in[i].last_tx_duration = 370 + (i % 3) * 10;
+        in[i].temp = 2043 - (i % 4) * 20 - (i == BATCH_MAX_READINGS - 2) * 3543;
+        in[i].humidity = 2962 - (i % 3) * 40;
+        in[i].status = 0;
+    }
+    uint8_t buf[BATCH_MAX_SIZE];
+    uint8_t len = encode_batch(7, NOW, in, BATCH_MAX_READINGS, buf, sizeof(buf));
+    TEST_ASSERT_TRUE(len > 200);
+
+    RxQueue<4> queue;
+    TEST_ASSERT_TRUE(queue.push(1000, -80, 9, 1, 7, 3, 0, buf, len));
+    TEST_ASSERT_EQUAL(0, queue.oversize());
+    const rx_frame_t *f = queue.front();
+    TEST_ASSERT_TRUE(f != 0);
+    TEST_ASSERT_EQUAL(len, f->len);
+
+    frame_record_t record;
+    TEST_ASSERT_TRUE(decode_frame(f->data, f->len, f->from, NOW + 1, &record));
+    queue.pop();
+    TEST_ASSERT_TRUE(record.batch);
+    TEST_ASSERT_EQUAL(BATCH_MAX_READINGS, record.count);
+
+    FramePipeline pipeline;
+    RecordingSink sink;
+    pipeline.add(&sink);
+    TEST_ASSERT_EQUAL(BATCH_MAX_READINGS, pipeline.dispatch(record));
+    TEST_ASSERT_EQUAL(BATCH_MAX_READINGS, sink.count);
+    TEST_ASSERT_EQUAL(70000 + BATCH_MAX_READINGS - 1, sink.packets[BATCH_MAX_READINGS - 1].message);
+    TEST_ASSERT_EQUAL(2043 - 40 - 3543, sink.packets[BATCH_MAX_READINGS - 2].temp);
+}
+
+void test_other_types_and_duplicates() {
+    frame_record_t record;
+    FramePipeline pipeline;
+    RecordingSink sink;
+    FrameCounts counts;
+    pipeline.add(&sink);
+    pipeline.add(&counts);
+
+    join_request_t jr;
+    build_join_request(&jr, 0x0123456789abcdefULL);
+    TEST_ASSERT_TRUE(decode_frame((const uint8_t *)&jr, sizeof(jr), 0, NOW, &record));
+    TEST_ASSERT_EQUAL(join_request, record.type);
+    TEST_ASSERT_TRUE(record.dev_eui == 0x0123456789abcdefULL);
+    TEST_ASSERT_EQUAL(0, record.count);
+    TEST_ASSERT_EQUAL(1, pipeline.dispatch(record));
+    TEST_ASSERT_EQUAL(-1, sink.readings[0]);
+
+    time_request_t tr;
+    build_time_request(&tr, 9, NOW - 5);
+    TEST_ASSERT_TRUE(decode_frame((const uint8_t *)&tr, sizeof(tr), 9, NOW, &record));
+    TEST_ASSERT_EQUAL(time_request, record.type);
+    TEST_ASSERT_EQUAL(NOW - 5, record.node_time);
+    pipeline.dispatch(record);
+
+    // A type we don't know still goes to the sinks
+    uint8_t odd[] = {0x42, 1, 2, 3};
+    TEST_ASSERT_TRUE(decode_frame(odd, sizeof(odd), 9, NOW, &record));
+    pipeline.dispatch(record);
+
+    // A duplicate data message goes nowhere
+    padded_message_t pm;
+    build_data_message(&pm.m, 5, 13, NOW, 416, 370, -150, 2962, 0);
+    TEST_ASSERT_TRUE(decode_frame((const uint8_t *)&pm, MESSAGE_LEN, 5, NOW, &record));
+    TEST_ASSERT_EQUAL(1, pipeline.dispatch(record));
+    record.fresh = 0;
+    TEST_ASSERT_EQUAL(0, pipeline.dispatch(record));
+
+    TEST_ASSERT_EQUAL(4, sink.count);
+    TEST_ASSERT_EQUAL(1, counts.messages(join_request));
+    TEST_ASSERT_EQUAL(1, counts.messages(time_request));
+    TEST_ASSERT_EQUAL(1, counts.messages(data_message));
+    TEST_ASSERT_EQUAL(1, counts.unknown());
+    TEST_ASSERT_EQUAL(0, counts.batched());
+}
+
+void test_sink_limit() {
+    FramePipeline pipeline;
+    FrameCounts counts[FRAME_MAX_SINKS + 1];
+    for (uint8_t i = 0; i < FRAME_MAX_SINKS; ++i)
+        TEST_ASSERT_TRUE(pipeline.add(&counts[i]));
+    TEST_ASSERT_FALSE(pipeline.add(&counts[FRAME_MAX_SINKS]));
+    TEST_ASSERT_EQUAL(FRAME_MAX_SINKS, pipeline.sinks());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_decode_packet_and_message);
+    RUN_TEST(test_batch_goes_out_as_packets);
+    RUN_TEST(test_full_batch_through_rx_queue);
+    RUN_TEST(test_other_types_and_duplicates);
+    RUN_TEST(test_sink_limit);
+
+    UNITY_END();
+}
@@ -0,0 +1,158 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "IngestMerge.h"
+#include "data_packet.h"
+#include "messages.h"
+
+#define T0 1615909112UL
+#define HOLD 2000
+
+typedef IngestMerge<3, 8> Merge;
+
+// Leaf node 4's data packet 'message', as a main node received it at T0 + 'at'
+static log_record_t frame(uint32_t message, uint32_t at, int16_t rssi = -52) {
+    packet_t data;
+    build_data_packet(&data, 4, message, 1615887488 + message, 416, 0, 2043, 2962, 0);
+    log_record_t rec;
+    build_log_record(&rec, T0 + at, rssi, 11, data_packet, 4, &data, sizeof(data));
+    return rec;
+}
+
+// The message numbers of the frames next() returns at 'now_ms'
+static uint32_t drain(Merge &m, uint32_t now_ms, uint32_t *messages, bool all = false) {
+    log_record_t rec;
+    uint8_t port;
+    uint32_t n = 0;
+    while (m.next(now_ms, &rec, &port, all)) {
+        packet_t data;
+        memcpy(&data, rec.payload, sizeof(data));
+        uint8_t node, status;
+        uint32_t time;
+        uint16_t battery, last_tx_duration, humidity;
+        int16_t temp;
+        parse_data_packet(&data, &node, &messages[n++], &time, &battery, &last_tx_duration, &temp, &humidity, &status);
+    }
+    return n;
+}
+
+void test_time_order_across_ports() {
+    Merge m(HOLD);
+    m.set_open(0, true);
+    m.set_open(1, true);
+    uint32_t out[8];
+
+    // Port 1 is behind: nothing is returned until it has caught up
+    m.add(0, frame(1, 0), 0, T0);
+    m.add(0, frame(3, 2), 0, T0 + 2);
+    TEST_ASSERT_EQUAL(0, drain(m, 10, out));
+
+    m.add(1, frame(2, 1), 10, T0 + 1);
+    TEST_ASSERT_EQUAL(2, drain(m, 10, out));
+    TEST_ASSERT_EQUAL(1, out[0]);
+    TEST_ASSERT_EQUAL(2, out[1]);
+
+    // Port 1 goes quiet: frame 3 waits for it for the hold time only
+    TEST_ASSERT_EQUAL(0, drain(m, HOLD - 1, out));
+    TEST_ASSERT_EQUAL(1, drain(m, HOLD, out));
+    TEST_ASSERT_EQUAL(3, out[0]);
+    TEST_ASSERT_EQUAL(HOLD, m.stats(0).hold_max_ms);
+
+    // Port 2 was never opened, so it never held anything back
+    TEST_ASSERT_EQUAL(0, m.stats(2).frames);
+}
+
+void test_closed_port_does_not_hold() {
+    Merge m(HOLD);
+    m.set_open(0, true);
+    m.set_open(1, true);
+    uint32_t out[8];
+
+    m.add(0, frame(1, 0), 0, T0);
+    TEST_ASSERT_EQUAL(0, drain(m, 0, out));
+    m.set_open(1, false);
+    TEST_ASSERT_EQUAL(1, drain(m, 0, out));
+
+    // Opened again, it holds the stream back only once it has been heard
+    m.set_open(1, true);
+    m.add(0, frame(2, 5), 0, T0 + 5);
+    TEST_ASSERT_EQUAL(0, drain(m, 0, out));
+    m.add(1, frame(9, 9), 0, T0 + 9);
+    TEST_ASSERT_EQUAL(1, drain(m, 0, out));
+    TEST_ASSERT_EQUAL(2, out[0]);
+}
+
+void test_duplicates() {
+    Merge m(HOLD);
+    m.set_open(0, true);
+    m.set_open(1, true);
+    uint32_t out[8];
+
+    // Both main nodes hear message 1; their clocks are a second apart
+    TEST_ASSERT_TRUE(m.add(0, frame(1, 0, -52), 0, T0));
+    TEST_ASSERT_FALSE(m.add(1, frame(1, 1, -90), 0, T0 + 1));
+    TEST_ASSERT_TRUE(m.add(1, frame(2, 1), 0, T0 + 1));
+    TEST_ASSERT_EQUAL(1, m.stats(1).duplicates);
+    TEST_ASSERT_EQUAL(1, m.stats(1).frames);
+
+    // The first copy is the one kept; it is a duplicate after it is returned, too
+    log_record_t rec;
+    uint8_t port;
+    TEST_ASSERT_TRUE(m.next(0, &rec, &port));
+    TEST_ASSERT_EQUAL(0, port);
+    TEST_ASSERT_EQUAL(-52, rec.rssi);
+    TEST_ASSERT_FALSE(m.add(0, frame(1, 0), 0, T0));
+
+    // The same bytes long after are a new frame
+    TEST_ASSERT_TRUE(m.add(0, frame(1, INGEST_DUPLICATE_S + 1), 0, T0));
+    TEST_ASSERT_EQUAL(2, drain(m, 0, out, true));
+}
+
+void test_late_frames_and_lag() {
+    Merge m(HOLD);
+    m.set_open(0, true);
+    uint32_t out[8];
+
+    m.add(0, frame(2, 10), 0, T0 + 12);
+    TEST_ASSERT_EQUAL(1, drain(m, 0, out));
+
+    // The main node's clock was set back: the frame is returned, and counted
+    m.add(0, frame(3, 5), 0, T0 + 5);
+    TEST_ASSERT_EQUAL(1, drain(m, 0, out));
+    TEST_ASSERT_EQUAL(1, m.stats(0).late);
+
+    TEST_ASSERT_EQUAL(0, m.stats(0).lag_min_s);
+    TEST_ASSERT_EQUAL(2, m.stats(0).lag_max_s);
+    TEST_ASSERT_EQUAL(2, m.stats(0).lag_sum_s);
+}
+
+void test_full() {
+    Merge m(HOLD);
+    m.set_open(0, true);
+    m.set_open(1, true);
+    uint32_t out[8];
+
+    // Port 1 is silent, so port 0's frames pile up; a full merge returns
+    // the earliest without waiting
+    for (uint32_t i = 0; i < 8; ++i)
+        TEST_ASSERT_TRUE(m.add(0, frame(i, i), 0, T0 + i));
+    TEST_ASSERT_FALSE(m.add(0, frame(8, 8), 0, T0 + 8));
+    TEST_ASSERT_EQUAL(1, m.stats(0).dropped);
+
+    TEST_ASSERT_EQUAL(1, drain(m, 0, out));
+    TEST_ASSERT_EQUAL(0, out[0]);
+    TEST_ASSERT_EQUAL(7, m.pending());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_time_order_across_ports);
+    RUN_TEST(test_closed_port_does_not_hold);
+    RUN_TEST(test_duplicates);
+    RUN_TEST(test_late_frames_and_lag);
+    RUN_TEST(test_full);
+
+    UNITY_END();
+}
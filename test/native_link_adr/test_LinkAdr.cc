@@ -0,0 +1,157 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "LinkAdr.h"
+
+#define NOW 1615909112UL
+
+// Frames from 'node' every 'interval' s at 'snr', the last one at 'last'
+template <class Registry>
+static node_state_t *hear(Registry &nodes, LinkAdr &adr, uint8_t node, int8_t snr, uint32_t last, uint32_t interval,
+                          int frames) {
+    node_state_t *n = 0;
+    for (int i = frames - 1; i >= 0; --i) {
+        const node_state_t *before = nodes.node(node);
+        uint32_t last_seen = before ? before->last_seen : 0;
+        n = nodes.saw_frame(node, last - i * interval, -60, snr);
+        adr.saw_uplink(*n, last - i * interval, last_seen);
+    }
+    return n;
+}
+
+void test_strong_link_speeds_up_then_backs_off() {
+    NodeRegistry<8> nodes;
+    LinkAdr adr(10, 13, 10);
+    link_adr_command_t cmd = link_adr_command_t();
+    TEST_ASSERT_EQUAL(3, sizeof(link_adr_command_t));
+
+    // 10 dB at SF10 is 25 dB over its floor: 15 dB over the margin,
+    // five steps: SF10 -> SF7 and 13 -> 7 dBm. Not until the history is full.
+    node_state_t *n = hear(nodes, adr, 4, 10, NOW, 300, NODE_SNR_HISTORY - 1);
+    TEST_ASSERT_FALSE(adr.check(*n, &cmd));
+    hear(nodes, adr, 4, 10, NOW + 300, 300, 1);
+    TEST_ASSERT_TRUE(adr.check(*n, &cmd));
+    TEST_ASSERT_EQUAL(LINK_ADR_MESSAGE_TYPE, cmd.type);
+    TEST_ASSERT_EQUAL(7, cmd.spreading_factor);
+    TEST_ASSERT_EQUAL(7, cmd.tx_power);
+    TEST_ASSERT_EQUAL(300, n->uplink_interval);
+
+    // Pending: no second command and no change until the ACK
+    TEST_ASSERT_FALSE(adr.check(*n, &cmd));
+    TEST_ASSERT_EQUAL(10, adr.spreading_factor(*n));
+    adr.confirm(*n, true);
+    TEST_ASSERT_EQUAL(7, adr.spreading_factor(*n));
+    TEST_ASSERT_EQUAL(7, adr.tx_power(*n));
+    TEST_ASSERT_EQUAL(0, n->snr_count);
+    TEST_ASSERT_EQUAL(1, adr.changes());
+
+    // -5 dB at SF7 is 2.5 dB over its floor, 7.5 under the margin: three
+    // steps back, 7 -> 13 dBm and then SF7 -> SF8
+    hear(nodes, adr, 4, -5, NOW + 300 * (1 + NODE_SNR_HISTORY), 300, NODE_SNR_HISTORY);
+    TEST_ASSERT_TRUE(adr.check(*n, &cmd));
+    TEST_ASSERT_EQUAL(8, cmd.spreading_factor);
+    TEST_ASSERT_EQUAL(13, cmd.tx_power);
+
+    // Not ACK'd: the node stays where it was
+    adr.confirm(*n, false);
+    TEST_ASSERT_EQUAL(7, adr.spreading_factor(*n));
+    TEST_ASSERT_EQUAL(0, n->adr_spreading_factor);
+    TEST_ASSERT_EQUAL(2, adr.commands());
+    TEST_ASSERT_EQUAL(1, adr.changes());
+}
+
+void test_margin_just_short_changes_nothing() {
+    NodeRegistry<8> nodes;
+    LinkAdr adr(10, 13, 10);
+    link_adr_command_t cmd = link_adr_command_t();
+
+    // -3 dB at SF10: 12 dB over the floor, 2 dB over the margin
+    node_state_t *n = hear(nodes, adr, 4, -3, NOW, 300, NODE_SNR_HISTORY);
+    TEST_ASSERT_FALSE(adr.check(*n, &cmd));
+
+    // One good frame among bad ones is enough; the best SNR counts
+    n = hear(nodes, adr, 5, -8, NOW, 300, NODE_SNR_HISTORY - 1);
+    hear(nodes, adr, 5, 0, NOW + 300, 300, 1);
+    TEST_ASSERT_TRUE(adr.check(*n, &cmd));
+    TEST_ASSERT_EQUAL(9, cmd.spreading_factor);
+    TEST_ASSERT_EQUAL(13, cmd.tx_power);
+}
+
+void test_interval_ignores_lost_frames() {
+    NodeRegistry<8> nodes;
+    LinkAdr adr(10);
+
+    node_state_t *n = hear(nodes, adr, 4, 5, NOW, 300, 2);
+    TEST_ASSERT_EQUAL(300, n->uplink_interval);
+    // Two frames lost
+    hear(nodes, adr, 4, 5, NOW + 900, 300, 1);
+    TEST_ASSERT_EQUAL(300, n->uplink_interval);
+    hear(nodes, adr, 4, 5, NOW + 1220, 300, 1);
+    TEST_ASSERT_EQUAL(305, n->uplink_interval);
+}
+
+void test_listen_windows_and_fallback() {
+    NodeRegistry<8> nodes;
+    LinkAdr adr(10);
+
+    // Node 4 at SF7, due at NOW + 300; node 5 at SF8, due at NOW + 400
+    node_state_t *a = hear(nodes, adr, 4, 5, NOW, 300, 2);
+    node_state_t *b = hear(nodes, adr, 5, 5, NOW + 100, 300, 2);
+    a->spreading_factor = 7;
+    b->spreading_factor = 8;
+    uint16_t guard = LINK_ADR_GUARD_S + 300 / 64;
+
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 100));
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 300 - guard - 1));
+    TEST_ASSERT_EQUAL(7, adr.listen(nodes, NOW + 300 - guard));
+    TEST_ASSERT_EQUAL(7, adr.listen(nodes, NOW + 300 + guard));
+    TEST_ASSERT_EQUAL(0, adr.missed());
+
+    // Node 4's frame did not come: a miss, and it is due again at NOW + 600
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 300 + guard + 1));
+    TEST_ASSERT_EQUAL(1, adr.missed());
+    TEST_ASSERT_EQUAL(8, adr.listen(nodes, NOW + 400));
+
+    // Overlapping windows: the node due first gets the radio
+    b->last_seen = NOW + 302;
+    TEST_ASSERT_EQUAL(7, adr.listen(nodes, NOW + 597));
+    TEST_ASSERT_EQUAL(8, adr.listen(nodes, NOW + 600 + guard + 1));
+
+    // Node 4 arrives; then both miss three in a row and are back at SF10
+    hear(nodes, adr, 4, 5, NOW + 600, 300, 1);
+    TEST_ASSERT_EQUAL(0, a->missed);
+    TEST_ASSERT_EQUAL(300, a->uplink_interval);
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 600 + 3 * 300 + guard + 1));
+    TEST_ASSERT_EQUAL(0, b->spreading_factor);
+    TEST_ASSERT_EQUAL(0, a->spreading_factor);
+    TEST_ASSERT_EQUAL(2, adr.fallbacks());
+}
+
+void test_unmoved_node_due_first_keeps_the_radio() {
+    NodeRegistry<8> nodes;
+    LinkAdr adr(10);
+
+    node_state_t *a = hear(nodes, adr, 4, 5, NOW, 300, 2);
+    hear(nodes, adr, 6, 5, NOW - 2, 300, 2);
+    a->spreading_factor = 7;
+
+    // Node 6 is due at NOW + 298 and node 4 at NOW + 300
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 297));
+    TEST_ASSERT_EQUAL(7, adr.listen(nodes, NOW + 299 + LINK_ADR_GUARD_S + 300 / 64));
+    // Node 6's frame never came: it is due again at NOW + 598, and is not a miss
+    TEST_ASSERT_EQUAL(10, adr.listen(nodes, NOW + 597));
+    TEST_ASSERT_EQUAL(1, adr.missed());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_strong_link_speeds_up_then_backs_off);
+    RUN_TEST(test_margin_just_short_changes_nothing);
+    RUN_TEST(test_interval_ignores_lost_frames);
+    RUN_TEST(test_listen_windows_and_fallback);
+    RUN_TEST(test_unmoved_node_due_first_keeps_the_radio);
+
+    UNITY_END();
+}
@@ -0,0 +1,113 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "LogIndex.h"
+
+#define NOW 1615909112UL    // 2021-03-16T15:38:32
+
+void test_file_name() {
+    char name[LOG_FILE_NAME_LEN];
+
+    log_file_name(NOW, "CSV", name);
+    TEST_ASSERT_EQUAL_STRING("20210316.CSV", name);
+    log_file_name(NOW, "IDX", name);
+    TEST_ASSERT_EQUAL_STRING("20210316.IDX", name);
+
+    // The day starts at midnight, and the leap day is a day of its own
+    log_file_name(1709164800UL - 1, "CSV", name);
+    TEST_ASSERT_EQUAL_STRING("20240228.CSV", name);
+    log_file_name(1709164800UL, "CSV", name);
+    TEST_ASSERT_EQUAL_STRING("20240229.CSV", name);
+    log_file_name(1709251200UL, "CSV", name);
+    TEST_ASSERT_EQUAL_STRING("20240301.CSV", name);
+    log_file_name(0, "CSV", name);
+    TEST_ASSERT_EQUAL_STRING("19700101.CSV", name);
+}
+
+void test_blocks_close_on_size_and_time() {
+    LogIndexer indexer(100, 60);
+    log_index_entry_t e;
+    uint32_t pos = 86;      // after the header lines
+
+    // Forty-byte records ten seconds apart from nodes 1 and 2: the third
+    // record would make the block too long
+    TEST_ASSERT_FALSE(indexer.record(pos, pos + 40, NOW, 1, &e));
+    pos += 40;
+    TEST_ASSERT_FALSE(indexer.record(pos, pos + 40, NOW + 10, 2, &e));
+    pos += 40;
+    TEST_ASSERT_TRUE(indexer.record(pos, pos + 40, NOW + 20, 2, &e));
+    TEST_ASSERT_EQUAL(NOW, e.first_time);
+    TEST_ASSERT_EQUAL(NOW + 10, e.last_time);
+    TEST_ASSERT_EQUAL(86, e.offset);
+    TEST_ASSERT_EQUAL(80, e.length);
+    TEST_ASSERT_TRUE(log_index_has_node(e, 1));
+    TEST_ASSERT_TRUE(log_index_has_node(e, 2));
+    TEST_ASSERT_FALSE(log_index_has_node(e, 3));
+    pos += 40;
+
+    // Short records, but a minute after the block's first
+    TEST_ASSERT_FALSE(indexer.record(pos, pos + 10, NOW + 50, 200, &e));
+    pos += 10;
+    TEST_ASSERT_TRUE(indexer.record(pos, pos + 10, NOW + 80, 3, &e));
+    TEST_ASSERT_EQUAL(NOW + 20, e.first_time);
+    TEST_ASSERT_EQUAL(NOW + 50, e.last_time);
+    TEST_ASSERT_EQUAL(166, e.offset);
+    TEST_ASSERT_EQUAL(50, e.length);
+    TEST_ASSERT_TRUE(log_index_has_node(e, 200));
+    pos += 10;
+
+    TEST_ASSERT_TRUE(indexer.open());
+    TEST_ASSERT_TRUE(indexer.finish(&e));
+    TEST_ASSERT_EQUAL(NOW + 80, e.first_time);
+    TEST_ASSERT_EQUAL(216, e.offset);
+    TEST_ASSERT_EQUAL(10, e.length);
+    TEST_ASSERT_FALSE(indexer.open());
+    TEST_ASSERT_FALSE(indexer.finish(&e));
+}
+
+void test_gap_or_earlier_time_starts_a_block() {
+    LogIndexer indexer(1000, 900);
+    log_index_entry_t e;
+
+    TEST_ASSERT_FALSE(indexer.record(0, 40, NOW, 1, &e));
+    // A header line was logged between the records
+    TEST_ASSERT_TRUE(indexer.record(126, 166, NOW + 1, 1, &e));
+    TEST_ASSERT_EQUAL(0, e.offset);
+    TEST_ASSERT_EQUAL(40, e.length);
+
+    // The clock went back
+    TEST_ASSERT_TRUE(indexer.record(166, 206, NOW - 5, 1, &e));
+    TEST_ASSERT_EQUAL(126, e.offset);
+    TEST_ASSERT_EQUAL(NOW + 1, e.first_time);
+}
+
+void test_match() {
+    log_index_entry_t e;
+    memset(&e, 0, sizeof(e));
+    e.first_time = NOW;
+    e.last_time = NOW + 100;
+    e.nodes[0] = 1 << 4;
+
+    TEST_ASSERT_TRUE(log_index_match(e, 0, UINT32_MAX, -1));
+    TEST_ASSERT_TRUE(log_index_match(e, NOW + 100, NOW + 200, 4));
+    TEST_ASSERT_TRUE(log_index_match(e, NOW - 100, NOW, -1));
+    TEST_ASSERT_FALSE(log_index_match(e, NOW + 101, NOW + 200, -1));
+    TEST_ASSERT_FALSE(log_index_match(e, NOW - 100, NOW - 1, 4));
+    TEST_ASSERT_FALSE(log_index_match(e, 0, UINT32_MAX, 5));
+
+    log_index_header_t h = log_index_header();
+    TEST_ASSERT_EQUAL(0, memcmp(&h.magic, "LIDX", 4));
+    TEST_ASSERT_EQUAL(LOG_INDEX_ENTRY_SIZE, h.entry_size);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_file_name);
+    RUN_TEST(test_blocks_close_on_size_and_time);
+    RUN_TEST(test_gap_or_earlier_time_starts_a_block);
+    RUN_TEST(test_match);
+
+    UNITY_END();
+}
@@ -0,0 +1,502 @@
+#include <unity.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LogTransfer.h"
+#include "SerialOut.h"
+#include "SerialRecord.h"
+
+// The card: file names and contents
+static std::map<std::string, std::string> card;
+
+// A stand-in for SdFile, reading from 'card'
+class FakeFile {
+    std::string d_name;
+    bool d_open = false;
+    bool d_dir = false;
+    std::map<std::string, std::string>::iterator d_next;   // for the directory
+    uint32_t d_pos = 0;
+
+public:
+    static int reads;
+
+    bool open(const char *path, int) {
+        close();
+        if (strcmp(path, "/") == 0) {
+            d_open = d_dir = true;
+            d_next = card.begin();
+            return true;
+        }
+        if (!card.count(path))
+            return false;
+        d_name = path;
+        d_open = true;
+        d_pos = 0;
+        return true;
+    }
+
+    bool openNext(FakeFile *dir, int oflag) {
+        close();
+        if (dir->d_next == card.end())
+            return false;
+        return open((dir->d_next++)->first.c_str(), oflag);
+    }
+
+    bool getName(char *name, size_t size) {
+        snprintf(name, size, "%s", d_name.c_str());
+        return true;
+    }
+
+    bool isFile() const { return d_open && !d_dir; }
+    uint32_t fileSize() const { return card[d_name].size(); }
+
+    bool seekSet(uint32_t pos) {
+        if (pos > fileSize())
+            return false;
+        d_pos = pos;
+        return true;
+    }
+
+    int read(void *buf, size_t count) {
+        ++reads;
+        const std::string &data = card[d_name];
+        size_t n = count < data.size() - d_pos ? count : data.size() - d_pos;
+        memcpy(buf, data.data() + d_pos, n);
+        d_pos += n;
+        return n;
+    }
+
+    bool close() {
+        bool was = d_open;
+        d_open = d_dir = false;
+        return was;
+    }
+};
+
+int FakeFile::reads = 0;
+
+struct NoLock {
+    static void lock() {}
+    static void unlock() {}
+};
+
+// Keeps the records the server writes
+class FakeOut {
+public:
+    std::vector<std::vector<uint8_t> > records;
+    uint16_t room = 2048;
+
+    uint16_t space() const { return room; }
+
+    bool write_record(uint8_t type, const void *payload, uint8_t len) {
+        std::vector<uint8_t> r(1, type);
+        r.insert(r.end(), (const uint8_t *)payload, (const uint8_t *)payload + len);
+        records.push_back(r);
+        return true;
+    }
+};
+
+typedef LogTransferServer<FakeFile, NoLock, FakeOut> DirectServer;
+
+static std::string received;
+static std::vector<std::string> listed;
+
+static bool keep_data(uint32_t, const uint8_t *data, uint16_t len, void *) {
+    received.append((const char *)data, len);
+    return true;
+}
+
+static void keep_info(const log_file_info_t *info, void *) {
+    listed.push_back(std::string(info->name) + ":" + std::to_string(info->size));
+}
+
+static std::string make_file(uint32_t size, unsigned seed) {
+    std::string data(size, '\0');
+    srand(seed);
+    for (uint32_t i = 0; i < size; ++i)
+        data[i] = rand() % 256;     // zeros included, so COBS has work to do
+    return data;
+}
+
+// Decode the command the client built, as the main node would, and pass it on
+static void to_server(DirectServer &server, const uint8_t *wire, size_t len, uint32_t now_ms) {
+    SerialCommandReader reader;
+    serial_record_t rec;
+    for (size_t i = 0; i < len; ++i) {
+        SerialCommandInput input = reader.add(wire[i], &rec);
+        TEST_ASSERT_TRUE(input != serial_command_char && input != serial_command_bad);
+        if (input == serial_command_record)
+            server.command(rec, now_ms);
+    }
+}
+
+/**
+ * Run the server and the client against each other, one record at a
+ * time; 'drop' decides which of the server's records are lost.
+ * @return The number of steps taken
+ */
+static int run(DirectServer &server, FakeOut &out, LogTransferClient &client, uint32_t *now_ms,
+               bool (*drop)(int n, const std::vector<uint8_t> &r), int max_steps = 100000) {
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    int n = 0;
+    int steps = 0;
+    while (!client.done() && steps < max_steps) {
+        ++steps;
+        *now_ms += 1;
+        server.service(*now_ms);
+        for (size_t i = 0; i < out.records.size(); ++i) {
+            const std::vector<uint8_t> &r = out.records[i];
+            if (drop && drop(n++, r))
+                continue;
+            serial_record_t rec;
+            rec.type = r[0];
+            rec.sequence = 0;
+            rec.len = r.size() - 1;
+            rec.payload = r.data() + 1;
+            size_t len = client.record(rec, wire);
+            if (len)
+                to_server(server, wire, len, *now_ms);
+        }
+        out.records.clear();
+    }
+    return steps;
+}
+
+static void clear() {
+    card.clear();
+    received.clear();
+    listed.clear();
+}
+
+void test_command_reader() {
+    SerialCommandReader reader;
+    serial_record_t rec;
+    TEST_ASSERT_EQUAL(serial_command_char, reader.add('B', &rec));
+
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    uint32_t payload = 0x00120034;
+    size_t len = encode_log_command('X', &payload, sizeof(payload), wire);
+    TEST_ASSERT_EQUAL(0, wire[0]);
+    TEST_ASSERT_EQUAL(0, wire[len - 1]);
+    for (size_t i = 0; i < len - 1; ++i)
+        TEST_ASSERT_EQUAL(serial_command_pending, reader.add(wire[i], &rec));
+    TEST_ASSERT_EQUAL(serial_command_record, reader.add(wire[len - 1], &rec));
+    TEST_ASSERT_EQUAL('X', rec.type);
+    TEST_ASSERT_EQUAL(4, rec.len);
+    TEST_ASSERT_EQUAL(0, memcmp(rec.payload, &payload, 4));
+
+    // Back to commands after the record; a damaged record is reported
+    TEST_ASSERT_EQUAL(serial_command_char, reader.add('S', &rec));
+    wire[3] ^= 0x40;
+    for (size_t i = 0; i < len - 1; ++i)
+        reader.add(wire[i], &rec);
+    TEST_ASSERT_EQUAL(serial_command_bad, reader.add(wire[len - 1], &rec));
+
+    // Two zeros: an empty record, and back to commands
+    TEST_ASSERT_EQUAL(serial_command_pending, reader.add(0, &rec));
+    TEST_ASSERT_EQUAL(serial_command_pending, reader.add(0, &rec));
+    TEST_ASSERT_EQUAL(serial_command_char, reader.add('T', &rec));
+}
+
+void test_list_and_errors() {
+    clear();
+    card["20210316.CSV"] = "4, 1\r\n";
+    card["NODES.DAT"] = std::string(1000, 'x');
+    FakeFile file, dir;
+    FakeOut out;
+    DirectServer server(file, dir, out);
+    LogTransferClient client(keep_info, keep_data, 0);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    uint32_t now_ms = 0;
+
+    to_server(server, wire, client.list(wire), now_ms);
+    run(server, out, client, &now_ms, 0);
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_EQUAL(2, listed.size());
+    TEST_ASSERT_EQUAL_STRING("20210316.CSV:6", listed[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("NODES.DAT:1000", listed[1].c_str());
+
+    to_server(server, wire, client.read("MISSING.CSV", 0, 0, 0, wire), now_ms);
+    run(server, out, client, &now_ms, 0);
+    TEST_ASSERT_FALSE(client.ok());
+    TEST_ASSERT_EQUAL(log_transfer_no_file, client.end().status);
+
+    to_server(server, wire, client.read("NODES.DAT", 1001, 0, 0, wire), now_ms);
+    run(server, out, client, &now_ms, 0);
+    TEST_ASSERT_EQUAL(log_transfer_bad_range, client.end().status);
+    TEST_ASSERT_FALSE(server.busy());
+    TEST_ASSERT_EQUAL(2, server.stats().failed);
+}
+
+// Every 7th data record is lost
+static bool lose_some(int n, const std::vector<uint8_t> &r) { return r[0] == LOG_TRANSFER_DATA && n % 7 == 3; }
+
+void test_read_with_losses() {
+    clear();
+    card["20210316.CSV"] = make_file(50000, 1);
+    FakeFile file, dir;
+    FakeOut out;
+    DirectServer server(file, dir, out);
+    LogTransferClient client(keep_info, keep_data, 0);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    uint32_t now_ms = 0;
+
+    to_server(server, wire, client.read("20210316.CSV", 0, 0, 4, wire), now_ms);
+    run(server, out, client, &now_ms, lose_some);
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_TRUE(received == card["20210316.CSV"]);
+    TEST_ASSERT_TRUE(client.rewinds() > 0);
+    TEST_ASSERT_EQUAL(client.rewinds(), server.stats().rewinds);
+    // Only a lost last chunk, with no chunk after it to show the gap, waits for the timeout
+    TEST_ASSERT_TRUE(server.stats().timeouts <= 1);
+    TEST_ASSERT_EQUAL(50000, client.end().size);
+    TEST_ASSERT_TRUE(server.stats().bytes > 50000);
+}
+
+// The last chunk is lost once. No later chunk shows the gap, so the
+// main node has to go back on its own.
+static bool lose_the_end(int, const std::vector<uint8_t> &r) {
+    static bool lost = false;
+    uint32_t offset;
+    memcpy(&offset, r.data() + 1, 4);
+    if (r[0] == LOG_TRANSFER_DATA && offset == 2000 + 12 * LOG_TRANSFER_CHUNK && !lost) {
+        lost = true;
+        return true;
+    }
+    return false;
+}
+
+void test_resend_timeout_and_resume() {
+    clear();
+    card["20210316.CSV"] = make_file(5000, 2);
+    FakeFile file, dir;
+    FakeOut out;
+    DirectServer server(file, dir, out);
+    LogTransferClient client(keep_info, keep_data, 0);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    uint32_t now_ms = 0;
+
+    to_server(server, wire, client.read("20210316.CSV", 0, 2000, 0, wire), now_ms);
+    run(server, out, client, &now_ms, 0);
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_EQUAL(2000, received.size());
+
+    // Resume from where the first read stopped
+    to_server(server, wire, client.read("20210316.CSV", client.offset(), 0, 0, wire), now_ms);
+    int steps = run(server, out, client, &now_ms, lose_the_end);
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_TRUE(received == card["20210316.CSV"]);
+    TEST_ASSERT_EQUAL(1, server.stats().timeouts);
+    TEST_ASSERT_TRUE(steps >= LOG_TRANSFER_RESEND_MS);
+    TEST_ASSERT_EQUAL(2000, client.end().offset);
+    TEST_ASSERT_EQUAL(5000, client.end().end);
+}
+
+void test_window_and_room() {
+    clear();
+    card["20210316.CSV"] = make_file(10000, 3);
+    FakeFile file, dir;
+    FakeOut out;
+    DirectServer server(file, dir, out);
+    LogTransferClient client(keep_info, keep_data, 0);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+
+    to_server(server, wire, client.read("20210316.CSV", 0, 0, 3, wire), 0);
+    for (int i = 0; i < 10; ++i)
+        server.service(i);
+    TEST_ASSERT_EQUAL(3, out.records.size());
+
+    // No room in the output: nothing is read from the card
+    out.records.clear();
+    to_server(server, wire, client.cancel(wire), 10);
+    to_server(server, wire, client.read("20210316.CSV", 0, 0, 3, wire), 10);
+    out.room = LOG_TRANSFER_CHUNK_ENCODED - 1;
+    int reads = FakeFile::reads;
+    TEST_ASSERT_TRUE(server.service(11));       // starts the read
+    TEST_ASSERT_FALSE(server.service(11));
+    TEST_ASSERT_EQUAL(reads, FakeFile::reads);
+
+    // The host went away
+    out.room = 2048;
+    server.service(11 + LOG_TRANSFER_IDLE_MS);
+    TEST_ASSERT_FALSE(server.busy());
+    TEST_ASSERT_EQUAL(LOG_TRANSFER_END, out.records.back()[0]);
+    TEST_ASSERT_EQUAL(log_transfer_timed_out, out.records.back()[1 + 16]);
+}
+
+static bool card_ready = true;
+static bool test_card_ready() { return card_ready; }
+
+// A read that is asked for while the card is busy waits for it, and so
+// does each chunk
+void test_busy_card_defers_read() {
+    clear();
+    card["20210316.CSV"] = make_file(1000, 5);
+    FakeFile file, dir;
+    FakeOut out;
+    DirectServer server(file, dir, out);
+    server.set_ready_check(test_card_ready);
+    LogTransferClient client(keep_info, keep_data, 0);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    uint32_t now_ms = 0;
+
+    card_ready = false;
+    to_server(server, wire, client.read("20210316.CSV", 0, 0, 0, wire), now_ms);
+    TEST_ASSERT_TRUE(server.read_pending());
+    TEST_ASSERT_FALSE(server.service(++now_ms));
+    TEST_ASSERT_TRUE(server.read_pending());
+    TEST_ASSERT_EQUAL(0, server.stats().reads);
+    TEST_ASSERT_EQUAL(1, server.stats().deferred);
+
+    card_ready = true;
+    TEST_ASSERT_TRUE(server.service(++now_ms));
+    TEST_ASSERT_FALSE(server.read_pending());
+    TEST_ASSERT_EQUAL(1, server.stats().reads);
+
+    card_ready = false;
+    int reads = FakeFile::reads;
+    TEST_ASSERT_FALSE(server.service(++now_ms));
+    TEST_ASSERT_EQUAL(reads, FakeFile::reads);
+    TEST_ASSERT_EQUAL(0, out.records.size());
+
+    card_ready = true;
+    run(server, out, client, &now_ms, 0);
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_TRUE(received == card["20210316.CSV"]);
+    TEST_ASSERT_EQUAL(2, server.stats().deferred);
+}
+
+// The main node's serial port, at the device end of a pty
+class PtyPort {
+    int d_fd;
+
+public:
+    PtyPort(int fd) : d_fd(fd) {}
+    int availableForWrite() { return 256; }
+    size_t write(const uint8_t *buf, size_t len) {
+        ssize_t n = ::write(d_fd, buf, len);
+        return n < 0 ? 0 : n;
+    }
+};
+
+typedef LogTransferServer<FakeFile, NoLock, SerialOut<PtyPort> > PtyServer;
+
+static uint32_t now_ms() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct host_t {
+    LogTransferClient *client;
+    int fd;
+};
+
+static void host_record(const serial_record_t *rec, void *context) {
+    host_t *host = (host_t *)context;
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    size_t len = host->client->record(*rec, wire);
+    if (len)
+        TEST_ASSERT_EQUAL(len, write(host->fd, wire, len));
+}
+
+// The whole path: the main node's loop on one side of a pty and the
+// host, with its tty in raw mode, on the other; the main node prints
+// a line of text now and then in the middle of the data
+void test_pty_loopback() {
+    clear();
+    card["20210316.CSV"] = make_file(200000, 4);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    TEST_ASSERT_TRUE(master >= 0);
+    TEST_ASSERT_EQUAL(0, grantpt(master));
+    TEST_ASSERT_EQUAL(0, unlockpt(master));
+    int tty = open(ptsname(master), O_RDWR | O_NOCTTY);
+    TEST_ASSERT_TRUE(tty >= 0);
+    struct termios t;
+    tcgetattr(tty, &t);
+    cfmakeraw(&t);
+    tcsetattr(tty, TCSANOW, &t);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    std::atomic<bool> stop(false);
+    std::thread node([&]() {
+        PtyPort port(master);
+        SerialOut<PtyPort> out(port, serial_framed);
+        FakeFile file, dir;
+        PtyServer server(file, dir, out);
+        SerialCommandReader reader;
+        uint32_t loops = 0;
+        while (!stop) {
+            uint8_t buf[64];
+            ssize_t n = read(master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; ++i) {
+                serial_record_t rec;
+                if (reader.add(buf[i], &rec) == serial_command_record)
+                    server.command(rec, now_ms());
+            }
+            if (++loops % 500 == 0)
+                out.write((const uint8_t *)"Current time: 2021-03-16T15:38:32\r\n", 35);
+            server.service(now_ms());
+            if (!out.service())
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+
+    LogTransferClient client(keep_info, keep_data, 0);
+    host_t host = {&client, tty};
+    SerialRecordReader reader(host_record, &host);
+    uint8_t wire[SERIAL_COMMAND_MAX_ENCODED + 2];
+    size_t len = client.read("20210316.CSV", 0, 0, 0, wire);
+    TEST_ASSERT_EQUAL(len, write(tty, wire, len));
+
+    uint32_t start = now_ms();
+    while (!client.done() && now_ms() - start < 20000) {
+        struct pollfd p = {tty, POLLIN, 0};
+        if (poll(&p, 1, 100) <= 0)
+            continue;
+        uint8_t buf[4096];
+        ssize_t n = read(tty, buf, sizeof(buf));
+        if (n > 0)
+            reader.add(buf, n);
+    }
+    uint32_t elapsed = now_ms() - start;
+
+    stop = true;
+    node.join();
+    close(tty);
+    close(master);
+
+    TEST_ASSERT_TRUE(client.ok());
+    TEST_ASSERT_TRUE(received == card["20210316.CSV"]);
+    TEST_ASSERT_EQUAL(0, reader.stats().bad);
+    TEST_ASSERT_EQUAL(0, reader.stats().lost);
+    char msg[80];
+    snprintf(msg, sizeof(msg), "200000 bytes in %u ms", elapsed);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_command_reader);
+    RUN_TEST(test_list_and_errors);
+    RUN_TEST(test_read_with_losses);
+    RUN_TEST(test_resend_timeout_and_resume);
+    RUN_TEST(test_window_and_room);
+    RUN_TEST(test_busy_card_defers_read);
+    RUN_TEST(test_pty_loopback);
+
+    UNITY_END();
+}
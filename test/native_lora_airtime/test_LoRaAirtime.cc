@@ -0,0 +1,82 @@
+
+#include <unity.h>
+
+#include "LoRaAirtime.h"
+
+// Values from Semtech's LoRa calculator for a 13-byte payload, 8 symbol
+// preamble, explicit header, CRC on, 4/5
+void test_reference_values() {
+    lora_settings_t sf7 = lora_settings(7, 125000, 5);
+    TEST_ASSERT_FALSE(lora_low_data_rate(sf7));
+    TEST_ASSERT_EQUAL(33, lora_payload_symbols(sf7, 13));
+    TEST_ASSERT_EQUAL(46336, lora_airtime_us(sf7, 13));
+
+    lora_settings_t sf12 = lora_settings(12, 125000, 5);
+    TEST_ASSERT_TRUE(lora_low_data_rate(sf12));
+    TEST_ASSERT_EQUAL(1155072, lora_airtime_us(sf12, 13));
+
+    // SF11 at 125 kHz is 16.4 ms a symbol, so it uses the optimization;
+    // at 250 kHz it does not
+    TEST_ASSERT_TRUE(lora_low_data_rate(lora_settings(11, 125000, 5)));
+    TEST_ASSERT_FALSE(lora_low_data_rate(lora_settings(11, 250000, 5)));
+}
+
+void test_settings() {
+    lora_settings_t s = lora_settings(10, 125000, 5);
+    uint32_t base = lora_airtime_us(s, 24);
+
+    // A bigger coding rate, a longer preamble and a smaller bandwidth all cost time
+    lora_settings_t cr = s;
+    cr.coding_rate = 8;
+    TEST_ASSERT_TRUE(lora_airtime_us(cr, 24) > base);
+
+    lora_settings_t pre = s;
+    pre.preamble = 12;
+    TEST_ASSERT_EQUAL(base + 4 * 8192, lora_airtime_us(pre, 24));
+
+    // Half the bandwidth is twice the time, and more once the symbols are
+    // long enough for the low data rate optimization
+    lora_settings_t sf7 = lora_settings(7, 125000, 5);
+    lora_settings_t bw = sf7;
+    bw.bandwidth = 62500;
+    TEST_ASSERT_EQUAL(2 * lora_airtime_us(sf7, 24), lora_airtime_us(bw, 24));
+    bw = s;
+    bw.bandwidth = 62500;
+    TEST_ASSERT_TRUE(lora_low_data_rate(bw));
+    TEST_ASSERT_TRUE(lora_airtime_us(bw, 24) > 2 * base);
+
+    // Implicit header and no CRC save symbols
+    lora_settings_t lean = s;
+    lean.explicit_header = false;
+    lean.crc = false;
+    TEST_ASSERT_TRUE(lora_airtime_us(lean, 24) < base);
+
+    // Airtime never goes down with the length, and an empty payload
+    // still has its eight symbols
+    for (uint16_t len = 1; len < 256; ++len)
+        TEST_ASSERT_TRUE(lora_airtime_us(s, len) >= lora_airtime_us(s, len - 1));
+    TEST_ASSERT_EQUAL(8, lora_payload_symbols(lean, 0));
+}
+
+// The main node's frames at SF10, 125 kHz, 4/5. An ACK and a time reply
+// take the same 30 symbols, so 400 ms for REPLY_TIMEOUT leaves about 150 ms
+// for the leaf node to turn round.
+void test_main_node_frames() {
+    lora_settings_t s = lora_settings(10, 125000, 5);
+    TEST_ASSERT_EQUAL(8192, lora_symbol_us(s));
+    TEST_ASSERT_EQUAL(32768, lora_symbol_us(lora_settings(12, 125000, 5)));
+
+    TEST_ASSERT_EQUAL(247808, lora_airtime_us(s, 1 + LORA_RH_HEADER_LEN));
+    TEST_ASSERT_EQUAL(247808, lora_airtime_us(s, 4 + LORA_RH_HEADER_LEN));
+    TEST_ASSERT_EQUAL(370688, lora_airtime_us(s, 20 + LORA_RH_HEADER_LEN));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reference_values);
+    RUN_TEST(test_settings);
+    RUN_TEST(test_main_node_frames);
+
+    UNITY_END();
+}
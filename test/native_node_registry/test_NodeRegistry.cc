@@ -0,0 +1,355 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NodeRegistry.h"
+
+// The node's time in message m from a node that sends every five minutes
+#define MSG_TIME(m) (1615909112UL + 300 * (m))
+
+// A stand-in for SdFat's SdFile, in memory. Like SdFile, seekSet() past
+// the end of the file fails. If 'fail_after' is set, writes fail once
+// that many bytes have been written, as if the node had been reset.
+class FakeFile {
+    uint32_t d_pos = 0;
+
+public:
+    std::string data;
+    long fail_after = -1;
+
+    uint32_t fileSize() const { return data.size(); }
+
+    bool seekSet(uint32_t pos) {
+        if (pos > data.size())
+            return false;
+        d_pos = pos;
+        return true;
+    }
+
+    size_t write(const void *buf, size_t n) {
+        if (fail_after >= 0) {
+            if ((long)n > fail_after)
+                n = fail_after;
+            fail_after -= n;
+        }
+        if (d_pos + n > data.size())
+            data.resize(d_pos + n);
+        data.replace(d_pos, n, (const char *)buf, n);
+        d_pos += n;
+        return n;
+    }
+
+    int read(void *buf, size_t n) {
+        if (d_pos + n > data.size())
+            n = data.size() - d_pos;
+        memcpy(buf, data.data() + d_pos, n);
+        d_pos += n;
+        return n;
+    }
+
+    bool sync() { return true; }
+};
+
+static int locks = 0;
+
+struct CountingLock {
+    static void lock() { ++locks; }
+    static void unlock() {}
+};
+
+#define EUI(n) (0x70b3d57ed0000000ULL + (n))
+
+// Call save() until the save is complete or fails
+template <class Registry>
+static NodeSaveStatus save_all(Registry &nodes, FakeFile &file) {
+    NodeSaveStatus status;
+    while ((status = nodes.template save<FakeFile, CountingLock>(file)) == node_save_more)
+        ;
+    return status;
+}
+
+void test_join_assigns_stable_addresses() {
+    NodeRegistry<16> nodes(10);
+
+    // A hand-configured node at 11 takes that address
+    TEST_ASSERT_NOT_NULL(nodes.saw_frame(11, 1000, -60, 7));
+    TEST_ASSERT_EQUAL(0, nodes.node(11)->dev_eui);
+
+    TEST_ASSERT_EQUAL(10, nodes.join(EUI(1), 1001));
+    TEST_ASSERT_EQUAL(12, nodes.join(EUI(2), 1002));
+    TEST_ASSERT_EQUAL(10, nodes.join(EUI(1), 1003));     // joins again
+    TEST_ASSERT_EQUAL(3, nodes.count());
+
+    TEST_ASSERT_EQUAL(12, nodes.address_of(EUI(2)));
+    TEST_ASSERT_EQUAL(0, nodes.address_of(EUI(3)));
+    TEST_ASSERT_EQUAL(0, nodes.join(0, 1004));
+    TEST_ASSERT_EQUAL(EUI(1), nodes.node(10)->dev_eui);
+    TEST_ASSERT_EQUAL(NODE_JOINED, nodes.node(10)->flags & NODE_JOINED);
+    TEST_ASSERT_EQUAL(1003, nodes.node(10)->last_seen);
+
+    // Not leaf node addresses
+    TEST_ASSERT_NULL(nodes.saw_frame(0, 1005, 0, 0));
+    TEST_ASSERT_NULL(nodes.saw_frame(255, 1005, 0, 0));
+}
+
+void test_full_table() {
+    NodeRegistry<4> nodes(250);
+    TEST_ASSERT_EQUAL(250, nodes.join(EUI(1), 0));
+    TEST_ASSERT_EQUAL(251, nodes.join(EUI(2), 0));
+    TEST_ASSERT_EQUAL(252, nodes.join(EUI(3), 0));
+    TEST_ASSERT_NOT_NULL(nodes.saw_frame(254, 0, 0, 0));
+    TEST_ASSERT_EQUAL(0, nodes.join(EUI(4), 0));          // no entries left
+    TEST_ASSERT_NULL(nodes.saw_frame(5, 0, 0, 0));
+
+    NodeRegistry<8> more(253);
+    TEST_ASSERT_EQUAL(253, more.join(EUI(1), 0));
+    TEST_ASSERT_EQUAL(254, more.join(EUI(2), 0));
+    TEST_ASSERT_EQUAL(0, more.join(EUI(3), 0));           // no addresses left
+}
+
+void test_message_loss() {
+    NodeRegistry<4> nodes;
+    nodes.saw_frame(4, 0, -50, 9);
+    nodes.saw_message(4, 10, MSG_TIME(10));
+    nodes.saw_message(4, 11, MSG_TIME(11));
+    nodes.saw_message(4, 14, MSG_TIME(14));         // 12 and 13 lost
+    nodes.saw_message(4, 14, MSG_TIME(14));         // a duplicate is not loss
+    nodes.saw_message(4, 1, MSG_TIME(1));           // a restart is not loss
+    nodes.saw_message(4, 5000, MSG_TIME(5000));     // nor is a jump past NODE_MAX_COUNTER_GAP
+    TEST_ASSERT_EQUAL(2, nodes.node(4)->lost);
+    TEST_ASSERT_EQUAL(5000, nodes.node(4)->last_message);
+
+    TEST_ASSERT_TRUE(nodes.saw_message(7, 1, MSG_TIME(1)));   // never heard from; ignored
+    TEST_ASSERT_NULL(nodes.node(7));
+}
+
+void test_duplicate_suppression() {
+    NodeRegistry<4> nodes;
+    nodes.saw_frame(4, 0, -50, 9);
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 10, MSG_TIME(10)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 10, MSG_TIME(10)));   // a retry
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 13, MSG_TIME(13)));    // 11 and 12 lost...
+    TEST_ASSERT_EQUAL(2, nodes.node(4)->lost);
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 11, MSG_TIME(11)));    // ...until 11 turns up late
+    TEST_ASSERT_EQUAL(1, nodes.node(4)->lost);
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 11, MSG_TIME(11)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 10, MSG_TIME(10)));
+    TEST_ASSERT_EQUAL(13, nodes.node(4)->last_message);
+
+    // The window slides: 13 is still in it 31 messages on, but not 32
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 44, MSG_TIME(44)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 13, MSG_TIME(13)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 45, MSG_TIME(45)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 13, MSG_TIME(13)));    // too old to tell
+    TEST_ASSERT_EQUAL(1 + 30, nodes.node(4)->lost);
+    TEST_ASSERT_EQUAL(4, nodes.node(4)->duplicates);
+
+    // A restart empties the window, so message 1 is new even though the
+    // node sent a message 1 before it restarted
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 1, MSG_TIME(100)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 2, MSG_TIME(101)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 2, MSG_TIME(101)));
+    TEST_ASSERT_EQUAL(1 + 30, nodes.node(4)->lost);
+    TEST_ASSERT_EQUAL(5, nodes.node(4)->duplicates);
+}
+
+// A node that restarts inside the window: its new message numbers are
+// all in the window and were all seen before
+void test_restart_inside_window() {
+    NodeRegistry<4> nodes;
+    nodes.saw_frame(4, 0, -50, 9);
+    for (uint32_t m = 1; m <= 5; ++m)
+        TEST_ASSERT_TRUE(nodes.saw_message(4, m, MSG_TIME(m)));
+
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 1, MSG_TIME(10)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 2, MSG_TIME(11)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 3, MSG_TIME(12)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 3, MSG_TIME(12)));     // a retry
+    TEST_ASSERT_EQUAL(0, nodes.node(4)->lost);
+
+    // It restarts again before getting past message 1: same number, a
+    // different time. A retry of it has the same time.
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 1, MSG_TIME(20)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 1, MSG_TIME(20)));
+    TEST_ASSERT_TRUE(nodes.saw_message(4, 1, MSG_TIME(21)));
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 1, MSG_TIME(21)));
+    TEST_ASSERT_EQUAL(1, nodes.node(4)->last_message);
+    TEST_ASSERT_EQUAL(0, nodes.node(4)->lost);
+    TEST_ASSERT_EQUAL(3, nodes.node(4)->duplicates);
+
+    // A registry saved before message times were kept: fall back on the numbers
+    nodes.node(4)->flags &= ~NODE_HAS_MESSAGE_TIME;
+    TEST_ASSERT_FALSE(nodes.saw_message(4, 1, MSG_TIME(22)));
+}
+
+void test_save_and_load() {
+    FakeFile file;
+    NodeRegistry<32> nodes(100);
+    for (int i = 0; i < 20; ++i)
+        nodes.join(EUI(i * 977), 5000 + i);
+    nodes.saw_frame(3, 6000, -70, -2);
+    nodes.saw_message(3, 42, MSG_TIME(42));
+    TEST_ASSERT_TRUE(nodes.dirty());
+
+    locks = 0;
+    TEST_ASSERT_EQUAL(node_save_done, save_all(nodes, file));
+    TEST_ASSERT_FALSE(nodes.dirty());
+    TEST_ASSERT_TRUE(locks >= 2);
+
+    NodeRegistry<32> loaded(100);
+    TEST_ASSERT_TRUE((loaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(21, loaded.count());
+    for (int i = 0; i < 20; ++i)
+        TEST_ASSERT_EQUAL(nodes.address_of(EUI(i * 977)), loaded.address_of(EUI(i * 977)));
+    TEST_ASSERT_EQUAL(42, loaded.node(3)->last_message);
+    TEST_ASSERT_EQUAL(-70, loaded.node(3)->rssi);
+
+    // A new node joins with the next free address
+    TEST_ASSERT_EQUAL(120, loaded.join(EUI(1), 7000));
+
+    // The second save goes to the other slot; a save cut short leaves
+    // the one before it
+    TEST_ASSERT_EQUAL(node_save_done, save_all(loaded, file));
+    TEST_ASSERT_TRUE(file.data.size() > NODE_REGISTRY_SLOT_SIZE);
+    loaded.join(EUI(2), 7001);
+    file.fail_after = 100;
+    TEST_ASSERT_EQUAL(node_save_failed, save_all(loaded, file));
+    TEST_ASSERT_TRUE(loaded.dirty());
+    file.fail_after = -1;
+
+    NodeRegistry<32> reloaded(100);
+    TEST_ASSERT_TRUE((reloaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(22, reloaded.count());
+    TEST_ASSERT_EQUAL(120, reloaded.address_of(EUI(1)));
+    TEST_ASSERT_EQUAL(0, reloaded.address_of(EUI(2)));
+
+    // Two good saves, then the newer one (in the first slot) goes bad
+    TEST_ASSERT_EQUAL(node_save_done, save_all(reloaded, file));
+    reloaded.join(EUI(3), 7002);
+    TEST_ASSERT_EQUAL(node_save_done, save_all(reloaded, file));
+    TEST_ASSERT_TRUE((loaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(23, loaded.count());
+    file.data[NODE_REGISTRY_HEADER_SIZE + 5] ^= 1;
+    TEST_ASSERT_TRUE((loaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(22, loaded.count());
+
+    // Nothing good to load
+    FakeFile empty;
+    TEST_ASSERT_FALSE((reloaded.load<FakeFile, CountingLock>(empty)));
+    TEST_ASSERT_EQUAL(0, reloaded.count());
+}
+
+static bool card_ready = true;
+static bool test_card_ready() { return card_ready; }
+
+// One chunk a call, nothing while the card is busy, and the header last
+void test_save_a_chunk_at_a_time() {
+    FakeFile file;
+    NodeRegistry<32> nodes(100);
+    nodes.set_ready_check(test_card_ready);
+    for (int i = 0; i < 20; ++i)
+        nodes.join(EUI(i), 5000 + i);
+
+    card_ready = false;
+    TEST_ASSERT_EQUAL(node_save_busy, (nodes.save<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(0, file.data.size());
+    TEST_ASSERT_TRUE(nodes.saving());
+    TEST_ASSERT_FALSE(nodes.dirty());
+
+    // The first save is to the second slot: the file is extended to its
+    // records, then come three chunks of records (20 * 64 bytes)
+    card_ready = true;
+    uint32_t records = NODE_REGISTRY_SLOT_SIZE + NODE_REGISTRY_HEADER_SIZE;
+    uint32_t calls = 0;
+    while (file.data.size() < records + 20 * sizeof(node_state_t)) {
+        size_t size = file.data.size();
+        TEST_ASSERT_EQUAL(node_save_more, (nodes.save<FakeFile, CountingLock>(file)));
+        TEST_ASSERT_TRUE(file.data.size() - size <= 512);
+        ++calls;
+    }
+    TEST_ASSERT_EQUAL((records + 511) / 512 + 3, calls);
+
+    // No header yet, so there is nothing to load
+    NodeRegistry<32> loaded(100);
+    TEST_ASSERT_FALSE((loaded.load<FakeFile, CountingLock>(file)));
+
+    // An entry changes and a node joins while the save is under way
+    nodes.saw_frame(100, 6000, -80, 3);
+    nodes.join(EUI(99), 6001);
+    TEST_ASSERT_EQUAL(node_save_more, (nodes.save<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(node_save_done, (nodes.save<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_FALSE(nodes.saving());
+    TEST_ASSERT_TRUE(nodes.dirty());
+
+    // The slot has the records as they were written
+    TEST_ASSERT_TRUE((loaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(20, loaded.count());
+    TEST_ASSERT_EQUAL(5000, loaded.node(100)->last_seen);
+    TEST_ASSERT_EQUAL(0, loaded.address_of(EUI(99)));
+
+    // The next save has them all
+    TEST_ASSERT_EQUAL(node_save_done, save_all(nodes, file));
+    TEST_ASSERT_TRUE((loaded.load<FakeFile, CountingLock>(file)));
+    TEST_ASSERT_EQUAL(21, loaded.count());
+    TEST_ASSERT_EQUAL(6000, loaded.node(100)->last_seen);
+}
+
+// Fill the table with random DevEUIs and time the lookups the packet
+// path (by address) and the join path (by DevEUI) make
+void test_lookup_benchmark() {
+    static NodeRegistry<254> nodes(1);
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> euis;
+    while (euis.size() < 254) {
+        uint64_t eui = rng();
+        if (eui && !nodes.address_of(eui)) {
+            TEST_ASSERT_EQUAL(euis.size() + 1, nodes.join(eui, 0));
+            euis.push_back(eui);
+        }
+    }
+    TEST_ASSERT_EQUAL(254, nodes.count());
+
+    const int rounds = 2000;
+    uint32_t sum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < euis.size(); ++i)
+            sum += nodes.address_of(euis[i]);
+    double eui_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                    / (rounds * euis.size());
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (int a = 1; a <= 254; ++a)
+            sum += nodes.saw_frame(a, r, -60, 5)->address;
+    double frame_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+                      / (rounds * 254);
+
+    printf("254 nodes: DevEUI lookup %.1f ns, frame update %.1f ns, longest probe %u (checksum %u)\n", eui_ns,
+           frame_ns, nodes.max_probe(), sum);
+
+    for (size_t i = 0; i < euis.size(); ++i)
+        TEST_ASSERT_EQUAL(i + 1, nodes.address_of(euis[i]));
+    TEST_ASSERT_TRUE(nodes.max_probe() <= 16);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_join_assigns_stable_addresses);
+    RUN_TEST(test_full_table);
+    RUN_TEST(test_message_loss);
+    RUN_TEST(test_duplicate_suppression);
+    RUN_TEST(test_restart_inside_window);
+    RUN_TEST(test_save_and_load);
+    RUN_TEST(test_save_a_chunk_at_a_time);
+    RUN_TEST(test_lookup_benchmark);
+
+    UNITY_END();
+}
@@ -0,0 +1,220 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include "OutboundEngine.h"
+
+// Airtime at SF10/BW125/CR5 for a 4-byte time reply (plus the 4-byte
+// RadioHead header) and for a 1-byte ACK.
+#define REPLY_AIRTIME_MS 206
+#define ACK_AIRTIME_MS 165
+#define TIMEOUT_MS 400
+#define RETRIES 3
+
+static uint32_t sim_ms = 0;
+
+// A radio that is 'in TX' for the frame's airtime after start_send().
+class FakeRadio : public OutboundTransport {
+public:
+    uint32_t tx_end = 0;
+    uint32_t sends = 0;
+    uint8_t last_id = 0;
+    uint8_t last_to = 0;
+
+    bool start_send(uint8_t to, uint8_t id, const uint8_t *, uint8_t, bool) override {
+        ++sends;
+        last_id = id;
+        last_to = to;
+        tx_end = sim_ms + REPLY_AIRTIME_MS;
+        return true;
+    }
+
+    bool send_done() override {
+        return sim_ms >= tx_end;
+    }
+
+    void transmit_ack() {
+        tx_end = sim_ms + ACK_AIRTIME_MS;
+    }
+
+    bool transmitting() const {
+        return sim_ms < tx_end;
+    }
+};
+
+static outbound_result_t last_result;
+static int results = 0;
+
+void record_result(const outbound_result_t *result) {
+    last_result = *result;
+    ++results;
+}
+
+void test_reply_acked_first_try() {
+    FakeRadio radio;
+    OutboundEngine engine(radio, TIMEOUT_MS, RETRIES, record_result);
+    results = 0;
+    sim_ms = 0;
+
+    uint32_t now = 1234;
+    TEST_ASSERT_TRUE(engine.enqueue(4, &now, sizeof(now), sim_ms));
+    engine.service(sim_ms);
+    TEST_ASSERT_EQUAL(outbound_transmitting, engine.state());
+    TEST_ASSERT_EQUAL(4, radio.last_to);
+
+    sim_ms = REPLY_AIRTIME_MS;
+    engine.service(sim_ms);
+    TEST_ASSERT_EQUAL(outbound_waiting_for_ack, engine.state());
+
+    sim_ms += ACK_AIRTIME_MS;
+    engine.on_ack(4, radio.last_id);
+    engine.service(sim_ms);
+
+    TEST_ASSERT_EQUAL(1, results);
+    TEST_ASSERT_TRUE(last_result.acked);
+    TEST_ASSERT_EQUAL(0, last_result.retransmissions);
+    TEST_ASSERT_EQUAL(REPLY_AIRTIME_MS + ACK_AIRTIME_MS, last_result.duration_ms);
+    TEST_ASSERT_TRUE(engine.idle());
+}
+
+void test_reply_gives_up_after_retries() {
+    FakeRadio radio;
+    OutboundEngine engine(radio, TIMEOUT_MS, RETRIES, record_result);
+    results = 0;
+    sim_ms = 0;
+
+    uint32_t now = 1234;
+    engine.enqueue(4, &now, sizeof(now), sim_ms, 7);
+    for (; sim_ms < 10000 && results == 0; ++sim_ms)
+        engine.service(sim_ms);
+
+    TEST_ASSERT_EQUAL(1, results);
+    TEST_ASSERT_FALSE(last_result.acked);
+    TEST_ASSERT_EQUAL(7, last_result.tag);
+    TEST_ASSERT_EQUAL(RETRIES, last_result.retransmissions);
+    TEST_ASSERT_EQUAL(RETRIES + 1, radio.sends);
+    TEST_ASSERT_EQUAL(1, engine.failed());
+}
+
+void test_ack_from_wrong_node_or_id_ignored() {
+    FakeRadio radio;
+    OutboundEngine engine(radio, TIMEOUT_MS, RETRIES, record_result);
+    results = 0;
+    sim_ms = 0;
+
+    uint32_t now = 1234;
+    engine.enqueue(4, &now, sizeof(now), sim_ms);
+    engine.service(sim_ms);
+    sim_ms = REPLY_AIRTIME_MS;
+    engine.service(sim_ms);
+
+    engine.on_ack(5, radio.last_id);
+    engine.on_ack(4, radio.last_id + 1);
+    engine.service(++sim_ms);
+    TEST_ASSERT_EQUAL(0, results);
+    TEST_ASSERT_EQUAL(outbound_waiting_for_ack, engine.state());
+}
+
+void test_queue_is_bounded_and_fifo() {
+    FakeRadio radio;
+    OutboundEngine engine(radio, TIMEOUT_MS, RETRIES, record_result);
+    results = 0;
+    sim_ms = 0;
+
+    uint8_t b = 0;
+    for (uint8_t node = 1; node <= OUTBOUND_QUEUE_LEN; ++node)
+        TEST_ASSERT_TRUE(engine.enqueue(node, &b, 1, sim_ms));
+    TEST_ASSERT_FALSE(engine.enqueue(99, &b, 1, sim_ms));
+    TEST_ASSERT_EQUAL(1, engine.dropped());
+
+    for (uint8_t node = 1; node <= OUTBOUND_QUEUE_LEN; ++node) {
+        engine.service(sim_ms);
+        TEST_ASSERT_EQUAL(node, radio.last_to);
+        sim_ms += REPLY_AIRTIME_MS;
+        engine.service(sim_ms);
+        engine.on_ack(node, radio.last_id);
+        engine.service(++sim_ms);
+        TEST_ASSERT_EQUAL(node, last_result.to);
+    }
+
+    TEST_ASSERT_TRUE(engine.idle());
+    TEST_ASSERT_EQUAL(OUTBOUND_QUEUE_LEN, engine.sent());
+}
+
+/**
+ * Uplinks from other leaf nodes arrive every 'interval' ms while one
+ * reply is pending and the first 'lost_acks' ACKs for it are lost. With
+ * sendtoWait() every one of them is dropped, since RHReliableDatagram
+ * discards data frames while it waits for an ACK. With the engine, any
+ * uplink that arrives while the radio is not transmitting is received
+ * (and ACK'd, which keeps the radio busy for ACK_AIRTIME_MS).
+ *
+ * @return The number of uplinks received while the reply was pending
+ */
+int simulate_uplinks_during_reply(int lost_acks, uint32_t interval, int *offered) {
+    FakeRadio radio;
+    OutboundEngine engine(radio, TIMEOUT_MS, RETRIES, record_result);
+    results = 0;
+    sim_ms = 0;
+
+    uint32_t now = 1234;
+    engine.enqueue(4, &now, sizeof(now), sim_ms);
+
+    int serviced = 0;
+    *offered = 0;
+    uint32_t ack_due = 0;
+    uint32_t answered = 0;
+    for (; results == 0; ++sim_ms) {
+        engine.service(sim_ms);
+
+        // Leaf node 4 ACKs each transmission ACK_AIRTIME_MS after it ends,
+        // but the first 'lost_acks' of those ACKs never arrive.
+        if (engine.state() == outbound_waiting_for_ack && answered != radio.sends) {
+            answered = radio.sends;
+            if (radio.sends > (uint32_t)lost_acks)
+                ack_due = sim_ms + ACK_AIRTIME_MS;
+        }
+        if (ack_due != 0 && sim_ms >= ack_due) {
+            engine.on_ack(4, radio.last_id);
+            ack_due = 0;
+        }
+
+        if (sim_ms > 0 && sim_ms % interval == 0) {
+            ++*offered;
+            if (!radio.transmitting()) {
+                ++serviced;
+                radio.transmit_ack();
+            }
+        }
+    }
+
+    return serviced;
+}
+
+void benchmark_uplinks_serviced_while_reply_pending() {
+    const uint32_t interval = 250;
+    printf("Uplinks every %lu ms while a reply is pending\n", (unsigned long)interval);
+    for (int lost = 0; lost <= RETRIES; ++lost) {
+        int offered = 0;
+        int serviced = simulate_uplinks_during_reply(lost, interval, &offered);
+        printf("    %d lost ACKs: reply took %4lu ms, uplinks offered %2d, "
+               "serviced %2d async, 0 with sendtoWait()\n",
+               lost, (unsigned long)last_result.duration_ms, offered, serviced);
+        TEST_ASSERT_TRUE(last_result.acked);
+        TEST_ASSERT_EQUAL(lost, last_result.retransmissions);
+        TEST_ASSERT_TRUE(serviced > 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reply_acked_first_try);
+    RUN_TEST(test_reply_gives_up_after_retries);
+    RUN_TEST(test_ack_from_wrong_node_or_id_ignored);
+    RUN_TEST(test_queue_is_bounded_and_fifo);
+    RUN_TEST(benchmark_uplinks_serviced_while_reply_pending);
+
+    UNITY_END();
+}
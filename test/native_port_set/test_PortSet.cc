@@ -0,0 +1,248 @@
+#include <unity.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "IngestMerge.h"
+#include "PortSet.h"
+#include "SerialRecord.h"
+#include "data_packet.h"
+#include "messages.h"
+
+// The main nodes are pty pairs. PortSet opens a symlink to each pty's
+// slave side, as it would /dev/serial/by-id/...; the test writes to and
+// closes the master side. Unplugging is closing the master, plugging
+// back in is a new pty and the symlink pointed at it.
+
+#define RETRY_MS 20
+#define WAIT_MS 2000
+
+struct pty_t {
+    int master;
+    char link[64];
+};
+
+static char dir[] = "/tmp/test_PortSetXXXXXX";
+
+// Open a pty and point 'link' at its slave side
+static void plug(pty_t *p, const char *link) {
+    p->master = posix_openpt(O_RDWR | O_NOCTTY);
+    TEST_ASSERT_TRUE(p->master >= 0);
+    TEST_ASSERT_EQUAL(0, grantpt(p->master));
+    TEST_ASSERT_EQUAL(0, unlockpt(p->master));
+    snprintf(p->link, sizeof(p->link), "%s/%s", dir, link);
+    unlink(p->link);
+    TEST_ASSERT_EQUAL(0, symlink(ptsname(p->master), p->link));
+}
+
+static void unplug(pty_t *p) {
+    close(p->master);
+    p->master = -1;
+}
+
+struct ports_t {
+    std::string data[2];
+    int opened[2];
+    int closed[2];
+    PortSet *set;
+};
+
+static void port_data(uint8_t port, const uint8_t *data, size_t len, void *context) {
+    ((ports_t *)context)->data[port].append((const char *)data, len);
+}
+
+static void port_state(uint8_t port, bool open, void *context) {
+    ports_t *p = (ports_t *)context;
+    if (open) {
+        ++p->opened[port];
+        p->set->write(port, "B", 1);
+    }
+    else {
+        ++p->closed[port];
+    }
+}
+
+// poll() until 'done' or WAIT_MS
+template <class Done>
+static bool poll_until(PortSet &set, Done done) {
+    uint32_t start = PortSet::now_ms();
+    while (!done()) {
+        if (PortSet::now_ms() - start > WAIT_MS)
+            return false;
+        set.poll(10);
+    }
+    return true;
+}
+
+static std::string read_master(pty_t *p, size_t n) {
+    std::string s;
+    char c;
+    while (s.size() < n && read(p->master, &c, 1) == 1)
+        s += c;
+    return s;
+}
+
+void test_read_and_write() {
+    pty_t a, b;
+    plug(&a, "a");
+    plug(&b, "b");
+    ports_t ports = ports_t();
+    PortSet set(port_data, port_state, &ports, RETRY_MS);
+    ports.set = &set;
+    TEST_ASSERT_EQUAL(0, set.add(a.link));
+    TEST_ASSERT_EQUAL(1, set.add(b.link));
+
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return set.is_open(0) && set.is_open(1); }));
+    TEST_ASSERT_EQUAL_STRING("B", read_master(&a, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("B", read_master(&b, 1).c_str());
+
+    TEST_ASSERT_EQUAL(5, write(a.master, "hello", 5));
+    TEST_ASSERT_EQUAL(2, write(b.master, "hi", 2));
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return ports.data[0].size() == 5 && ports.data[1].size() == 2; }));
+    TEST_ASSERT_EQUAL_STRING("hello", ports.data[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("hi", ports.data[1].c_str());
+    TEST_ASSERT_EQUAL(5, set.stats(0).bytes);
+
+    unplug(&a);
+    unplug(&b);
+}
+
+void test_unplug_and_replug() {
+    pty_t a;
+    plug(&a, "a");
+    ports_t ports = ports_t();
+    PortSet set(port_data, port_state, &ports, RETRY_MS);
+    ports.set = &set;
+    set.add(a.link);
+
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return set.is_open(0); }));
+    read_master(&a, 1);
+
+    // Unplugged: the port closes, and is tried again without blocking the set
+    unplug(&a);
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return ports.closed[0] == 1; }));
+    TEST_ASSERT_FALSE(set.is_open(0));
+    uint32_t start = PortSet::now_ms();
+    TEST_ASSERT_EQUAL(0, set.poll(WAIT_MS));
+    TEST_ASSERT_LESS_THAN(WAIT_MS, PortSet::now_ms() - start);
+    TEST_ASSERT_EQUAL(1, ports.opened[0]);
+
+    // Plugged back in: it is opened again and switched to framed mode
+    plug(&a, "a");
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return ports.opened[0] == 2; }));
+    TEST_ASSERT_EQUAL_STRING("B", read_master(&a, 1).c_str());
+    TEST_ASSERT_EQUAL(4, write(a.master, "back", 4));
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return ports.data[0] == "back"; }));
+    TEST_ASSERT_EQUAL(2, set.stats(0).opens);
+    TEST_ASSERT_EQUAL(1, set.stats(0).closes);
+
+    unplug(&a);
+}
+
+typedef IngestMerge<2, 16> Merge;
+
+struct collector_t {
+    Merge merge;
+    SerialRecordReader *readers[2];
+    uint8_t ports[2];
+    std::string out;
+
+    collector_t() : merge(WAIT_MS) {}
+};
+
+static collector_t *collector;
+
+static void record(const serial_record_t *rec, void *context) {
+    uint8_t port = *(uint8_t *)context;
+    log_record_t frame;
+    if (rec->type != SERIAL_RECORD_FRAME || log_record_decode(rec->payload, rec->len, &frame) != rec->len)
+        return;
+    collector->merge.add(port, frame, PortSet::now_ms(), frame.rx_time);
+}
+
+static void collect_data(uint8_t port, const uint8_t *data, size_t len, void *) {
+    collector->readers[port]->add(data, len);
+    log_record_t rec;
+    uint8_t from;
+    while (collector->merge.next(PortSet::now_ms(), &rec, &from))
+        collector->out += (char)rec.payload[0];
+}
+
+static void collect_state(uint8_t port, bool open, void *) {
+    collector->merge.set_open(port, open);
+}
+
+// Main node 'p' received a one-byte frame 'c' at 'at'
+static void send_frame(pty_t *p, uint8_t sequence, char c, uint32_t at) {
+    log_record_t rec;
+    build_log_record(&rec, 1615909112 + at, -60, 9, text, 4, &c, 1);
+    uint8_t buf[LOG_RECORD_MAX_SIZE];
+    uint8_t wire[SERIAL_RECORD_MAX_ENCODED];
+    size_t len = encode_serial_record(SERIAL_RECORD_FRAME, sequence, buf, log_record_encode(&rec, buf), wire);
+    TEST_ASSERT_EQUAL(len, write(p->master, wire, len));
+}
+
+// Two main nodes, one of them behind and both hearing frame 'b'
+void test_merged_stream() {
+    pty_t a, b;
+    plug(&a, "a");
+    plug(&b, "b");
+    collector_t c;
+    collector = &c;
+    c.ports[0] = 0;
+    c.ports[1] = 1;
+    SerialRecordReader reader_a(record, &c.ports[0]), reader_b(record, &c.ports[1]);
+    c.readers[0] = &reader_a;
+    c.readers[1] = &reader_b;
+    PortSet set(collect_data, collect_state, 0, RETRY_MS);
+    set.add(a.link);
+    set.add(b.link);
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return set.is_open(0) && set.is_open(1); }));
+
+    send_frame(&a, 0, 'a', 0);
+    send_frame(&a, 1, 'b', 2);
+    send_frame(&a, 2, 'd', 4);
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return reader_a.stats().records == 3; }));
+    TEST_ASSERT_EQUAL_STRING("", c.out.c_str());
+
+    send_frame(&b, 0, 'b', 3);
+    send_frame(&b, 1, 'c', 3);
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return reader_b.stats().records == 2; }));
+    TEST_ASSERT_EQUAL_STRING("abc", c.out.c_str());
+    TEST_ASSERT_EQUAL(1, c.merge.stats(1).duplicates);
+
+    // Main node b is unplugged; a's last frame no longer waits for it
+    unplug(&b);
+    TEST_ASSERT_TRUE(poll_until(set, [&] { return !set.is_open(1); }));
+    log_record_t rec;
+    uint8_t from;
+    TEST_ASSERT_TRUE(c.merge.next(PortSet::now_ms(), &rec, &from));
+    TEST_ASSERT_EQUAL('d', rec.payload[0]);
+    TEST_ASSERT_EQUAL(0, c.merge.pending());
+
+    unplug(&a);
+}
+
+int main(int argc, char **argv) {
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return 1;
+    }
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_read_and_write);
+    RUN_TEST(test_unplug_and_replug);
+    RUN_TEST(test_merged_stream);
+
+    unlink((std::string(dir) + "/a").c_str());
+    unlink((std::string(dir) + "/b").c_str());
+    rmdir(dir);
+
+    UNITY_END();
+}
@@ -0,0 +1,197 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include <atomic>
+#include <thread>
+
+#include "RxQueue.h"
+
+#define DEPTH 8
+
+typedef RxQueue<DEPTH> TestQueue;
+
+// A frame whose payload is a function of its sequence number, so the
+// consumer can tell a torn or mixed-up slot from a good one.
+static bool push_frame(TestQueue &q, uint32_t seq) {
+    uint8_t data[20];
+    for (uint8_t i = 0; i < sizeof(data); ++i)
+        data[i] = (uint8_t)(seq * 7 + i);
+    return q.push(seq, -(int16_t)(seq % 120), (int8_t)(seq % 13), 0, seq % 250 + 1, (uint8_t)seq, 0, data,
+                  sizeof(data));
+}
+
+static bool check_frame(const rx_frame_t *f, uint32_t seq) {
+    if (f->rx_ms != seq || f->rssi != -(int16_t)(seq % 120) || f->snr != (int8_t)(seq % 13)
+        || f->from != seq % 250 + 1 || f->id != (uint8_t)seq || f->len != 20)
+        return false;
+    for (uint8_t i = 0; i < f->len; ++i)
+        if (f->data[i] != (uint8_t)(seq * 7 + i))
+            return false;
+    return true;
+}
+
+void test_fifo_order_and_metadata() {
+    TestQueue q;
+    TEST_ASSERT_TRUE(q.empty());
+    TEST_ASSERT_NULL(q.front());
+
+    for (uint32_t seq = 0; seq < 5; ++seq)
+        TEST_ASSERT_TRUE(push_frame(q, seq));
+    TEST_ASSERT_EQUAL(5, q.size());
+
+    for (uint32_t seq = 0; seq < 5; ++seq) {
+        const rx_frame_t *f = q.front();
+        TEST_ASSERT_NOT_NULL(f);
+        TEST_ASSERT_TRUE(check_frame(f, seq));
+        q.pop();
+    }
+    TEST_ASSERT_TRUE(q.empty());
+    TEST_ASSERT_EQUAL(5, q.pushed());
+    TEST_ASSERT_EQUAL(0, q.overflows());
+}
+
+// The consumer is busy (printing, logging, drawing) while a burst of
+// frames arrives; every burst up to the depth is kept.
+void test_burst_up_to_depth() {
+    TestQueue q;
+    uint32_t seq = 0, next = 0;
+    for (int round = 0; round < 100; ++round) {
+        for (uint16_t burst = 1; burst <= DEPTH; ++burst) {
+            for (uint16_t i = 0; i < burst; ++i)
+                TEST_ASSERT_TRUE(push_frame(q, seq++));
+
+            while (const rx_frame_t *f = q.front()) {
+                TEST_ASSERT_TRUE(check_frame(f, next++));
+                q.pop();
+            }
+        }
+    }
+
+    TEST_ASSERT_EQUAL(seq, next);
+    TEST_ASSERT_EQUAL(0, q.overflows());
+    TEST_ASSERT_EQUAL(DEPTH, q.high_water());
+}
+
+// Past the depth, the newest frames are dropped and counted
+void test_overflow() {
+    TestQueue q;
+    for (uint32_t seq = 0; seq < DEPTH + 3; ++seq)
+        push_frame(q, seq);
+
+    TEST_ASSERT_EQUAL(DEPTH, q.size());
+    TEST_ASSERT_EQUAL(DEPTH, q.pushed());
+    TEST_ASSERT_EQUAL(3, q.overflows());
+
+    for (uint32_t seq = 0; seq < DEPTH; ++seq) {
+        TEST_ASSERT_TRUE(check_frame(q.front(), seq));
+        q.pop();
+    }
+    TEST_ASSERT_TRUE(q.empty());
+
+    uint8_t big[RX_FRAME_MAX_LEN + 1] = {0};
+    TEST_ASSERT_FALSE(q.push(0, 0, 0, 0, 1, 1, 0, big, sizeof(big)));
+    TEST_ASSERT_EQUAL(1, q.oversize());
+    TEST_ASSERT_TRUE(q.empty());
+}
+
+// The producer (standing in for the interrupt handler) and the consumer
+// run on different threads. Bursts of up to DEPTH frames arrive back to
+// back; between bursts the producer waits until the queue is drained,
+// as it would be when the gap between bursts is longer than the time
+// loop() needs for the frames. Nothing may be lost or torn.
+void test_threaded_bursts() {
+    TestQueue q;
+    const uint32_t frames = 100000;
+    std::atomic<bool> done(false);
+    uint32_t received = 0, bad = 0;
+
+    std::thread consumer([&]() {
+        uint32_t spin = 0;
+        while (!done.load() || !q.empty()) {
+            const rx_frame_t *f = q.front();
+            if (!f) {
+                std::this_thread::yield();
+                continue;
+            }
+            // Work at an uneven pace
+            for (uint32_t i = 0; i < (++spin % 64); ++i)
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            if (!check_frame(f, received))
+                ++bad;
+            ++received;
+            q.pop();
+        }
+    });
+
+    uint32_t seq = 0;
+    uint16_t burst = 1;
+    while (seq < frames) {
+        for (uint16_t i = 0; i < burst && seq < frames; ++i)
+            push_frame(q, seq++);
+        burst = burst % DEPTH + 1;
+        while (!q.empty())
+            std::this_thread::yield();
+    }
+    done.store(true);
+    consumer.join();
+
+    printf("Bursts of 1 to %d frames: %u sent, %u received, %u overflows, %u bad, high water %u\n", DEPTH, seq,
+           received, q.overflows(), bad, q.high_water());
+    TEST_ASSERT_EQUAL(frames, received);
+    TEST_ASSERT_EQUAL(0, q.overflows());
+    TEST_ASSERT_EQUAL(0, bad);
+    TEST_ASSERT_EQUAL(DEPTH, q.high_water());
+}
+
+// A producer that never waits overruns the queue; the frames that get
+// through are intact and in order, and the rest are all counted.
+void test_threaded_overrun() {
+    TestQueue q;
+    const uint32_t frames = 100000;
+    std::atomic<bool> done(false);
+    uint32_t received = 0, bad = 0, last = 0;
+    bool first = true;
+
+    std::thread consumer([&]() {
+        while (!done.load() || !q.empty()) {
+            const rx_frame_t *f = q.front();
+            if (!f) {
+                std::this_thread::yield();
+                continue;
+            }
+            if ((!first && f->rx_ms <= last) || !check_frame(f, f->rx_ms))
+                ++bad;
+            first = false;
+            last = f->rx_ms;
+            ++received;
+            q.pop();
+        }
+    });
+
+    for (uint32_t seq = 0; seq < frames; ++seq) {
+        push_frame(q, seq);
+        if (seq % 16 == 0)
+            std::this_thread::yield();
+    }
+    done.store(true);
+    consumer.join();
+
+    printf("Free running: %u sent, %u received, %u overflows, %u bad\n", frames, received, q.overflows(), bad);
+    TEST_ASSERT_EQUAL(frames, received + q.overflows());
+    TEST_ASSERT_EQUAL(received, q.pushed());
+    TEST_ASSERT_EQUAL(0, bad);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_fifo_order_and_metadata);
+    RUN_TEST(test_burst_up_to_depth);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_threaded_bursts);
+    RUN_TEST(test_threaded_overrun);
+
+    UNITY_END();
+}
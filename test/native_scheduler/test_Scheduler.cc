@@ -0,0 +1,178 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "Scheduler.h"
+
+// A clock the tests and the tasks move; a task 'takes' time by advancing it
+struct FakeClock {
+    static uint32_t now_us;
+    static uint32_t ms() { return now_us / 1000; }
+    static uint32_t us() { return now_us; }
+};
+
+uint32_t FakeClock::now_us = 0;
+
+typedef Scheduler<FakeClock> FakeScheduler;
+
+static std::string order;
+static bool sd_blocked = false;
+static uint32_t radio_runs = 0;
+
+static void clear() {
+    FakeClock::now_us = 0;
+    order.clear();
+    sd_blocked = false;
+    radio_runs = 0;
+}
+
+static bool radio() {
+    ++radio_runs;
+    FakeClock::now_us += 50;
+    return true;
+}
+
+static bool a() { order += "a"; FakeClock::now_us += 100; return true; }
+static bool b() { order += "b"; FakeClock::now_us += 100; return true; }
+static bool c() { order += "c"; FakeClock::now_us += 100; return true; }
+
+static bool sd() {
+    if (sd_blocked)
+        return false;
+    order += "s";
+    FakeClock::now_us += 8000;
+    return true;
+}
+
+void test_earliest_deadline_first() {
+    clear();
+    FakeScheduler s;
+    s.every(a, 30, "a", 30);
+    s.every(b, 10, "b", 10);
+    s.every(c, 20, "c", 20);
+
+    // Nothing is due yet
+    TEST_ASSERT_FALSE(s.service());
+    TEST_ASSERT_EQUAL_STRING("", order.c_str());
+
+    // All three are due; the one due first runs first, one a pass. Each
+    // was more than a period late, so none is due again until 50 ms.
+    FakeClock::now_us = 40000;
+    while (s.service())
+        ;
+    TEST_ASSERT_EQUAL_STRING("bca", order.c_str());
+    FakeClock::now_us = 50000;
+    while (s.service())
+        ;
+    TEST_ASSERT_EQUAL_STRING("bcab", order.c_str());
+}
+
+void test_period_without_catching_up() {
+    clear();
+    FakeScheduler s;
+    int8_t t = s.every(a, 10, "a");
+
+    // On time: the next deadline is one period after the last
+    s.service();
+    FakeClock::now_us = 10000;
+    s.service();
+    TEST_ASSERT_EQUAL(2, s.stats(t).runs);
+
+    // Held up for 100 ms: it runs once, not ten times
+    FakeClock::now_us = 120000;
+    while (s.service())
+        ;
+    TEST_ASSERT_EQUAL(3, s.stats(t).runs);
+    TEST_ASSERT_EQUAL(100, s.stats(t).max_late_ms);
+
+    FakeClock::now_us = 129000;
+    TEST_ASSERT_FALSE(s.service());
+    FakeClock::now_us = 130000;
+    TEST_ASSERT_TRUE(s.service());
+}
+
+void test_deferred_task_stays_due() {
+    clear();
+    FakeScheduler s;
+    int8_t t_sd = s.every(sd, 0, "sd");
+    s.every(a, 5, "a", 5);
+
+    // Frames are waiting: the SD task gives its pass to the next task
+    sd_blocked = true;
+    FakeClock::now_us = 10000;
+    TEST_ASSERT_TRUE(s.service());
+    TEST_ASSERT_EQUAL_STRING("a", order.c_str());
+    TEST_ASSERT_FALSE(s.service());
+    TEST_ASSERT_EQUAL(2, s.stats(t_sd).deferred);
+
+    sd_blocked = false;
+    TEST_ASSERT_TRUE(s.service());
+    TEST_ASSERT_EQUAL_STRING("as", order.c_str());
+    TEST_ASSERT_EQUAL(1, s.stats(t_sd).runs);
+}
+
+void test_stop_and_wake() {
+    clear();
+    FakeScheduler s;
+    int8_t t = s.every(a, 1000, "a", 1000);
+
+    s.stop(t);
+    FakeClock::now_us = 2000000;
+    TEST_ASSERT_FALSE(s.service());
+
+    s.wake(t);
+    TEST_ASSERT_TRUE(s.service());
+    TEST_ASSERT_TRUE(s.active(t));
+    TEST_ASSERT_EQUAL_STRING("a", order.c_str());
+}
+
+// Everything at once: the radio and serial poll tasks, a slow SD task that
+// always has work and four periodic tasks. The radio must run at least
+// once per the poll tasks plus the longest timed task, and every task
+// must still get its turn.
+void test_radio_latency_under_load() {
+    clear();
+    FakeScheduler s;
+    int8_t t_radio = s.poll(radio, "radio");
+    s.poll(c, "serial");
+    int8_t t_sd = s.every(sd, 0, "sd");
+    s.every(a, 1, "a");
+    s.every(b, 2, "b");
+    s.every(a, 3, "a3");
+    s.every(b, 1000, "b1000");
+
+    for (int i = 0; i < 20000; ++i)
+        s.service();
+
+    const uint32_t bound_us = 50 + 100 + 8000;
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Worst-case radio gap: %u us (bound %u us) over %u passes",
+             (unsigned)s.max_poll_gap_us(), (unsigned)bound_us, (unsigned)s.passes());
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_LESS_OR_EQUAL(bound_us, s.max_poll_gap_us());
+    TEST_ASSERT_EQUAL(20000, s.stats(t_radio).runs);
+    TEST_ASSERT_EQUAL(8000, s.stats(t_sd).max_run_us);
+
+    // The SD task, due on every pass, does not starve the periodic tasks:
+    // each runs within about one SD run of its deadline
+    for (uint8_t i = 0; i < s.count(); ++i) {
+        TEST_ASSERT_GREATER_THAN(0, s.stats(i).runs);
+        TEST_ASSERT_LESS_OR_EQUAL(2 * 9, s.stats(i).max_late_ms);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_earliest_deadline_first);
+    RUN_TEST(test_period_without_catching_up);
+    RUN_TEST(test_deferred_task_stays_due);
+    RUN_TEST(test_stop_and_wake);
+    RUN_TEST(test_radio_latency_under_load);
+
+    UNITY_END();
+}
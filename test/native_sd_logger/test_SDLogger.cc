@@ -0,0 +1,390 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "SDLogger.h"
+
+// A stand-in for SdFat's SdFile. It keeps the file in memory and charges
+// simulated time to 'sim_clock_us' using a simple model of an SD card on
+// the M0's SPI bus at SPI_HALF_SPEED (~4 MHz): one 512-byte sector transfer
+// costs about 1.1 ms, one FAT sector covers 128 clusters and the card has
+// 32 KiB clusters. Only the relative costs matter for the benchmark.
+
+#define SECTOR_US 1100
+#define CLUSTER_SIZE 32768
+#define FAT_ENTRIES_PER_SECTOR 128
+
+#define SIM_O_WRONLY 0x01
+#define SIM_O_CREAT 0x02
+#define SIM_O_APPEND 0x04
+
+static uint64_t sim_clock_us = 0;
+
+class FakeSdFile {
+    std::string d_data;
+    uint32_t d_pos = 0;
+    bool d_open = false;
+
+    // Bytes in the card's cache sector; a write that does not fill a
+    // whole aligned sector costs a read and a write.
+    void charge_write(uint32_t pos, size_t n) {
+        while (n > 0) {
+            uint32_t in_sector = SD_SECTOR_SIZE - (pos % SD_SECTOR_SIZE);
+            uint32_t chunk = (n < in_sector) ? n : in_sector;
+            sim_clock_us += (chunk == SD_SECTOR_SIZE) ? SECTOR_US : 2 * SECTOR_US;
+            pos += chunk;
+            n -= chunk;
+        }
+    }
+
+public:
+    uint32_t opens = 0;
+    uint32_t writes = 0;
+    uint32_t syncs = 0;
+    bool preallocated = false;
+    bool fail = false;          // writes fail, as with a card that was pulled
+    uint32_t busy_us = 0;       // the card programs a write this long
+    uint64_t busy_until_us = 0;
+
+    // Preload the file so the benchmark starts with a months-old log
+    void preload(uint32_t size) {
+        d_data.assign(size, 'x');
+    }
+
+    bool open(const char *, int oflag) {
+        ++opens;
+        d_open = true;
+        // Directory lookup
+        sim_clock_us += SECTOR_US;
+        d_pos = 0;
+        if (oflag & SIM_O_APPEND)
+            seekSet(d_data.size());
+        return true;
+    }
+
+    bool seekSet(uint32_t pos) {
+        // Seeking from the start of the file walks the cluster chain, one FAT
+        // sector per FAT_ENTRIES_PER_SECTOR clusters.
+        uint32_t clusters = pos / CLUSTER_SIZE;
+        sim_clock_us += (uint64_t)(clusters / FAT_ENTRIES_PER_SECTOR + 1) * SECTOR_US;
+        d_pos = pos;
+        return true;
+    }
+
+    uint32_t fileSize() const {
+        return d_data.size();
+    }
+
+    bool preAllocate(uint32_t) {
+        preallocated = true;
+        return true;
+    }
+
+    size_t write(const void *buf, size_t n) {
+        ++writes;
+        if (fail)
+            return 0;
+        // Like SdFat, wait for the card to finish the last write first
+        if (sim_clock_us < busy_until_us)
+            sim_clock_us = busy_until_us;
+        charge_write(d_pos, n);
+        busy_until_us = sim_clock_us + busy_us;
+        d_data.replace(d_pos, n, (const char *)buf, n);
+        d_pos += n;
+        return n;
+    }
+
+    bool sync() {
+        ++syncs;
+        // Write the cached sector, read and write the directory entry
+        sim_clock_us += 2 * SECTOR_US;
+        return true;
+    }
+
+    bool close() {
+        sync();
+        d_open = false;
+        return true;
+    }
+
+    const std::string &data() const {
+        return d_data;
+    }
+};
+
+// Record the longest span of simulated time spent with 'interrupts off'
+struct SimCriticalSection {
+    static uint64_t start;
+    static uint64_t worst;
+    static void lock() { start = sim_clock_us; }
+    static void unlock() {
+        if (sim_clock_us - start > worst)
+            worst = sim_clock_us - start;
+    }
+};
+
+uint64_t SimCriticalSection::start = 0;
+uint64_t SimCriticalSection::worst = 0;
+
+typedef SDLogger<FakeSdFile, SimCriticalSection> TestLogger;
+
+#define RECORD "4, 1, 1615887488, 416, 0, 2043, 2962, 0x00"
+#define MONTHS_OLD_LOG (48UL * 1024 * 1024)
+#define RECORDS 2000
+
+void test_records_reach_the_file_in_order() {
+    FakeSdFile file;
+    TestLogger logger(file);
+
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 1024 * 1024, 0));
+    TEST_ASSERT_TRUE(file.preallocated);
+
+    char line[32];
+    std::string expected;
+    for (int i = 0; i < 200; ++i) {
+        snprintf(line, sizeof(line), "record %d", i);
+        TEST_ASSERT_TRUE(logger.log(line, i));
+        expected += line;
+        expected += "\r\n";
+        logger.service(i);
+    }
+
+    logger.flush();
+    TEST_ASSERT_EQUAL(0, logger.pending());
+    TEST_ASSERT_TRUE(file.data() == expected);
+    TEST_ASSERT_EQUAL(1, file.opens);
+}
+
+void test_only_whole_sectors_until_flush_interval() {
+    FakeSdFile file;
+    TestLogger logger(file, 1000, 60000);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    logger.log(RECORD, 0);
+    logger.service(10);
+    TEST_ASSERT_EQUAL(0, file.writes);
+
+    // After the flush interval the partial sector is written
+    logger.service(1000);
+    TEST_ASSERT_EQUAL(1, logger.stats().partial_writes);
+    TEST_ASSERT_EQUAL(0, logger.pending());
+
+    // Fill past a sector; the next write realigns on the sector boundary
+    while (logger.pending() < SD_SECTOR_SIZE)
+        logger.log(RECORD, 1100);
+    logger.service(1100);
+    TEST_ASSERT_EQUAL(0, file.data().size() % SD_SECTOR_SIZE);
+}
+
+// A partial sector that could not be written is an error, not a partial write
+void test_failed_partial_write_is_not_counted() {
+    FakeSdFile file;
+    TestLogger logger(file, 1000, 60000);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    logger.log(RECORD, 0);
+    file.fail = true;
+    logger.service(1000);
+    TEST_ASSERT_EQUAL(0, logger.stats().partial_writes);
+    TEST_ASSERT_EQUAL(1, logger.stats().errors);
+    TEST_ASSERT_EQUAL(strlen(RECORD) + 2, logger.pending());
+
+    file.fail = false;
+    logger.service(1000);
+    TEST_ASSERT_EQUAL(1, logger.stats().partial_writes);
+    TEST_ASSERT_EQUAL(0, logger.pending());
+
+    // Nor is a failed full sector
+    FakeSdFile file2;
+    TestLogger logger2(file2, 1000, 60000);
+    TEST_ASSERT_TRUE(logger2.begin("log2.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+    while (logger2.pending() < SD_SECTOR_SIZE)
+        logger2.log(RECORD, 0);
+    file2.fail = true;
+    TEST_ASSERT_FALSE(logger2.write_sectors(true));
+    TEST_ASSERT_EQUAL(0, logger2.stats().sectors);
+    TEST_ASSERT_EQUAL(1, logger2.stats().errors);
+
+    file2.fail = false;
+    TEST_ASSERT_TRUE(logger2.write_sectors(true));
+    TEST_ASSERT_EQUAL(1, logger2.stats().sectors);
+}
+
+void test_appends_to_existing_file_without_preallocating() {
+    FakeSdFile file;
+    file.preload(1000);
+    TestLogger logger(file);
+
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 1024 * 1024, 0));
+    TEST_ASSERT_FALSE(file.preallocated);
+    TEST_ASSERT_EQUAL(1000, logger.position());
+
+    logger.log(RECORD, 0);
+    logger.flush();
+    TEST_ASSERT_EQUAL(1000 + strlen(RECORD) + 2, file.data().size());
+}
+
+void test_sync_schedule() {
+    FakeSdFile file;
+    TestLogger logger(file, 100, 1000);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    for (uint32_t t = 0; t < 10000; t += 50) {
+        logger.log(RECORD, t);
+        logger.service(t);
+    }
+
+    // roughly one sync per second, never one per record
+    TEST_ASSERT_TRUE(logger.stats().syncs >= 9 && logger.stats().syncs <= 10);
+}
+
+void test_full_buffer_drops_are_counted() {
+    FakeSdFile file;
+    SDLogger<FakeSdFile, SimCriticalSection, 1> logger(file);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    char big[400];
+    memset(big, 'a', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    TEST_ASSERT_TRUE(logger.log(big, 0));
+    // Only 110 bytes left and less than a whole sector to write, so drop
+    TEST_ASSERT_FALSE(logger.log(big, 0));
+    TEST_ASSERT_EQUAL(1, logger.stats().dropped);
+}
+
+static bool card_ready = true;
+static bool test_card_ready() { return card_ready; }
+
+void test_busy_card_defers_writes() {
+    FakeSdFile file;
+    TestLogger logger(file, 100, 1000);
+    logger.set_ready_check(test_card_ready);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    card_ready = false;
+    for (int i = 0; i < 30; ++i)
+        logger.log(RECORD, 0);
+    logger.service(2000);
+    TEST_ASSERT_EQUAL(0, file.writes);
+    TEST_ASSERT_EQUAL(0, file.syncs);
+    TEST_ASSERT_EQUAL(1, logger.stats().deferred);
+    TEST_ASSERT_EQUAL(30 * (strlen(RECORD) + 2), logger.pending());
+
+    // Once the card is ready, the sectors, the partial sector and the sync go out
+    card_ready = true;
+    logger.service(2000);
+    TEST_ASSERT_EQUAL(0, logger.pending());
+    TEST_ASSERT_EQUAL(1, file.syncs);
+    TEST_ASSERT_EQUAL(30 * (strlen(RECORD) + 2), file.data().size());
+
+    // flush_soon() writes the partial sector and syncs without waiting
+    // for the intervals, but not while the card is busy
+    logger.log(RECORD, 2000);
+    logger.flush_soon();
+    card_ready = false;
+    logger.service(2001);
+    TEST_ASSERT_TRUE(logger.flushing());
+    TEST_ASSERT_EQUAL(strlen(RECORD) + 2, logger.pending());
+    card_ready = true;
+    logger.service(2001);
+    TEST_ASSERT_FALSE(logger.flushing());
+    TEST_ASSERT_EQUAL(0, logger.pending());
+    TEST_ASSERT_EQUAL(2, file.syncs);
+}
+
+static FakeSdFile *busy_file;
+static bool busy_file_ready() { return sim_clock_us >= busy_file->busy_until_us; }
+
+// The card is busy for 300 ms after each write and a record comes every
+// 10 ms, so the buffer fills. Records are dropped, but no write waits
+// out the busy time with the bus held.
+void test_full_buffer_does_not_wait_for_busy_card() {
+    FakeSdFile file;
+    file.busy_us = 300000;
+    busy_file = &file;
+    TestLogger logger(file, 1000, 60000);
+    logger.set_ready_check(busy_file_ready);
+    TEST_ASSERT_TRUE(logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0));
+
+    sim_clock_us = 0;
+    SimCriticalSection::worst = 0;
+    for (uint32_t t = 0; t < 10000; t += 10) {
+        if (sim_clock_us < t * 1000ULL)
+            sim_clock_us = t * 1000ULL;
+        logger.log(RECORD, t);
+        logger.service(t);
+    }
+    TEST_ASSERT_TRUE(logger.stats().dropped > 0);
+    TEST_ASSERT_TRUE(SimCriticalSection::worst <= 2 * SECTOR_US);
+
+    // What was staged is all there, in order
+    logger.flush();
+    TEST_ASSERT_EQUAL(logger.stats().bytes, file.data().size());
+}
+
+/**
+ * Compare the original open/append/println/close pattern with the logger,
+ * both writing to a log that already holds MONTHS_OLD_LOG bytes.
+ */
+void benchmark_legacy_vs_buffered() {
+    // Legacy: open with O_APPEND, write, close, all with interrupts off.
+    FakeSdFile legacy_file;
+    legacy_file.preload(MONTHS_OLD_LOG);
+    SimCriticalSection::worst = 0;
+    sim_clock_us = 0;
+    for (int i = 0; i < RECORDS; ++i) {
+        SimCriticalSection::lock();
+        legacy_file.open("log.csv", SIM_O_WRONLY | SIM_O_CREAT | SIM_O_APPEND);
+        legacy_file.write(RECORD "\r\n", strlen(RECORD) + 2);
+        legacy_file.close();
+        SimCriticalSection::unlock();
+    }
+    uint64_t legacy_total = sim_clock_us;
+    uint64_t legacy_worst = SimCriticalSection::worst;
+
+    // Buffered: one uplink every 500 ms; service() every loop.
+    FakeSdFile file;
+    file.preload(MONTHS_OLD_LOG);
+    TestLogger logger(file);
+    logger.begin("log.csv", SIM_O_WRONLY | SIM_O_CREAT, 0, 0);
+    SimCriticalSection::worst = 0;
+    sim_clock_us = 0;
+    for (int i = 0; i < RECORDS; ++i) {
+        logger.log(RECORD, i * 500);
+        logger.service(i * 500);
+    }
+    logger.flush();
+    uint64_t buffered_total = sim_clock_us;
+    uint64_t buffered_worst = SimCriticalSection::worst;
+
+    printf("SD logging, %d records, %lu byte existing log\n", RECORDS, MONTHS_OLD_LOG);
+    printf("    open/append/close: %8.1f us/record, worst interrupts off %6lu us\n",
+           (double)legacy_total / RECORDS, (unsigned long)legacy_worst);
+    printf("    buffered logger:   %8.1f us/record, worst interrupts off %6lu us\n",
+           (double)buffered_total / RECORDS, (unsigned long)buffered_worst);
+
+    TEST_ASSERT_TRUE(buffered_total < legacy_total);
+    TEST_ASSERT_TRUE(buffered_worst <= 2 * SECTOR_US);
+    TEST_ASSERT_TRUE(buffered_worst < legacy_worst);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_records_reach_the_file_in_order);
+    RUN_TEST(test_only_whole_sectors_until_flush_interval);
+    RUN_TEST(test_failed_partial_write_is_not_counted);
+    RUN_TEST(test_appends_to_existing_file_without_preallocating);
+    RUN_TEST(test_sync_schedule);
+    RUN_TEST(test_full_buffer_drops_are_counted);
+    RUN_TEST(test_busy_card_defers_writes);
+    RUN_TEST(test_full_buffer_does_not_wait_for_busy_card);
+    RUN_TEST(benchmark_legacy_vs_buffered);
+
+    UNITY_END();
+}
@@ -0,0 +1,336 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "BinaryLog.h"
+#include "COBS.h"
+#include "SerialOut.h"
+#include "SerialRecord.h"
+
+// A stand-in for the serial port and the host at the other end. The
+// host takes HOST_BUF bytes at a time at HOST_NS_PER_BYTE while it is
+// reading. availableForWrite() is the room left in its buffer; a write
+// bigger than that blocks, charging simulated time to 'sim_clock_us',
+// until the host makes room, or, if the host has stopped reading, for
+// WRITE_TIMEOUT_US, after which the rest is lost.
+
+#define HOST_BUF 64
+#define HOST_NS_PER_BYTE 1000
+#define WRITE_TIMEOUT_US 70000
+
+static uint64_t sim_clock_us = 0;
+
+class FakePort {
+    uint32_t d_pending = 0;     // bytes in the host buffer
+    uint64_t d_drained_us = 0;
+
+    void drain() {
+        if (reading) {
+            uint64_t bytes = (sim_clock_us - d_drained_us) * 1000 / HOST_NS_PER_BYTE;
+            d_pending -= bytes < d_pending ? bytes : d_pending;
+        }
+        d_drained_us = sim_clock_us;
+    }
+
+public:
+    bool reading = true;
+    std::string received;
+
+    int availableForWrite() {
+        drain();
+        return HOST_BUF - d_pending;
+    }
+
+    size_t write(const uint8_t *buf, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+            drain();
+            if (d_pending == HOST_BUF) {
+                if (!reading) {
+                    sim_clock_us += WRITE_TIMEOUT_US;
+                    break;
+                }
+                sim_clock_us += HOST_NS_PER_BYTE / 1000;
+                continue;
+            }
+            size_t n = len - sent < HOST_BUF - d_pending ? len - sent : HOST_BUF - d_pending;
+            received.append((const char *)buf + sent, n);
+            d_pending += n;
+            sent += n;
+        }
+        return sent;
+    }
+};
+
+static std::vector<std::string> lines_of(const std::string &s) {
+    std::vector<std::string> lines;
+    size_t start = 0, nl;
+    while ((nl = s.find('\n', start)) != std::string::npos) {
+        lines.push_back(s.substr(start, nl - start + 1));
+        start = nl + 1;
+    }
+    return lines;
+}
+
+template <class Out>
+static void print(Out &out, const char *s) {
+    out.write((const uint8_t *)s, strlen(s));
+}
+
+void test_cobs_round_trip() {
+    const size_t sizes[] = {1, 2, 253, 254, 255, 256, 508, 509, 600};
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        for (int pattern = 0; pattern < 3; ++pattern) {
+            std::vector<uint8_t> in(sizes[k]);
+            for (size_t i = 0; i < in.size(); ++i)
+                in[i] = pattern == 0 ? 0 : pattern == 1 ? (uint8_t)(i % 255 + 1) : (uint8_t)(i * 7 % 5);
+
+            std::vector<uint8_t> enc(COBS_MAX_ENCODED(in.size()));
+            size_t n = cobs_encode(in.data(), in.size(), enc.data());
+            TEST_ASSERT_TRUE(n <= enc.size());
+            for (size_t i = 0; i < n; ++i)
+                TEST_ASSERT_NOT_EQUAL(0, enc[i]);
+
+            std::vector<uint8_t> dec(n);
+            TEST_ASSERT_EQUAL(in.size(), cobs_decode(enc.data(), n, dec.data()));
+            TEST_ASSERT_EQUAL_MEMORY(in.data(), dec.data(), in.size());
+        }
+    }
+
+    // A code that runs past the end, and a zero inside a frame
+    const uint8_t bad1[] = {5, 1, 2};
+    const uint8_t bad2[] = {3, 1, 0};
+    uint8_t out[8];
+    TEST_ASSERT_EQUAL(0, cobs_decode(bad1, sizeof(bad1), out));
+    TEST_ASSERT_EQUAL(0, cobs_decode(bad2, sizeof(bad2), out));
+}
+
+void test_text_lines_pass_through() {
+    sim_clock_us = 0;
+    FakePort port;
+    SerialOut<FakePort, 512> out(port);
+
+    print(out, "Received length: 20, ");
+    print(out, "from: 0x04\r\n");
+    TEST_ASSERT_EQUAL(1, out.stats().lines);
+    TEST_ASSERT_EQUAL(0, port.received.size());     // nothing goes to the port until service()
+
+    print(out, "Data: node: 4\r\npartial");
+    while (out.service() > 0)
+        sim_clock_us += 100;
+    TEST_ASSERT_EQUAL_STRING("Received length: 20, from: 0x04\r\nData: node: 4\r\n", port.received.c_str());
+
+    print(out, " line\r\n");
+    out.service();
+    TEST_ASSERT_EQUAL_STRING("Received length: 20, from: 0x04\r\nData: node: 4\r\npartial line\r\n",
+                             port.received.c_str());
+    TEST_ASSERT_TRUE(out.empty());
+}
+
+struct decoded_t {
+    std::vector<serial_record_t> records;
+    std::vector<std::string> payloads;
+};
+
+static void collect(const serial_record_t *rec, void *context) {
+    decoded_t *d = (decoded_t *)context;
+    d->records.push_back(*rec);
+    d->payloads.push_back(std::string((const char *)rec->payload, rec->len));
+}
+
+void test_framed_records() {
+    sim_clock_us = 0;
+    FakePort port;
+    SerialOut<FakePort, 1024> out(port);
+
+    print(out, "boot\r\n");
+    out.set_mode(serial_framed);
+    print(out, "Received length: 20\r\n");
+
+    log_record_t rec;
+    const uint8_t frame[] = {0, 1, 0, 0, 2, 0xff};      // zeros must survive the framing
+    build_log_record(&rec, 1615909112, -52, 11, 2, 4, frame, sizeof(frame));
+    uint8_t buf[LOG_RECORD_MAX_SIZE];
+    size_t len = log_record_encode(&rec, buf);
+    TEST_ASSERT_EQUAL(LOG_RECORD_HEADER_SIZE + sizeof(frame), len);
+    TEST_ASSERT_TRUE(out.write_record(SERIAL_RECORD_FRAME, buf, len));
+    print(out, "Data: node: 4\r\n");
+
+    while (!out.empty()) {
+        out.service();
+        sim_clock_us += 100;
+    }
+
+    // The text before the switch is one bad frame to the reader
+    decoded_t d;
+    SerialRecordReader reader(collect, &d);
+    reader.add((const uint8_t *)port.received.data(), port.received.size());
+    TEST_ASSERT_EQUAL(1, reader.stats().bad);
+    TEST_ASSERT_EQUAL(3, reader.stats().records);
+    TEST_ASSERT_EQUAL(0, reader.stats().lost);
+
+    TEST_ASSERT_EQUAL(SERIAL_RECORD_TEXT, d.records[0].type);
+    TEST_ASSERT_EQUAL_STRING("Received length: 20", d.payloads[0].c_str());
+    TEST_ASSERT_EQUAL(SERIAL_RECORD_FRAME, d.records[1].type);
+    TEST_ASSERT_EQUAL(len, d.payloads[1].size());
+    log_record_t back;
+    TEST_ASSERT_EQUAL(len, log_record_decode((const uint8_t *)d.payloads[1].data(), len, &back));
+    TEST_ASSERT_EQUAL_MEMORY(&rec, &back, len);
+    TEST_ASSERT_EQUAL_STRING("Data: node: 4", d.payloads[2].c_str());
+    TEST_ASSERT_EQUAL(d.records[0].sequence + 2, d.records[2].sequence);
+
+    // In text mode there are no binary records
+    out.set_mode(serial_text);
+    TEST_ASSERT_FALSE(out.write_record(SERIAL_RECORD_FRAME, buf, len));
+}
+
+void test_corrupt_record_is_skipped() {
+    uint8_t wire[3 * SERIAL_RECORD_MAX_ENCODED];
+    size_t n = 0;
+    n += encode_serial_record(SERIAL_RECORD_TEXT, 7, "one", 3, wire + n);
+    size_t second = n;
+    n += encode_serial_record(SERIAL_RECORD_TEXT, 8, "two", 3, wire + n);
+    n += encode_serial_record(SERIAL_RECORD_TEXT, 10, "four", 4, wire + n);
+    wire[second + 2] ^= 0x20;
+
+    decoded_t d;
+    SerialRecordReader reader(collect, &d);
+    reader.add(wire, n);
+    TEST_ASSERT_EQUAL(2, reader.stats().records);
+    TEST_ASSERT_EQUAL(1, reader.stats().bad);
+    TEST_ASSERT_EQUAL(2, reader.stats().lost);          // 8, the corrupt one, and 9
+    TEST_ASSERT_EQUAL_STRING("one", d.payloads[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("four", d.payloads[1].c_str());
+}
+
+// With the host gone, lines that don't fit are dropped whole; when the
+// host comes back it gets whole lines and a note of how many were lost
+void test_full_buffer_drops_whole_lines() {
+    sim_clock_us = 0;
+    FakePort port;
+    port.reading = false;
+    SerialOut<FakePort, 512> out(port);
+
+    char line[64];
+    for (int i = 0; i < 100; ++i) {
+        snprintf(line, sizeof(line), "Data: node: 4, message: %d, padding padding\r\n", i);
+        print(out, line);
+        out.service();
+        sim_clock_us += 1000;
+    }
+    TEST_ASSERT_TRUE(out.stats().dropped > 0);
+    TEST_ASSERT_EQUAL(100, out.stats().lines + out.stats().dropped);
+
+    port.reading = true;
+    for (int i = 0; i < 1000 && !out.empty(); ++i) {
+        out.service();
+        sim_clock_us += 1000;
+    }
+    print(out, "Data: node: 4, message: 100, padding padding\r\n");
+    for (int i = 0; i < 1000 && !out.empty(); ++i) {
+        out.service();
+        sim_clock_us += 1000;
+    }
+    TEST_ASSERT_TRUE(out.empty());
+
+    std::vector<std::string> lines = lines_of(port.received);
+    int notes = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].compare(0, 22, "Serial output dropped ") == 0) {
+            ++notes;
+            continue;
+        }
+        TEST_ASSERT_EQUAL_STRING_LEN("Data: node: 4, message: ", lines[i].c_str(), 24);
+        TEST_ASSERT_EQUAL_STRING(" padding padding\r\n", lines[i].c_str() + lines[i].size() - 18);
+    }
+    TEST_ASSERT_EQUAL(1, notes);
+    TEST_ASSERT_EQUAL_STRING("Data: node: 4, message: 100, padding padding\r\n", lines.back().c_str());
+}
+
+static void service(FakePort &) {}
+static void service(SerialOut<FakePort> &out) { out.service(); }
+
+// One pass of loop(): a frame arrives every 'every' passes and the node
+// prints four lines for it
+template <class Out>
+static uint64_t loop_pass(Out &out, int pass, int every) {
+    uint64_t start = sim_clock_us;
+    if (pass % every == 0) {
+        char line[200];
+        snprintf(line, sizeof(line),
+                 "\r\nCurrent time: 2021-03-16T09:38:35\r\n"
+                 "Received length: 20, from: 0x04, to: 0xff, id: 0x%02x, header: 0x00, type: data packet\r\n",
+                 pass & 0xff);
+        out.write((const uint8_t *)line, strlen(line));
+        snprintf(line, sizeof(line), "Data: node: 4, message: %d, time: 1615887488, Vbat 416 v, Tx dur 0 ms, "
+                 "T: 2043 C, RH: 2962 %%, status: 0x00, RSSI -52 dBm, SNR 11 dB, good/bad packets: 1/0\r\n", pass);
+        out.write((const uint8_t *)line, strlen(line));
+    }
+    service(out);
+    sim_clock_us += 200;    // the rest of loop()
+    return sim_clock_us - start;
+}
+
+// The worst loop() time with the host reading and after it stops, for
+// output written straight to the port and through SerialOut
+void test_loop_latency_flat_when_host_stops() {
+    const int passes = 4000, every = 50;
+    uint64_t direct_reading = 0, direct_stopped = 0, buffered_reading = 0, buffered_stopped = 0;
+
+    {
+        sim_clock_us = 0;
+        FakePort port;
+        for (int i = 0; i < passes; ++i) {
+            port.reading = i < passes / 2;
+            uint64_t t = loop_pass(port, i, every);
+            uint64_t &worst = port.reading ? direct_reading : direct_stopped;
+            if (t > worst)
+                worst = t;
+        }
+    }
+    {
+        sim_clock_us = 0;
+        FakePort port;
+        SerialOut<FakePort> out(port);
+        for (int i = 0; i < passes; ++i) {
+            port.reading = i < passes / 2;
+            uint64_t t = loop_pass(out, i, every);
+            uint64_t &worst = port.reading ? buffered_reading : buffered_stopped;
+            if (t > worst)
+                worst = t;
+        }
+        TEST_ASSERT_EQUAL(passes / every * 4, out.stats().lines + out.stats().dropped);
+        TEST_ASSERT_TRUE(out.stats().dropped > 0);
+    }
+
+    char msg[160];
+    snprintf(msg, sizeof(msg),
+             "worst loop() us: direct %llu reading, %llu stopped; buffered %llu reading, %llu stopped",
+             (unsigned long long)direct_reading, (unsigned long long)direct_stopped,
+             (unsigned long long)buffered_reading, (unsigned long long)buffered_stopped);
+    printf("%s\n", msg);
+
+    // Straight to the port, loop() waits for the host and then for the
+    // timeout; through SerialOut it takes the same time either way
+    TEST_ASSERT_TRUE_MESSAGE(direct_reading > 200 + 100, msg);
+    TEST_ASSERT_TRUE_MESSAGE(direct_stopped >= WRITE_TIMEOUT_US, msg);
+    TEST_ASSERT_EQUAL_MESSAGE(buffered_reading, buffered_stopped, msg);
+    TEST_ASSERT_TRUE_MESSAGE(buffered_reading < 200 + 100, msg);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_cobs_round_trip);
+    RUN_TEST(test_text_lines_pass_through);
+    RUN_TEST(test_framed_records);
+    RUN_TEST(test_corrupt_record_is_skipped);
+    RUN_TEST(test_full_buffer_drops_whole_lines);
+    RUN_TEST(test_loop_latency_flat_when_host_stops);
+
+    UNITY_END();
+}
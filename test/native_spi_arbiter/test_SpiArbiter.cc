@@ -0,0 +1,140 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "SpiArbiter.h"
+
+// A bus that logs what the arbiter asks of it. The clock is set by the
+// tests; 'masked' is true while the radio's interrupt would be held off.
+class FakeBus : public SpiBus {
+public:
+    uint32_t clock_us = 0;
+    bool masked = false;
+    std::string log;
+
+    void begin(SpiDevice device) override {
+        if (device != spi_radio)
+            masked = true;
+        log += "b";
+        log += SpiArbiter::device_name(device);
+        log += " ";
+    }
+
+    void end(SpiDevice device) override {
+        masked = false;
+        log += "e";
+        log += SpiArbiter::device_name(device);
+        log += " ";
+    }
+
+    uint32_t now_us() override { return clock_us; }
+};
+
+void test_hold_times_per_device() {
+    FakeBus bus;
+    SpiArbiter arbiter(bus, 1000);
+
+    arbiter.acquire(spi_sd);
+    TEST_ASSERT_EQUAL(spi_sd, arbiter.owner());
+    bus.clock_us += 600;
+    arbiter.release(spi_sd);
+    TEST_ASSERT_EQUAL(-1, arbiter.owner());
+
+    arbiter.acquire(spi_sd);
+    bus.clock_us += 1500;
+    arbiter.release(spi_sd);
+
+    arbiter.acquire(spi_tft);
+    bus.clock_us += 200;
+    arbiter.release(spi_tft);
+
+    const spi_hold_stats_t &sd = arbiter.stats(spi_sd);
+    TEST_ASSERT_EQUAL(2, sd.holds);
+    TEST_ASSERT_EQUAL(1500, sd.max_us);
+    TEST_ASSERT_EQUAL(2100, sd.total_us);
+    TEST_ASSERT_EQUAL(1, sd.over_budget);
+
+    const spi_hold_stats_t &tft = arbiter.stats(spi_tft);
+    TEST_ASSERT_EQUAL(1, tft.holds);
+    TEST_ASSERT_EQUAL(200, tft.max_us);
+    TEST_ASSERT_EQUAL(0, tft.over_budget);
+
+    TEST_ASSERT_EQUAL(0, arbiter.stats(spi_radio).holds);
+    TEST_ASSERT_EQUAL(0, arbiter.conflicts());
+
+    arbiter.reset_stats();
+    TEST_ASSERT_EQUAL(0, arbiter.stats(spi_sd).holds);
+    TEST_ASSERT_EQUAL(0, arbiter.stats(spi_sd).max_us);
+}
+
+void test_hold_across_clock_wrap() {
+    FakeBus bus;
+    SpiArbiter arbiter(bus);
+
+    bus.clock_us = 0xFFFFFF00;
+    arbiter.acquire(spi_sd);
+    bus.clock_us += 0x200;
+    arbiter.release(spi_sd);
+    TEST_ASSERT_EQUAL(0x200, arbiter.stats(spi_sd).max_us);
+}
+
+// The radio is never masked by its own holds and is not held to the budget
+void test_radio_holds() {
+    FakeBus bus;
+    SpiArbiter arbiter(bus, 100);
+
+    arbiter.acquire(spi_radio);
+    TEST_ASSERT_FALSE(bus.masked);
+    bus.clock_us += 300;
+    arbiter.release(spi_radio);
+
+    TEST_ASSERT_EQUAL(1, arbiter.stats(spi_radio).holds);
+    TEST_ASSERT_EQUAL(300, arbiter.stats(spi_radio).max_us);
+    TEST_ASSERT_EQUAL(0, arbiter.stats(spi_radio).over_budget);
+}
+
+// The radio is masked from before the owner is set until after it is
+// cleared, so its handler can't see a half-taken bus
+void test_bus_calls_bracket_the_hold() {
+    FakeBus bus;
+    SpiArbiter arbiter(bus);
+
+    arbiter.acquire(spi_tft);
+    TEST_ASSERT_TRUE(bus.masked);
+    arbiter.release(spi_tft);
+    TEST_ASSERT_FALSE(bus.masked);
+    arbiter.acquire(spi_sd);
+    arbiter.release(spi_sd);
+
+    TEST_ASSERT_EQUAL_STRING("btft etft bsd esd ", bus.log.c_str());
+}
+
+// A device that takes the bus while another holds it is counted: on the
+// M0 that means the radio's interrupt was not masked
+void test_conflicts_are_counted() {
+    FakeBus bus;
+    SpiArbiter arbiter(bus);
+
+    arbiter.acquire(spi_sd);
+    arbiter.acquire(spi_radio);
+    arbiter.release(spi_radio);
+    arbiter.release(spi_sd);
+
+    TEST_ASSERT_EQUAL(1, arbiter.conflicts());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_hold_times_per_device);
+    RUN_TEST(test_hold_across_clock_wrap);
+    RUN_TEST(test_radio_holds);
+    RUN_TEST(test_bus_calls_bracket_the_hold);
+    RUN_TEST(test_conflicts_are_counted);
+
+    UNITY_END();
+}
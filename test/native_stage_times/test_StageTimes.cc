@@ -0,0 +1,68 @@
+
+#include <unity.h>
+
+#include "StageTimes.h"
+
+void test_bins() {
+    TEST_ASSERT_EQUAL(0, StageTimes::bin(0));
+    TEST_ASSERT_EQUAL(1, StageTimes::bin(1));
+    TEST_ASSERT_EQUAL(2, StageTimes::bin(2));
+    TEST_ASSERT_EQUAL(2, StageTimes::bin(3));
+    TEST_ASSERT_EQUAL(11, StageTimes::bin(1024));
+    TEST_ASSERT_EQUAL(STAGE_BINS - 1, StageTimes::bin(1UL << 22));
+    TEST_ASSERT_EQUAL(STAGE_BINS - 1, StageTimes::bin(0xffffffff));
+
+    // Every time is within its bin's limit and above the one before
+    for (uint32_t us = 1; us < (1UL << 22); us = us * 3 + 1) {
+        uint8_t b = StageTimes::bin(us);
+        TEST_ASSERT_TRUE(us <= StageTimes::bin_limit_us(b));
+        TEST_ASSERT_TRUE(us > StageTimes::bin_limit_us(b - 1));
+    }
+}
+
+void test_add_and_percentiles() {
+    StageTimes times;
+    TEST_ASSERT_EQUAL(-1, times.percentile_bin(stage_log, 50));
+
+    for (int i = 0; i < 90; ++i)
+        times.add(stage_log, 100);      // bin 7, 64 to 127 us
+    for (int i = 0; i < 10; ++i)
+        times.add(stage_log, 5000);     // bin 13
+
+    const stage_stats_t &s = times.stats(stage_log);
+    TEST_ASSERT_EQUAL(100, s.count);
+    TEST_ASSERT_EQUAL(5000, s.max_us);
+    TEST_ASSERT_EQUAL(90 * 100 + 10 * 5000, (uint32_t)s.total_us);
+    TEST_ASSERT_EQUAL(90, s.bins[7]);
+
+    TEST_ASSERT_EQUAL(7, times.percentile_bin(stage_log, 0));
+    TEST_ASSERT_EQUAL(7, times.percentile_bin(stage_log, 50));
+    TEST_ASSERT_EQUAL(7, times.percentile_bin(stage_log, 89));
+    TEST_ASSERT_EQUAL(13, times.percentile_bin(stage_log, 90));
+    TEST_ASSERT_EQUAL(13, times.percentile_bin(stage_log, 100));
+
+    TEST_ASSERT_EQUAL(0, times.stats(stage_tft).count);
+    times.reset();
+    TEST_ASSERT_EQUAL(0, times.stats(stage_log).count);
+}
+
+void test_lap() {
+    StageTimes times;
+    uint32_t start = 0xfffffff0;        // micros() wraps
+    times.lap(stage_render, start, 0xfffffff0 + 40);
+    TEST_ASSERT_EQUAL(0xfffffff0 + 40, start);
+    times.lap(stage_serial, start, 100);
+    TEST_ASSERT_EQUAL(40, times.stats(stage_render).max_us);
+    TEST_ASSERT_EQUAL(100 - (uint32_t)(0xfffffff0 + 40), times.stats(stage_serial).max_us);
+    TEST_ASSERT_EQUAL(100, start);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_bins);
+    RUN_TEST(test_add_and_percentiles);
+    RUN_TEST(test_lap);
+
+    UNITY_END();
+}
@@ -0,0 +1,97 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "TextFormat.h"
+
+void test_integers() {
+    char text[64];
+    TextSpan s(text, sizeof(text));
+    s.put_uint(0).put(' ').put_uint(4294967295UL).put(' ').put_uint(7, 3).put(' ').put_uint(7, 3, '0');
+    TEST_ASSERT_EQUAL_STRING("0 4294967295   7 007", text);
+
+    TextSpan i(text, sizeof(text));
+    i.put_int(-5).put(' ').put_int(-5, 4).put(' ').put_int(-5, 4, '0').put(' ').put_int(INT32_MIN);
+    TEST_ASSERT_EQUAL_STRING("-5   -5 -005 -2147483648", text);
+
+    TextSpan h(text, sizeof(text));
+    h.put_hex(0).put(' ').put_hex(0x1f, 2).put(' ').put_hex(0xabc, 2).put(' ').put_hex(0xdeadbeef);
+    TEST_ASSERT_EQUAL_STRING("0 1f abc deadbeef", text);
+    TEST_ASSERT_EQUAL(17, h.length());
+    TEST_ASSERT_FALSE(h.truncated());
+}
+
+// The same text as printf() with centi / 100.0, except on the ties
+// printf() rounds by the nearest double
+void test_centi_matches_printf() {
+    char text[16], expected[16];
+    for (int32_t v = -2000; v <= 12000; ++v) {
+        snprintf(expected, sizeof(expected), "%3.2f", v / 100.0);
+        TextSpan(text, sizeof(text)).put_centi(v, 2, 3);
+        TEST_ASSERT_EQUAL_STRING(expected, text);
+
+        if (v % 10 == 5 || v % 10 == -5)
+            continue;
+        snprintf(expected, sizeof(expected), "%3.1f", v / 100.0);
+        TextSpan(text, sizeof(text)).put_centi(v, 1, 3);
+        TEST_ASSERT_EQUAL_STRING(expected, text);
+    }
+
+    // Ties go away from zero
+    TextSpan(text, sizeof(text)).put_centi(2045, 1);
+    TEST_ASSERT_EQUAL_STRING("20.5", text);
+    TextSpan(text, sizeof(text)).put_centi(-2045, 1);
+    TEST_ASSERT_EQUAL_STRING("-20.5", text);
+    TextSpan(text, sizeof(text)).put_centi(9995, 1);
+    TEST_ASSERT_EQUAL_STRING("100.0", text);
+    TextSpan(text, sizeof(text)).put_centi(-4, 1);
+    TEST_ASSERT_EQUAL_STRING("-0.0", text);
+    TextSpan(text, sizeof(text)).put_centi(250, 0, 3);
+    TEST_ASSERT_EQUAL_STRING("  3", text);
+}
+
+void test_iso8601() {
+    char text[ISO8601_CHARS];
+    TextSpan(text, sizeof(text)).put_iso8601(1615909112UL);
+    TEST_ASSERT_EQUAL_STRING("2021-03-16T15:38:32", text);
+
+    date_time_t t;
+    unix_date_time(951782400UL, &t);     // 2000-02-29, a leap day in a century year
+    TEST_ASSERT_EQUAL(2000, t.year);
+    TEST_ASSERT_EQUAL(2, t.month);
+    TEST_ASSERT_EQUAL(29, t.day);
+}
+
+// Nothing is written past the end and the text is always terminated
+void test_truncation() {
+    char text[8];
+    memset(text, 'x', sizeof(text));
+    TextSpan s(text, 6);
+    s.put("abc").put_uint(12345).put('z');
+    TEST_ASSERT_EQUAL_STRING("abc12", text);
+    TEST_ASSERT_TRUE(s.truncated());
+    TEST_ASSERT_EQUAL(5, s.length());
+    TEST_ASSERT_EQUAL('x', text[6]);
+
+    TextSpan one(text, 1);
+    one.put("a");
+    TEST_ASSERT_EQUAL_STRING("", text);
+    TEST_ASSERT_TRUE(one.truncated());
+
+    TextSpan some(text, sizeof(text));
+    some.put("CSVXYZ", 3);
+    TEST_ASSERT_EQUAL_STRING("CSV", text);
+    TEST_ASSERT_FALSE(some.truncated());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_integers);
+    RUN_TEST(test_centi_matches_printf);
+    RUN_TEST(test_iso8601);
+    RUN_TEST(test_truncation);
+
+    UNITY_END();
+}
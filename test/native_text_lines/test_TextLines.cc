@@ -0,0 +1,57 @@
+#include <unity.h>
+
+#include "TextLines.h"
+
+#define NOW 1615909112UL    // 2021-03-16T15:38:32
+
+void test_date_time() {
+    date_time_t t;
+    unix_date_time(NOW, &t);
+    TEST_ASSERT_EQUAL(2021, t.year);
+    TEST_ASSERT_EQUAL(3, t.month);
+    TEST_ASSERT_EQUAL(16, t.day);
+    TEST_ASSERT_EQUAL(15, t.hour);
+    TEST_ASSERT_EQUAL(38, t.minute);
+    TEST_ASSERT_EQUAL(32, t.second);
+
+    char text[ISO8601_CHARS];
+    TEST_ASSERT_EQUAL_STRING("2021-03-16T15:38:32", iso8601_date_time(NOW, text));
+    TEST_ASSERT_EQUAL_STRING("1970-01-01T00:00:00", iso8601_date_time(0, text));
+    TEST_ASSERT_EQUAL_STRING("2024-02-29T23:59:59", iso8601_date_time(1709251200UL - 1, text));
+    TEST_ASSERT_EQUAL_STRING("2106-02-07T06:28:15", iso8601_date_time(UINT32_MAX, text));
+}
+
+void test_reading_line() {
+    batch_reading_t r;
+    r.message = 1;
+    r.time = NOW;
+    r.battery = 416;
+    r.last_tx_duration = 370;
+    r.temp = 2041;
+    r.humidity = 2950;
+    r.status = 0;
+
+    char text[DATA_LINE_CHARS];
+    tft_get_reading_line(4, r, 38, 35, text);
+    TEST_ASSERT_EQUAL_STRING("4 38:35 20.4 29 4.16 0x00", text);
+
+    // Below zero, and the packet form
+    r.temp = -512;
+    r.status = 0x1f;
+    tft_get_reading_line(12, r, 0, 5, text);
+    TEST_ASSERT_EQUAL_STRING("12 00:05 -5.1 29 4.16 0x1f", text);
+
+    packet_t p;
+    build_data_packet(&p, 4, 1, NOW, 416, 370, 2041, 2950, 0);
+    tft_get_data_line(&p, 38, 35, text);
+    TEST_ASSERT_EQUAL_STRING("4 38:35 20.4 29 4.16 0x00", text);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_date_time);
+    RUN_TEST(test_reading_line);
+
+    UNITY_END();
+}
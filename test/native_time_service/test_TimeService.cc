@@ -0,0 +1,156 @@
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include "TimeService.h"
+
+#define EPOCH 1615909112UL
+
+static uint32_t sim_ms = 0;
+
+struct FakeDateTime {
+    uint32_t t;
+    uint32_t unixtime() const { return t; }
+    uint8_t minute() const { return (t / 60) % 60; }
+    uint8_t second() const { return t % 60; }
+};
+
+// An RTC whose seconds change 'phase_ms' after each multiple of 1000 in
+// sim_ms. Each now() is one I2C transaction.
+class FakeRTC {
+public:
+    uint32_t phase_ms = 0;
+    uint32_t transactions = 0;
+
+    uint32_t truth(uint32_t ms) const {
+        return EPOCH + (ms + 1000 - phase_ms) / 1000;
+    }
+
+    FakeDateTime now() {
+        ++transactions;
+        return FakeDateTime{truth(sim_ms)};
+    }
+};
+
+struct NoCriticalSection {
+    static void lock() {}
+    static void unlock() {}
+};
+
+typedef TimeService<FakeRTC, NoCriticalSection> TestTimeService;
+
+/**
+ * What loop() used to do for each data packet: read the time for the
+ * 'Current time' line, again for the reply, then (after the blocking
+ * reply, ~540 ms) twice more for the TFT line's minute and second.
+ */
+void test_legacy_reads_per_packet() {
+    FakeRTC rtc;
+    int disagreements = 0;
+    for (int packet = 0; packet < 100; ++packet) {
+        uint32_t start = packet * 2017;
+        sim_ms = start;
+        FakeDateTime t = rtc.now();
+        sim_ms = start + 20;
+        uint32_t reply = rtc.now().unixtime();
+        sim_ms = start + 540;
+        uint8_t min = rtc.now().minute();
+        sim_ms = start + 541;
+        uint8_t sec = rtc.now().second();
+        if (t.second() != sec || t.unixtime() != reply || t.minute() != min)
+            ++disagreements;
+    }
+
+    printf("Legacy: %u RTC transactions for 100 packets, %d packets with disagreeing times\n", rtc.transactions,
+           disagreements);
+    TEST_ASSERT_EQUAL(400, rtc.transactions);
+    TEST_ASSERT_TRUE(disagreements > 0);
+}
+
+void test_one_read_then_millis() {
+    FakeRTC rtc;
+    rtc.phase_ms = 0;
+    sim_ms = 0;
+    TestTimeService ts(rtc);
+    ts.begin(sim_ms);
+
+    for (int packet = 0; packet < 100; ++packet) {
+        sim_ms = packet * 2017;
+        ts.service(sim_ms);
+        uint32_t t = ts.now(sim_ms);
+        TEST_ASSERT_EQUAL(rtc.truth(sim_ms), t);
+    }
+
+    // 200 s is much less than the resync interval
+    TEST_ASSERT_EQUAL(1, rtc.transactions);
+    TEST_ASSERT_EQUAL(1, ts.rtc_reads());
+}
+
+void test_resync_schedule() {
+    FakeRTC rtc;
+    sim_ms = 0;
+    TestTimeService ts(rtc, 60000);
+    ts.begin(sim_ms);
+
+    for (sim_ms = 0; sim_ms < 600000; sim_ms += 100)
+        ts.service(sim_ms);
+
+    // Once a minute for ten minutes, plus begin()
+    TEST_ASSERT_EQUAL(10, rtc.transactions);
+}
+
+void test_square_wave_sets_phase() {
+    FakeRTC rtc;
+    rtc.phase_ms = 300;     // seconds change at 300, 1300, 2300, ... ms
+    sim_ms = 1000;
+    TestTimeService ts(rtc);
+    ts.begin(sim_ms);       // reads EPOCH + 1 at 1000 ms, 700 ms into that second
+
+    // Without the square wave, now() lags by up to one second
+    TEST_ASSERT_EQUAL(rtc.truth(1350) - 1, ts.now(1350));
+
+    for (sim_ms = 1300; sim_ms < 20000; sim_ms += 1000)
+        ts.on_tick(sim_ms);
+    TEST_ASSERT_TRUE(ts.disciplined());
+
+    for (uint32_t ms = 19300; ms < 20300; ms += 50) {
+        uint16_t millis_part;
+        TEST_ASSERT_EQUAL(rtc.truth(ms), ts.now(ms, &millis_part));
+        TEST_ASSERT_EQUAL((ms - 300) % 1000, millis_part);
+    }
+
+    // The square wave stops; the service reads the RTC again
+    sim_ms = 19300 + TIME_TICK_TIMEOUT_MS;
+    ts.service(sim_ms);
+    TEST_ASSERT_FALSE(ts.disciplined());
+    TEST_ASSERT_EQUAL(2, rtc.transactions);
+}
+
+// A queued frame's receive time can be from before the last RTC read
+void test_time_before_last_read() {
+    FakeRTC rtc;
+    sim_ms = 5000;
+    TestTimeService ts(rtc);
+    ts.begin(sim_ms);
+    uint32_t base = ts.now(sim_ms);
+
+    uint16_t millis_part;
+    TEST_ASSERT_EQUAL(base - 1, ts.now(4500, &millis_part));
+    TEST_ASSERT_EQUAL(500, millis_part);
+    TEST_ASSERT_EQUAL(base - 1, ts.now(4000, &millis_part));
+    TEST_ASSERT_EQUAL(0, millis_part);
+    TEST_ASSERT_EQUAL(base - 2, ts.now(3999));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_legacy_reads_per_packet);
+    RUN_TEST(test_one_read_then_millis);
+    RUN_TEST(test_resync_schedule);
+    RUN_TEST(test_square_wave_sets_phase);
+    RUN_TEST(test_time_before_last_read);
+
+    UNITY_END();
+}
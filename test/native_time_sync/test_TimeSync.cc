@@ -0,0 +1,84 @@
+
+#include <unity.h>
+
+#include <string.h>
+
+#include "TimeSync.h"
+
+#define NOW 1615909112UL
+
+static node_state_t fresh_node() {
+    node_state_t n;
+    memset(&n, 0, sizeof(n));
+    n.address = 4;
+    return n;
+}
+
+void test_offset_bound() {
+    TimeSync sync(2);
+    node_state_t n = fresh_node();
+
+    TEST_ASSERT_FALSE(sync.check(n, NOW, NOW, 20));
+    TEST_ASSERT_EQUAL(0, n.clock_offset);
+    TEST_ASSERT_FALSE(sync.check(n, NOW - 1, NOW, 20));
+    TEST_ASSERT_EQUAL(-1, n.clock_offset);
+    TEST_ASSERT_FALSE(sync.check(n, NOW + 1, NOW, 20));
+    TEST_ASSERT_TRUE(sync.check(n, NOW - 2, NOW, 20));
+    TEST_ASSERT_EQUAL(-2, n.clock_offset);
+    TEST_ASSERT_TRUE(sync.check(n, NOW + 2, NOW, 20));
+
+    // A node whose clock was never set, years off
+    TEST_ASSERT_TRUE(sync.check(n, 946684800, NOW, 20));
+    TEST_ASSERT_EQUAL(6, sync.checks());
+    TEST_ASSERT_EQUAL(0, sync.corrections());
+}
+
+void test_drift_prediction() {
+    TimeSync sync(2);
+    node_state_t n = fresh_node();
+    sync.set(n, NOW);
+    TEST_ASSERT_TRUE(n.flags & NODE_CLOCK_SET);
+    TEST_ASSERT_EQUAL(1, sync.corrections());
+
+    // One second off after a day: at that rate it is still under two
+    // seconds off by a message a day later...
+    TEST_ASSERT_FALSE(sync.check(n, NOW + 86400 + 1, NOW + 86400, 3600));
+    // ...but not by one two days later
+    TEST_ASSERT_TRUE(sync.check(n, NOW + 86400 + 1, NOW + 86400, 2 * 86400));
+
+    // Too soon after the clock was set to tell a rate
+    sync.set(n, NOW);
+    TEST_ASSERT_FALSE(sync.check(n, NOW + 600 + 1, NOW + 600, 100000));
+
+    // Without a set time there is no rate either
+    node_state_t m = fresh_node();
+    TEST_ASSERT_FALSE(sync.check(m, NOW + 86400 + 1, NOW + 86400, 2 * 86400));
+}
+
+// The reply with the time was lost: set() is not called, so the node is
+// due the time again at its next message
+void test_lost_reply_leaves_node_due() {
+    TimeSync sync(2);
+    node_state_t n = fresh_node();
+    sync.set(n, NOW);
+
+    TEST_ASSERT_TRUE(sync.check(n, NOW + 86400 + 3, NOW + 86400, 60));
+    TEST_ASSERT_TRUE(sync.check(n, NOW + 86400 + 60 + 3, NOW + 86400 + 60, 60));
+    TEST_ASSERT_EQUAL(NOW, n.clock_set);
+    TEST_ASSERT_EQUAL(1, sync.corrections());
+
+    // This one was ACK'd
+    sync.set(n, NOW + 86400 + 60);
+    TEST_ASSERT_FALSE(sync.check(n, NOW + 86400 + 120, NOW + 86400 + 120, 60));
+    TEST_ASSERT_EQUAL(2, sync.corrections());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_offset_bound);
+    RUN_TEST(test_drift_prediction);
+    RUN_TEST(test_lost_reply_leaves_node_due);
+
+    UNITY_END();
+}